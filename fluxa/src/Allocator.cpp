@@ -16,6 +16,8 @@
 
 #include "Allocator.h"
 
+__thread bool Allocator::m_Realtime=false;
+
 char *MallocAllocator::New(unsigned int size)
 {
 	return new char[size];
@@ -28,37 +30,253 @@ void MallocAllocator::Delete(char *mem)
 
 ///////////////////////////////////////////////////////////
 
-RealtimeAllocator::RealtimeAllocator(unsigned int size) :
-m_Position(0),
-m_Size(size)
+// the most memory a size class can use
+static const unsigned int POOL_CLASS_BYTES=32*1024*1024;
+static const unsigned int POOL_MAX_BLOCKS=65536;
+// how much to add to a class at once when it runs out
+static const unsigned int POOL_SLAB_BYTES=64*1024;
+static const unsigned int POOL_MAGIC=0xf1a7b10c;
+
+PoolAllocator::PoolAllocator(unsigned int prealloc) :
+m_Slabs(NULL),
+m_LargeInUse(0),
+m_LargeHighWater(0),
+m_LargeCount(0),
+m_Refused(0)
 {
-	m_Buffer = new char[m_Size];
+	for (unsigned int n=0; n<NUM_CLASSES; n++)
+	{
+		SizeClass &c=m_Classes[n];
+		c.Size=1<<(n+MIN_SHIFT);
+		c.MaxBlocks=POOL_CLASS_BYTES/c.Size;
+		if (c.MaxBlocks>POOL_MAX_BLOCKS) c.MaxBlocks=POOL_MAX_BLOCKS;
+		c.Blocks=new Header*[c.MaxBlocks];
+		c.NumBlocks=0;
+		c.Head=0;
+		c.InUse=0;
+		c.HighWater=0;
+		c.Grows=0;
+		
+		unsigned int count=prealloc/c.Size;
+		if (count<1) count=1;
+		Header *h=Grow(c,count);
+		if (h!=NULL) Push(c,h,h);
+	}
+	
+	// the first lot don't count
+	ResetStats();
 }
 
-void RealtimeAllocator::Reset()
+PoolAllocator::~PoolAllocator()
 {
-	m_Position=0;
+	while (m_Slabs!=NULL)
+	{
+		char *next=*(char**)m_Slabs;
+		delete[] m_Slabs;
+		m_Slabs=next;
+	}
+	
+	for (unsigned int n=0; n<NUM_CLASSES; n++)
+	{
+		delete[] m_Classes[n].Blocks;
+	}
 }
 
-char *RealtimeAllocator::New(unsigned int size)
+PoolAllocator::Header *PoolAllocator::Grow(SizeClass &c, unsigned int count)
 {
-	//cerr<<"new "<<size<<endl;
-	char *ret = m_Buffer+m_Position;
-	m_Position+=size;
+	unsigned int start=__sync_fetch_and_add(&c.NumBlocks,count);
+	if (start>=c.MaxBlocks) 
+	{
+		__sync_fetch_and_sub(&c.NumBlocks,count);
+		return NULL;
+	}
+	if (start+count>c.MaxBlocks) 
+	{
+		__sync_fetch_and_sub(&c.NumBlocks,start+count-c.MaxBlocks);
+		count=c.MaxBlocks-start;
+	}
 	
+	// the slab starts with a pointer to the next one, padded 
+	// to the header size to keep the blocks aligned
+	unsigned int blocksize=sizeof(Header)+c.Size;
+	char *slab=new char[sizeof(Header)+count*blocksize];
+	
+	Header *first=NULL;
+	Header *prev=NULL;
+	for (unsigned int n=0; n<count; n++)
+	{
+		Header *h=(Header*)(slab+sizeof(Header)+n*blocksize);
+		h->Class=&c-m_Classes;
+		h->Index=start+n;
+		h->Next=0;
+		h->Magic=POOL_MAGIC;
+		c.Blocks[start+n]=h;
+		if (prev!=NULL) prev->Next=h->Index+1;
+		else first=h;
+		prev=h;
+	}
 
-	if (m_Position>m_Size)
+	char *head;
+	do
 	{
-		cerr<<"out of realtime buffer mem, here we go!!! :("<<endl;
-		m_Position=0;
-		ret = m_Buffer;
+		head=m_Slabs;
+		*(char**)slab=head;
 	}
+	while (!__sync_bool_compare_and_swap(&m_Slabs,head,slab));
+	
+	__sync_fetch_and_add(&c.Grows,1);
 	
-	return ret;
+	// keep the first one, and put the rest on the list
+	if (count>1)
+	{
+		Header *second=c.Blocks[first->Next-1];
+		Push(c,second,prev);
+	}
+	return first;
+}
+
+PoolAllocator::Header *PoolAllocator::Pop(SizeClass &c)
+{
+	while (true)
+	{
+		unsigned long long head=c.Head;
+		unsigned int index=(unsigned int)head;
+		if (index==0) return NULL;
+		// this might have been taken already, in which
+		// case next is rubbish, but the swap will fail
+		Header *h=c.Blocks[index-1];
+		unsigned long long next=(((head>>32)+1)<<32)|h->Next;
+		if (__sync_bool_compare_and_swap(&c.Head,head,next)) return h;
+	}
+}
+
+void PoolAllocator::Push(SizeClass &c, Header *first, Header *last)
+{
+	while (true)
+	{
+		unsigned long long head=c.Head;
+		last->Next=(unsigned int)head;
+		unsigned long long next=(((head>>32)+1)<<32)|(first->Index+1);
+		if (__sync_bool_compare_and_swap(&c.Head,head,next)) return;
+	}
 }
 
-void RealtimeAllocator::Delete(char *mem)
+void PoolAllocator::UpdateHighWater(volatile unsigned int &highwater, unsigned int value)
 {
-	//cerr<<"delete"<<endl;
-	// we don't need no stinking delete!
+	unsigned int current=highwater;
+	while (value>current)
+	{
+		unsigned int old=__sync_val_compare_and_swap(&highwater,current,value);
+		if (old==current) return;
+		current=old;
+	}
+}
+
+char *PoolAllocator::New(unsigned int size)
+{
+	unsigned int cls=0;
+	while (cls<NUM_CLASSES && m_Classes[cls].Size<size) cls++;
+	if (cls==NUM_CLASSES) 
+	{
+		if (IsRealtime()) return Refuse();
+		return NewLarge(size);
+	}
+	
+	if (IsRealtime()) 
+	{
+		// take the first free block big enough, rather than grow
+		for (unsigned int n=cls; n<NUM_CLASSES; n++)
+		{
+			SizeClass &c=m_Classes[n];
+			Header *h=Pop(c);
+			if (h!=NULL)
+			{
+				UpdateHighWater(c.HighWater,__sync_add_and_fetch(&c.InUse,1));
+				return (char*)(h+1);
+			}
+		}
+		return Refuse();
+	}
+	
+	SizeClass &c=m_Classes[cls];
+	Header *h=Pop(c);
+	if (h==NULL)
+	{
+		unsigned int count=POOL_SLAB_BYTES/c.Size;
+		if (count<1) count=1;
+		h=Grow(c,count);
+		// the class is full, so it'll have to come from the heap
+		if (h==NULL) return NewLarge(size);
+	}
+	
+	UpdateHighWater(c.HighWater,__sync_add_and_fetch(&c.InUse,1));
+	return (char*)(h+1);
+}
+
+char *PoolAllocator::Refuse()
+{
+	__sync_fetch_and_add(&m_Refused,1);
+	return NULL;
+}
+
+char *PoolAllocator::NewLarge(unsigned int size)
+{
+	char *mem=new char[sizeof(Header)+size];
+	Header *h=(Header*)mem;
+	h->Class=NUM_CLASSES;
+	h->Index=size;
+	h->Next=0;
+	h->Magic=POOL_MAGIC;
+	
+	__sync_fetch_and_add(&m_LargeCount,1);
+	UpdateHighWater(m_LargeHighWater,__sync_add_and_fetch(&m_LargeInUse,size));
+	return mem+sizeof(Header);
+}
+
+void PoolAllocator::Delete(char *mem)
+{
+	if (mem==NULL) return;
+	
+	Header *h=((Header*)mem)-1;
+	if (h->Magic!=POOL_MAGIC)
+	{
+		cerr<<"PoolAllocator: deleting memory it didn't allocate"<<endl;
+		return;
+	}
+	
+	if (h->Class==NUM_CLASSES)
+	{
+		__sync_fetch_and_sub(&m_LargeInUse,h->Index);
+		__sync_fetch_and_sub(&m_LargeCount,1);
+		delete[] (char*)h;
+		return;
+	}
+	
+	SizeClass &c=m_Classes[h->Class];
+	__sync_fetch_and_sub(&c.InUse,1);
+	Push(c,h,h);
+}
+
+void PoolAllocator::ResetStats()
+{
+	for (unsigned int n=0; n<NUM_CLASSES; n++)
+	{
+		m_Classes[n].HighWater=m_Classes[n].InUse;
+		m_Classes[n].Grows=0;
+	}
+	m_LargeHighWater=m_LargeInUse;
+	m_Refused=0;
+}
+
+void PoolAllocator::Dump(ostream &out) const
+{
+	out<<"size\tblocks\tin use\tpeak\tgrown"<<endl;
+	for (unsigned int n=0; n<NUM_CLASSES; n++)
+	{
+		const SizeClass &c=m_Classes[n];
+		out<<c.Size<<"\t"<<c.NumBlocks<<"\t"<<c.InUse<<"\t"<<c.HighWater<<"\t"<<c.Grows<<endl;
+	}
+	out<<"large: "<<m_LargeCount<<" blocks, "<<m_LargeInUse<<" bytes in use, peak "
+		<<m_LargeHighWater<<" bytes"<<endl;
+	out<<"refused on the audio thread: "<<m_Refused<<endl;
 }
@@ -28,6 +28,17 @@ public:
 	virtual void Reset() {}
 	virtual char *New(unsigned int size)=0;
 	virtual void Delete(char *mem)=0;
+	virtual void Dump(ostream &out) const {}
+	virtual void ResetStats() {}
+	
+	// set by the audio thread (and the workers helping it) while it 
+	// runs, allocators which can should then only hand out memory they 
+	// already have, and return NULL rather than go to the heap
+	static void SetRealtime(bool s) { m_Realtime=s; }
+	static bool IsRealtime() { return m_Realtime; }
+
+private:
+	static __thread bool m_Realtime;
 };
 
 ///////////////////////////////////////////////////
@@ -46,21 +57,81 @@ protected:
 
 /////////////////////////////////////////////////////
 
-class RealtimeAllocator : public Allocator
+// hands out blocks from free lists for each power of two size, 
+// which are filled up front and given back to rather than freed, 
+// so once it's warmed up, new and delete don't go near malloc. 
+// the lists are lock free, so blocks can be freed from any thread.
+// sizes bigger than the largest class (loaded samples) go to the 
+// heap as normal. on a realtime thread it never grows, a class which 
+// has run dry borrows from a bigger one, and if they are all empty, 
+// or the size is too big for any of them, New returns NULL
+
+class PoolAllocator : public Allocator
 {
 public:
-	RealtimeAllocator(unsigned int size);
-	virtual ~RealtimeAllocator() {}
+	// prealloc is how many bytes to start off each size class with
+	PoolAllocator(unsigned int prealloc=POOL_PREALLOC);
+	virtual ~PoolAllocator();
 	
-	virtual void Reset();
 	virtual char *New(unsigned int size);
 	virtual void Delete(char *mem);
+	
+	// prints the blocks in use, the most there have been, how many 
+	// times each class has grown, and how many realtime news failed
+	virtual void Dump(ostream &out) const;
+	// starts the peaks and growth counts again from now
+	virtual void ResetStats();
+	
+	static const unsigned int POOL_PREALLOC=256*1024;
+	static const unsigned int MIN_SHIFT=6;
+	static const unsigned int MAX_SHIFT=16;
+	static const unsigned int NUM_CLASSES=MAX_SHIFT-MIN_SHIFT+1;
 
-protected:
+private:
+	// goes in front of every block, 16 bytes to keep 
+	// the blocks aligned for sse
+	struct Header
+	{
+		unsigned int Class;
+		unsigned int Index;
+		unsigned int Next;
+		unsigned int Magic;
+	};
+
+	struct SizeClass
+	{
+		unsigned int Size;
+		unsigned int MaxBlocks;
+		// every block, by index - written before a 
+		// block is first put on the free list
+		Header **Blocks;
+		volatile unsigned int NumBlocks;
+		// the free list, a count in the top half to stop a block 
+		// being taken and put back between reading and swapping 
+		// the head, and the index of the first block+1 in the bottom
+		volatile unsigned long long Head;
+		volatile unsigned int InUse;
+		volatile unsigned int HighWater;
+		volatile unsigned int Grows;
+	};
+
+	// makes more blocks, and returns one of them
+	Header *Grow(SizeClass &c, unsigned int count);
+	Header *Pop(SizeClass &c);
+	void Push(SizeClass &c, Header *first, Header *last);
+	char *NewLarge(unsigned int size);
+	// counts a realtime new there was nothing for
+	char *Refuse();
+	static void UpdateHighWater(volatile unsigned int &highwater, unsigned int value);
+
+	SizeClass m_Classes[NUM_CLASSES];
+	// the memory the blocks are in, a list through the first word of each
+	char *volatile m_Slabs;
 	
-	char *m_Buffer;	
-	unsigned int m_Position;
-	unsigned int m_Size;
+	volatile unsigned int m_LargeInUse;
+	volatile unsigned int m_LargeHighWater;
+	volatile unsigned int m_LargeCount;
+	volatile unsigned int m_Refused;
 };
 
 #endif
@@ -25,8 +25,7 @@ AsyncSampleLoader *AsyncSampleLoader::m_Singleton=NULL;
 deque<AsyncSampleLoader::LoadItem> AsyncSampleLoader::m_LoadQueue;
 pthread_mutex_t* AsyncSampleLoader::m_Mutex;
 map<string,Sample*> AsyncSampleLoader::m_Cache;
-
-short *LoadWav(FILE *file, unsigned int &size, unsigned short &channels);
+map<string,SampleStream*> AsyncSampleLoader::m_StreamCache;
 
 AsyncSampleLoader* AsyncSampleLoader::Get()
 {
@@ -52,6 +51,10 @@ AsyncSampleLoader::~AsyncSampleLoader()
 		cerr<<"deleting cache "<<i->first<<endl;
 		delete i->second;
 	}
+	for (map<string,SampleStream*>::iterator i=m_StreamCache.begin(); i!=m_StreamCache.end(); i++)
+	{
+		delete i->second;
+	}
 	
 	Shutdown();
 }
@@ -67,31 +70,67 @@ Sample *AsyncSampleLoader::AddToQueue(const string &Filename)
 	LoadItem NewItem;
 	NewItem.Name=Filename;
 	NewItem.SamplePtr=new Sample;
+	NewItem.StreamPtr=NULL;
 	
 	// add to the cache
 	m_Cache[Filename]=NewItem.SamplePtr;
+	Queue(NewItem);
+	return NewItem.SamplePtr;
+}
+
+SampleStream *AsyncSampleLoader::AddStreamToQueue(const string &Filename)
+{
+	map<string,SampleStream*>::iterator i=m_StreamCache.find(Filename);
+	if (i!=m_StreamCache.end())
+	{
+		return i->second;
+	}
+	
+	LoadItem NewItem;
+	NewItem.Name=Filename;
+	NewItem.SamplePtr=NULL;
+	NewItem.StreamPtr=new SampleStream(Filename);
+	
+	m_StreamCache[Filename]=NewItem.StreamPtr;
+	Queue(NewItem);
+	return NewItem.StreamPtr;
+}
 
+void AsyncSampleLoader::Queue(const LoadItem &Item)
+{
 	// spinlock
 	for (int n=0; n<5; n++) // why?
 	{
-		if (pthread_mutex_trylock(m_Mutex))
+		if (pthread_mutex_trylock(m_Mutex)==0)
 		{
-			m_LoadQueue.push_back(NewItem);
+			m_LoadQueue.push_back(Item);
 			pthread_mutex_unlock(m_Mutex);
-			return NewItem.SamplePtr;
+			return;
 		}
 	}
-	cerr<<"Could not get a lock on the loaderqueue, not loading ["<<Filename<<"]"<<endl;
-	return NewItem.SamplePtr;
+	cerr<<"Could not get a lock on the loaderqueue, not loading ["<<Item.Name<<"]"<<endl;
 }
 
-void AsyncSampleLoader::LoadQueue()
+void AsyncSampleLoader::LoadQueue(bool wait)
 {
-	if (pthread_mutex_trylock(m_Mutex))
+	if (wait)
+	{
+		pthread_mutex_lock(m_Mutex);
+		while (m_LoadQueue.size())
+		{
+			Load(*m_LoadQueue.begin());
+			m_LoadQueue.pop_front();
+		}
+		pthread_mutex_unlock(m_Mutex);
+		return;
+	}
+
+	if (pthread_mutex_trylock(m_Mutex)==0)
 	{
-		if (m_LoadQueue.size()>0)
+		if (m_LoadQueue.size()>0 && 
+		    pthread_create(&m_LoaderThread,NULL,(void*(*)(void*))LoadLoop,NULL)==0)
 		{
-			pthread_create(&m_LoaderThread,NULL,(void*(*)(void*))LoadLoop,NULL);
+			pthread_detach(m_LoaderThread);
 		}
 		pthread_mutex_unlock(m_Mutex);
 	}
@@ -111,56 +150,40 @@ void AsyncSampleLoader::LoadLoop()
 		m_LoadQueue.pop_front();
 		pthread_mutex_unlock(m_Mutex);
 			
-		SF_INFO info;
-		info.format=0;
-		string filename=SearchPaths::Get()->GetFullPath(Item.Name);
+		Load(Item);
+		pthread_mutex_lock(m_Mutex);
+	}		
+	pthread_mutex_unlock(m_Mutex);
+}
 
-		cerr<<"async loading: "<<filename<<endl;
-		
-		FILE* file = fopen (filename.c_str(), "rb") ;
-		if (!file)
-		{
-			cerr<<"Error opening ["<<Item.Name<<"]"<<endl;
-		}
-		else
+void AsyncSampleLoader::Load(const LoadItem &Item)
+{
+	if (Item.StreamPtr!=NULL)
+	{
+		Item.StreamPtr->Open();
+		return;
+	}
+
+	string filename=SearchPaths::Get()->GetFullPath(Item.Name);
+
+	cerr<<"async loading: "<<filename<<endl;
+	
+	FILE* file = fopen (filename.c_str(), "rb") ;
+	if (!file)
+	{
+		cerr<<"Error opening ["<<Item.Name<<"]"<<endl;
+	}
+	else
+	{
+		SampleFormat format;
+		if (ReadSampleFormat(file,filename,format))
 		{
-			unsigned short channels=0;
-			unsigned int size=0;
-			short *data = LoadWav(file,size,channels);
-			size/=2; // bytes -> samples
-			
-			if (data)
-			{
-				unsigned int samples=size/channels;
-				Item.SamplePtr->Allocate(samples);
-				
-				// mix down to mono if need be
-				if (channels>1)
-				{
-					int from=0;
-					for (unsigned int n=0; n<samples; n++)
-					{
-						for (int c=0; c<channels; c++)
-						{
-							//cerr<<n<<endl; // 60414
-							Item.SamplePtr->Set(n,((*Item.SamplePtr)[n]+(data[from++]/32767.0f))/(float)channels);
-						}
-					}
-				}
-				else
-				{
-					for (unsigned int n=0; n<size; n++)
-					{
-						Item.SamplePtr->Set(n,data[n]/32767.0f);
-					}
-				}
-				delete[] data;
-			}
-			fclose(file);
+			// read straight into the sample, mixing down to mono as we go
+			Item.SamplePtr->Allocate(format.Frames);
+			ReadSampleFrames(fileno(file),format,0,format.Frames,Item.SamplePtr->GetNonConstBuffer());
 		}
-		sleep(1);
-	}		
-	pthread_mutex_unlock(m_Mutex);
+		fclose(file);
+	}
 }
 
  /*
@@ -211,59 +234,3 @@ void AsyncSampleLoader::LoadLoop()
 	pthread_mutex_unlock(m_Mutex);
 }
 */
-
-// having problems with libsndfile crashing in this thread. (nm/eb.wav)
-// need to look into it more, but need this working for a gig
-// so writing a quick dirty wav loader here 
-short *LoadWav(FILE *file, unsigned int &size, unsigned short &channels)
-{
-	char id[5];
-	id[4]='\0';
-	fread(id,1,4,file);
-	if (strcmp(id,"RIFF")!=0) 
-	{
-		cerr<<"WAV format error (RIFF): "<<id<<endl;
-		return NULL;
-	}
-	fread(&size,1,4,file);
-	fread(id,1,4,file);
-	if (strcmp(id,"WAVE")!=0)
-	{
-		cerr<<"WAV format error (WAVE): "<<id<<endl;
-		return NULL;
-	}
-	fread(id,1,4,file);
-	if (strcmp(id,"fmt ")!=0)
-	{
-		cerr<<"WAV format error (fmt ): "<<id<<endl;
-		return NULL;
-	}
-	fread(&size,1,4,file);
-	unsigned int datastart=size+ftell(file);
-	short compression;
-	fread(&compression,1,2,file);
-	if (compression!=1)
-	{
-		cerr<<"WAV data is compressed"<<endl;
-		return NULL;
-	}
-	fread(&channels,1,2,file);
-	if (!(channels==1 || channels==2))
-	{
-		cerr<<"WAV data is not mono or stereo"<<endl;
-		return NULL;
-	}
-	fseek(file,datastart,SEEK_SET);		
-	fread(id,1,4,file);
-	if (strcmp(id,"data")!=0)
-	{
-		cerr<<"WAV format error (data): "<<id<<endl;
-		return NULL;
-	}
-	fread(&size,1,4,file);
-	char *data=new char[size];
-	fread(data,1,size,file);
-	return (short*)data;
-};
-
-
@@ -20,6 +20,7 @@
 #include <map>
 #include "Types.h"
 #include "Sample.h"
+#include "SampleStream.h"
 
 using namespace std;
 
@@ -31,7 +32,8 @@ namespace spiralcore
 
 // a sample loader that does it's loading in another thread. should be suitable
 // for realtime use. caches samples (forever) and seems to work, but needs a 
-// little fixing up to be safer
+// little fixing up to be safer. streamed samples only have their start
+// read here, SampleStream looks after the rest
 class AsyncSampleLoader
 {
 public:
@@ -45,8 +47,12 @@ public:
 	// ownership of the sample remains in control of this class - do not
 	// delete!
 	Sample *AddToQueue(const string &Filename);
-	// batches em up to save time
-	void LoadQueue();
+	// the same, but only the start of the sample is read, and the rest
+	// is streamed from disk while it's playing
+	SampleStream *AddStreamToQueue(const string &Filename);
+	// batches em up to save time - or if wait is true loads them 
+	// before returning, for when we aren't running in realtime
+	void LoadQueue(bool wait=false);
 	
 private:
 	AsyncSampleLoader();
@@ -61,9 +67,14 @@ private:
 	{
 		string Name;
 		Sample *SamplePtr;
+		SampleStream *StreamPtr;
 	};
 	
+	static void Queue(const LoadItem &Item);
+	static void Load(const LoadItem &Item);
+
 	static map<string,Sample*> m_Cache;
+	static map<string,SampleStream*> m_StreamCache;
 	
 	// two loaderstacks, so we can get a lock on at least one of them at any time
 	static deque<LoadItem> m_LoadQueue;
@@ -20,57 +20,6 @@
 
 using namespace std;
 
-CommandRingBuffer::Command::Command(const char *name, const char *types, const char *data, unsigned int datasize)
-{
-	strcpy(Name,name);
-	strcpy(Types,types);
-	// already checking datasize fits in OSCServer.cpp
-    memcpy(Data,data,datasize);
-	
-	m_NumArgs=strlen(Types);
-
-	// figure out the offsets into the data to use later
-	int pos=0;
-	for(unsigned int i=0; i<m_NumArgs; i++)
-	{
-		m_Offsets[i]=pos;
-		switch(Types[i])
-		{
-			case 'i': pos+=4; break;
-			case 'f': pos+=4; break;
-			case 's': pos+=strlen(Data+pos)+1; break;
-			case 'b': pos+=sizeof(char*); break;
-			
-			default: 
-				// invalidate the command
-				for(unsigned int n=0; n<strlen(Types); n++) m_Offsets[n]=-1;
-				cerr<<"CommandRingBuffer::Command::Command: erk! unknown type: "<<Types[i]<<endl; 				
-				return;				
-			break;
-		}
-	}
-}
-
-int CommandRingBuffer::Command::GetInt(unsigned int index)
-{
-	if (m_Offsets[index]!=-1 && Types[index]=='i') return *((int*)(Data+m_Offsets[index]));
-	return 0;
-}
-
-float CommandRingBuffer::Command::GetFloat(unsigned int index)
-{
-	if (m_Offsets[index]!=-1 && Types[index]=='f') return *((float*)(Data+m_Offsets[index]));
-	return 0;
-}
-
-char *CommandRingBuffer::Command::GetString(unsigned int index)
-{
-	if (m_Offsets[index]!=-1 && Types[index]=='s') return ((char*)(Data+m_Offsets[index]));
-	return 0;
-}
-
-////////////////////////////////////////////////////////////////
-
 CommandRingBuffer::CommandRingBuffer(unsigned int size): 
 RingBuffer(size) 
 {
@@ -80,13 +29,31 @@ CommandRingBuffer::~CommandRingBuffer()
 {
 }
 	
-bool CommandRingBuffer::Send(const Command& command)
+bool CommandRingBuffer::Send(Opcode op, const Arg *args, unsigned int numargs)
 {
-	return Write((char*)&command,sizeof(Command));
+	if (numargs>COMMAND_MAX_ARGS) return false;
+
+	// written in one go, so the reader can't see the 
+	// header without the arguments
+	char data[sizeof(Header)+COMMAND_MAX_ARGS*sizeof(Arg)];
+	Header *header=(Header*)data;
+	header->Op=op;
+	header->NumArgs=numargs;
+	memcpy(data+sizeof(Header),args,numargs*sizeof(Arg));
+	return Write(data,sizeof(Header)+numargs*sizeof(Arg));
 }
 
 bool CommandRingBuffer::Get(Command& command)
 {
-	return Read((char*)&command, sizeof(Command));
-}
+	Header header;
+	if (!Read((char*)&header,sizeof(Header))) return false;
 
+	command.Op=(Opcode)header.Op;
+	command.NumArgs=header.NumArgs;
+	if (header.NumArgs>0)
+	{
+		// written with the header, so it's already there
+		Read((char*)command.Args,header.NumArgs*sizeof(Arg));
+	}
+	return true;
+}
@@ -16,41 +16,73 @@
 
 #include "RingBuffer.h"
 
-static const unsigned int COMMAND_DATA_SIZE = 128;
+#ifndef COMMAND_RING_BUFFER
+#define COMMAND_RING_BUFFER
 
+// the most words a single command can carry, longer 
+// batches of /create or /connect are sent in pieces
+static const unsigned int COMMAND_MAX_ARGS = 1024;
+
+// commands are decoded from osc in the server thread, so the
+// audio thread only has to switch on the opcode and read the 
+// arguments, which are packed as 4 byte words - strings take
+// as many words as they need, null terminated
 class CommandRingBuffer : public RingBuffer
 {
 public:
 	CommandRingBuffer(unsigned int size);
 	~CommandRingBuffer();
+
+	enum Opcode
+	{
+		SETCLOCK,
+		CREATE,        // id type value, repeated
+		CONNECT,       // id arg child, repeated
+		PLAY,          // seconds fraction id pan
+		MAXSYNTHS,
+		RESET,
+		GLOBALVOLUME,
+		PAN,
+		EQ,            // low mid high
+		COMP,          // attack release threshold slope
+		ADDTOQUEUE,    // id filename
+		LOADQUEUE,
+		UNLOAD,
+		DEBUG,
+		ADDSEARCHPATH, // path
+		VOICESTEAL
+	};
+
+	union Arg
+	{
+		int i;
+		float f;
+	};
 	
 	class Command
 	{
 	public:
-		Command() {}
-		Command(const char *name, const char *types, const char *data, unsigned int datasize);
-		~Command() {}
+		Command() : Op(SETCLOCK), NumArgs(0) {}
 		
-		int GetInt(unsigned int index);
-		float GetFloat(unsigned int index);
-		char *GetString(unsigned int index);
-		// unlike the string - ownership of the blob is yours
-		// you must delete it when you're done...
-		char *GetBlob(unsigned int index);
-		unsigned int Size() { return m_NumArgs; }
-		char Name[256];
-		char Types[64];
-		
-	private:
-		char Data[COMMAND_DATA_SIZE];
-		int m_Offsets[64]; 
-		unsigned int m_NumArgs; 
+		int GetInt(unsigned int index) const { return index<NumArgs?Args[index].i:0; }
+		float GetFloat(unsigned int index) const { return index<NumArgs?Args[index].f:0; }
+		const char *GetString(unsigned int index) const { return index<NumArgs?(const char *)&Args[index]:""; }
+		unsigned int Size() const { return NumArgs; }
 		
+		Opcode Op;
+		unsigned int NumArgs; 
+		Arg Args[COMMAND_MAX_ARGS];
 	};	
 	
-	bool Send(const Command& command);
+	bool Send(Opcode op, const Arg *args, unsigned int numargs);
 	bool Get(Command& command);
-	
+
 private:
-	Command m_Current;
+	struct Header
+	{
+		unsigned int Op;
+		unsigned int NumArgs;
+	};
 };
+
+#endif
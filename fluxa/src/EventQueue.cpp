@@ -18,7 +18,9 @@
 
 using namespace spiralcore;
 
-EventQueue::EventQueue()
+EventQueue::EventQueue(unsigned int capacity) :
+m_Heap(capacity>0?capacity:1),
+m_Size(0)
 {
 }
 
@@ -28,31 +30,40 @@ EventQueue::~EventQueue()
 
 bool EventQueue::Add(const Event &e)
 {
-	for (int i=0; i<EVENT_QUEUE_SIZE; i++)
+	if (m_Size==m_Heap.size()) return false;
+
+	// sift up from the end
+	unsigned int i=m_Size++;
+	while (i>0)
 	{
-		if (m_Queue[i].m_IsEmpty)
-		{
-			m_Queue[i].m_Event=e;
-			m_Queue[i].m_IsEmpty=false;
-			return true;
-		}
+		unsigned int parent=(i-1)/2;
+		if (!Earlier(e,m_Heap[parent])) break;
+		m_Heap[i]=m_Heap[parent];
+		i=parent;
 	}
-	
-	return false;
+	m_Heap[i]=e;
+	return true;
 }
 
-bool EventQueue::Get(Time from, Time till, Event &e)
+bool EventQueue::Get(Time till, Event &e)
 {
-	for (int i=0; i<EVENT_QUEUE_SIZE; i++)
+	if (m_Size==0 || !(m_Heap[0].TimeStamp<till)) return false;
+
+	e=m_Heap[0];      // return this one
+	m_Size--;
+
+	// sift the last one down from the top
+	const Event &last=m_Heap[m_Size];
+	unsigned int i=0;
+	while (true)
 	{
-		if (!m_Queue[i].m_IsEmpty && m_Queue[i].m_Event.TimeStamp>from &&
-		     m_Queue[i].m_Event.TimeStamp<till)
-		{
-			e=m_Queue[i].m_Event;      // return this one
-			m_Queue[i].m_IsEmpty=true; // delete from the queue
-			return true;
-		}
+		unsigned int child=i*2+1;
+		if (child>=m_Size) break;
+		if (child+1<m_Size && Earlier(m_Heap[child+1],m_Heap[child])) child++;
+		if (!Earlier(m_Heap[child],last)) break;
+		m_Heap[i]=m_Heap[child];
+		i=child;
 	}
-	return false;
+	m_Heap[i]=last;
+	return true;
 }
-
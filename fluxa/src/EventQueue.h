@@ -14,40 +14,48 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <vector>
 #include "Event.h"
 
 #ifndef SPIRALCORE_EVENT_QUEUE
 #define SPIRALCORE_EVENT_QUEUE
 
-static const int EVENT_QUEUE_SIZE = 256;
+static const unsigned int EVENT_QUEUE_SIZE = 1024;
 
 namespace spiralcore
 {
 
-// no mallocs, so a bit of diy memory allocation
+// no mallocs, so a bit of diy memory allocation - the events are
+// kept in a binary heap allocated up front, ordered by time stamp,
+// so they come out in the order they are to be played
 
 class EventQueue
 {
 public:
-	EventQueue();
+	EventQueue(unsigned int capacity=EVENT_QUEUE_SIZE);
 	~EventQueue();
 	
+	// returns false if the queue is full
 	bool Add(const Event &e);
 	
 	// you should keep calling this function for the specified
-	// time slice until it returns false
-	bool Get(Time from, Time till, Event &e);
+	// time slice until it returns false, events before till
+	// are returned earliest first
+	bool Get(Time till, Event &e);
+
+	unsigned int GetSize() const { return m_Size; }
+	unsigned int GetCapacity() const { return m_Heap.size(); }
 	
 private:
-
-	struct QueueItem
+	static bool Earlier(const Event &a, const Event &b)
 	{
-		QueueItem() : m_IsEmpty(true) {}
-		bool m_IsEmpty;
-		Event m_Event;
-	};
+		return a.TimeStamp.Seconds<b.TimeStamp.Seconds || 
+			(a.TimeStamp.Seconds==b.TimeStamp.Seconds && 
+			 a.TimeStamp.Fraction<b.TimeStamp.Fraction);
+	}
 
-	QueueItem m_Queue[EVENT_QUEUE_SIZE]; 
+	std::vector<Event> m_Heap; 
+	unsigned int m_Size;
 };
 
 }
@@ -22,12 +22,15 @@
 
 using namespace spiralcore;
 
-Fluxa::Fluxa(OSCServer *server, JackClient* jack, const string &leftport, const string &rightport) :
+Fluxa::Fluxa(OSCServer *server, JackClient* jack, const string &leftport, const string &rightport, 
+	unsigned int eventqueuesize, unsigned int threads) :
 m_SampleRate(jack->GetSamplerate()),
-m_Graph(70,jack->GetSamplerate()),
+m_Graph(70,jack->GetSamplerate(),threads),
 m_Sampler(jack->GetSamplerate()),
 m_Running(false),
+m_Offline(false),
 m_Server(server),
+m_EventQueue(eventqueuesize),
 m_GlobalVolume(1.0f),
 m_Pan(0.0f),
 m_Debug(false),
@@ -36,8 +39,17 @@ m_RightEq(jack->GetSamplerate()),
 m_LeftComp(jack->GetSamplerate()),
 m_RightComp(jack->GetSamplerate())
 {
-	WaveTable::WriteWaves();
-    CryptoInit();
+	Init();
+
+	// the audio thread can't grow the buffers itself unless jack's 
+	// buffer size goes up, so make room for what it is now
+	unsigned int bufsize=jack->GetBufferSize();
+	if (bufsize>(unsigned int)m_LeftBuffer.GetLength())
+	{
+		m_LeftBuffer.Allocate(bufsize);
+		m_RightBuffer.Allocate(bufsize);
+		m_Graph.Reserve(bufsize);
+	}
 
  	jack->SetCallback(Run,(void*)this);
 
@@ -49,11 +61,6 @@ m_RightComp(jack->GetSamplerate())
 	//Options.BufferSize=512;
 	//Audio->Attach("Fluxa",Options);
 
-	m_LeftBuffer.Allocate(1024);
-	m_RightBuffer.Allocate(1024);
-	m_LeftBuffer.Zero();
-	m_RightBuffer.Zero();
-
 	if (jack->IsAttached())
 	{
 		//Audio->SetOutputs(m_LeftBuffer.GetNonConstBuffer(),m_RightBuffer.GetNonConstBuffer());
@@ -66,79 +73,94 @@ m_RightComp(jack->GetSamplerate())
   	    jack->ConnectOutput(m_RightJack,rightport);
  		m_Running=true;
 	}
-	//Sample::SetAllocator(new RealtimeAllocator(1024*1024*40));
+
+	cerr<<"fluxa server ready... "<<endl;
+}
+
+Fluxa::Fluxa(OSCServer *server, unsigned int samplerate, unsigned int eventqueuesize, 
+	unsigned int threads) :
+m_SampleRate(samplerate),
+m_Graph(70,samplerate,threads),
+m_Sampler(samplerate),
+m_LeftJack(0),
+m_RightJack(0),
+m_Running(false),
+m_Offline(true),
+m_Server(server),
+m_EventQueue(eventqueuesize),
+m_GlobalVolume(1.0f),
+m_Pan(0.0f),
+m_Debug(false),
+m_LeftEq(samplerate),
+m_RightEq(samplerate),
+m_LeftComp(samplerate),
+m_RightComp(samplerate)
+{
+	Init();
+}
+
+void Fluxa::Init()
+{
+	WaveTable::WriteWaves();
+    CryptoInit();
+
+	m_LeftBuffer.Allocate(1024);
+	m_RightBuffer.Allocate(1024);
+	m_LeftBuffer.Zero();
+	m_RightBuffer.Zero();
+	m_Graph.Reserve(1024);
 
 	Time Now;
 	Now.SetToNow();
 	m_CurrentTime.Seconds=Now.Seconds;
 	m_CurrentTime.Fraction=Now.Fraction;
-
-	cerr<<"fluxa server ready... "<<endl;
 }
 
 void Fluxa::Run(void *RunContext, unsigned int BufSize)
 {
+	// the sample pools mustn't grow from here on in
+	Allocator::SetRealtime(!((Fluxa*)RunContext)->m_Offline);
 	((Fluxa*)RunContext)->ProcessCommands();
 	((Fluxa*)RunContext)->Process(BufSize);
 }
 
 void Fluxa::ProcessCommands()
 {
-	CommandRingBuffer::Command cmd;
+	CommandRingBuffer::Command &cmd=m_Command;
 	while (m_Server->Get(cmd))
 	{
-		string name = cmd.Name;
-		//cerr<<name<<endl;
-
-		if (name=="/setclock")
+		switch (cmd.Op)
+		{
+		case CommandRingBuffer::SETCLOCK:
 		{
+			// offline our clock isn't the real one
+			if (m_Offline) break;
+
 			// baddddd :P
 			Time Now;
 			Now.SetToNow();
 			m_CurrentTime.Seconds=Now.Seconds;
 			m_CurrentTime.Fraction=Now.Fraction;
 		}
-		else if (name=="/create")
+		break;
+		case CommandRingBuffer::CREATE:
 		{
-			unsigned int pos=0;
-			while (pos<cmd.Size())
+			// the value is only used by terminals
+			for (unsigned int n=0; n+2<cmd.Size(); n+=3)
 			{
-				if (cmd.Size()<pos+1)
-				{
-					cerr<<"/create - malformed arguments..."<<endl;
-				}
-				else
-				{
-					Graph::Type type=(Graph::Type)cmd.GetInt(pos+1);
-
-					if (type==Graph::TERMINAL)
-					{
-						m_Graph.Create(cmd.GetInt(pos),type,cmd.GetFloat(pos+2));
-						pos+=3;
-					}
-					else
-					{
-						m_Graph.Create(cmd.GetInt(pos),type,0);
-						pos+=2;
-					}
-				}
+				m_Graph.Create(cmd.GetInt(n),(Graph::Type)cmd.GetInt(n+1),cmd.GetFloat(n+2));
 			}
 		}
-		else if (name=="/connect")
+		break;
+		case CommandRingBuffer::CONNECT:
 		{
-			for (unsigned int n=0; n<cmd.Size(); n+=3)
+			for (unsigned int n=0; n+2<cmd.Size(); n+=3)
 			{
-				if (cmd.Size()<n+1)
-				{
-					cerr<<"/connect - malformed arguments..."<<endl;
-				}
-				else
-				{
-					m_Graph.Connect(cmd.GetInt(n),cmd.GetInt(n+1),cmd.GetInt(n+2));
-				}
+				m_Graph.Connect(cmd.GetInt(n),cmd.GetInt(n+1),cmd.GetInt(n+2));
 			}
 		}
-		else if (name=="/play")
+		break;
+		case CommandRingBuffer::PLAY:
 		{
 			Event e;
 			e.TimeStamp.Seconds=(unsigned int)cmd.GetInt(0);
@@ -153,7 +175,10 @@ void Fluxa::ProcessCommands()
 			}
 			if (e.TimeStamp>=m_CurrentTime)
 			{
-				m_EventQueue.Add(e);
+				if (!m_EventQueue.Add(e))
+				{
+					Trace(RED,YELLOW,"Event queue full (%d events), dropping event",m_EventQueue.GetCapacity());
+				}
 
 				if (e.TimeStamp.GetDifference(m_CurrentTime)>30)
 				{
@@ -174,34 +199,32 @@ void Fluxa::ProcessCommands()
 																			 (unsigned int)e.TimeStamp.Fraction);
 			}
 		}
-		else if (name=="/maxsynths")
-		{
+		break;
+		case CommandRingBuffer::MAXSYNTHS:
 			m_Graph.SetMaxPlaying(cmd.GetInt(0));
-		}
-		else if (name=="/reset")
-		{
-			m_Graph.Clear();
-			m_Graph.Init();
-		}
-		else if (name=="/globalvolume")
-		{
+		break;
+		case CommandRingBuffer::VOICESTEAL:
+			if (cmd.GetInt(0)==1) Sampler::SetStealMode(Sampler::QUIETEST);
+			else Sampler::SetStealMode(Sampler::OLDEST);
+		break;
+		case CommandRingBuffer::RESET:
+			m_Graph.Reset();
+		break;
+		case CommandRingBuffer::GLOBALVOLUME:
 			m_GlobalVolume=cmd.GetFloat(0);
-		}
-		else if (name=="/pan")
-		{
+		break;
+		case CommandRingBuffer::PAN:
 			m_Pan=cmd.GetFloat(0);
-		}
-		else if (name=="/eq")
-		{
+		break;
+		case CommandRingBuffer::EQ:
 			m_LeftEq.SetLow(cmd.GetFloat(0));
-            m_LeftEq.SetMid(cmd.GetFloat(1));
+			m_LeftEq.SetMid(cmd.GetFloat(1));
 			m_LeftEq.SetHigh(cmd.GetFloat(2));
 			m_RightEq.SetLow(cmd.GetFloat(0));
 			m_RightEq.SetMid(cmd.GetFloat(1));
 			m_RightEq.SetHigh(cmd.GetFloat(2));
-		}
-		else if (name=="/comp")
-		{
+		break;
+		case CommandRingBuffer::COMP:
 			m_LeftComp.SetAttack(cmd.GetFloat(0));
 			m_LeftComp.SetRelease(cmd.GetFloat(1));
 			m_LeftComp.SetThreshold(cmd.GetFloat(2));
@@ -211,30 +234,23 @@ void Fluxa::ProcessCommands()
 			m_RightComp.SetRelease(cmd.GetFloat(1));
 			m_RightComp.SetThreshold(cmd.GetFloat(2));
 			m_RightComp.SetSlope(cmd.GetFloat(3));
-		}
-		else if (name=="/addtoqueue")
-		{
-			char *filename = cmd.GetString(1);
-			if (filename!=NULL)
-			{
-				SampleStore::Get()->AddToQueue(cmd.GetInt(0), filename);
-			}
-		}
-		else if (name=="/loadqueue")
-		{
-			SampleStore::Get()->LoadQueue();
-		}
-		else if (name=="/unload")
-		{
+		break;
+		case CommandRingBuffer::ADDTOQUEUE:
+			SampleStore::Get()->AddToQueue(cmd.GetInt(0), cmd.GetString(1));
+		break;
+		case CommandRingBuffer::LOADQUEUE:
+			SampleStore::Get()->LoadQueue(m_Offline);
+		break;
+		case CommandRingBuffer::UNLOAD:
 			SampleStore::Get()->Unload(cmd.GetInt(0));
-		}
-		else if (name=="/debug")
-		{
+		break;
+		case CommandRingBuffer::DEBUG:
 			m_Debug=cmd.GetInt(0);
-		}
-		else if (name=="/addsearchpath")
-		{
+			if (m_Debug) Sample::GetAllocator()->Dump(cerr);
+		break;
+		case CommandRingBuffer::ADDSEARCHPATH:
 			SearchPaths::Get()->AddPath(cmd.GetString(0));
+		break;
 		}
 	}
 }
@@ -249,11 +265,21 @@ void Fluxa::Process(unsigned int BufSize)
 
 	if (BufSize>(unsigned int)m_LeftBuffer.GetLength())
 	{
+		// jack's buffer size has gone up, which glitches anyway, so 
+		// this is the one time the audio thread goes to the heap - 
+		// these and the graph outputs must be at least this long
+		bool realtime=Allocator::IsRealtime();
+		Allocator::SetRealtime(false);
 		m_LeftBuffer.Allocate(BufSize);
 		m_RightBuffer.Allocate(BufSize);
+		m_Graph.Reserve(BufSize);
+		Allocator::SetRealtime(realtime);
 		//PortAudioClient::Get()->SetOutputs(m_LeftBuffer.GetNonConstBuffer(),m_RightBuffer.GetNonConstBuffer());
- 		JackClient::Get()->SetOutputBuf(m_LeftJack, m_LeftBuffer.GetNonConstBuffer());
- 		JackClient::Get()->SetOutputBuf(m_RightJack, m_RightBuffer.GetNonConstBuffer());
+		if (m_Running)
+		{
+ 			JackClient::Get()->SetOutputBuf(m_LeftJack, m_LeftBuffer.GetNonConstBuffer());
+ 			JackClient::Get()->SetOutputBuf(m_RightJack, m_RightBuffer.GetNonConstBuffer());
+		}
 	}
 
 	m_LeftBuffer.Zero();
@@ -263,21 +289,14 @@ void Fluxa::Process(unsigned int BufSize)
 	m_CurrentTime.IncBySample(BufSize,m_SampleRate);
 
 	Event e;
-	while (m_EventQueue.Get(LastTime, m_CurrentTime, e))
+	while (m_EventQueue.Get(m_CurrentTime, e))
 	{
+		// the offset into this block in seconds, negative 
+		// so the sampler and envelopes wait until then
 		float t = LastTime.GetDifference(e.TimeStamp);
-		// hack to get round bug with GetDifference throwing big numbers
-		if (t<=0)
-		{
-			m_Graph.Play(t,e.ID,e.Pan);
-		}
-		else
-		{
-			cerr<<"----------------"<<endl;
-			cerr<<t<<endl;
-			LastTime.Print();
-			e.TimeStamp.Print();
-		}
+		// if the clock has been reset past it, play it now
+		if (t>0) t=0;
+		m_Graph.Play(t,e.ID,e.Pan);
 	}
 
 	m_Graph.Process(BufSize,m_LeftBuffer,m_RightBuffer);
@@ -31,10 +31,23 @@ static const int EVENT_BUFFER_SIZE=1024;
 class Fluxa
 {
 public:
-	Fluxa(OSCServer *server, JackClient* jack, const string &leftport, const string &rightport);
+	Fluxa(OSCServer *server, JackClient* jack, const string &leftport, const string &rightport, 
+		unsigned int eventqueuesize=EVENT_QUEUE_SIZE, unsigned int threads=1);
+	// runs without jack, call Render to make each block
+	Fluxa(OSCServer *server, unsigned int samplerate, unsigned int eventqueuesize=EVENT_QUEUE_SIZE, 
+		unsigned int threads=1);
 	~Fluxa() {}
 
+	// for running offline - deals with the commands sent 
+	// so far, then fills the buffers with the next block
+	void Render(unsigned int BufSize) { ProcessCommands(); Process(BufSize); }
+	const Sample &GetLeftBuffer() const { return m_LeftBuffer; }
+	const Sample &GetRightBuffer() const { return m_RightBuffer; }
+	const Time &GetTime() const { return m_CurrentTime; }
+	Graph &GetGraph() { return m_Graph; }
+
 private:
+	void Init();
 	static void Run(void *RunContext, unsigned int BufSize);
 	void Process(unsigned int BufSize);
 	void ProcessCommands();
@@ -48,8 +61,11 @@ private:
 	int    m_LeftJack;
 	int    m_RightJack;
 	bool 	m_Running;
+	bool	m_Offline;
 	Time	m_CurrentTime;
 	OSCServer *m_Server;
+	// big, so not on the stack
+	CommandRingBuffer::Command m_Command;
 	EventQueue m_EventQueue;
 	float m_GlobalVolume;
 	float m_Pan;
@@ -15,26 +15,60 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <vector>
+#include <algorithm>
 #include <math.h>
+#include <time.h>
 #include "Graph.h"
 #include "ModuleNodes.h"
 #include "Modules.h"
 
-Graph::Graph(unsigned int NumNodes, unsigned int SampleRate) :
+static double GetSeconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec+t.tv_nsec*0.000000001;
+}
+
+Graph::Graph(unsigned int NumNodes, unsigned int SampleRate, unsigned int NumThreads) :
 m_MaxPlaying(10),
 m_NumNodes(NumNodes),
-m_SampleRate(SampleRate)
+m_SampleRate(SampleRate),
+m_PlanDirty(true),
+m_PlanPass(0),
+m_Workers(NULL),
+m_ProcessJob(this),
+m_BufSize(0),
+m_OutputSize(0),
+m_Profiling(false)
 {
+	if (NumThreads<1) NumThreads=1;
+	if (NumThreads>1) m_Workers = new WorkerPool(NumThreads);
+	m_ProfileTime.resize(NUMTYPES*NumThreads);
+	m_ProfileCount.resize(NUMTYPES*NumThreads);
+	ResetProfile();
 	Init();
+	SetMaxPlaying(m_MaxPlaying);
 }
 
 Graph::~Graph()
 {
 	Clear();
+	if (m_Workers!=NULL) delete m_Workers;
+}
+
+void Graph::SetMaxPlaying(int s)
+{
+	m_MaxPlaying=s;
+	m_RootNodes.reserve(s+1);
+	m_PlanRoots.reserve(s+1);
+	m_PlanGroups.reserve(s+1);
+	m_GroupParent.reserve(s+1);
+	m_GroupStart.reserve(s+2);
 }
 
 void Graph::Init()
 {
+	unsigned int total=0;
 	for (unsigned int type=0; type<NUMTYPES; type++)
 	{
 		NodeDescVec *descvec = new NodeDescVec;
@@ -80,17 +114,31 @@ void Graph::Init()
 				default: assert(0); break;
 			}
 
+			nodedesc->m_Node->m_Type=type;
 			descvec->m_Vec.push_back(nodedesc);
 		}
 
 		m_NodeDescMap[(Type)type] = descvec;
+		total+=count;
 	}
+
+	m_NodeMap.Reserve(total);
+
+	// so compiling the plan doesn't allocate in the audio thread
+	m_Plan.reserve(m_NumNodes*NUMTYPES);
+	m_PlanScratch.reserve(m_NumNodes*NUMTYPES);
+	m_OutputSize=0;
+	m_PlanDirty=true;
 }
 
 void Graph::Clear()
 {
 	m_RootNodes.clear();
-	m_NodeMap.clear();
+	m_NodeMap.Clear();
+	m_Plan.clear();
+	m_PlanRoots.clear();
+	m_PlanGroups.clear();
+	m_PlanDirty=true;
 
 	for (map<Type,NodeDescVec*>::iterator i=m_NodeDescMap.begin();
 		i!=m_NodeDescMap.end(); ++i)
@@ -106,82 +154,386 @@ void Graph::Clear()
 	m_NodeDescMap.clear();
 }
 
+void Graph::Reset()
+{
+	m_RootNodes.clear();
+	m_NodeMap.Clear();
+	m_Plan.clear();
+	m_PlanRoots.clear();
+	m_PlanGroups.clear();
+	m_PlanDirty=true;
+
+	for (map<Type,NodeDescVec*>::iterator i=m_NodeDescMap.begin();
+		i!=m_NodeDescMap.end(); ++i)
+	{
+		i->second->m_Current=0;
+		for (vector<NodeDesc*>::iterator ni=i->second->m_Vec.begin();
+			ni!=i->second->m_Vec.end(); ++ni)
+		{
+			(*ni)->m_ID=0;
+			(*ni)->m_Node->Clear();
+		}
+	}
+}
+
 void Graph::Create(unsigned int id, Type t, float v)
 {
 	unsigned int index=m_NodeDescMap[t]->NewIndex();
-	unsigned int oldid=m_NodeDescMap[t]->m_Vec[index]->m_ID;
+	NodeDesc *desc=m_NodeDescMap[t]->m_Vec[index];
+	unsigned int oldid=desc->m_ID;
 
 //cerr<<"create id:"<<id<<" index:"<<index<<" type:"<<t<<" value:"<<v<<endl;
 
-	map<unsigned int,GraphNode*>::iterator i=m_NodeMap.find(oldid);
-	if (i!=m_NodeMap.end()) m_NodeMap.erase(i);
+	// unless the id has been given to another node since
+	if (m_NodeMap.Find(oldid)==desc->m_Node) m_NodeMap.Erase(oldid);
 
-	list<pair<unsigned int,float> >::iterator remove;
-	bool found=false;
-	for (list<pair<unsigned int,float> >::iterator ri=m_RootNodes.begin();
-		ri!=m_RootNodes.end(); ++ri)
+	vector<pair<unsigned int,float> >::iterator ri=m_RootNodes.begin();
+	while (ri!=m_RootNodes.end())
 	{
-		if (ri->first==oldid)
-		{
-			remove=ri;
-			found=true;
-		}
+		if (ri->first==oldid) ri=m_RootNodes.erase(ri);
+		else ++ri;
 	}
-	if (found) m_RootNodes.erase(remove);
 
-	m_NodeDescMap[t]->m_Vec[index]->m_ID=id;
-	m_NodeDescMap[t]->m_Vec[index]->m_Node->Clear();
-	m_NodeMap[id]=m_NodeDescMap[t]->m_Vec[index]->m_Node;
+	desc->m_ID=id;
+	desc->m_Node->Clear();
+	m_NodeMap.Set(id,desc->m_Node);
+	m_PlanDirty=true;
 
 	if (t==TERMINAL)
 	{
-		TerminalNode *terminal = dynamic_cast<TerminalNode*>(m_NodeMap[id]);
+		TerminalNode *terminal = dynamic_cast<TerminalNode*>(desc->m_Node);
 		assert(terminal!=NULL);
 		terminal->SetValue(v);
 	}
 }
 
+void Graph::NodeTable::Reserve(unsigned int count)
+{
+	// kept under half full
+	unsigned int size=16;
+	while (size<count*2) size*=2;
+	Entry empty={0,NULL};
+	m_Entries.assign(size,empty);
+	m_Mask=size-1;
+}
+
+GraphNode *Graph::NodeTable::Find(unsigned int id) const
+{
+	if (m_Entries.empty()) return NULL;
+	for (unsigned int i=Home(id); m_Entries[i].Node!=NULL; i=(i+1)&m_Mask)
+	{
+		if (m_Entries[i].ID==id) return m_Entries[i].Node;
+	}
+	return NULL;
+}
+
+void Graph::NodeTable::Set(unsigned int id, GraphNode *node)
+{
+	unsigned int i=Home(id);
+	while (m_Entries[i].Node!=NULL && m_Entries[i].ID!=id) i=(i+1)&m_Mask;
+	m_Entries[i].ID=id;
+	m_Entries[i].Node=node;
+}
+
+void Graph::NodeTable::Erase(unsigned int id)
+{
+	if (m_Entries.empty()) return;
+	unsigned int i=Home(id);
+	while (m_Entries[i].ID!=id)
+	{
+		if (m_Entries[i].Node==NULL) return;
+		i=(i+1)&m_Mask;
+	}
+	
+	// move back the ones after it which would be 
+	// found before the gap, so none get lost
+	for (unsigned int j=(i+1)&m_Mask; m_Entries[j].Node!=NULL; j=(j+1)&m_Mask)
+	{
+		unsigned int home=Home(m_Entries[j].ID);
+		if (((j-home)&m_Mask)>=((j-i)&m_Mask))
+		{
+			m_Entries[i]=m_Entries[j];
+			i=j;
+		}
+	}
+	m_Entries[i].Node=NULL;
+}
+
+void Graph::NodeTable::Clear()
+{
+	for (vector<Entry>::iterator i=m_Entries.begin(); i!=m_Entries.end(); ++i)
+	{
+		i->Node=NULL;
+	}
+}
+
 void Graph::Connect(unsigned int id, unsigned int arg, unsigned int to)
 {
 //cerr<<"connect id "<<id<<" arg "<<arg<<" to "<<to<<endl;
-	if (m_NodeMap[id]!=NULL && m_NodeMap[to]!=NULL)
+	GraphNode *node=m_NodeMap.Find(id);
+	GraphNode *child=m_NodeMap.Find(to);
+	if (node!=NULL && child!=NULL)
 	{
-		m_NodeMap[id]->SetChild(arg,m_NodeMap[to]);
+		node->SetChild(arg,child);
+		m_PlanDirty=true;
 	}
 }
 
 void Graph::Play(float time, unsigned int id, float pan)
 {
 //cerr<<"play id "<<id<<endl;
-	if (m_NodeMap[id]!=NULL)
+	GraphNode *node=m_NodeMap.Find(id);
+	if (node!=NULL)
 	{
-		m_NodeMap[id]->Trigger(time);
+		node->Trigger(time);
 		m_RootNodes.push_back(pair<unsigned int, float>(id,pan));
 
 		while (m_RootNodes.size()>m_MaxPlaying)
 		{
 			m_RootNodes.erase(m_RootNodes.begin());
 		}
+		m_PlanDirty=true;
 	}
 }
 
-void Graph::Process(unsigned int bufsize, Sample &left, Sample &right)
+void Graph::CompilePlan()
 {
-	for(list<pair<unsigned int, float> >::iterator i=m_RootNodes.begin();
+	m_Plan.clear();
+	m_PlanRoots.clear();
+	m_GroupParent.clear();
+	m_PlanPass++;
+
+	for(vector<pair<unsigned int, float> >::iterator i=m_RootNodes.begin();
 		i!=m_RootNodes.end(); ++i)
 	{
-		if (m_NodeMap[i->first]!=NULL)
+		GraphNode *node=m_NodeMap.Find(i->first);
+		if (node!=NULL)
+		{
+			m_GroupParent.push_back(m_PlanRoots.size());
+			AddToPlan(node,m_PlanRoots.size());
+			m_PlanRoots.push_back(pair<GraphNode*, float>(node,i->second));
+		}
+	}
+
+	GroupPlan();
+	m_PlanDirty=false;
+}
+
+void Graph::AddToPlan(GraphNode *node, unsigned int group)
+{
+	// nodes shared between voices only go in once, and 
+	// this also stops us going round in circles - the 
+	// voices sharing it all have to go on one thread, 
+	// apart from terminals which are only ever read
+	if (node->m_PlanPass==m_PlanPass) 
+	{
+		if (node->IsTerminal()) return;
+		unsigned int a=FindGroup(node->m_Group);
+		unsigned int b=FindGroup(group);
+		if (a<b) m_GroupParent[b]=a;
+		else m_GroupParent[a]=b;
+		return;
+	}
+	node->m_PlanPass=m_PlanPass;
+	node->m_Group=group;
+
+	for (unsigned int n=0; n<node->GetNumChildren(); n++)
+	{
+		GraphNode *child=node->GetChild(n);
+		if (child!=NULL) AddToPlan(child,group);
+	}
+
+	// terminals have nothing to do
+	if (!node->IsTerminal()) m_Plan.push_back(node);
+}
+
+unsigned int Graph::FindGroup(unsigned int group)
+{
+	while (m_GroupParent[group]!=group)
+	{
+		m_GroupParent[group]=m_GroupParent[m_GroupParent[group]];
+		group=m_GroupParent[group];
+	}
+	return group;
+}
+
+static bool BiggestGroup(const pair<unsigned int, unsigned int> &a, 
+	const pair<unsigned int, unsigned int> &b)
+{
+	return a.second-a.first>b.second-b.first;
+}
+
+void Graph::GroupPlan()
+{
+	m_PlanGroups.clear();
+	if (m_Workers==NULL) 
+	{
+		m_PlanGroups.push_back(pair<unsigned int, unsigned int>(0,m_Plan.size()));
+		return;
+	}
+
+	// count the nodes in each group...
+	unsigned int numgroups=m_GroupParent.size();
+	m_GroupStart.assign(numgroups+1,0);
+	for (vector<GraphNode*>::iterator i=m_Plan.begin(); i!=m_Plan.end(); ++i)
+	{
+		(*i)->m_Group=FindGroup((*i)->m_Group);
+		m_GroupStart[(*i)->m_Group+1]++;
+	}
+
+	for (unsigned int g=0; g<numgroups; g++)
+	{
+		unsigned int start=m_GroupStart[g];
+		m_GroupStart[g+1]+=start;
+		if (m_GroupStart[g+1]>start)
+		{
+			m_PlanGroups.push_back(pair<unsigned int, unsigned int>(start,m_GroupStart[g+1]));
+		}
+	}
+
+	// ...and then sort them into place, keeping their order, 
+	// so the children still come before their parents
+	m_PlanScratch.resize(m_Plan.size());
+	for (vector<GraphNode*>::iterator i=m_Plan.begin(); i!=m_Plan.end(); ++i)
+	{
+		m_PlanScratch[m_GroupStart[(*i)->m_Group]++]=*i;
+	}
+	m_Plan.swap(m_PlanScratch);
+
+	// start the big ones first, so the small 
+	// ones can fill in around them
+	sort(m_PlanGroups.begin(),m_PlanGroups.end(),BiggestGroup);
+}
+
+void Graph::ProcessGroup(unsigned int group, unsigned int thread)
+{
+	vector<GraphNode*>::iterator start=m_Plan.begin()+m_PlanGroups[group].first;
+	vector<GraphNode*>::iterator end=m_Plan.begin()+m_PlanGroups[group].second;
+
+	if (m_Profiling)
+	{
+		double *times=&m_ProfileTime[thread*NUMTYPES];
+		unsigned int *counts=&m_ProfileCount[thread*NUMTYPES];
+		for (vector<GraphNode*>::iterator i=start; i!=end; ++i)
 		{
-			m_NodeMap[i->first]->Process(bufsize);
+			double t=GetSeconds();
+			(*i)->Process(m_BufSize);
+			times[(*i)->m_Type]+=GetSeconds()-t;
+			counts[(*i)->m_Type]++;
+		}
+	}
+	else
+	{
+		for (vector<GraphNode*>::iterator i=start; i!=end; ++i)
+		{
+			(*i)->Process(m_BufSize);
+		}
+	}
+}
+
+unsigned int Graph::GetNumOutputs()
+{
+	unsigned int count=0;
+	for (map<Type,NodeDescVec*>::iterator i=m_NodeDescMap.begin();
+		i!=m_NodeDescMap.end(); ++i)
+	{
+		if (i->first!=TERMINAL) count+=i->second->m_Vec.size();
+	}
+	return count;
+}
+
+bool Graph::Reserve(unsigned int bufsize)
+{
+	unsigned int count=GetNumOutputs();
+	if (count*bufsize>m_Outputs.GetLength()) return m_Outputs.Allocate(count*bufsize);
+	return true;
+}
 
-            // do stereo panning
-            float pan = i->second;
-            float leftpan=1,rightpan=1;
-            if (pan<0) leftpan=1-pan;
-            else rightpan=1+pan;
+bool Graph::AllocateOutputs(unsigned int bufsize)
+{
+	// the outputs are mixed by length, so they
+	// mustn't be any longer than the block
+	unsigned int size=bufsize;
+	if (!Reserve(size)) 
+	{
+		// in the audio thread, with nothing reserved
+		m_OutputSize=0;
+		return false;
+	}
 
-			left.MulMix(m_NodeMap[i->first]->GetOutput(),0.1*leftpan);
-            right.MulMix(m_NodeMap[i->first]->GetOutput(),0.1*rightpan);
+	AudioType *pos=m_Outputs.GetNonConstBuffer();
+	for (map<Type,NodeDescVec*>::iterator i=m_NodeDescMap.begin();
+		i!=m_NodeDescMap.end(); ++i)
+	{
+		if (i->first==TERMINAL) continue;
+		for (vector<NodeDesc*>::iterator ni=i->second->m_Vec.begin();
+			ni!=i->second->m_Vec.end(); ++ni)
+		{
+			(*ni)->m_Node->GetOutput().Wrap(pos,size);
+			pos+=size;
 		}
 	}
+
+	m_OutputSize=size;
+	return true;
+}
+
+void Graph::Process(unsigned int bufsize, Sample &left, Sample &right)
+{
+	if (bufsize!=m_OutputSize && !AllocateOutputs(bufsize)) return;
+	if (m_PlanDirty) CompilePlan();
+
+	m_BufSize=bufsize;
+	if (m_Workers!=NULL) m_Workers->Run(&m_ProcessJob,m_PlanGroups.size());
+	else if (!m_PlanGroups.empty()) ProcessGroup(0,0);
+
+	// mixed here in the same order whichever thread 
+	// made them, so the output doesn't change
+	for(vector<pair<GraphNode*, float> >::iterator i=m_PlanRoots.begin();
+		i!=m_PlanRoots.end(); ++i)
+	{
+		// do stereo panning
+		float pan = i->second;
+		float leftpan=1,rightpan=1;
+		if (pan<0) leftpan=1-pan;
+		else rightpan=1+pan;
+
+		left.MulMix(i->first->GetOutput(),0.1*leftpan);
+		right.MulMix(i->first->GetOutput(),0.1*rightpan);
+	}
+}
+
+const char *Graph::GetTypeName(Type t)
+{
+	static const char *names[NUMTYPES]=
+	{
+		"terminal","sine","saw","tri","squ","white","pink","adsr","add","sub","mul","div","pow",
+		"mooglp","moogbp","mooghp","formant","sample","crush","distort","klip","echo","ks","xfade","s&h",
+		"t&h","pad","cryptodistort"
+	};
+	if (t<NUMTYPES) return names[t];
+	return "unknown";
+}
+
+void Graph::ResetProfile()
+{
+	for (unsigned int n=0; n<m_ProfileTime.size(); n++)
+	{
+		m_ProfileTime[n]=0;
+		m_ProfileCount[n]=0;
+	}
+}
+
+double Graph::GetProfileTime(Type t) const
+{
+	double ret=0;
+	for (unsigned int n=t; n<m_ProfileTime.size(); n+=NUMTYPES) ret+=m_ProfileTime[n];
+	return ret;
+}
+
+unsigned int Graph::GetProfileCount(Type t) const
+{
+	unsigned int ret=0;
+	for (unsigned int n=t; n<m_ProfileCount.size(); n+=NUMTYPES) ret+=m_ProfileCount[n];
+	return ret;
 }
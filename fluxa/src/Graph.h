@@ -17,10 +17,10 @@
 #include <vector>
 #include <map>
 #include <set>
-#include <list>
 #include <math.h>
 #include "GraphNode.h"
 #include "ModuleNodes.h"
+#include "WorkerPool.h"
 
 #ifndef GRAPH
 #define GRAPH
@@ -28,7 +28,9 @@
 class Graph
 {
 public:
-	Graph(unsigned int NumNodes, unsigned int SampleRate);
+	// with more than one thread, voices which don't share any 
+	// nodes are shared out between them
+	Graph(unsigned int NumNodes, unsigned int SampleRate, unsigned int NumThreads=1);
 	~Graph();
 
 	enum Type{TERMINAL,SINOSC,SAWOSC,TRIOSC,SQUOSC,WHITEOSC,PINKOSC,ADSR,ADD,SUB,MUL,DIV,POW,
@@ -37,13 +39,54 @@ public:
 
 	void Init();
 	void Clear();
+	// forgets all the nodes and voices, but keeps the nodes 
+	// to hand out again, so it can be done in the audio thread
+	void Reset();
 	void Create(unsigned int id, Type t, float v);
 	void Connect(unsigned int id, unsigned int arg, unsigned int to);
 	void Play(float time, unsigned int id, float pan);
 	void Process(unsigned int bufsize, Sample &left, Sample &right);
-	void SetMaxPlaying(int s) { m_MaxPlaying=s; }
+	void SetMaxPlaying(int s);
+	// makes room for the node outputs for blocks up to this 
+	// size, so it doesn't have to happen in the audio thread - 
+	// false if it couldn't
+	bool Reserve(unsigned int bufsize);
+
+	static const char *GetTypeName(Type t);
+
+	// times each type of node as it's processed, for benchmarking
+	void SetProfiling(bool s) { m_Profiling=s; }
+	void ResetProfile();
+	// seconds spent processing nodes of this type, and how 
+	// many times one was processed, over all the threads
+	double GetProfileTime(Type t) const;
+	unsigned int GetProfileCount(Type t) const;
 
 private:
+	// the playing nodes and everything they are connected to, in
+	// an order where children come before their parents, so each
+	// node is processed once per block - remade when it changes
+	void CompilePlan();
+	void AddToPlan(GraphNode *node, unsigned int group);
+	// groups are the voices which share nodes, so have to 
+	// be processed on the same thread
+	unsigned int FindGroup(unsigned int group);
+	void GroupPlan();
+	void ProcessGroup(unsigned int group, unsigned int thread);
+	// gives every node a slice of one buffer for its output
+	bool AllocateOutputs(unsigned int bufsize);
+	unsigned int GetNumOutputs();
+
+	class ProcessJob : public WorkerPool::Job
+	{
+	public:
+		ProcessJob(Graph *graph) : m_Graph(graph) {}
+		virtual void RunTask(unsigned int task, unsigned int thread) 
+		{ m_Graph->ProcessGroup(task,thread); }
+	private:
+		Graph *m_Graph;
+	};
+
 	class NodeDesc
 	{
 	public:
@@ -71,12 +114,61 @@ private:
 		vector<NodeDesc*> m_Vec;
 	};
 
+	// ids to nodes, open addressed in a table made big enough 
+	// for every node by Init, so Create doesn't allocate
+	class NodeTable
+	{
+	public:
+		NodeTable() : m_Mask(0) {}
+		void Reserve(unsigned int count);
+		GraphNode *Find(unsigned int id) const;
+		void Set(unsigned int id, GraphNode *node);
+		void Erase(unsigned int id);
+		void Clear();
+
+	private:
+		unsigned int Home(unsigned int id) const { return (id*2654435761u)&m_Mask; }
+
+		// empty ones have no node
+		struct Entry
+		{
+			unsigned int ID;
+			GraphNode *Node;
+		};
+
+		vector<Entry> m_Entries;
+		unsigned int m_Mask;
+	};
+
 	unsigned int m_MaxPlaying;
-	list<pair<unsigned int, float> > m_RootNodes;
-	map<unsigned int,GraphNode*> m_NodeMap;
+	vector<pair<unsigned int, float> > m_RootNodes;
+	NodeTable m_NodeMap;
 	map<Type,NodeDescVec*> m_NodeDescMap;
 	unsigned int m_NumNodes;
 	unsigned int m_SampleRate;
+
+	bool m_PlanDirty;
+	unsigned int m_PlanPass;
+	vector<GraphNode*> m_Plan;
+	vector<pair<GraphNode*, float> > m_PlanRoots;
+	// the plan is sorted by group, these are the start 
+	// and end of each one, biggest first
+	vector<pair<unsigned int, unsigned int> > m_PlanGroups;
+	vector<unsigned int> m_GroupParent;
+	vector<unsigned int> m_GroupStart;
+	vector<GraphNode*> m_PlanScratch;
+
+	WorkerPool *m_Workers;
+	ProcessJob m_ProcessJob;
+	unsigned int m_BufSize;
+
+	Sample m_Outputs;
+	unsigned int m_OutputSize;
+
+	bool m_Profiling;
+	// a set of times for each thread
+	vector<double> m_ProfileTime;
+	vector<unsigned int> m_ProfileCount;
 };
 
 #endif
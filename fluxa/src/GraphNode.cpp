@@ -22,7 +22,10 @@ using namespace std;
 
 ///////////////////////////////////////////
 	
-GraphNode::GraphNode(unsigned int numinputs) 
+GraphNode::GraphNode(unsigned int numinputs) :
+m_PlanPass(0),
+m_Type(0),
+m_Group(0)
 { 
 	for(unsigned int n=0; n<numinputs; n++)
 	{
@@ -49,18 +52,6 @@ void GraphNode::TriggerChildren(float time)
 	}
 }
 
-void GraphNode::ProcessChildren(unsigned int bufsize)
-{
-	for(vector<GraphNode*>::iterator i=m_ChildNodes.begin(); 
-		i!=m_ChildNodes.end(); ++i)
-	{
-		if (*i!=NULL)
-		{
-			(*i)->Process(bufsize);
-		}
-	}
-}
-
 void GraphNode::Clear()
 {
 	for(unsigned int n=0; n<m_ChildNodes.size(); n++)
@@ -34,6 +34,8 @@ public:
 	virtual ~GraphNode();
 	
 	virtual void Trigger(float time) {}
+	// the graph processes the children first, so their
+	// outputs are ready to use
 	virtual void Process(unsigned int bufsize)=0;
 	virtual float GetValue() { return 0; }
 	virtual bool IsTerminal() { return false; }
@@ -41,10 +43,10 @@ public:
 	virtual void Clear();
 	
 	void TriggerChildren(float time);
-	void ProcessChildren(unsigned int bufsize);
 	void SetChild(unsigned int num, GraphNode *s);
 	bool ChildExists(unsigned int num);
 	GraphNode* GetChild(unsigned int num);
+	unsigned int GetNumChildren() { return m_ChildNodes.size(); }
 	Sample &GetInput(unsigned int num);
 	float GetCVValue();
 	
@@ -52,7 +54,15 @@ protected:
 	Sample m_Output;
 	
 private:
+	friend class Graph;
+
 	vector<GraphNode*> m_ChildNodes;
+	// the last time the graph put us in its plan
+	unsigned int m_PlanPass;
+	// the graph's type for this node
+	unsigned int m_Type;
+	// the voice which first put us in the plan
+	unsigned int m_Group;
 };
 
 #endif
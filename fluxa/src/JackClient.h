@@ -54,6 +54,7 @@ public:
     int    AddInputPort();
     int    AddOutputPort();
 	unsigned int GetSamplerate() { return m_SampleRate; }
+	unsigned int GetBufferSize()  { return m_Attached?jack_get_buffer_size(m_Client):0; }
 	
 protected:
 	JackClient();
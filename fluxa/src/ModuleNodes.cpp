@@ -48,7 +48,6 @@ void OscNode::Process(unsigned int bufsize)
 	{
 		m_Output.Allocate(bufsize);
 	}
-	ProcessChildren(bufsize);
 
 	if (ChildExists(0) && !GetChild(0)->IsTerminal())
 	{
@@ -85,7 +84,6 @@ void ADSRNode::Process(unsigned int bufsize)
 		m_Output.Allocate(bufsize);
 	}
 
-	ProcessChildren(bufsize);
 	m_Envelope.Process(bufsize, m_Output);
 }
 
@@ -107,7 +105,6 @@ void MathNode::Process(unsigned int bufsize)
 		m_Output.Allocate(bufsize);
 	}
 
-	ProcessChildren(bufsize);
 
 	if (ChildExists(0) && ChildExists(1))
 	{
@@ -268,7 +265,6 @@ void FilterNode::Process(unsigned int bufsize)
 		m_Output.Allocate(bufsize);
 	}
 
-	ProcessChildren(bufsize);
 
 	if (ChildExists(0) && !GetChild(0)->IsTerminal() && ChildExists(1) && ChildExists(2))
 	{
@@ -314,11 +310,15 @@ void SampleNode::Process(unsigned int bufsize)
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
 		m_Output.Allocate(bufsize);
-		m_Temp.Allocate(bufsize);
 	}
-
-	ProcessChildren(bufsize);
 	m_Output.Zero();
+	
+	// the pools may have run dry on the audio thread, keep quiet if so
+	if (bufsize>(unsigned int)m_Temp.GetLength() && !m_Temp.Allocate(bufsize))
+	{
+		return;
+	}
+
 	m_Sampler.Process(bufsize, m_Output, m_Temp);
 }
 
@@ -341,7 +341,6 @@ void EffectNode::Process(unsigned int bufsize)
 		m_Output.Allocate(bufsize);
 	}
 
-	ProcessChildren(bufsize);
 
     if (ChildExists(0) && !GetChild(0)->IsTerminal() && ChildExists(1))
     {
@@ -422,7 +421,6 @@ void KSNode::Process(unsigned int bufsize)
 	{
 		m_Output.Allocate(bufsize);
 	}
-	ProcessChildren(bufsize);
 
 	if (ChildExists(1) && ChildExists(2))
 	{
@@ -457,7 +455,6 @@ void XFadeNode::Process(unsigned int bufsize)
 	{
 		m_Output.Allocate(bufsize);
 	}
-	ProcessChildren(bufsize);
 
 	if (ChildExists(0) && ChildExists(1) && ChildExists(2))
 	{
@@ -607,7 +604,6 @@ void HoldNode::Process(unsigned int bufsize)
 	{
 		m_Output.Allocate(bufsize);
 	}
-	ProcessChildren(bufsize);
 
 	if (ChildExists(0) && ChildExists(1))
 	{
@@ -727,7 +723,6 @@ void PadNode::Process(unsigned int bufsize)
 	{
 		m_Output.Allocate(bufsize);
 	}
-	ProcessChildren(bufsize);
 
     bool HaveFreqCV = false;
     bool HaveGapCV = false;
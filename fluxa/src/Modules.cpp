@@ -17,9 +17,14 @@
 #include "Modules.h"
 #include <stdlib.h>
 #include <math.h>
+#include <vector>
 #include <openssl/evp.h>
 #include <openssl/aes.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 static float SmallNumber = (1.0 / 4294967295.0);   // Very small amount (Denormal Fix)
@@ -148,19 +153,93 @@ void CryptoDistort(Sample &buf)
 ///////////////////////////////////////////////////////////////////////////
 
 unsigned int WaveTable::m_TableLength=DEFAULT_TABLE_LEN;
-Sample WaveTable::m_Table[NUM_TABLES];
+Sample WaveTable::m_Table[NUM_TABLES][NUM_WAVE_LEVELS];
+
+// the phase is 32 bit fixed point - the top bits index the table 
+// (which is DEFAULT_TABLE_LEN long) and the rest interpolate
+static const unsigned int WAVE_FRAC_BITS=22;
+static const unsigned int WAVE_FRAC_MASK=(1<<WAVE_FRAC_BITS)-1;
+static const float WAVE_FRAC_SCALE=1.0f/(1<<WAVE_FRAC_BITS);
+// when the pitch changes every sample, the phases are worked
+// out this many at a time, then the table is read in one go
+static const unsigned int WAVE_CHUNK=64;
+
+// the tables have a copy of the first entry on the end, so
+// the one after the last doesn't need wrapping round
+static inline float ReadWave1(const AudioType *table, unsigned int phase)
+{
+	unsigned int i=phase>>WAVE_FRAC_BITS;
+	float t=(phase&WAVE_FRAC_MASK)*WAVE_FRAC_SCALE;
+	return table[i]+(table[i+1]-table[i])*t;
+}
+
+#ifdef __SSE2__
+static inline __m128 ReadWave4(const AudioType *table, __m128i phase)
+{
+	union { __m128i v; unsigned int i[4]; } index;
+	index.v=_mm_srli_epi32(phase,WAVE_FRAC_BITS);
+	__m128 a=_mm_set_ps(table[index.i[3]],table[index.i[2]],table[index.i[1]],table[index.i[0]]);
+	__m128 b=_mm_set_ps(table[index.i[3]+1],table[index.i[2]+1],table[index.i[1]+1],table[index.i[0]+1]);
+	__m128 t=_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(phase,_mm_set1_epi32(WAVE_FRAC_MASK))),
+		_mm_set1_ps(WAVE_FRAC_SCALE));
+	return _mm_add_ps(a,_mm_mul_ps(_mm_sub_ps(b,a),t));
+}
+#endif
+
+// reads count samples at a fixed pitch, moving phase on
+static void ReadWaveRamp(const AudioType *table, unsigned int &phase, unsigned int incr, 
+	float vol, AudioType *out, unsigned int count)
+{
+	unsigned int n=0;
+#ifdef __SSE2__
+	__m128i p=_mm_set_epi32((int)(phase+incr*3),(int)(phase+incr*2),(int)(phase+incr),(int)phase);
+	__m128i step=_mm_set1_epi32((int)(incr*4));
+	__m128 v=_mm_set1_ps(vol);
+	for (; n+4<=count; n+=4)
+	{
+		_mm_storeu_ps(out+n,_mm_mul_ps(ReadWave4(table,p),v));
+		p=_mm_add_epi32(p,step);
+	}
+	phase+=incr*n;
+#endif
+	for (; n<count; n++)
+	{
+		out[n]=ReadWave1(table,phase)*vol;
+		phase+=incr;
+	}
+}
+
+// reads the table at each of the phases given
+static void ReadWave(const AudioType *table, const unsigned int *phases, 
+	float vol, AudioType *out, unsigned int count)
+{
+	unsigned int n=0;
+#ifdef __SSE2__
+	__m128 v=_mm_set1_ps(vol);
+	for (; n+4<=count; n+=4)
+	{
+		__m128i p=_mm_loadu_si128((const __m128i*)(phases+n));
+		_mm_storeu_ps(out+n,_mm_mul_ps(ReadWave4(table,p),v));
+	}
+#endif
+	for (; n<count; n++)
+	{
+		out[n]=ReadWave1(table,phases[n])*vol;
+	}
+}
 
 WaveTable::WaveTable(int SampleRate) :
 Module(SampleRate)
 {
 	m_TimePerSample=1/(float)m_SampleRate;
-	m_CyclePos=0;
+	m_Phase=0;
 	m_Pitch=m_SampleRate/DEFAULT_TABLE_LEN;
 	m_TargetPitch=m_Pitch;
 	m_Volume=1.0f;
 	m_SlideTime=0;
 	Reset();
 	m_TablePerSample=m_TableLength/(float)SampleRate;
+	m_PhasePerHz=4294967296.0/SampleRate;
 }
 
 void WaveTable::Reset()
@@ -174,9 +253,12 @@ void WaveTable::Reset()
 
 void WaveTable::WriteWaves()
 {
+	// the shapes are drawn first, then put into each 
+	// level with the harmonics that level can have
+	Sample Shape[NUM_TABLES];
 	for (int n=0; n<NUM_TABLES; n++)
 	{
-		m_Table[n].Allocate(m_TableLength);
+		Shape[n].Allocate(m_TableLength);
 	}
 
 	float RadCycle = (M_PI/180)*360;
@@ -186,7 +268,7 @@ void WaveTable::WriteWaves()
 	{
 		if (n==0) Pos=0;
 		else Pos=(n/(float)m_TableLength)*RadCycle;
-		m_Table[NOISE].Set(n,RandRange(-1,1));
+		Shape[NOISE].Set(n,RandRange(-1,1));
 	}
 
 	// todo - might be better to run this a few cycles before storing
@@ -201,7 +283,7 @@ void WaveTable::WriteWaves()
   		b3 = 0.86650f * b3 + White * 0.3104856f;
   		b4 = 0.55000f * b4 + White * 0.5329522f;
   		b5 = -0.7616f * b5 - White * 0.0168980f;
-  		m_Table[PINKNOISE].Set(n,b0 + b1 + b2 + b3 + b4 + b5 + b6 + White * 0.5362f);
+  		Shape[PINKNOISE].Set(n,b0 + b1 + b2 + b3 + b4 + b5 + b6 + White * 0.5362f);
   		b6 = White * 0.115926f;
 	}
 
@@ -209,23 +291,23 @@ void WaveTable::WriteWaves()
 	{
 		if (n==0) Pos=0;
 		else Pos=(n/(float)m_TableLength)*RadCycle;
-		m_Table[SINE].Set(n,sin(Pos));
+		Shape[SINE].Set(n,sin(Pos));
 	}
 
 	for (unsigned int n=0; n<m_TableLength; n++)
 	{
-		if (n<m_TableLength/2) m_Table[SQUARE].Set(n,1.0f);
-		else m_Table[SQUARE].Set(n,-1);
+		if (n<m_TableLength/2) Shape[SQUARE].Set(n,1.0f);
+		else Shape[SQUARE].Set(n,-1);
 	}
 
 	for (unsigned int n=0; n<m_TableLength; n++)
 	{
-		m_Table[REVSAW].Set(n,((n/(float)m_TableLength)*2.0f)-1.0f);
+		Shape[REVSAW].Set(n,((n/(float)m_TableLength)*2.0f)-1.0f);
 	}
 
 	for (unsigned int n=0; n<m_TableLength; n++)
 	{
-		m_Table[SAW].Set(n,1-(n/(float)m_TableLength)*2.0f);
+		Shape[SAW].Set(n,1-(n/(float)m_TableLength)*2.0f);
 	}
 
 	float HalfTab=m_TableLength/2;
@@ -235,19 +317,85 @@ void WaveTable::WriteWaves()
 		if (n<HalfTab) v=1-(n/HalfTab)*2.0f;
 		else v=(((n-HalfTab)/HalfTab)*2.0f)-1.0f;
 		v*=0.99;
-		m_Table[TRIANGLE].Set(n,v);
+		Shape[TRIANGLE].Set(n,v);
 	}
 
 	for (unsigned int n=0; n<m_TableLength; n++)
 	{
-		if (n<m_TableLength/1.2) m_Table[PULSE1].Set(n,1);
-		else m_Table[PULSE1].Set(n,-1);
+		if (n<m_TableLength/1.2) Shape[PULSE1].Set(n,1);
+		else Shape[PULSE1].Set(n,-1);
 	}
 
 	for (unsigned int n=0; n<m_TableLength; n++)
 	{
-		if (n<m_TableLength/1.5) m_Table[PULSE2].Set(n,1);
-		else m_Table[PULSE2].Set(n,-1);
+		if (n<m_TableLength/1.5) Shape[PULSE2].Set(n,1);
+		else Shape[PULSE2].Set(n,-1);
+	}
+
+	unsigned int mask=m_TableLength-1;
+	unsigned int half=m_TableLength/2;
+	vector<double> Cos(m_TableLength), Sin(m_TableLength);
+	for (unsigned int n=0; n<m_TableLength; n++)
+	{
+		Cos[n]=cos(n*RAD/m_TableLength);
+		Sin[n]=sin(n*RAD/m_TableLength);
+	}
+
+	vector<double> Re(half+1), Im(half+1);
+	for (int type=0; type<NUM_TABLES; type++)
+	{
+		for (int level=0; level<NUM_WAVE_LEVELS; level++)
+		{
+			m_Table[type][level].Allocate(m_TableLength+1);
+		}
+
+		// aliasing noise just sounds like more noise
+		if (type==NOISE || type==PINKNOISE)
+		{
+			for (int level=0; level<NUM_WAVE_LEVELS; level++)
+			{
+				for (unsigned int n=0; n<m_TableLength; n++)
+				{
+					m_Table[type][level].Set(n,Shape[type][n]);
+				}
+				m_Table[type][level].Set(m_TableLength,Shape[type][0u]);
+			}
+			continue;
+		}
+
+		// find the harmonics...
+		for (unsigned int h=0; h<=half; h++)
+		{
+			Re[h]=0;
+			Im[h]=0;
+			for (unsigned int n=0; n<m_TableLength; n++)
+			{
+				Re[h]+=Shape[type][n]*Cos[(h*n)&mask];
+				Im[h]+=Shape[type][n]*Sin[(h*n)&mask];
+			}
+			Re[h]*=2.0/m_TableLength;
+			Im[h]*=2.0/m_TableLength;
+		}
+		Re[0]*=0.5;
+		Re[half]*=0.5;
+		Im[half]=0;
+
+		// ...and add them up again, halving them each octave, so 
+		// the first level has them all and is the same as the shape
+		for (int level=0; level<NUM_WAVE_LEVELS; level++)
+		{
+			unsigned int harmonics=half>>level;
+			for (unsigned int n=0; n<m_TableLength; n++)
+			{
+				double v=Re[0];
+				for (unsigned int h=1; h<=harmonics; h++)
+				{
+					v+=Re[h]*Cos[(h*n)&mask]+Im[h]*Sin[(h*n)&mask];
+				}
+				m_Table[type][level].Set(n,v);
+			}
+			m_Table[type][level].Set(m_TableLength,m_Table[type][level][0u]);
+		}
 	}
 }
 
@@ -259,77 +407,99 @@ void WaveTable::Trigger(float time, float pitch, float slidepitch, float vol)
 	m_SlideTime=0;
 }
 
+float WaveTable::GetFreq(float freq) const
+{
+	freq*=m_FineFreq;
+	if (m_Octave>0) freq*=1<<(m_Octave);
+	if (m_Octave<0) freq/=1<<(-m_Octave);
+	return freq;
+}
+
+unsigned int WaveTable::GetIncrement(float freq) const
+{
+	// negative frequencies wrap round and play backwards
+	return (unsigned int)(long long)(freq*m_PhasePerHz);
+}
+
+const AudioType *WaveTable::GetTable(float freq) const
+{
+	// the highest harmonic in a level is half the table length 
+	// shifted down by the level, so pick the first one where 
+	// that's under the nyquist frequency
+	float incr=fabs(freq)*m_TablePerSample;
+	int level=0;
+	while (level<NUM_WAVE_LEVELS-1 && incr>(1<<level)) level++;
+	return m_Table[(int)m_Type][level].GetBuffer();
+}
+
 void WaveTable::Process(unsigned int BufSize, Sample &In)
 {
+	AudioType *out=In.GetNonConstBuffer();
+
 	if (m_SlideLength>0)
 	{
-		float Incr;
-		float Freq;
-		float StartFreq=m_Pitch;
-		StartFreq*=m_FineFreq;
-		if (m_Octave>0) StartFreq*=1<<(m_Octave);
-		if (m_Octave<0) StartFreq/=1<<(-m_Octave);
-
-		float SlideFreq=m_TargetPitch;
-		SlideFreq*=m_FineFreq;
-		if (m_Octave>0) SlideFreq*=1<<(m_Octave);
-		if (m_Octave<0) SlideFreq/=1<<(-m_Octave);
-
-		for (unsigned int n=0; n<BufSize; n++)
+		float StartFreq=GetFreq(m_Pitch);
+		float SlideFreq=GetFreq(m_TargetPitch);
+		unsigned int phases[WAVE_CHUNK];
+
+		for (unsigned int start=0; start<BufSize; start+=WAVE_CHUNK)
 		{
-			float t=m_SlideTime/m_SlideLength;
-			if (t>1) Freq=SlideFreq;
-			else Freq=(1-t)*StartFreq+t*SlideFreq;
-			Incr = Freq*m_TablePerSample;
-			m_CyclePos+=Incr;
-			if (m_CyclePos<0) m_CyclePos=m_TableLength-m_CyclePos;
-			m_CyclePos=fmod(m_CyclePos,m_TableLength-1);
-			In[n]=m_Table[(int)m_Type][m_CyclePos]*m_Volume;
-			m_SlideTime+=m_TimePerSample;
+			unsigned int count=min(BufSize-start,WAVE_CHUNK);
+			float maxfreq=0;
+			for (unsigned int n=0; n<count; n++)
+			{
+				float Freq;
+				float t=m_SlideTime/m_SlideLength;
+				if (t>1) Freq=SlideFreq;
+				else Freq=(1-t)*StartFreq+t*SlideFreq;
+				phases[n]=m_Phase;
+				m_Phase+=GetIncrement(Freq);
+				maxfreq=max(maxfreq,fabsf(Freq));
+				m_SlideTime+=m_TimePerSample;
+			}
+			ReadWave(GetTable(maxfreq),phases,m_Volume,out+start,count);
 		}
 	}
 	else
 	{
-		float Incr;
-		float Freq=m_Pitch;
-		Freq*=m_FineFreq;
-		if (m_Octave>0) Freq*=1<<(m_Octave);
-		if (m_Octave<0) Freq/=1<<(-m_Octave);
-		Incr = Freq*m_TablePerSample;
-
-		for (unsigned int n=0; n<BufSize; n++)
-		{
-			m_CyclePos+=Incr;
-			if (m_CyclePos<0) m_CyclePos=m_TableLength-m_CyclePos;
-			m_CyclePos=fmod(m_CyclePos,m_TableLength-1);
-			In[n]=m_Table[(int)m_Type][m_CyclePos]*m_Volume;
-		}
+		float Freq=GetFreq(m_Pitch);
+		ReadWaveRamp(GetTable(Freq),m_Phase,GetIncrement(Freq),m_Volume,out,BufSize);
 	}
 }
 
 void WaveTable::ProcessFM(unsigned int BufSize, Sample &In, const Sample &Pitch)
 {
-	for (unsigned int n=0; n<BufSize; n++)
+	AudioType *out=In.GetNonConstBuffer();
+	const AudioType *pitch=Pitch.GetBuffer();
+	unsigned int phases[WAVE_CHUNK];
+
+	for (unsigned int start=0; start<BufSize; start+=WAVE_CHUNK)
 	{
-		if (isfinite(Pitch[n]))
+		unsigned int count=min(BufSize-start,WAVE_CHUNK);
+		float maxfreq=0;
+		for (unsigned int n=0; n<count; n++)
 		{
-			m_CyclePos+=Pitch[n]*m_TablePerSample;
-			if (m_CyclePos<0) m_CyclePos=m_TableLength-m_CyclePos;
-			m_CyclePos=fmod(m_CyclePos,m_TableLength-1);
-			In[n]=m_Table[(int)m_Type][m_CyclePos]*m_Volume;
+			float Freq=pitch[start+n];
+			phases[n]=m_Phase;
+			if (isfinite(Freq))
+			{
+				m_Phase+=GetIncrement(Freq);
+				maxfreq=max(maxfreq,fabsf(Freq));
+			}
 		}
+		ReadWave(GetTable(maxfreq),phases,m_Volume,out+start,count);
 	}
 }
 
 void WaveTable::SimpleProcess(unsigned int BufSize, Sample &In)
 {
-	float Incr = m_Pitch*m_FineFreq*(m_TableLength/(float)m_SampleRate);
+	float Freq=m_Pitch*m_FineFreq;
+	unsigned int Incr=GetIncrement(Freq);
+	const AudioType *table=GetTable(Freq);
 	for (unsigned int n=0; n<BufSize; n++)
 	{
-		m_CyclePos+=Incr;
-		if (m_CyclePos<0) m_CyclePos=m_TableLength-m_CyclePos;
-		m_CyclePos=fmod(m_CyclePos,m_TableLength-1);
-		In[n]+=m_Table[(int)m_Type][m_CyclePos]*m_Volume;
+		In[n]+=ReadWave1(table,m_Phase)*m_Volume;
+		m_Phase+=Incr;
 	}
 }
 
@@ -633,7 +803,8 @@ b2(0.0f),
 b3(0.0f),
 b4(0.0f),
 t1(0.0f),
-t2(0.0f)
+t2(0.0f),
+m_Noise(1)
 {
 	Reset();
 }
@@ -667,7 +838,7 @@ void MoogFilter::Process(unsigned int BufSize, Sample &In, Sample *CutoffCV, Sam
 		in = In[n];
 
 		// say no to denormalisation!
-		in+=(rand()%1000)*0.000000001;
+		in+=Dither();
 
 		in -= q * b4;
 
@@ -874,7 +1045,8 @@ void Delay::Process(unsigned int BufSize, Sample &In, Sample &Out)
     if (m_Feedback>0.99) m_Feedback=0.99;
     if (m_Feedback<0) m_Feedback=0;
 
-	if (delay==0)
+	// the buffer is empty if it couldn't be allocated
+	if (delay==0 || m_Buffer.GetLength()<2)
 	{
         for (unsigned int n=0; n<BufSize; n++)
         {
@@ -1121,6 +1293,7 @@ void KS::Trigger(float time, float pitch, float slidepitch, float vol)
 	//m_Volume=vol*1.0;
 
 	unsigned int delay=(unsigned int)(m_SampleRate*m_Delay);
+	if (delay>(unsigned int)m_Buffer.GetLength()) delay=m_Buffer.GetLength();
 
 	for (unsigned int n=0; n<delay; n++)
 	{
@@ -1132,7 +1305,8 @@ void KS::Process(unsigned int BufSize, Sample &Out)
 {
 	unsigned int delay=(unsigned int)(m_SampleRate*m_Delay);
 
-	if (delay==0) return;
+	// the buffer is empty if it couldn't be allocated
+	if (delay==0 || m_Buffer.GetLength()<2) return;
 	if (delay>=(unsigned int)m_Buffer.GetLength())
     {
         delay=m_Buffer.GetLength()-1;
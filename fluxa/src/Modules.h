@@ -26,6 +26,9 @@ using namespace std;
 
 static const int NUM_TABLES = 9;
 static const int DEFAULT_TABLE_LEN = 1024;
+// each waveform has a table for each octave, with fewer harmonics 
+// in the higher ones so they don't alias - the last is just a sine
+static const int NUM_WAVE_LEVELS = 10;
 static const int FILTER_GRANULARITY = 10;
 static const float PI=3.141592654;
 static const float RAD=(PI/180.0)*360.0;
@@ -78,11 +81,18 @@ public:
 
 private:
 
+	// the phase increment for a frequency, and the table 
+	// which won't alias when played with it
+	unsigned int GetIncrement(float freq) const;
+	const AudioType *GetTable(float freq) const;
+	float GetFreq(float freq) const;
+
 	float m_Pitch;
 	float m_TargetPitch;
 	float m_Volume;
 	int   m_Note;
-	float m_CyclePos;
+	// position in the cycle, wraps round by itself
+	unsigned int m_Phase;
 	Type  m_Type;
 	int   m_Octave;
 	float m_FineFreq;
@@ -90,8 +100,9 @@ private:
 	float m_SlideLength;
 	float m_TimePerSample;
 	float m_TablePerSample;
+	double m_PhasePerHz;
 
-	static Sample m_Table[NUM_TABLES];
+	static Sample m_Table[NUM_TABLES][NUM_WAVE_LEVELS];
 	static unsigned int m_TableLength;
 };
 
@@ -203,7 +214,7 @@ public:
         q = Q + (1.0f + 0.5f * q * (1.0f - q + 5.6f * q * q));
 
         // say no to denormalisation!
-        in+=(rand()%1000)*0.000000001;
+        in+=Dither();
 
         in -= q * b4;
 
@@ -222,12 +233,21 @@ public:
     }
 
 protected:
+	// a tiny bit of noise - not rand(), which takes a 
+	// lock, as filters may run on more than one thread
+	inline float Dither()
+	{
+		m_Noise=m_Noise*1664525+1013904223;
+		return ((m_Noise>>16)%1000)*0.000000001;
+	}
+
 	float Cutoff, Resonance;
 
 	float fs, fc;
 	float f,p,q;
 	float b0,b1,b2,b3,b4;
 	float t1,t2;
+	unsigned int m_Noise;
 
 	float in1,in2,in3,in4,out1,out2,out3,out4;
 };
@@ -23,6 +23,7 @@
 #include "OSCServer.h"
 
 using namespace std;
+using namespace spiralcore;
 
 #ifdef NO_LO_ARG_SIZE_DECL
 extern "C" {
@@ -31,11 +32,15 @@ extern "C" {
 #endif
 
 OSCServer::OSCServer(const string &Port) :
+m_Server(NULL),
 m_Port(Port),
 m_Exit(false),
-m_CommandRingBuffer(262144)
+m_CommandRingBuffer(262144),
+m_Record(NULL)
 {
         //cerr<<"Using port: ["<<Port<<"]"<<endl;
+        // no port means commands only come from Send
+        if (Port=="") return;
     m_Server = lo_server_thread_new(Port.c_str(), ErrorHandler);
     lo_server_thread_add_method(m_Server, NULL, NULL, DefaultHandler, this);
 }
@@ -43,6 +48,7 @@ m_CommandRingBuffer(262144)
 OSCServer::~OSCServer()
 {
         m_Exit=true;
+        if (m_Record!=NULL) fclose(m_Record);
 }
 
 void OSCServer::Run()
@@ -57,90 +63,202 @@ void OSCServer::ErrorHandler(int num, const char *msg, const char *path)
     cerr<<"liblo server error "<<num<<endl;
 }
 
+// how each osc message is decoded into a command - 'i' and 'f' are 
+// one word each (converted if the sender used the other), 's' is 
+// a string, '?' is a float which may be left out (and is zero if 
+// it is) and '*' at the end means the arguments repeat
+struct CommandInfo
+{
+        const char *Name;
+        CommandRingBuffer::Opcode Op;
+        const char *Args;
+};
+
+static const CommandInfo Commands[] =
+{
+        {"/setclock", CommandRingBuffer::SETCLOCK, ""},
+        {"/create", CommandRingBuffer::CREATE, "ii?*"},
+        {"/connect", CommandRingBuffer::CONNECT, "iii*"},
+        {"/play", CommandRingBuffer::PLAY, "iiif"},
+        {"/maxsynths", CommandRingBuffer::MAXSYNTHS, "i"},
+        {"/reset", CommandRingBuffer::RESET, ""},
+        {"/globalvolume", CommandRingBuffer::GLOBALVOLUME, "f"},
+        {"/pan", CommandRingBuffer::PAN, "f"},
+        {"/eq", CommandRingBuffer::EQ, "fff"},
+        {"/comp", CommandRingBuffer::COMP, "ffff"},
+        {"/addtoqueue", CommandRingBuffer::ADDTOQUEUE, "is"},
+        {"/loadqueue", CommandRingBuffer::LOADQUEUE, ""},
+        {"/unload", CommandRingBuffer::UNLOAD, "i"},
+        {"/debug", CommandRingBuffer::DEBUG, "i"},
+        {"/addsearchpath", CommandRingBuffer::ADDSEARCHPATH, "s"},
+        {"/voicesteal", CommandRingBuffer::VOICESTEAL, "i"},
+        {NULL, CommandRingBuffer::SETCLOCK, NULL}
+};
+
+static CommandRingBuffer::Arg IntArg(char type, lo_arg *arg)
+{
+        CommandRingBuffer::Arg ret;
+        switch (type)
+        {
+                case LO_INT32: ret.i=arg->i; break;
+                case LO_FLOAT: ret.i=(int)arg->f; break;
+                case LO_DOUBLE: ret.i=(int)arg->d; break;
+                default: ret.i=0; break;
+        }
+        return ret;
+}
+
+static CommandRingBuffer::Arg FloatArg(char type, lo_arg *arg)
+{
+        CommandRingBuffer::Arg ret;
+        switch (type)
+        {
+                case LO_INT32: ret.f=arg->i; break;
+                case LO_FLOAT: ret.f=arg->f; break;
+                case LO_DOUBLE: ret.f=arg->d; break;
+                default: ret.f=0; break;
+        }
+        return ret;
+}
+
+static void AddString(vector<CommandRingBuffer::Arg> &args, const char *str)
+{
+        unsigned int size=strlen(str)+1;
+        unsigned int start=args.size();
+        args.resize(start+(size+3)/4);
+        memcpy(&args[start],str,size);
+}
+
 int OSCServer::DefaultHandler(const char *path, const char *types, lo_arg **argv,
                     int argc, void *data, void *user_data)
 {
         OSCServer *server = (OSCServer*)user_data;
+        if (server->m_Record!=NULL) server->Record(path,types,argv,argc);
+        server->Send(path,types,argv,argc);
+        return 1;
+}
 
-        unsigned int size = 0;
-        for (int i=0; i<argc; i++)
+void OSCServer::Send(const char *path, const char *types, lo_arg **argv, int argc)
+{
+        const CommandInfo *info=Commands;
+        while (info->Name!=NULL && strcmp(info->Name,path)) info++;
+        if (info->Name==NULL)
         {
-                size+=lo_arg_size((lo_type)types[i],argv[i]);
-                // add one for the null terminator
-                if (types[i]=='s') size++;
+                cerr<<"OSCServer: unknown command "<<path<<endl;
+                return;
         }
 
-        char *newdata=new char[size];
-        unsigned int pos=0;
-        for (int i=0; i<argc; i++)
+        unsigned int entrysize=strlen(info->Args);
+        bool repeat=entrysize>0 && info->Args[entrysize-1]=='*';
+        if (repeat) entrysize--;
+
+        vector<CommandRingBuffer::Arg> &args=m_Args;
+        args.clear();
+
+        int i=0;
+        do
         {
-                switch (types[i])
+                for (unsigned int a=0; a<entrysize; a++)
                 {
-                        case LO_INT32:
+                        // eg. /create only has a value for terminals, and 
+                        // fluxa.rkt sends none at all for the other nodes
+                        if (info->Args[a]=='?' && (i>=argc || types[i]!=LO_FLOAT))
                         {
-                                if (pos+4>COMMAND_DATA_SIZE)
-                                {
-                                        cerr<<"osc data too big for ringbuffer command"<<endl;
-                                        delete[] newdata;
-                                        return 1;
-                                }
-
-                                memcpy(newdata+pos,(char*)argv[i],4);
-                                pos+=4;
+                                args.push_back(FloatArg(0,NULL));
+                                continue;
                         }
-                        break;
-                        case LO_FLOAT:
+
+                        if (i>=argc)
                         {
-                                if (pos+4>COMMAND_DATA_SIZE)
-                                {
-                                        cerr<<"osc data too big for ringbuffer command"<<endl;
-                                        delete[] newdata;
-                                        return 1;
-                                }
-
-                                memcpy(newdata+pos,(char*)argv[i],4);
-                                pos+=4;
+                                if (repeat && a>0) cerr<<path<<" - malformed arguments..."<<endl;
+                                // missing ones are zero
+                                if (repeat) break;
+                                args.push_back(IntArg(0,NULL));
+                                continue;
                         }
-                        break;
-                        case LO_STRING:
+
+                        switch (info->Args[a])
                         {
-                                int size=strlen(&argv[i]->s);
-
-                                if (pos+size+1>COMMAND_DATA_SIZE)
-                                {
-                                        cerr<<"osc data too big for ringbuffer command"<<endl;
-                                        delete[] newdata;
-                                        return 1;
-                                }
-
-                                memcpy(newdata+pos,&argv[i]->s,size);
-                                newdata[pos+size]='\0';
-                                pos+=size+1;
+                                case 'i': args.push_back(IntArg(types[i],argv[i])); break;
+                                case 'f': 
+                                case '?': args.push_back(FloatArg(types[i],argv[i])); break;
+                                case 's':
+                                        if (types[i]!=LO_STRING)
+                                        {
+                                                cerr<<path<<" - expected a string"<<endl;
+                                                return;
+                                        }
+                                        AddString(args,&argv[i]->s);
+                                break;
                         }
-                        break;
-                        default:
+                        i++;
+                }
+        } while (repeat && i<argc);
+
+        if (repeat)
+        {
+                // send big batches in as many pieces as they need
+                unsigned int chunk=(COMMAND_MAX_ARGS/entrysize)*entrysize;
+                for (unsigned int start=0; start<args.size(); start+=chunk)
+                {
+                        unsigned int count=args.size()-start<chunk?args.size()-start:chunk;
+                        if (!m_CommandRingBuffer.Send(info->Op,&args[start],count))
                         {
-                                cerr<<"unsupported type: "<<types[i]<<endl;
-                                delete[] newdata;
-                                return 1;
+                                return;
                         }
-                        break;
                 }
         }
-
-        if (1)//pos==size) hmm
+        else
         {
-                CommandRingBuffer::Command command(path,types,newdata,pos);
-                if (!server->m_CommandRingBuffer.Send(command))
+                if (args.size()>COMMAND_MAX_ARGS)
                 {
-                        //cerr<<"OSCServer - ringbuffer full!"<<endl;
+                        cerr<<path<<" - osc data too big for ringbuffer command"<<endl;
+                        return;
                 }
+                m_CommandRingBuffer.Send(info->Op,args.empty()?NULL:&args[0],args.size());
         }
-        else
+}
+
+void OSCServer::Record(const string &filename)
+{
+        if (m_Record!=NULL) fclose(m_Record);
+        m_Record=fopen(filename.c_str(),"w");
+        if (m_Record==NULL)
         {
-                cerr<<"OSCServer::DefaultHandler: size mismatch ["<<pos<<":"<<size<<"], not sending message"<<endl;
+                cerr<<"OSCServer: couldn't open "<<filename<<" to record to"<<endl;
+                return;
+        }
+        m_RecordStart.SetToNow();
+}
+
+void OSCServer::Record(const char *path, const char *types, lo_arg **argv, int argc)
+{
+        Time now;
+        now.SetToNow();
+        fprintf(m_Record,"%f %s %s",now.GetDifference(m_RecordStart),path,types);
+
+        // play times are written relative to the start of the recording
+        if (!strcmp(path,"/play") && argc>1 && types[0]==LO_INT32 && types[1]==LO_INT32 &&
+            (argv[0]->i!=0 || argv[1]->i!=0))
+        {
+                Time t((unsigned int)argv[0]->i,(unsigned int)argv[1]->i);
+                double offset=t.GetDifference(m_RecordStart);
+                if (offset<0) offset=0;
+                fprintf(m_Record," %d %d",(int)offset,(int)(unsigned int)((offset-(int)offset)*UINT_MAX));
+                argv+=2; types+=2; argc-=2;
         }
 
-        delete[] newdata;
-    return 1;
+        for (int i=0; i<argc; i++)
+        {
+                switch (types[i])
+                {
+                        case LO_INT32: fprintf(m_Record," %d",argv[i]->i); break;
+                        case LO_FLOAT: fprintf(m_Record," %f",argv[i]->f); break;
+                        case LO_DOUBLE: fprintf(m_Record," %f",argv[i]->d); break;
+                        case LO_STRING: fprintf(m_Record," \"%s\"",&argv[i]->s); break;
+                        default: fprintf(m_Record," 0"); break;
+                }
+        }
+        fprintf(m_Record,"\n");
+        fflush(m_Record);
 }
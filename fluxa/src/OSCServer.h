@@ -15,8 +15,11 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <string>
+#include <vector>
+#include <cstdio>
 #include <lo/lo.h>
 #include "CommandRingBuffer.h"
+#include "Time.h"
 
 using namespace std;
 
@@ -28,13 +31,26 @@ public:
 	
 	void Run();
 	bool Get(CommandRingBuffer::Command& command) { return m_CommandRingBuffer.Get(command);}
+
+	// decodes a message and queues it for the audio thread, 
+	// as if it came over the network
+	void Send(const char *path, const char *types, lo_arg **argv, int argc);
+
+	// writes the messages received to a script, which 
+	// fluxa-render can play back
+	void Record(const string &filename);
 	
 private:
 	static int DefaultHandler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
 	static void ErrorHandler(int num, const char *m, const char *path);
+	void Record(const char *path, const char *types, lo_arg **argv, int argc);
 
 	lo_server_thread m_Server;
 	string m_Port;
 	bool m_Exit;
 	CommandRingBuffer m_CommandRingBuffer; 
+	// decoded arguments, kept to save reallocating
+	vector<CommandRingBuffer::Arg> m_Args;
+	FILE *m_Record;
+	spiralcore::Time m_RecordStart;
 };
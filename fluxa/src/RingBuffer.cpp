@@ -49,27 +49,22 @@ bool RingBuffer::Write(char *src, unsigned int size)
         return false;
     }
 	
-	if (size<m_Size-m_WritePos)
+	unsigned int pos=m_WritePos;
+	if (size<m_Size-pos)
 	{
-		//cerr<<"written to: "<<m_WritePos<<endl;
-		memcpy(&(m_Buffer[m_WritePos]), src, size);
-		m_WritePos += size;
-		m_WritePos &= m_SizeMask;
+		//cerr<<"written to: "<<pos<<endl;
+		memcpy(&(m_Buffer[pos]), src, size);
 	}
 	else // have to split data over boundary
 	{
-		unsigned int first = m_Size-m_WritePos;
-		unsigned int second = (m_WritePos+size) & m_SizeMask;
-		
-		memcpy(&(m_Buffer[m_WritePos]), src, first);
-		m_WritePos += first;
-		m_WritePos &= m_SizeMask;
-		
-		memcpy(&(m_Buffer[m_WritePos]), &src[first], second);
-		m_WritePos += second;
-		m_WritePos &= m_SizeMask;
+		unsigned int first = m_Size-pos;
+		memcpy(&(m_Buffer[pos]), src, first);
+		memcpy(m_Buffer, &src[first], size-first);
 	}
 	
+	// make sure the data is there before the reader can see it
+	__sync_synchronize();
+	m_WritePos = (pos+size) & m_SizeMask;
 	return true;
 }
 
@@ -77,29 +72,25 @@ bool RingBuffer::Read(char *dest, unsigned int size)
 {
 	//cerr<<"read pos: "<<m_ReadPos<<endl;
 	unsigned int space=ReadSpace();
-	if (space==0 || size>m_Size) return false;
+	if (space==0 || space<size) return false;
+	__sync_synchronize();
 	
-	if (size<m_Size-m_ReadPos)
+	unsigned int pos=m_ReadPos;
+	if (size<m_Size-pos)
 	{
-		//cerr<<"reading from: "<<m_ReadPos<<endl;
-		memcpy(dest, &(m_Buffer[m_ReadPos]), size);
-		m_ReadPos += size;
-		m_ReadPos &= m_SizeMask;
+		//cerr<<"reading from: "<<pos<<endl;
+		memcpy(dest, &(m_Buffer[pos]), size);
 	}
 	else // have to split data over boundary
 	{
-		unsigned int first = m_Size-m_ReadPos;
-		unsigned int second = (m_ReadPos+size) & m_SizeMask;
-		
-		memcpy(dest, &(m_Buffer[m_ReadPos]), first);
-		m_ReadPos += first;
-		m_ReadPos &= m_SizeMask;
-		
-		memcpy(&dest[first], &(m_Buffer[m_ReadPos]), second);
-		m_ReadPos += second;
-		m_ReadPos &= m_SizeMask;
+		unsigned int first = m_Size-pos;
+		memcpy(dest, &(m_Buffer[pos]), first);
+		memcpy(&dest[first], m_Buffer, size-first);
 	}
 	
+	// and finished with it before the writer can reuse it
+	__sync_synchronize();
+	m_ReadPos = (pos+size) & m_SizeMask;
 	return true;
 }
 
@@ -114,7 +105,7 @@ unsigned int RingBuffer::WriteSpace()
 	unsigned int read = m_ReadPos;
 	unsigned int write = m_WritePos;
 	
-	if (write > read) return (read - write + m_Size) & (m_SizeMask - 1);
+	if (write > read) return ((read - write + m_Size) & m_SizeMask) - 1;
 	if (write < read) return (read - write) - 1;
 	return m_Size - 1;
 }
@@ -29,12 +29,14 @@ public:
 	bool Read(char *dest, unsigned int size);
 	void Dump();
 
-private:
 	unsigned int WriteSpace();
 	unsigned int ReadSpace();
-	
-	unsigned int m_ReadPos;
-	unsigned int m_WritePos;
+
+private:
+	// each is only changed by one thread, and only after 
+	// the data it covers has been written or read
+	volatile unsigned int m_ReadPos;
+	volatile unsigned int m_WritePos;
 	unsigned int m_Size;
 	unsigned int m_SizeMask;	
 	char *m_Buffer;	
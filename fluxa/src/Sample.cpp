@@ -21,11 +21,12 @@
 
 using namespace spiralcore;
 
-Allocator *Sample::m_Allocator = new MallocAllocator();
+Allocator *Sample::m_Allocator = new PoolAllocator();
 
 Sample::Sample(unsigned int Len) :
 m_Data(NULL),
-m_Length(0)
+m_Length(0),
+m_Wrapped(false)
 {	
 	if (Len) 
 	{
@@ -36,7 +37,8 @@ m_Length(0)
 
 Sample::Sample(const Sample &rhs):
 m_Data(NULL),
-m_Length(0)
+m_Length(0),
+m_Wrapped(false)
 {
 	*this=rhs;
 }
@@ -44,7 +46,8 @@ m_Length(0)
 
 Sample::Sample(const AudioType *S, unsigned int Len):
 m_Data(NULL),
-m_Length(0)
+m_Length(0),
+m_Wrapped(false)
 {
 	assert(S);
 	Allocate(Len);		
@@ -61,9 +64,14 @@ Sample::~Sample()
 	
 bool Sample::Allocate(unsigned int Size)
 {
+	// on the audio thread this can fail, in which 
+	// case we keep hold of what we had
+	AudioType *Data = (AudioType*) m_Allocator->New(Size*sizeof(AudioType));
+	if (!Data) return false;
+	
 	Clear();
 	
-	m_Data = (AudioType*) m_Allocator->New(Size*sizeof(AudioType));
+	m_Data = Data;
 	m_Length=Size;
 	
 	memset(m_Data,0,GetLengthInBytes());
@@ -71,13 +79,23 @@ bool Sample::Allocate(unsigned int Size)
 	return (m_Data);
 }
 
+void Sample::Wrap(AudioType *Data, unsigned int Size)
+{
+	Clear();
+
+	m_Data = Data;
+	m_Length = Size;
+	m_Wrapped = true;
+}
+
 void Sample::Clear()
 {
 	if (m_Data)
 	{
-		m_Allocator->Delete((char*)m_Data);
+		if (!m_Wrapped) m_Allocator->Delete((char*)m_Data);
 		m_Length=0;
 		m_Data=NULL;
+		m_Wrapped=false;
 	}
 }
 
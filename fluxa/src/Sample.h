@@ -53,6 +53,8 @@ public:
 	static Allocator *GetAllocator() { return m_Allocator; }
 
 	bool Allocate(unsigned int Size);
+	// use someone else's memory, which is not freed by Clear
+	void Wrap(AudioType *Data, unsigned int Size);
 	void Clear();
 	void Zero();
 	void Set(AudioType Val);
@@ -117,6 +119,7 @@ public:
 private:
 	AudioType *m_Data;
 	unsigned int m_Length;
+	bool m_Wrapped;
 	
     SampleType m_SampleType;
 	static Allocator *m_Allocator;
@@ -19,7 +19,9 @@
 
 SampleStore *SampleStore::m_Singleton=NULL;
 
-SampleStore::SampleStore()
+SampleStore::SampleStore() :
+m_Version(0),
+m_Streaming(false)
 {
 }
 
@@ -30,12 +32,22 @@ SampleStore::~SampleStore()
 void SampleStore::AddToQueue(SampleID ID, const string &Filename)
 {
 	//if (m_SampleMap.find(ID)!=m_SampleMap.end()) return;
-	m_SampleMap[ID]=AsyncSampleLoader::Get()->AddToQueue(Filename);
+	if (m_Streaming)
+	{
+		m_SampleMap.erase(ID);
+		m_StreamMap[ID]=AsyncSampleLoader::Get()->AddStreamToQueue(Filename);
+	}
+	else
+	{
+		m_StreamMap.erase(ID);
+		m_SampleMap[ID]=AsyncSampleLoader::Get()->AddToQueue(Filename);
+	}
+	m_Version++;
 }
 
-void SampleStore::LoadQueue()
+void SampleStore::LoadQueue(bool wait)
 {
-	AsyncSampleLoader::Get()->LoadQueue();
+	AsyncSampleLoader::Get()->LoadQueue(wait);
 }
 	
 void SampleStore::Unload(SampleID ID)
@@ -44,6 +56,13 @@ void SampleStore::Unload(SampleID ID)
 	if (i!=m_SampleMap.end())
 	{
 		m_SampleMap.erase(i);
+		m_Version++;
+	}
+	map<SampleID,SampleStream*>::iterator s = m_StreamMap.find(ID);
+	if (s!=m_StreamMap.end())
+	{
+		m_StreamMap.erase(s);
+		m_Version++;
 	}
 	//else
 	//{
@@ -54,7 +73,9 @@ void SampleStore::Unload(SampleID ID)
 void SampleStore::UnloadAll()
 {
 	m_SampleMap.clear();
+	m_StreamMap.clear();
 	m_NextSampleID=1;	
+	m_Version++;
 }	
 
 Sample *SampleStore::GetSample(SampleID id)
@@ -67,3 +88,14 @@ Sample *SampleStore::GetSample(SampleID id)
 	
 	return NULL;
 }
+
+SampleStream *SampleStore::GetStream(SampleID id)
+{
+	map<SampleID,SampleStream*>::iterator i = m_StreamMap.find(id);
+	if (i!=m_StreamMap.end())
+	{
+		return i->second;
+	}
+	
+	return NULL;
+}
@@ -16,6 +16,7 @@
 
 #include <map>
 #include "Sample.h"
+#include "SampleStream.h"
 
 using namespace spiralcore;
 using namespace std;
@@ -30,18 +31,30 @@ public:
 	}
 
 	void AddToQueue(SampleID ID, const string &Filename);
-	void LoadQueue();
+	void LoadQueue(bool wait=false);
 	void Unload(SampleID ID);
 	void UnloadAll();
 
 	Sample* GetSample(SampleID ID);
+	// samples added while streaming is on are played from disk
+	SampleStream* GetStream(SampleID ID);
+
+	// stream samples added from now on, rather than loading them
+	void SetStreaming(bool s) { m_Streaming=s; }
+
+	// changes when samples are added or removed, so 
+	// pointers to them can be looked up again
+	unsigned int GetVersion() { return m_Version; }
 
 private:
 	SampleStore();
 	~SampleStore();
 
  	map<SampleID,Sample*> m_SampleMap;
+ 	map<SampleID,SampleStream*> m_StreamMap;
  	int m_NextSampleID;
+	unsigned int m_Version;
+	bool m_Streaming;
 	
 	static SampleStore *m_Singleton;
 };
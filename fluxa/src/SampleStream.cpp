@@ -0,0 +1,510 @@
+// Copyright (C) 2008 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "SampleStream.h"
+#include "SearchPaths.h"
+
+using namespace spiralcore;
+
+const unsigned int SampleStream::PAGE_FRAMES;
+vector<SampleStream*> SampleStream::m_Streams;
+pthread_mutex_t SampleStream::m_Mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_t SampleStream::m_Thread;
+bool SampleStream::m_Running=false;
+volatile int SampleStream::m_Wake=0;
+volatile unsigned int SampleStream::m_Clock=1;
+unsigned int SampleStream::m_PreloadMS=500;
+unsigned long long SampleStream::m_CacheSize=256*1024*1024;
+bool SampleStream::m_Blocking=false;
+volatile unsigned long long SampleStream::m_Resident=0;
+volatile unsigned long long SampleStream::m_HeadBytes=0;
+volatile unsigned int SampleStream::m_Underruns=0;
+volatile unsigned int SampleStream::m_Loads=0;
+volatile unsigned int SampleStream::m_Evictions=0;
+
+// how often the stream thread looks for pages to read, in microseconds
+static const unsigned int STREAM_POLL=5000;
+
+bool spiralcore::ReadSampleFormat(FILE *file, const string &filename, SampleFormat &format)
+{
+	// raw files are just mono floats
+	if (filename.size()>4 && filename.substr(filename.size()-4)==".raw")
+	{
+		fseek(file,0,SEEK_END);
+		format.Channels=1;
+		format.Bits=32;
+		format.Float=true;
+		format.DataStart=0;
+		format.Frames=ftell(file)/sizeof(float);
+		return true;
+	}
+
+	char id[5];
+	id[4]='\0';
+	unsigned int size=0;
+	if (fread(id,1,4,file)!=4 || strcmp(id,"RIFF")!=0)
+	{
+		cerr<<"WAV format error (RIFF): "<<id<<endl;
+		return false;
+	}
+	fread(&size,1,4,file);
+	if (fread(id,1,4,file)!=4 || strcmp(id,"WAVE")!=0)
+	{
+		cerr<<"WAV format error (WAVE): "<<id<<endl;
+		return false;
+	}
+
+	bool gotformat=false;
+	while (fread(id,1,4,file)==4 && fread(&size,1,4,file)==4)
+	{
+		long next=ftell(file)+size+(size&1);
+		if (strcmp(id,"fmt ")==0)
+		{
+			unsigned short compression=0;
+			fread(&compression,1,2,file);
+			fread(&format.Channels,1,2,file);
+			fread(&format.SampleRate,1,4,file);
+			fseek(file,6,SEEK_CUR);
+			fread(&format.Bits,1,2,file);
+
+			if (!((compression==1 && format.Bits==16) || (compression==3 && format.Bits==32)))
+			{
+				cerr<<"WAV data is not 16 bit or float"<<endl;
+				return false;
+			}
+			if (format.Channels<1)
+			{
+				cerr<<"WAV data has no channels"<<endl;
+				return false;
+			}
+			format.Float=compression==3;
+			gotformat=true;
+		}
+		else if (strcmp(id,"data")==0)
+		{
+			if (!gotformat)
+			{
+				cerr<<"WAV format error (fmt ): data first"<<endl;
+				return false;
+			}
+			format.DataStart=ftell(file);
+			unsigned int framebytes=format.Channels*format.Bits/8;
+			format.Frames=size/framebytes;
+			// a truncated file says it has more than it does, and 
+			// reading off the end of the map would crash
+			struct stat st;
+			if (fstat(fileno(file),&st)==0)
+			{
+				unsigned long long held=0;
+				if ((unsigned long long)st.st_size>format.DataStart) held=(st.st_size-format.DataStart)/framebytes;
+				if (held<format.Frames) 
+				{
+					cerr<<"WAV data is truncated, "<<held<<" of "<<format.Frames<<" frames"<<endl;
+					format.Frames=held;
+				}
+			}
+			return true;
+		}
+		fseek(file,next,SEEK_SET);
+	}
+
+	cerr<<"WAV format error (data): not found"<<endl;
+	return false;
+}
+
+bool spiralcore::ReadSampleFrames(int fd, const SampleFormat &format, unsigned int start,
+	unsigned int count, AudioType *dest)
+{
+	// read a bit at a time, rather than all the
+	// interleaved channels at once
+	static const unsigned int CHUNK=4096;
+	char buf[CHUNK];
+	unsigned int framesize=format.Channels*format.Bits/8;
+	unsigned int chunkframes=CHUNK/framesize;
+	off_t pos=format.DataStart+(off_t)start*framesize;
+	float scale=1.0f/format.Channels;
+
+	while (count>0)
+	{
+		unsigned int frames=min(count,chunkframes);
+		ssize_t got=pread(fd,buf,frames*framesize,pos);
+		if (got<(ssize_t)(frames*framesize))
+		{
+			memset(dest,0,count*sizeof(AudioType));
+			return false;
+		}
+
+		if (format.Float)
+		{
+			const float *src=(const float *)buf;
+			for (unsigned int n=0; n<frames; n++)
+			{
+				float v=0;
+				for (unsigned int c=0; c<format.Channels; c++) v+=*src++;
+				dest[n]=v*scale;
+			}
+		}
+		else
+		{
+			const short *src=(const short *)buf;
+			for (unsigned int n=0; n<frames; n++)
+			{
+				float v=0;
+				for (unsigned int c=0; c<format.Channels; c++) v+=*src++/32767.0f;
+				dest[n]=v*scale;
+			}
+		}
+
+		dest+=frames;
+		count-=frames;
+		pos+=frames*framesize;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////
+
+SampleStream::SampleStream(const string &filename) :
+m_Filename(filename),
+m_Length(0),
+m_HeadPages(0),
+m_Map(NULL),
+m_MapSize(0),
+m_Wanted(0)
+{
+}
+
+SampleStream::~SampleStream()
+{
+	// the stream thread mustn't find it once it's gone
+	Unregister(this);
+	
+	for (unsigned int n=0; n<m_Pages.size(); n++)
+	{
+		if (m_Pages[n].State>=0)
+		{
+			unsigned int bytes=GetPageSize(n)*sizeof(AudioType);
+			if (n<m_HeadPages) __sync_fetch_and_sub(&m_HeadBytes,bytes);
+			else __sync_fetch_and_sub(&m_Resident,bytes);
+		}
+		if (m_Map==NULL) delete[] m_Pages[n].Data;
+	}
+	if (m_Map!=NULL) munmap(m_Map,m_MapSize);
+}
+
+bool SampleStream::Open()
+{
+	string filename=SearchPaths::Get()->GetFullPath(m_Filename);
+	cerr<<"streaming: "<<filename<<endl;
+
+	FILE *file=fopen(filename.c_str(),"rb");
+	if (!file)
+	{
+		cerr<<"Error opening ["<<m_Filename<<"]"<<endl;
+		return false;
+	}
+
+	if (!ReadSampleFormat(file,filename,m_Format))
+	{
+		fclose(file);
+		return false;
+	}
+
+	// mono floats are already what we want, so leave
+	// it to the os to page them in from the file
+	if (m_Format.Float && m_Format.Channels==1 && m_Format.DataStart%sizeof(float)==0)
+	{
+		m_MapSize=m_Format.DataStart+m_Format.Frames*sizeof(float);
+		void *map=mmap(NULL,m_MapSize,PROT_READ,MAP_SHARED,fileno(file),0);
+		if (map!=MAP_FAILED) m_Map=(char*)map;
+	}
+	fclose(file);
+
+	unsigned int length=m_Format.Frames;
+	m_Pages.resize((length+PAGE_FRAMES-1)/PAGE_FRAMES);
+	for (unsigned int n=0; n<m_Pages.size(); n++)
+	{
+		m_Pages[n].Data=NULL;
+		m_Pages[n].State=UNLOADED;
+		m_Pages[n].LastUsed=0;
+		m_Pages[n].Wanted=0;
+	}
+
+	// the start is read now, so it can be played straight away
+	unsigned long long preload=m_PreloadMS*(unsigned long long)m_Format.SampleRate/1000;
+	m_HeadPages=min((unsigned int)((preload+PAGE_FRAMES-1)/PAGE_FRAMES),(unsigned int)m_Pages.size());
+	m_Length=length;
+	for (unsigned int n=0; n<m_HeadPages; n++)
+	{
+		LoadPage(n);
+		__sync_fetch_and_add(&m_HeadBytes,GetPageSize(n)*sizeof(AudioType));
+	}
+	__sync_synchronize();
+
+	Register(this);
+	return true;
+}
+
+unsigned int SampleStream::GetPageSize(unsigned int index) const
+{
+	return min(PAGE_FRAMES,m_Length-index*PAGE_FRAMES);
+}
+
+bool SampleStream::Pin(Page &page)
+{
+	while (true)
+	{
+		int state=page.State;
+		if (state<0) return false;
+		if (__sync_bool_compare_and_swap(&page.State,state,state+1)) return true;
+	}
+}
+
+void SampleStream::Ask(Page &page)
+{
+	if (!page.Wanted)
+	{
+		page.Wanted=1;
+		m_Wanted=1;
+		m_Wake=1;
+	}
+}
+
+void SampleStream::Read(unsigned int start, unsigned int count, AudioType *dest)
+{
+	unsigned int end=start+count;
+	if (end>m_Length)
+	{
+		unsigned int over=min(count,end-m_Length);
+		memset(dest+count-over,0,over*sizeof(AudioType));
+		end=m_Length;
+	}
+
+	while (start<end)
+	{
+		unsigned int index=start/PAGE_FRAMES;
+		unsigned int offset=start%PAGE_FRAMES;
+		unsigned int frames=min(PAGE_FRAMES-offset,end-start);
+		Page &page=m_Pages[index];
+
+		bool pinned=Pin(page);
+		if (!pinned && m_Blocking)
+		{
+			// someone else may be loading it
+			while (!LoadPage(index)) sched_yield();
+			pinned=Pin(page);
+		}
+
+		if (pinned)
+		{
+			memcpy(dest,page.Data+offset,frames*sizeof(AudioType));
+			page.LastUsed=m_Clock;
+			Unpin(page);
+		}
+		else
+		{
+			memset(dest,0,frames*sizeof(AudioType));
+			__sync_fetch_and_add(&m_Underruns,frames);
+			Ask(page);
+		}
+
+		dest+=frames;
+		start+=frames;
+	}
+}
+
+void SampleStream::Want(unsigned int start, unsigned int end)
+{
+	if (end>m_Length) end=m_Length;
+	if (start>=end) return;
+
+	for (unsigned int index=start/PAGE_FRAMES; index<=(end-1)/PAGE_FRAMES; index++)
+	{
+		Page &page=m_Pages[index];
+		// keep the ones we're about to need from being thrown away
+		if (page.State>=0) page.LastUsed=m_Clock;
+		else Ask(page);
+	}
+}
+
+bool SampleStream::LoadPage(unsigned int index)
+{
+	Page &page=m_Pages[index];
+	if (!__sync_bool_compare_and_swap(&page.State,UNLOADED,LOADING))
+	{
+		return page.State>=0;
+	}
+
+	unsigned int first=index*PAGE_FRAMES;
+	unsigned int count=GetPageSize(index);
+	AudioType *data=page.Data;
+
+	if (m_Map!=NULL)
+	{
+		// touch it, so it's read in here rather than in the audio thread
+		data=(AudioType*)(m_Map+m_Format.DataStart)+first;
+		volatile float sum=0;
+		for (unsigned int n=0; n<count; n+=1024) sum+=data[n];
+	}
+	else
+	{
+		data=new AudioType[count];
+		int fd=open(SearchPaths::Get()->GetFullPath(m_Filename).c_str(),O_RDONLY);
+		if (fd<0 || !ReadSampleFrames(fd,m_Format,first,count,data))
+		{
+			memset(data,0,count*sizeof(AudioType));
+		}
+		if (fd>=0) close(fd);
+	}
+
+	page.Data=data;
+	page.LastUsed=m_Clock;
+	if (index>=m_HeadPages) __sync_fetch_and_add(&m_Resident,count*sizeof(AudioType));
+	__sync_fetch_and_add(&m_Loads,1);
+	__sync_synchronize();
+	page.State=0;
+	page.Wanted=0;
+	return true;
+}
+
+bool SampleStream::Evict(unsigned int index)
+{
+	Page &page=m_Pages[index];
+	if (!__sync_bool_compare_and_swap(&page.State,0,EVICTING)) return false;
+
+	unsigned int count=GetPageSize(index);
+	if (m_Map!=NULL)
+	{
+		// only give back the os pages that are all ours
+		long pagesize=sysconf(_SC_PAGESIZE);
+		unsigned long start=(unsigned long)page.Data;
+		unsigned long end=start+count*sizeof(AudioType);
+		start=(start+pagesize-1)&~(pagesize-1);
+		end&=~(pagesize-1);
+		if (end>start) madvise((void*)start,end-start,MADV_DONTNEED);
+	}
+	else
+	{
+		delete[] page.Data;
+		page.Data=NULL;
+	}
+
+	__sync_fetch_and_sub(&m_Resident,count*sizeof(AudioType));
+	__sync_fetch_and_add(&m_Evictions,1);
+	__sync_synchronize();
+	page.State=UNLOADED;
+	return true;
+}
+
+void SampleStream::Register(SampleStream *stream)
+{
+	pthread_mutex_lock(&m_Mutex);
+	m_Streams.push_back(stream);
+	if (!m_Running)
+	{
+		m_Running=pthread_create(&m_Thread,NULL,StreamThread,NULL)==0;
+		if (m_Running) pthread_detach(m_Thread);
+	}
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void SampleStream::Unregister(SampleStream *stream)
+{
+	pthread_mutex_lock(&m_Mutex);
+	vector<SampleStream*>::iterator i=find(m_Streams.begin(),m_Streams.end(),stream);
+	if (i!=m_Streams.end()) m_Streams.erase(i);
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void *SampleStream::StreamThread(void *context)
+{
+	while (true)
+	{
+		usleep(STREAM_POLL);
+		m_Clock++;
+		if (!m_Wake) continue;
+		m_Wake=0;
+
+		pthread_mutex_lock(&m_Mutex);
+		for (unsigned int s=0; s<m_Streams.size(); s++)
+		{
+			SampleStream *stream=m_Streams[s];
+			if (!stream->m_Wanted) continue;
+			stream->m_Wanted=0;
+			for (unsigned int n=0; n<stream->m_Pages.size(); n++)
+			{
+				if (stream->m_Pages[n].Wanted) stream->LoadPage(n);
+			}
+		}
+		EvictToBudget();
+		pthread_mutex_unlock(&m_Mutex);
+	}
+	return NULL;
+}
+
+struct EvictCandidate
+{
+	EvictCandidate(unsigned int lastused, SampleStream *stream, unsigned int index) :
+		LastUsed(lastused), Stream(stream), Index(index) {}
+	bool operator<(const EvictCandidate &other) const { return LastUsed<other.LastUsed; }
+	unsigned int LastUsed;
+	SampleStream *Stream;
+	unsigned int Index;
+};
+
+void SampleStream::EvictToBudget()
+{
+	if (m_Resident<=m_CacheSize) return;
+
+	// the pages nobody's used for the longest go first, but
+	// not ones that have been used in the last couple of polls
+	vector<EvictCandidate> candidates;
+	for (unsigned int s=0; s<m_Streams.size(); s++)
+	{
+		SampleStream *stream=m_Streams[s];
+		for (unsigned int n=stream->m_HeadPages; n<stream->m_Pages.size(); n++)
+		{
+			const Page &page=stream->m_Pages[n];
+			if (page.State==0 && !page.Wanted && page.LastUsed+2<m_Clock)
+			{
+				candidates.push_back(EvictCandidate(page.LastUsed,stream,n));
+			}
+		}
+	}
+
+	sort(candidates.begin(),candidates.end());
+	for (unsigned int c=0; c<candidates.size() && m_Resident>m_CacheSize; c++)
+	{
+		candidates[c].Stream->Evict(candidates[c].Index);
+	}
+}
+
+void SampleStream::Dump(ostream &out)
+{
+	pthread_mutex_lock(&m_Mutex);
+	out<<"streaming "<<m_Streams.size()<<" samples: "<<m_HeadBytes/1024<<"k preloaded, "
+		<<m_Resident/1024<<"k of "<<m_CacheSize/1024<<"k cache used, "
+		<<m_Loads<<" pages read, "<<m_Evictions<<" dropped, "
+		<<m_Underruns<<" frames missed"<<endl;
+	pthread_mutex_unlock(&m_Mutex);
+}
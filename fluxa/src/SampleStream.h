@@ -0,0 +1,140 @@
+// Copyright (C) 2008 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdio.h>
+#include <pthread.h>
+#include "Types.h"
+
+#ifndef SAMPLE_STREAM
+#define SAMPLE_STREAM
+
+using namespace std;
+
+namespace spiralcore
+{
+
+// what's in a sound file, and where
+struct SampleFormat
+{
+	SampleFormat() : Channels(1), Bits(16), Float(false), DataStart(0), Frames(0), SampleRate(44100) {}
+	unsigned short Channels;
+	unsigned short Bits;
+	bool Float;
+	unsigned int DataStart;
+	unsigned int Frames;
+	unsigned int SampleRate;
+};
+
+// reads the header of a 16 bit or float wav, or takes a
+// headerless .raw file to be mono floats
+bool ReadSampleFormat(FILE *file, const string &filename, SampleFormat &format);
+// reads frames from the file, mixed down to mono
+bool ReadSampleFrames(int fd, const SampleFormat &format, unsigned int start,
+	unsigned int count, AudioType *dest);
+
+// a sample which is mostly left on disk. the start is kept in memory
+// so it can be played straight away, and the rest is read in pages
+// by a background thread a little before the voices playing it get
+// there. pages are thrown away least recently used first, to keep
+// them under the cache size. mono float files are mapped instead
+class SampleStream
+{
+public:
+	SampleStream(const string &filename);
+	~SampleStream();
+
+	// reads the header and the start of the file,
+	// called from the loader thread
+	bool Open();
+
+	// zero until it's been opened
+	unsigned int GetLength() const { return m_Length; }
+
+	// copies count frames from start into dest, for the audio thread.
+	// frames which haven't been read yet are silent, and asked for
+	void Read(unsigned int start, unsigned int count, AudioType *dest);
+	// asks for the frames from start to end to be read soon
+	void Want(unsigned int start, unsigned int end);
+
+	// how much of the start of each sample to keep in memory
+	static void SetPreload(unsigned int ms) { m_PreloadMS=ms; }
+	// the most memory the rest of the pages can take up
+	static void SetCacheSize(unsigned long long bytes) { m_CacheSize=bytes; }
+	// read missing pages as they're needed, for rendering offline
+	static void SetBlocking(bool s) { m_Blocking=s; }
+	static void Dump(ostream &out);
+
+	static const unsigned int PAGE_FRAMES=16384;
+
+private:
+	// a loaded page's state is the number of readers it has
+	enum {UNLOADED=-1, LOADING=-2, EVICTING=-3};
+
+	struct Page
+	{
+		AudioType *volatile Data;
+		volatile int State;
+		volatile unsigned int LastUsed;
+		volatile int Wanted;
+	};
+
+	bool Pin(Page &page);
+	void Unpin(Page &page) { __sync_fetch_and_sub(&page.State,1); }
+	void Ask(Page &page);
+	bool LoadPage(unsigned int index);
+	bool Evict(unsigned int index);
+	unsigned int GetPageSize(unsigned int index) const;
+
+	static void *StreamThread(void *context);
+	static void Register(SampleStream *stream);
+	static void Unregister(SampleStream *stream);
+	static void EvictToBudget();
+
+	string m_Filename;
+	SampleFormat m_Format;
+	volatile unsigned int m_Length;
+	vector<Page> m_Pages;
+	// the ones at the start, which are always kept
+	unsigned int m_HeadPages;
+	char *m_Map;
+	size_t m_MapSize;
+	volatile int m_Wanted;
+
+	static vector<SampleStream*> m_Streams;
+	static pthread_mutex_t m_Mutex;
+	static pthread_t m_Thread;
+	static bool m_Running;
+	static volatile int m_Wake;
+	static volatile unsigned int m_Clock;
+
+	static unsigned int m_PreloadMS;
+	static unsigned long long m_CacheSize;
+	static bool m_Blocking;
+
+	// 64 bit, so the cache can be 4 gigs or more
+	static volatile unsigned long long m_Resident;
+	static volatile unsigned long long m_HeadBytes;
+	static volatile unsigned int m_Underruns;
+	static volatile unsigned int m_Loads;
+	static volatile unsigned int m_Evictions;
+};
+
+}
+
+#endif
@@ -16,33 +16,196 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <float.h>
 #include <algorithm>
 #include "Sampler.h"
 #include "SampleStore.h"
 #include "AsyncSampleLoader.h"
 
-static const unsigned int SAFETY_MAX_CHANNELS=30;
+Sampler::StealMode Sampler::m_StealMode=Sampler::OLDEST;
 
-Sampler::Sampler(unsigned int samplerate) :
+// mixes a voice into the buffers, with the sample starting at pos
+// (negative to start part way into the buffer) and skipping speed
+// samples each time, or played from the end if rev is the length.
+// data may be a window starting offset samples into the sample.
+// returns the peak level of the sample over the buffer
+static float MixVoice(const AudioType *data, unsigned int offset, unsigned int length, float pos, float speed, 
+	float rev, float leftvol, float rightvol, AudioType *left, AudioType *right, uint32 bufsize)
+{
+	float peak=0;
+	float end=(float)length-1;
+	//                   ^^ have to account for some floating point error...
+
+	if (speed==1 && rev==0)
+	{
+		// the common case, where the interpolation is the same for every 
+		// sample, so it's a straight run through memory the compiler 
+		// can vectorise
+		int start=(int)floorf(pos);
+		float t=pos-start;
+		uint32 first=pos<0?(uint32)ceilf(-pos):0;
+		uint32 last=pos<end?(uint32)ceilf(end-pos):0;
+		if (first>bufsize) first=bufsize;
+		if (last>bufsize) last=bufsize;
+
+		const AudioType *src=data+start-(int)offset;
+		for (uint32 n=first; n<last; n++)
+		{
+			float v=src[n]*(1-t)+src[n+1]*t;
+			left[n]+=v*leftvol;
+			right[n]+=v*rightvol;
+			float a=fabsf(v);
+			peak=a>peak?a:peak;
+		}
+		return peak;
+	}
+
+	for (uint32 n=0; n<bufsize; n++)
+	{
+		float p=pos+n*speed;
+		if (p<end && p>=0)
+		{
+			float i=fabsf(p-rev);
+			unsigned int ii=(unsigned int)i;
+			float v;
+			if (ii>=length-1) v=data[(ii<length?ii:length-1)-offset];
+			else 
+			{
+				float t=i-ii;
+				v=data[ii-offset]*(1-t)+data[ii+1-offset]*t;
+			}
+			left[n]+=v*leftvol;
+			right[n]+=v*rightvol;
+			float a=fabsf(v);
+			peak=a>peak?a:peak;
+		}
+	}
+	return peak;
+}
+
+Sampler::Sampler(unsigned int samplerate, unsigned int voices) :
 m_SampleRate(samplerate),
 m_Poly(true),
 m_Reverse(false),
 m_StartTime(0),
+m_PlayingOn(0),
+m_FreeList(-1),
+m_SampleStoreVersion(0),
 m_NextEventID(1)
 {
+	if (voices<1) voices=1;
+	m_Voices.resize(voices);
+	m_Active.reserve(voices);
+	for (int n=voices-1; n>=0; n--)
+	{
+		m_Voices[n].TheSample=NULL;
+		m_Voices[n].TheStream=NULL;
+		m_Voices[n].Next=m_FreeList;
+		m_FreeList=n;
+	}
 }
 
 Sampler::~Sampler()
 {
 }
 
+const AudioType *Sampler::ReadStream(SampleStream *stream, unsigned int length, float pos, 
+	float speed, float rev, uint32 bufsize, unsigned int &offset)
+{
+	float end=(float)length-1;
+	
+	// ask for the next second or so, which should be 
+	// plenty of time for it to be read
+	float a=pos+bufsize*speed;
+	float b=a+m_SampleRate*speed;
+	float lo=max(0.0f,min(a,b));
+	float hi=min(end,max(a,b));
+	if (lo<=hi)
+	{
+		float i0=fabsf(lo-rev), i1=fabsf(hi-rev);
+		stream->Want((unsigned int)min(i0,i1),(unsigned int)max(i0,i1)+2);
+	}
+	
+	// the range MixVoice will read from
+	lo=max(0.0f,min(pos,pos+(bufsize-1)*speed));
+	hi=min(end,max(pos,pos+(bufsize-1)*speed));
+	if (lo>hi) return NULL;
+	float i0=fabsf(lo-rev), i1=fabsf(hi-rev);
+	unsigned int first=(unsigned int)min(i0,i1);
+	unsigned int last=min(length,(unsigned int)max(i0,i1)+2);
+	if (first>=last) return NULL;
+	
+	if (m_Window.GetLength()<last-first && !m_Window.Allocate(last-first)) return NULL;
+	stream->Read(first,last-first,m_Window.GetNonConstBuffer());
+	offset=first;
+	return m_Window.GetBuffer();
+}
+
+int Sampler::NewVoice()
+{
+	if (m_FreeList==-1)
+	{
+		// they're all playing, so pick one to stop
+		unsigned int steal=0;
+		for (unsigned int a=1; a<m_Active.size(); a++)
+		{
+			const Voice &voice=m_Voices[m_Active[a]];
+			const Voice &best=m_Voices[m_Active[steal]];
+			if (m_StealMode==QUIETEST)
+			{
+				if (voice.Level<best.Level) steal=a;
+			}
+			else
+			{
+				if (voice.ID<best.ID) steal=a;
+			}
+		}
+		FreeVoice(steal);
+	}
+
+	int v=m_FreeList;
+	m_FreeList=m_Voices[v].Next;
+	m_Active.push_back(v);
+	return v;
+}
+
+void Sampler::FreeVoice(unsigned int active)
+{
+	unsigned int v=m_Active[active];
+	m_Active[active]=m_Active.back();
+	m_Active.pop_back();
+	m_Voices[v].TheSample=NULL;
+	m_Voices[v].TheStream=NULL;
+	m_Voices[v].Next=m_FreeList;
+	m_FreeList=v;
+}
+
+void Sampler::ResolveSamples()
+{
+	// samples may have been unloaded or replaced
+	unsigned int version=SampleStore::Get()->GetVersion();
+	if (version==m_SampleStoreVersion) return;
+	m_SampleStoreVersion=version;
+
+	unsigned int a=0;
+	while (a<m_Active.size())
+	{
+		Voice &voice=m_Voices[m_Active[a]];
+		voice.TheSample=SampleStore::Get()->GetSample(voice.Ev.ID);
+		voice.TheStream=SampleStore::Get()->GetStream(voice.Ev.ID);
+		// sample deleted, so free the voice
+		if (voice.TheSample==NULL && voice.TheStream==NULL) FreeVoice(a);
+		else a++;
+	}
+}
+
 EventID Sampler::Play(float timeoffset, const Event &event)
 {
 	Sample* sample = SampleStore::Get()->GetSample(event.ID);
-	if (sample!=NULL)
+	SampleStream* stream = sample==NULL?SampleStore::Get()->GetStream(event.ID):NULL;
+	if (sample!=NULL || stream!=NULL)
 	{
-		Event Copy = event;
-		if (Copy.Frequency==0)
+		if (event.Frequency==0)
 		{
 			cerr<<"Cancelling zero speed sample"<<endl;
 			return 0;
@@ -59,31 +222,34 @@ EventID Sampler::Play(float timeoffset, const Event &event)
 			}
 			Copy.Position=c;  
 		}*/
-		
-		while (m_ChannelMap.size()>SAFETY_MAX_CHANNELS)
-		{	
-			Trace(RED,BLACK,"channels exceeded %d, culling!",SAFETY_MAX_CHANNELS);
-			m_ChannelMap.erase(m_ChannelMap.begin());
-		}
 
-
-		Copy.Position+=((m_StartTime+timeoffset)*(float)m_SampleRate)*(Copy.Frequency/440.0)*
+		ResolveSamples();
+		
+		Voice &voice=m_Voices[NewVoice()];
+		voice.Ev=event;
+		voice.Ev.Position+=((m_StartTime+timeoffset)*(float)m_SampleRate)*(event.Frequency/440.0)*
 			(m_Globals.Frequency/440.0);
-		m_ChannelMap[m_NextEventID++]=Copy;
+		voice.ID=m_NextEventID++;
+		voice.TheSample=sample;
+		voice.TheStream=stream;
+		// not heard yet, so don't steal it first
+		voice.Level=FLT_MAX;
 		
 		// if poly mode is turned off, remove the last playing sample
 		if (!m_Poly)
 		{
-			map<EventID,Event>::iterator i=m_ChannelMap.find(m_PlayingOn);
-			while(i!=m_ChannelMap.end())
+			for (unsigned int a=0; a<m_Active.size(); a++)
 			{
-	       		m_ChannelMap.erase(i);
-				i=m_ChannelMap.find(m_PlayingOn);
+				if (m_Voices[m_Active[a]].ID==m_PlayingOn)
+				{
+					FreeVoice(a);
+					break;
+				}
 			}
 		}
 		
-		m_PlayingOn=m_NextEventID-1;
-		return m_NextEventID-1;
+		m_PlayingOn=voice.ID;
+		return voice.ID;
 	}
 	else
 	{
@@ -95,61 +261,64 @@ EventID Sampler::Play(float timeoffset, const Event &event)
 
 void Sampler::Process(uint32 BufSize, Sample &left, Sample &right)
 {
-	static uint32 highwater=0;
-	if (m_ChannelMap.size()>highwater)
-	{
-		highwater=m_ChannelMap.size();
-		//cerr<<"Channels highwater mark now at : "<<highwater<<endl;
-	}
+	ResolveSamples();
 
-	map<EventID,Event>::iterator nexti=m_ChannelMap.begin();
-	for (map<EventID,Event>::iterator i=m_ChannelMap.begin();
-	       i!=m_ChannelMap.end();)
+	AudioType *leftbuf=left.GetNonConstBuffer();
+	AudioType *rightbuf=right.GetNonConstBuffer();
+
+	unsigned int a=0;
+	while (a<m_Active.size())
 	{
-		nexti++; // used so we can delete the current channel
-		Event *ch = &i->second;
-		Sample *sample = SampleStore::Get()->GetSample(ch->ID);
-		// check we still have the sample
-		if (sample != NULL)
-		{			
-			float Volume = ch->Volume*m_Globals.Volume*10.0f;
-			float Speed =  (ch->Frequency/440.0)*(m_Globals.Frequency/440.0);
-			
-			float Pan = 0;
+		Voice &voice=m_Voices[m_Active[a]];
+		Event *ch = &voice.Ev;
+		Sample *sample = voice.TheSample;
+		// may still be loading, in which case this is zero
+		unsigned int length = sample!=NULL?sample->GetLength():voice.TheStream->GetLength();
+
+		float Volume = ch->Volume*m_Globals.Volume*10.0f;
+		float Speed =  (ch->Frequency/440.0)*(m_Globals.Frequency/440.0);
+		
+		float Pan = 0;
+		
+		if (m_Globals.Pan!=0) Pan = (ch->Pan+m_Globals.Pan)/2.0f; // average
+		else Pan = ch->Pan; // just channel pan
 			
-			if (m_Globals.Pan!=0) Pan = (ch->Pan+m_Globals.Pan)/2.0f; // average
-			else Pan = ch->Pan; // just channel pan
+		Pan = 0.5f+Pan/2.0f; // 0 -> 1
+		float Left = Pan;		
+		float Right = 1-Pan;
 				
-			Pan = 0.5f+Pan/2.0f; // 0 -> 1
-			float Left = Pan;		
-			float Right = 1-Pan;
-					
-			float rev = 0;
-			if (m_Reverse) rev = sample->GetLength();
-					
-			for (uint32 n=0; n<BufSize; n++)
-			{	
-				if (ch->Position<sample->GetLength()-1 && ch->Position>=0)
-				//                                  ^^ have to account for some floating point error...
-				{
-					left.Set(n,left[n]+(*sample)[(float)fabs(ch->Position-rev)]*Volume*Left);
-					right.Set(n,right[n]+(*sample)[(float)fabs(ch->Position-rev)]*Volume*Right);
-				}
-				
-				ch->Position+=Speed;
-							
-				if (ch->Position>=sample->GetLength())
-				{
-					m_ChannelMap.erase(i);
-					break;
-				}
+		float rev = 0;
+		if (m_Reverse) rev = length;
+
+		if (length>0)
+		{
+			unsigned int offset=0;
+			const AudioType *data=NULL;
+			if (sample!=NULL) data=sample->GetBuffer();
+			else data=ReadStream(voice.TheStream,length,ch->Position,Speed,rev,BufSize,offset);
+			
+			float peak=0;
+			if (data!=NULL)
+			{
+				peak=MixVoice(data,offset,length,ch->Position,Speed,rev,
+							  Volume*Left,Volume*Right,leftbuf,rightbuf,BufSize);
+			}
+			if (ch->Position+BufSize*Speed>=0)
+			{
+				voice.Level=peak*Volume;
 			}
 		}
-		else // sample deleted, so free the channel
+
+		ch->Position+=BufSize*Speed;
+
+		// finished, or going backwards off the start
+		if (ch->Position>=length || (Speed<0 && ch->Position<0))
+		{
+			FreeVoice(a);
+		}
+		else
 		{
-			m_ChannelMap.erase(i);
+			a++;
 		}
-		i=nexti;
 	}
 }
-
@@ -14,12 +14,12 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
-#include <map>
 #include <string>
 #include <vector>
 #include "Types.h"
 #include "Event.h"
 #include "Sample.h"
+#include "SampleStream.h"
 #include "Trace.h"
 
 #ifndef NE_SAMPLER
@@ -37,7 +37,10 @@ struct OutBuffer
 class Sampler
 {
 public:
-	Sampler(unsigned int samplerate);
+	// which voice to stop when they are all in use
+	enum StealMode {OLDEST, QUIETEST};
+
+	Sampler(unsigned int samplerate, unsigned int voices=32);
 	virtual ~Sampler();
 
 	EventID Play(float timeoffset, const Event &Channel);	
@@ -45,8 +48,30 @@ public:
 	
 	void SetPoly(bool s) { m_Poly=s; }
 	void SetReverse(bool s) { m_Reverse=s; }
+	static void SetStealMode(StealMode s) { m_StealMode=s; }
 	
 private:
+	struct Voice
+	{
+		Event Ev;
+		EventID ID;
+		Sample *TheSample;
+		// or where it's streamed from
+		SampleStream *TheStream;
+		// peak level of the last block, for stealing
+		float Level;
+		// next in the free list
+		int Next;
+	};
+
+	int NewVoice();
+	void FreeVoice(unsigned int active);
+	void ResolveSamples();
+	// reads the part of a stream this block plays into m_Window,
+	// and asks for what comes next
+	const AudioType *ReadStream(SampleStream *stream, unsigned int length, float pos, 
+		float speed, float rev, uint32 bufsize, unsigned int &offset);
+
 	unsigned int m_SampleRate;
 	
 	bool m_Poly;
@@ -55,8 +80,17 @@ private:
 	Event m_Globals;
 	EventID m_PlayingOn;
 	
- 	map<EventID,Event> m_ChannelMap;
- 	int m_NextEventID;
+	// all allocated up front, so nothing is allocated
+	// or freed in the audio thread
+	vector<Voice> m_Voices;
+	// indices of the playing voices
+	vector<unsigned int> m_Active;
+	int m_FreeList;
+	unsigned int m_SampleStoreVersion;
+	Sample m_Window;
+ 	EventID m_NextEventID;
+
+	static StealMode m_StealMode;
 };
 
 #endif
@@ -0,0 +1,208 @@
+// Copyright (C) 2008 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <iostream>
+#include <climits>
+#include <unistd.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#include "WorkerPool.h"
+#include "Allocator.h"
+
+// how long to wait for work before going to sleep
+static const unsigned int SPIN_COUNT=20000;
+
+static inline void Pause()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("pause");
+#endif
+}
+
+WorkerPool::WorkerPool(unsigned int numthreads) :
+m_Next(0),
+m_Job(NULL),
+m_Count(0),
+m_Done(0),
+m_Generation(0),
+m_Sleeping(0),
+m_Quit(false),
+m_Realtime(false),
+m_PriorityMatched(false)
+{
+	if (numthreads<1) numthreads=1;
+	m_Workers.resize(numthreads-1);
+
+	long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (unsigned int i=0; i<m_Workers.size(); i++)
+	{
+		m_Workers[i].Pool=this;
+		m_Workers[i].Index=i+1;
+
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,WorkerThread,&m_Workers[i])!=0)
+		{
+			cerr<<"WorkerPool: couldn't start worker thread"<<endl;
+			break;
+		}
+
+#ifdef __linux__
+		// keep each worker to its own core, leaving the 
+		// first one to the audio thread
+		if (cpus>1)
+		{
+			cpu_set_t cpuset;
+			CPU_ZERO(&cpuset);
+			CPU_SET((i+1)%cpus,&cpuset);
+			pthread_setaffinity_np(thread,sizeof(cpu_set_t),&cpuset);
+		}
+#endif
+		m_Threads.push_back(thread);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	m_Quit=true;
+	__sync_fetch_and_add(&m_Generation,1);
+#ifdef __linux__
+	syscall(SYS_futex,&m_Generation,FUTEX_WAKE,INT_MAX,NULL,NULL,0);
+#endif
+	for (vector<pthread_t>::iterator i=m_Threads.begin(); i!=m_Threads.end(); ++i)
+	{
+		pthread_join(*i,NULL);
+	}
+}
+
+void WorkerPool::MatchPriority()
+{
+	// the workers should be as realtime as the thread they are 
+	// helping, which we only find out when it first calls us
+	int policy;
+	sched_param param;
+	if (pthread_getschedparam(pthread_self(),&policy,&param)==0)
+	{
+		for (vector<pthread_t>::iterator i=m_Threads.begin(); i!=m_Threads.end(); ++i)
+		{
+			pthread_setschedparam(*i,policy,&param);
+		}
+	}
+	m_PriorityMatched=true;
+}
+
+void WorkerPool::Run(Job *job, unsigned int count)
+{
+	if (count==0) return;
+
+	if (m_Threads.empty() || count==1)
+	{
+		for (unsigned int n=0; n<count; n++) job->RunTask(n,0);
+		return;
+	}
+
+	if (!m_PriorityMatched) MatchPriority();
+
+	// close the last run first, so a worker still looking 
+	// at it can't claim a task from this one
+	m_Next=((unsigned long long)m_Generation<<32)|0xffffffff;
+	__sync_synchronize();
+
+	unsigned int generation=m_Generation+1;
+	m_Job=job;
+	m_Count=count;
+	m_Realtime=Allocator::IsRealtime();
+	m_Done=0;
+	// the job must be visible before the tasks are
+	__sync_synchronize();
+	m_Next=(unsigned long long)generation<<32;
+	__sync_synchronize();
+	m_Generation=generation;
+	__sync_synchronize();
+
+#ifdef __linux__
+	if (m_Sleeping>0)
+	{
+		syscall(SYS_futex,&m_Generation,FUTEX_WAKE,INT_MAX,NULL,NULL,0);
+	}
+#endif
+
+	RunTasks(generation,0);
+
+	// wait for the tasks the workers took
+	while (m_Done<count) Pause();
+	__sync_synchronize();
+}
+
+void WorkerPool::RunTasks(unsigned int generation, unsigned int thread)
+{
+	while (true)
+	{
+		unsigned long long next=m_Next;
+		if ((unsigned int)(next>>32)!=generation) return;
+		unsigned int task=(unsigned int)next;
+		__sync_synchronize();
+		// read before claiming, the claim makes sure they were for this run
+		Job *job=m_Job;
+		unsigned int count=m_Count;
+		if (task>=count) return;
+		if (__sync_val_compare_and_swap(&m_Next,next,next+1)!=next) continue;
+
+		job->RunTask(task,thread);
+		__sync_fetch_and_add(&m_Done,1);
+	}
+}
+
+void WorkerPool::Wait(unsigned int generation)
+{
+	for (unsigned int n=0; n<SPIN_COUNT; n++)
+	{
+		if (m_Generation!=generation) return;
+		Pause();
+	}
+
+	__sync_fetch_and_add(&m_Sleeping,1);
+	while (m_Generation==generation)
+	{
+#ifdef __linux__
+		syscall(SYS_futex,&m_Generation,FUTEX_WAIT,generation,NULL,NULL,0);
+#else
+		usleep(100);
+#endif
+	}
+	__sync_fetch_and_sub(&m_Sleeping,1);
+}
+
+void *WorkerPool::WorkerThread(void *context)
+{
+	Worker *worker=(Worker*)context;
+	WorkerPool *pool=worker->Pool;
+	unsigned int generation=0;
+
+	while (true)
+	{
+		pool->Wait(generation);
+		if (pool->m_Quit) break;
+		generation=pool->m_Generation;
+		__sync_synchronize();
+		Allocator::SetRealtime(pool->m_Realtime);
+		pool->RunTasks(generation,worker->Index);
+	}
+	return NULL;
+}
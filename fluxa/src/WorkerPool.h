@@ -0,0 +1,81 @@
+// Copyright (C) 2008 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <vector>
+#include <pthread.h>
+
+#ifndef WORKER_POOL
+#define WORKER_POOL
+
+using namespace std;
+
+// threads for the audio thread to share its work with. they are all 
+// started up front, and Run doesn't allocate or take any locks - the 
+// tasks are handed out with atomic counters, and the workers spin for 
+// a little while waiting for the next lot before sleeping on a futex
+
+class WorkerPool
+{
+public:
+	// a job is split into tasks, which may be run in 
+	// any order, on any of the threads
+	class Job
+	{
+	public:
+		virtual ~Job() {}
+		// thread is 0 for the caller, 1 onwards for the workers
+		virtual void RunTask(unsigned int task, unsigned int thread)=0;
+	};
+
+	// the number of threads includes the one calling Run
+	WorkerPool(unsigned int numthreads);
+	~WorkerPool();
+
+	unsigned int GetNumThreads() const { return m_Threads.size()+1; }
+
+	// runs all the tasks, and returns when they are finished
+	void Run(Job *job, unsigned int count);
+
+private:
+	struct Worker
+	{
+		WorkerPool *Pool;
+		unsigned int Index;
+	};
+
+	static void *WorkerThread(void *context);
+	void RunTasks(unsigned int generation, unsigned int thread);
+	void Wait(unsigned int generation);
+	void MatchPriority();
+
+	// the generation in the top half, the next task in the bottom, 
+	// so a task is never claimed from a run that's already finished
+	volatile unsigned long long m_Next;
+	Job *volatile m_Job;
+	volatile unsigned int m_Count;
+	volatile unsigned int m_Done;
+	volatile unsigned int m_Generation;
+	volatile unsigned int m_Sleeping;
+	volatile bool m_Quit;
+	// whether the caller is the audio thread, for the workers to copy
+	volatile bool m_Realtime;
+	bool m_PriorityMatched;
+
+	vector<pthread_t> m_Threads;
+	vector<Worker> m_Workers;
+};
+
+#endif
@@ -15,12 +15,14 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <iostream>
+#include <cstdlib>
 #include "Fluxa.h"
 #include "JackClient.h"
+#include "SampleStore.h"
 
 void printusage()
 {
-	cerr<<"usage: fluxa [-osc oscportnumber] [-jackports leftport rightport]"<<endl;
+	cerr<<"usage: fluxa [-osc oscportnumber] [-jackports leftport rightport] [-events queuesize] [-threads n] [-stream preloadms] [-cache megabytes] [-record scriptfile]"<<endl;
 	exit(-1);
 }
 
@@ -34,6 +36,9 @@ int main(int argc, char **argv)
 	string rightport("alsa_pcm:playback_2");
 #endif
 	string port("4004");
+	unsigned int eventqueuesize=EVENT_QUEUE_SIZE;
+	unsigned int threads=1;
+	string record("");
 
 	int arg=1;
 	while(arg<argc)
@@ -52,13 +57,43 @@ int main(int argc, char **argv)
 			}
 			else printusage();
 		}
+		if (!strcmp(argv[arg],"-events"))
+		{
+			if (arg+1 < argc) eventqueuesize=atoi(argv[arg+1]);
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-threads"))
+		{
+			if (arg+1 < argc) threads=atoi(argv[arg+1]);
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-stream"))
+		{
+			if (arg+1 < argc) 
+			{
+				SampleStore::Get()->SetStreaming(true);
+				SampleStream::SetPreload(atoi(argv[arg+1]));
+			}
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-cache"))
+		{
+			if (arg+1 < argc) SampleStream::SetCacheSize(strtoull(argv[arg+1],NULL,10)*1024*1024);
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-record"))
+		{
+			if (arg+1 < argc) record=argv[arg+1];
+			else printusage();
+		}
 		arg++;
 	}
 
 	OSCServer server(port);
+	if (record!="") server.Record(record);
 	JackClient* jack=JackClient::Get();
 	jack->Attach("fluxa");
-	Fluxa engine(&server,jack,leftport,rightport);
+	Fluxa engine(&server,jack,leftport,rightport,eventqueuesize,threads);
 	server.Run();
 	return 0;
 }
@@ -0,0 +1,434 @@
+// Copyright (C) 2004 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+// fluxa-render plays a script of osc messages, as written by fluxa 
+// -record, through fluxa as fast as it can without jack. the output 
+// goes to a wav file, and it reports how long each block and each type 
+// of node took. with -benchmark it times each type of node on its own 
+// at a range of buffer sizes instead.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sndfile.h>
+#include "Fluxa.h"
+#include "SampleStore.h"
+#include "Modules.h"
+
+void printusage()
+{
+	cerr<<"usage: fluxa-render [-samplerate rate] [-bufsize size] [-threads n] [-stream preloadms] [-cache megabytes] [-length secs] [-tail secs] [-o file.wav] script"<<endl;
+	cerr<<"       fluxa-render -benchmark [-samplerate rate] [-sample file.wav]"<<endl;
+	exit(-1);
+}
+
+static double GetSeconds()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec+t.tv_nsec*0.000000001;
+}
+
+// a line of the script - the seconds from the start 
+// it's sent at, then the osc message:
+// 0.5 /play iiif 1 2147483648 12 0.0
+struct ScriptCommand
+{
+	double Time;
+	string Path;
+	string Types;
+	vector<string> Args;
+};
+
+static bool ParseLine(const string &line, ScriptCommand &cmd)
+{
+	istringstream is(line);
+	if (!(is>>cmd.Time>>cmd.Path)) return false;
+	cmd.Types="";
+	cmd.Args.clear();
+	// no types means no arguments
+	is>>cmd.Types;
+
+	for (unsigned int i=0; i<cmd.Types.size(); i++)
+	{
+		string arg;
+		if (!(is>>ws)) return false;
+		if (is.peek()=='"')
+		{
+			// strings are quoted, and may have spaces
+			is.get();
+			getline(is,arg,'"');
+		}
+		else if (!(is>>arg))
+		{
+			return false;
+		}
+		cmd.Args.push_back(arg);
+	}
+	return true;
+}
+
+static bool LoadScript(const string &filename, vector<ScriptCommand> &script)
+{
+	ifstream file(filename.c_str());
+	if (!file)
+	{
+		cerr<<"couldn't open script "<<filename<<endl;
+		return false;
+	}
+
+	string line;
+	unsigned int linenum=0;
+	while (getline(file,line))
+	{
+		linenum++;
+		if (line.empty() || line[0]=='#') continue;
+		ScriptCommand cmd;
+		if (!ParseLine(line,cmd))
+		{
+			cerr<<filename<<":"<<linenum<<" can't read this line, skipping it"<<endl;
+			continue;
+		}
+		script.push_back(cmd);
+	}
+	return true;
+}
+
+// play times are from the start of the script, if they are zero
+// they mean now, as usual
+static bool GetPlayOffset(const ScriptCommand &cmd, double &offset)
+{
+	if (cmd.Path!="/play" || cmd.Types.size()<2 || cmd.Types[0]!='i' || cmd.Types[1]!='i') return false;
+	unsigned int secs=(unsigned int)atoi(cmd.Args[0].c_str());
+	unsigned int frac=(unsigned int)atoi(cmd.Args[1].c_str());
+	if (secs==0 && frac==0) return false;
+	offset=secs+frac*ONE_OVER_UINT_MAX;
+	return true;
+}
+
+static void SendCommand(OSCServer &server, const ScriptCommand &cmd, const Time &start)
+{
+	unsigned int count=cmd.Types.size();
+	vector<lo_arg> values(count+1);
+	vector<lo_arg*> argv(count+1);
+
+	for (unsigned int i=0; i<count; i++)
+	{
+		argv[i]=&values[i];
+		switch (cmd.Types[i])
+		{
+			case 'i': values[i].i=atoi(cmd.Args[i].c_str()); break;
+			case 'f': values[i].f=atof(cmd.Args[i].c_str()); break;
+			case 'd': values[i].d=atof(cmd.Args[i].c_str()); break;
+			case 's': argv[i]=(lo_arg*)cmd.Args[i].c_str(); break;
+			default: values[i].i=0; break;
+		}
+	}
+
+	double offset;
+	if (GetPlayOffset(cmd,offset))
+	{
+		Time t=start;
+		t+=offset;
+		values[0].i=t.Seconds;
+		values[1].i=t.Fraction;
+	}
+
+	server.Send(cmd.Path.c_str(),cmd.Types.c_str(),&argv[0],count);
+}
+
+static void PrintProfile(Graph &graph, double total)
+{
+	cerr<<"node type        total ms   % of dsp   us per block"<<endl;
+	for (unsigned int t=1; t<Graph::NUMTYPES; t++)
+	{
+		unsigned int count=graph.GetProfileCount((Graph::Type)t);
+		if (count==0) continue;
+		double time=graph.GetProfileTime((Graph::Type)t);
+		fprintf(stderr,"%-14s %10.2f %10.1f %14.2f\n",Graph::GetTypeName((Graph::Type)t),
+			time*1000,total>0?time/total*100:0,time/count*1000000);
+	}
+}
+
+static int Render(const string &scriptname, const string &outname, unsigned int samplerate, 
+	unsigned int bufsize, double length, double tail, unsigned int threads)
+{
+	vector<ScriptCommand> script;
+	if (!LoadScript(scriptname,script)) return -1;
+
+	// run until the last event has had time to finish
+	if (length<=0)
+	{
+		for (vector<ScriptCommand>::iterator i=script.begin(); i!=script.end(); ++i)
+		{
+			double offset;
+			if (i->Time>length) length=i->Time;
+			if (GetPlayOffset(*i,offset) && offset>length) length=offset;
+		}
+		length+=tail;
+	}
+
+	SF_INFO info;
+	memset(&info,0,sizeof(info));
+	info.samplerate=samplerate;
+	info.channels=2;
+	info.format=SF_FORMAT_WAV|SF_FORMAT_FLOAT;
+	SNDFILE *file=sf_open(outname.c_str(),SFM_WRITE,&info);
+	if (!file)
+	{
+		cerr<<"couldn't open "<<outname<<" : "<<sf_strerror(file)<<endl;
+		return -1;
+	}
+
+	OSCServer server("");
+	Fluxa fluxa(&server,samplerate,EVENT_QUEUE_SIZE,threads);
+	fluxa.GetGraph().SetProfiling(true);
+	Sample::GetAllocator()->ResetStats();
+	Time start=fluxa.GetTime();
+
+	double budget=bufsize/(double)samplerate;
+	vector<float> interleaved(bufsize*2);
+	unsigned int blocks=0, over=0, next=0;
+	double total=0, worst=0;
+
+	for (double t=0; t<length; t+=budget)
+	{
+		// send everything due before the end of this block
+		while (next<script.size() && script[next].Time<t+budget)
+		{
+			// offline the clock is ours
+			if (script[next].Path!="/setclock") SendCommand(server,script[next],start);
+			next++;
+		}
+
+		double before=GetSeconds();
+		fluxa.Render(bufsize);
+		double took=GetSeconds()-before;
+
+		total+=took;
+		if (took>worst) worst=took;
+		if (took>budget) over++;
+		blocks++;
+
+		const Sample &left=fluxa.GetLeftBuffer();
+		const Sample &right=fluxa.GetRightBuffer();
+		for (unsigned int n=0; n<bufsize; n++)
+		{
+			interleaved[n*2]=left[n];
+			interleaved[n*2+1]=right[n];
+		}
+		sf_writef_float(file,&interleaved[0],bufsize);
+	}
+
+	sf_close(file);
+
+	fprintf(stderr,"rendered %.2f secs to %s in %.3f secs (%.1fx realtime)\n",
+		blocks*budget,outname.c_str(),total,total>0?blocks*budget/total:0);
+	fprintf(stderr,"%d blocks of %d samples: average %.1f us, worst %.1f us, budget %.1f us, %d over budget\n",
+		blocks,bufsize,blocks?total/blocks*1000000:0,worst*1000000,budget*1000000,over);
+
+	double dsp=0;
+	for (unsigned int t=1; t<Graph::NUMTYPES; t++) dsp+=fluxa.GetGraph().GetProfileTime((Graph::Type)t);
+	PrintProfile(fluxa.GetGraph(),dsp);
+
+	// anything that's grown was allocated while rendering
+	cerr<<"sample memory pool while rendering:"<<endl;
+	Sample::GetAllocator()->Dump(cerr);
+	SampleStream::Dump(cerr);
+	return 0;
+}
+
+static int Benchmark(unsigned int samplerate, const string &samplename)
+{
+	static const unsigned int numsizes=6;
+	static const unsigned int sizes[numsizes]={32,64,128,256,512,1024};
+
+	// normally done by fluxa
+	WaveTable::WriteWaves();
+	CryptoInit();
+
+	if (samplename!="")
+	{
+		SampleStore::Get()->AddToQueue(1,samplename);
+		SampleStore::Get()->LoadQueue(true);
+	}
+
+	cerr<<"nanoseconds per sample at each buffer size"<<endl;
+	fprintf(stderr,"%-14s","node type");
+	for (unsigned int s=0; s<numsizes; s++) fprintf(stderr,"%8d",sizes[s]);
+	fprintf(stderr,"\n");
+
+	// node ids
+	enum {NODE=1, FREQ, CONTROL, SOURCE, SAMPLEID};
+
+	for (unsigned int t=1; t<Graph::NUMTYPES; t++)
+	{
+		Graph::Type type=(Graph::Type)t;
+		fprintf(stderr,"%-14s",Graph::GetTypeName(type));
+		if (type==Graph::SAMPLER && samplename=="")
+		{
+			fprintf(stderr,"  (needs -sample)\n");
+			continue;
+		}
+
+		for (unsigned int s=0; s<numsizes; s++)
+		{
+			unsigned int size=sizes[s];
+			Graph graph(2,samplerate);
+			graph.Create(FREQ,Graph::TERMINAL,440);
+			graph.Create(CONTROL,Graph::TERMINAL,0.5);
+			graph.Create(SAMPLEID,Graph::TERMINAL,1);
+			graph.Create(SOURCE,Graph::SAWOSC,0);
+			graph.Connect(SOURCE,0,FREQ);
+			graph.Create(NODE,type,0);
+
+			// oscillators take a frequency, and most of the rest
+			// something to work on and some control values
+			switch (type)
+			{
+				case Graph::SINOSC: case Graph::SAWOSC: case Graph::TRIOSC: case Graph::SQUOSC:
+				case Graph::WHITEOSC: case Graph::PINKOSC: case Graph::KS: case Graph::PAD:
+					graph.Connect(NODE,0,FREQ);
+				break;
+				case Graph::ADSR:
+					for (unsigned int a=0; a<4; a++) graph.Connect(NODE,a,CONTROL);
+				break;
+				case Graph::SAMPLER:
+					graph.Connect(NODE,0,SAMPLEID);
+					graph.Connect(NODE,1,FREQ);
+				break;
+				default:
+					graph.Connect(NODE,0,SOURCE);
+					for (unsigned int a=1; a<4; a++) graph.Connect(NODE,a,CONTROL);
+				break;
+			}
+
+			graph.SetProfiling(true);
+			Sample left(size), right(size);
+
+			// ten seconds of audio, retriggered every second
+			unsigned int blocks=samplerate*10/size;
+			unsigned int retrigger=samplerate/size;
+			for (unsigned int b=0; b<blocks; b++)
+			{
+				if (b%retrigger==0) graph.Play(0,NODE,0);
+				left.Zero();
+				right.Zero();
+				graph.Process(size,left,right);
+			}
+
+			unsigned int count=graph.GetProfileCount(type);
+			double ns=count?graph.GetProfileTime(type)/(count*(double)size)*1000000000:0;
+			fprintf(stderr,"%8.2f",ns);
+		}
+		fprintf(stderr,"\n");
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int samplerate=44100;
+	unsigned int bufsize=256;
+	unsigned int threads=1;
+	double length=0;
+	double tail=2;
+	bool benchmark=false;
+	string outname("fluxa-render.wav");
+	string samplename("");
+	string scriptname("");
+
+	int arg=1;
+	while(arg<argc)
+	{
+		if (!strcmp(argv[arg],"-samplerate"))
+		{
+			if (arg+1 < argc) samplerate=atoi(argv[++arg]);
+			else printusage();
+		}
+		else if (!strcmp(argv[arg],"-bufsize"))
+		{
+			if (arg+1 < argc) bufsize=atoi(argv[++arg]);
+			else printusage();
+		}
+		else if (!strcmp(argv[arg],"-threads"))
+		{
+			if (arg+1 < argc) threads=atoi(argv[++arg]);
+			else printusage();
+		}
+		else if (!strcmp(argv[arg],"-stream"))
+		{
+			if (arg+1 < argc) 
+			{
+				// offline we can wait for the disk, so the output is the
+				// same as if the samples had been loaded
+				SampleStore::Get()->SetStreaming(true);
+				SampleStream::SetPreload(atoi(argv[++arg]));
+				SampleStream::SetBlocking(true);
+			}
+			else printusage();
+		}
+		else if (!strcmp(argv[arg],"-cache"))
+		{
+			if (arg+1 < argc) SampleStream::SetCacheSize(strtoull(argv[++arg],NULL,10)*1024*1024);
+			else printusage();
+		}
+		else if (!strcmp(argv[arg],"-length"))
+		{
+			if (arg+1 < argc) length=atof(argv[++arg]);
+			else printusage();
+		}
+		else if (!strcmp(argv[arg],"-tail"))
+		{
+			if (arg+1 < argc) tail=atof(argv[++arg]);
+			else printusage();
+		}
+		else if (!strcmp(argv[arg],"-o"))
+		{
+			if (arg+1 < argc) outname=argv[++arg];
+			else printusage();
+		}
+		else if (!strcmp(argv[arg],"-sample"))
+		{
+			if (arg+1 < argc) samplename=argv[++arg];
+			else printusage();
+		}
+		else if (!strcmp(argv[arg],"-benchmark"))
+		{
+			benchmark=true;
+		}
+		else if (argv[arg][0]=='-')
+		{
+			printusage();
+		}
+		else
+		{
+			scriptname=argv[arg];
+		}
+		arg++;
+	}
+
+	if (samplerate==0 || bufsize==0) printusage();
+	if (benchmark) return Benchmark(samplerate,samplename);
+	if (scriptname=="") printusage();
+	return Render(scriptname,outname,samplerate,bufsize,length,tail,threads);
+}
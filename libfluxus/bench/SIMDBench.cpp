@@ -0,0 +1,138 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+// Times the pdata kernels against the loops they replaced, at each
+// level the cpu supports. Built with scons BENCHMARKS=1
+//
+// usage: simd-bench [num-elements] [repeats]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+#include <vector>
+#include "dada.h"
+#include "SIMD.h"
+
+using namespace Fluxus;
+using namespace std;
+
+static double Now()
+{
+	timeval t;
+	gettimeofday(&t,NULL);
+	return t.tv_sec+t.tv_usec/1000000.0;
+}
+
+struct Data
+{
+	vector<dVector> v;
+	vector<dVector> v2;
+	vector<float> f;
+	vector<float> f2;
+	dMatrix m;
+};
+
+// the scalar loops, as they were in PDataArithmetic.cpp
+static void OldAdd(Data &d) { for (unsigned int i=0; i<d.v.size(); i++) d.v[i]+=d.v2[i]; }
+static void OldMult(Data &d) { for (unsigned int i=0; i<d.v.size(); i++) d.v[i]*=d.f[i]; }
+static void OldTransform(Data &d) { for (unsigned int i=0; i<d.v.size(); i++) d.v[i]=d.m.transform_persp(d.v[i]); }
+static void OldNormalise(Data &d) { for (unsigned int i=0; i<d.v.size(); i++) d.v[i].normalise(); }
+static void OldSin(Data &d) { for (unsigned int i=0; i<d.f.size(); i++) d.f[i]=sin(d.f2[i]); }
+static void OldLerp(Data &d) { for (unsigned int i=0; i<d.v.size(); i++) d.v[i]+=(d.v2[i]-d.v[i])*0.5f; }
+
+static void NewAdd(Data &d) { SIMD::OpArray(SIMD::ADD,d.v[0].arr(),d.v2[0].arr(),0x7,d.v.size()*4); }
+static void NewMult(Data &d) { SIMD::OpSplat(SIMD::MUL,d.v[0].arr(),&d.f[0],0x7,d.v.size()); }
+static void NewTransform(Data &d) { SIMD::Transform(d.v[0].arr(),d.m.arr(),true,d.v.size()); }
+static void NewNormalise(Data &d) { SIMD::Normalise(d.v[0].arr(),1,d.v.size()); }
+static void NewSin(Data &d) { SIMD::Sin(&d.f[0],&d.f2[0],d.f.size()); }
+static void NewLerp(Data &d) { SIMD::Lerp(d.v[0].arr(),d.v2[0].arr(),0.5f,0x7,d.v.size()*4); }
+
+struct Test
+{
+	const char *name;
+	void (*Old)(Data &d);
+	void (*New)(Data &d);
+};
+
+static const Test Tests[]=
+{
+	{"add", OldAdd, NewAdd},
+	{"mult", OldMult, NewMult},
+	{"transform", OldTransform, NewTransform},
+	{"normalise", OldNormalise, NewNormalise},
+	{"sin", OldSin, NewSin},
+	{"lerp", OldLerp, NewLerp},
+	{NULL, NULL, NULL}
+};
+
+static void Reset(Data &d)
+{
+	srand(0);
+	for (unsigned int i=0; i<d.v.size(); i++)
+	{
+		d.v[i]=dVector(rand()%100-50,rand()%100-50,rand()%100-50);
+		d.v2[i]=dVector(rand()%100-50,rand()%100-50,rand()%100-50);
+		d.f[i]=(rand()%100)/100.0f;
+		d.f2[i]=(rand()%1000)/100.0f;
+	}
+}
+
+static double Time(void (*Func)(Data &d), Data &d, unsigned int repeats)
+{
+	Reset(d);
+	double start=Now();
+	for (unsigned int i=0; i<repeats; i++) Func(d);
+	return (Now()-start)*1000.0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int size=argc>1?atoi(argv[1]):100000;
+	unsigned int repeats=argc>2?atoi(argv[2]):100;
+	if (size==0) size=1;
+
+	Data d;
+	d.v.resize(size);
+	d.v2.resize(size);
+	d.f.resize(size);
+	d.f2.resize(size);
+	d.m.rotxyz(10,20,30);
+	d.m.translate(1,2,3);
+
+	printf("%d elements, %d repeats, best level is %s\n",size,repeats,
+		SIMD::GetLevelName(SIMD::GetSupported()));
+	printf("%-10s %10s","", "old ms");
+	for (int l=SIMD::SCALAR; l<=SIMD::GetSupported(); l++)
+	{
+		printf(" %10s",SIMD::GetLevelName((SIMD::Level)l));
+	}
+	printf("\n");
+
+	for (const Test *t=Tests; t->name!=NULL; t++)
+	{
+		printf("%-10s %10.2f",t->name,Time(t->Old,d,repeats));
+		for (int l=SIMD::SCALAR; l<=SIMD::GetSupported(); l++)
+		{
+			SIMD::SetLevel((SIMD::Level)l);
+			printf(" %10.2f",Time(t->New,d,repeats));
+		}
+		SIMD::SetLevel(SIMD::GetSupported());
+		printf("\n");
+	}
+
+	return 0;
+}
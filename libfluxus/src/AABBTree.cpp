@@ -0,0 +1,414 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <float.h>
+#include <algorithm>
+#include "AABBTree.h"
+
+using namespace Fluxus;
+
+// how much to enlarge leaves by, relative to their size
+static const float FAT_MARGIN=0.1f;
+
+AABBTree::AABBTree() :
+m_Root(-1),
+m_FreeList(-1)
+{
+}
+
+void AABBTree::Clear()
+{
+	m_Nodes.clear();
+	m_Root=-1;
+	m_FreeList=-1;
+}
+
+int AABBTree::Allocate()
+{
+	if (m_FreeList==-1)
+	{
+		m_Nodes.push_back(TreeNode());
+		m_FreeList=m_Nodes.size()-1;
+		m_Nodes[m_FreeList].Parent=-1;
+	}
+
+	int node=m_FreeList;
+	m_FreeList=m_Nodes[node].Parent;
+	m_Nodes[node].Parent=-1;
+	m_Nodes[node].Left=-1;
+	m_Nodes[node].Right=-1;
+	m_Nodes[node].Height=0;
+	m_Nodes[node].Data=NULL;
+	return node;
+}
+
+void AABBTree::Free(int node)
+{
+	m_Nodes[node].Parent=m_FreeList;
+	m_Nodes[node].Height=-1;
+	m_FreeList=node;
+}
+
+dBoundingBox AABBTree::Combine(const dBoundingBox &a, const dBoundingBox &b)
+{
+	// an empty box has no extent, so mustn't pull the other to the origin
+	if (a.empty()) return b;
+	if (b.empty()) return a;
+	return dBoundingBox(dVector(min(a.min.x,b.min.x),min(a.min.y,b.min.y),min(a.min.z,b.min.z)),
+	                    dVector(max(a.max.x,b.max.x),max(a.max.y,b.max.y),max(a.max.z,b.max.z)));
+}
+
+float AABBTree::Area(const dBoundingBox &box)
+{
+	dVector d=box.max-box.min;
+	return 2.0f*(d.x*d.y+d.y*d.z+d.z*d.x);
+}
+
+bool AABBTree::OnPositiveSide(const dBoundingBox &box, const dPlane &plane)
+{
+	// only need to check the corner furthest along the normal
+	dVector p(plane.a>0?box.max.x:box.min.x,
+	          plane.b>0?box.max.y:box.min.y,
+	          plane.c>0?box.max.z:box.min.z);
+	return plane.pointdistance(p)>0;
+}
+
+int AABBTree::Insert(const dBoundingBox &box, void *data)
+{
+	int leaf=Allocate();
+	TreeNode &n=m_Nodes[leaf];
+	n.Data=data;
+	n.Tight=box;
+	n.Box=box;
+	n.Box.expandby((box.max-box.min).mag()*FAT_MARGIN);
+	InsertLeaf(leaf);
+	return leaf;
+}
+
+void AABBTree::Remove(int leaf)
+{
+	if (leaf<0 || leaf>=(int)m_Nodes.size() || m_Nodes[leaf].Height!=0) return;
+	RemoveLeaf(leaf);
+	Free(leaf);
+}
+
+void AABBTree::Update(int leaf, const dBoundingBox &box)
+{
+	if (leaf<0 || leaf>=(int)m_Nodes.size() || m_Nodes[leaf].Height!=0) return;
+
+	TreeNode &n=m_Nodes[leaf];
+	n.Tight=box;
+
+	// still inside the fat box, so the tree doesn't change
+	if (n.Box.min.x<=box.min.x && n.Box.min.y<=box.min.y && n.Box.min.z<=box.min.z &&
+		n.Box.max.x>=box.max.x && n.Box.max.y>=box.max.y && n.Box.max.z>=box.max.z)
+	{
+		return;
+	}
+
+	RemoveLeaf(leaf);
+	m_Nodes[leaf].Box=box;
+	m_Nodes[leaf].Box.expandby((box.max-box.min).mag()*FAT_MARGIN);
+	InsertLeaf(leaf);
+}
+
+void AABBTree::InsertLeaf(int leaf)
+{
+	if (m_Root==-1)
+	{
+		m_Root=leaf;
+		m_Nodes[leaf].Parent=-1;
+		return;
+	}
+
+	// find the best sibling, by the increase in surface area
+	dBoundingBox box=m_Nodes[leaf].Box;
+	int index=m_Root;
+	while (!m_Nodes[index].IsLeaf())
+	{
+		int left=m_Nodes[index].Left;
+		int right=m_Nodes[index].Right;
+
+		float area=Area(m_Nodes[index].Box);
+		float combined=Area(Combine(m_Nodes[index].Box,box));
+
+		// cost of making a new parent for this node and the leaf
+		float cost=2.0f*combined;
+		// minimum cost of pushing the leaf further down the tree
+		float inheritance=2.0f*(combined-area);
+
+		float costleft=Area(Combine(box,m_Nodes[left].Box))+inheritance;
+		if (!m_Nodes[left].IsLeaf()) costleft-=Area(m_Nodes[left].Box);
+		float costright=Area(Combine(box,m_Nodes[right].Box))+inheritance;
+		if (!m_Nodes[right].IsLeaf()) costright-=Area(m_Nodes[right].Box);
+
+		if (cost<costleft && cost<costright) break;
+
+		index=(costleft<costright)?left:right;
+	}
+
+	int sibling=index;
+	int oldparent=m_Nodes[sibling].Parent;
+	int newparent=Allocate();
+	m_Nodes[newparent].Parent=oldparent;
+	m_Nodes[newparent].Box=Combine(box,m_Nodes[sibling].Box);
+	m_Nodes[newparent].Height=m_Nodes[sibling].Height+1;
+	m_Nodes[newparent].Left=sibling;
+	m_Nodes[newparent].Right=leaf;
+	m_Nodes[sibling].Parent=newparent;
+	m_Nodes[leaf].Parent=newparent;
+
+	if (oldparent!=-1)
+	{
+		if (m_Nodes[oldparent].Left==sibling) m_Nodes[oldparent].Left=newparent;
+		else m_Nodes[oldparent].Right=newparent;
+	}
+	else
+	{
+		m_Root=newparent;
+	}
+
+	Refit(m_Nodes[leaf].Parent);
+}
+
+void AABBTree::RemoveLeaf(int leaf)
+{
+	if (leaf==m_Root)
+	{
+		m_Root=-1;
+		return;
+	}
+
+	int parent=m_Nodes[leaf].Parent;
+	int grandparent=m_Nodes[parent].Parent;
+	int sibling=(m_Nodes[parent].Left==leaf)?m_Nodes[parent].Right:m_Nodes[parent].Left;
+
+	if (grandparent!=-1)
+	{
+		// connect the sibling to the grandparent
+		if (m_Nodes[grandparent].Left==parent) m_Nodes[grandparent].Left=sibling;
+		else m_Nodes[grandparent].Right=sibling;
+		m_Nodes[sibling].Parent=grandparent;
+		Free(parent);
+		Refit(grandparent);
+	}
+	else
+	{
+		m_Root=sibling;
+		m_Nodes[sibling].Parent=-1;
+		Free(parent);
+	}
+}
+
+void AABBTree::Refit(int node)
+{
+	// walk back up the tree fixing heights and boxes
+	while (node!=-1)
+	{
+		node=Balance(node);
+
+		int left=m_Nodes[node].Left;
+		int right=m_Nodes[node].Right;
+		m_Nodes[node].Height=1+max(m_Nodes[left].Height,m_Nodes[right].Height);
+		m_Nodes[node].Box=Combine(m_Nodes[left].Box,m_Nodes[right].Box);
+
+		node=m_Nodes[node].Parent;
+	}
+}
+
+int AABBTree::Balance(int a)
+{
+	// rotates the tree if one side is more than one level
+	// deeper than the other, returns the new root of the
+	// subtree
+	if (m_Nodes[a].IsLeaf() || m_Nodes[a].Height<2) return a;
+
+	int b=m_Nodes[a].Left;
+	int c=m_Nodes[a].Right;
+	int balance=m_Nodes[c].Height-m_Nodes[b].Height;
+
+	if (balance>1 || balance<-1)
+	{
+		// promote the deeper child
+		int up=(balance>1)?c:b;
+		int other=(balance>1)?b:c;
+		int f=m_Nodes[up].Left;
+		int g=m_Nodes[up].Right;
+
+		// swap a and up
+		m_Nodes[up].Left=a;
+		m_Nodes[up].Parent=m_Nodes[a].Parent;
+		m_Nodes[a].Parent=up;
+
+		if (m_Nodes[up].Parent!=-1)
+		{
+			int p=m_Nodes[up].Parent;
+			if (m_Nodes[p].Left==a) m_Nodes[p].Left=up;
+			else m_Nodes[p].Right=up;
+		}
+		else
+		{
+			m_Root=up;
+		}
+
+		// the deeper grandchild stays with up, the other goes to a
+		int keep=(m_Nodes[f].Height>m_Nodes[g].Height)?f:g;
+		int give=(keep==f)?g:f;
+
+		m_Nodes[up].Right=keep;
+		if (balance>1) m_Nodes[a].Right=give;
+		else m_Nodes[a].Left=give;
+		m_Nodes[give].Parent=a;
+
+		m_Nodes[a].Box=Combine(m_Nodes[other].Box,m_Nodes[give].Box);
+		m_Nodes[a].Height=1+max(m_Nodes[other].Height,m_Nodes[give].Height);
+		m_Nodes[up].Box=Combine(m_Nodes[a].Box,m_Nodes[keep].Box);
+		m_Nodes[up].Height=1+max(m_Nodes[a].Height,m_Nodes[keep].Height);
+
+		return up;
+	}
+
+	return a;
+}
+
+void AABBTree::Intersect(const dBoundingBox &box, float threshold, vector<void*> &result) const
+{
+	if (m_Root==-1) return;
+	m_Stack.clear();
+	m_Stack.push_back(m_Root);
+	while (!m_Stack.empty())
+	{
+		const TreeNode &n=m_Nodes[m_Stack.back()];
+		m_Stack.pop_back();
+
+		if (n.IsLeaf())
+		{
+			if (n.Tight.inside(box,threshold)) result.push_back(n.Data);
+		}
+		else if (n.Box.inside(box,threshold))
+		{
+			m_Stack.push_back(n.Left);
+			m_Stack.push_back(n.Right);
+		}
+	}
+}
+
+void AABBTree::Intersect(const dVector &point, float threshold, vector<void*> &result) const
+{
+	if (m_Root==-1) return;
+	m_Stack.clear();
+	m_Stack.push_back(m_Root);
+	while (!m_Stack.empty())
+	{
+		const TreeNode &n=m_Nodes[m_Stack.back()];
+		m_Stack.pop_back();
+
+		if (n.IsLeaf())
+		{
+			if (n.Tight.inside(point,threshold)) result.push_back(n.Data);
+		}
+		else if (n.Box.inside(point,threshold))
+		{
+			m_Stack.push_back(n.Left);
+			m_Stack.push_back(n.Right);
+		}
+	}
+}
+
+void AABBTree::Intersect(const dPlane *planes, int numplanes, vector<void*> &result) const
+{
+	if (m_Root==-1) return;
+	m_Stack.clear();
+	m_Stack.push_back(m_Root);
+	while (!m_Stack.empty())
+	{
+		const TreeNode &n=m_Nodes[m_Stack.back()];
+		m_Stack.pop_back();
+
+		const dBoundingBox &box=n.IsLeaf()?n.Tight:n.Box;
+		bool inside=true;
+		for (int p=0; p<numplanes && inside; p++)
+		{
+			inside=OnPositiveSide(box,planes[p]);
+		}
+
+		if (inside)
+		{
+			if (n.IsLeaf())
+			{
+				result.push_back(n.Data);
+			}
+			else
+			{
+				m_Stack.push_back(n.Left);
+				m_Stack.push_back(n.Right);
+			}
+		}
+	}
+}
+
+void AABBTree::Intersect(const dVector &start, const dVector &end, vector<pair<float,void*> > &result) const
+{
+	if (m_Root==-1) return;
+	m_Stack.clear();
+	m_Stack.push_back(m_Root);
+	float t;
+	while (!m_Stack.empty())
+	{
+		const TreeNode &n=m_Nodes[m_Stack.back()];
+		m_Stack.pop_back();
+
+		if (n.IsLeaf())
+		{
+			if (IntersectLine(n.Tight,start,end,t)) result.push_back(pair<float,void*>(t,n.Data));
+		}
+		else if (IntersectLine(n.Box,start,end,t))
+		{
+			m_Stack.push_back(n.Left);
+			m_Stack.push_back(n.Right);
+		}
+	}
+}
+
+bool AABBTree::IntersectLine(const dBoundingBox &box, const dVector &start, const dVector &end, float &t)
+{
+	// the slab test, clipping the line against each axis in turn
+	float tmin=0,tmax=1;
+	const float s[3]={start.x,start.y,start.z};
+	const float d[3]={end.x-start.x,end.y-start.y,end.z-start.z};
+	const float bmin[3]={box.min.x,box.min.y,box.min.z};
+	const float bmax[3]={box.max.x,box.max.y,box.max.z};
+
+	for (int a=0; a<3; a++)
+	{
+		if (fabs(d[a])<FLT_EPSILON)
+		{
+			if (s[a]<bmin[a] || s[a]>bmax[a]) return false;
+		}
+		else
+		{
+			float t1=(bmin[a]-s[a])/d[a];
+			float t2=(bmax[a]-s[a])/d[a];
+			if (t1>t2) swap(t1,t2);
+			if (t1>tmin) tmin=t1;
+			if (t2<tmax) tmax=t2;
+			if (tmin>tmax) return false;
+		}
+	}
+
+	t=tmin;
+	return true;
+}
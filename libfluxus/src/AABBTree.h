@@ -0,0 +1,106 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_AABBTREE
+#define N_AABBTREE
+
+#include <vector>
+#include "dada.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// A dynamic bounding volume hierarchy. Boxes can be 
+/// added, removed and moved cheaply, and queries can 
+/// reject whole branches of the tree at once. Leaves
+/// store a slightly bigger box than they are given, 
+/// so small movements don't need the tree changing.
+class AABBTree
+{
+public:
+	AABBTree();
+	~AABBTree() {}
+
+	/// Adds a box, returns the leaf for it
+	int Insert(const dBoundingBox &box, void *data);
+
+	/// Removes a leaf
+	void Remove(int leaf);
+
+	/// Moves a leaf's box
+	void Update(int leaf, const dBoundingBox &box);
+
+	/// Removes everything
+	void Clear();
+
+	///////////////////////////////////////////
+	///@name Queries
+	/// These add the data of the leaves which
+	/// pass to the result vector
+	///@{
+	void Intersect(const dBoundingBox &box, float threshold, vector<void*> &result) const;
+	void Intersect(const dVector &point, float threshold, vector<void*> &result) const;
+
+	/// Boxes at least partly on the positive side of all the planes
+	void Intersect(const dPlane *planes, int numplanes, vector<void*> &result) const;
+
+	/// The line from start to end, returns the parametric 
+	/// distance to where each box is entered, not sorted
+	void Intersect(const dVector &start, const dVector &end, vector<pair<float,void*> > &result) const;
+	///@}
+
+	/// The line/box test used by the line query
+	static bool IntersectLine(const dBoundingBox &box, const dVector &start, 
+		const dVector &end, float &t);
+
+private:
+	class TreeNode
+	{
+	public:
+		bool IsLeaf() const { return Left==-1; }
+
+		dBoundingBox Box;   // fattened for leaves
+		dBoundingBox Tight; // the real leaf box
+		void *Data;
+		int Parent; // or next free
+		int Left;
+		int Right;
+		int Height; // -1 when free
+	};
+
+	int Allocate();
+	void Free(int node);
+	void InsertLeaf(int leaf);
+	void RemoveLeaf(int leaf);
+	int Balance(int node);
+	void Refit(int node);
+
+	static dBoundingBox Combine(const dBoundingBox &a, const dBoundingBox &b);
+	static float Area(const dBoundingBox &box);
+	static bool OnPositiveSide(const dBoundingBox &box, const dPlane &plane);
+
+	vector<TreeNode> m_Nodes;
+	int m_Root;
+	int m_FreeList;
+	mutable vector<int> m_Stack;
+};
+
+}
+
+#endif
@@ -67,6 +67,44 @@ void Camera::DoProjection()
 	#endif
 }
 
+dMatrix Camera::CalculateProjection()
+{
+	if (m_CustomProjection) return m_CustomProjectionMatrix;
+
+	dMatrix p;
+	if (m_Ortho)
+	{
+		// as glOrtho
+		float l=m_Left*m_OrthZoom, r=m_Right*m_OrthZoom;
+		float b=m_Bottom*m_OrthZoom, t=m_Top*m_OrthZoom;
+		p.m[0][0]=2/(r-l);
+		p.m[1][1]=2/(t-b);
+		p.m[2][2]=-2/(m_Back-m_Front);
+		p.m[3][0]=-(r+l)/(r-l);
+		p.m[3][1]=-(t+b)/(t-b);
+		p.m[3][2]=-(m_Back+m_Front)/(m_Back-m_Front);
+	}
+	else
+	{
+		// as glFrustum
+		p.m[0][0]=2*m_Front/(m_Right-m_Left);
+		p.m[1][1]=2*m_Front/(m_Top-m_Bottom);
+		p.m[2][0]=(m_Right+m_Left)/(m_Right-m_Left);
+		p.m[2][1]=(m_Top+m_Bottom)/(m_Top-m_Bottom);
+		p.m[2][2]=-(m_Back+m_Front)/(m_Back-m_Front);
+		p.m[2][3]=-1;
+		p.m[3][2]=-2*m_Back*m_Front/(m_Back-m_Front);
+		p.m[3][3]=0;
+	}
+	return p;
+}
+
+dMatrix Camera::GetViewTransform()
+{
+	if (m_CameraAttached) return m_Transform*m_LockedMatrix;
+	return m_Transform;
+}
+
 void Camera::DoCamera(Renderer * renderer)
 {
 	glMultMatrixf(m_Transform.arr());
@@ -55,6 +55,11 @@ public:
 	void SetMatrix(const dMatrix &m)         { m_Transform=m; }
 	dMatrix *GetLockedMatrix()               { return &m_LockedMatrix; }
 	dMatrix GetProjection();
+	/// The projection matrix DoProjection will use,
+	/// without needing to ask gl
+	dMatrix CalculateProjection();
+	/// The camera's transform, including any locking
+	dMatrix GetViewTransform();
 	void SetProjection(const dMatrix &m);
 	float GetTop() { return m_Top; }
 	float GetLeft() { return m_Left; }
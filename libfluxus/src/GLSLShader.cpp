@@ -17,8 +17,10 @@
 #include <stdio.h>
 #include <iostream>
 #include <assert.h>
+#include <algorithm>
 
 #include "GLSLShader.h"
+#include "StateCache.h"
 #include "Trace.h"
 #include "SearchPaths.h"
 #include "DebugGL.h"
@@ -29,29 +31,35 @@ using namespace Fluxus;
 bool GLSLShader::m_Enabled(false);
 
 GLSLShaderPair::GLSLShaderPair(bool load, const string &vertex, const string &fragment) :
+m_Loaded(true),
+m_Compiled(false),
 m_VertexShader(0),
 m_FragmentShader(0)
 {
 	if (load)
 	{
-		if (!Load(vertex, fragment))
+		if (!vertex.empty()) m_VertexName = SearchPaths::Get()->GetFullPath(vertex);
+		if (!fragment.empty()) m_FragmentName = SearchPaths::Get()->GetFullPath(fragment);
+		if (!LoadSource(m_VertexName, m_VertexSource) || !LoadSource(m_FragmentName, m_FragmentSource))
 		{
 			Trace::Stream<<"Problem loading shaderpair ["<<vertex<<", "<<fragment<<"]"<<endl;
+			m_Loaded = false;
 		}
 	}
 	else
 	{
-		if (!Make(vertex, fragment))
-		{
-			Trace::Stream<<"Problem making shaderpair"<<endl;
-		}
+		m_VertexName = "Inline vertex shader source";
+		m_FragmentName = "Inline fragment shader source";
+		m_VertexSource = vertex;
+		m_FragmentSource = fragment;
 	}
 }
 
 GLSLShaderPair::~GLSLShaderPair()
 {
 	#ifdef GLSL
-	if (!GLSLShader::m_Enabled)
+	// programs they're attached to keep them until they're deleted too
+	if (GLSLShader::m_Enabled)
 	{
 		if (m_VertexShader!=0) glDeleteShader(m_VertexShader);
 		if (m_FragmentShader!=0) glDeleteShader(m_FragmentShader);
@@ -59,112 +67,68 @@ GLSLShaderPair::~GLSLShaderPair()
 	#endif
 }
 
-bool GLSLShaderPair::Make(const string &vertexsource, const string &fragmentsource)
+bool GLSLShaderPair::Compile()
 {
 	#ifdef GLSL
 	if (!GLSLShader::m_Enabled) return true;
+	if (!m_Loaded) return false;
+	if (m_Compiled) return true;
+	m_Compiled = true;
 
-	if (vertexsource.empty())
+	if (!m_VertexSource.empty())
 	{
-		m_VertexShader = 0;
-	}
-	else
-	{
-		m_VertexShader = MakeShader("Inline vertex shader source",vertexsource,GL_VERTEX_SHADER);
-		if (m_VertexShader==0) return false;
+		m_VertexShader = MakeShader(m_VertexName,m_VertexSource,GL_VERTEX_SHADER);
 	}
 
-	if (fragmentsource.empty())
+	if (!m_FragmentSource.empty())
 	{
-		m_FragmentShader = 0;
-	}
-	else
-	{
-		m_FragmentShader = MakeShader("Inline fragment shader source",fragmentsource,GL_FRAGMENT_SHADER);
-		if (m_FragmentShader==0) return false;
+		m_FragmentShader = MakeShader(m_FragmentName,m_FragmentSource,GL_FRAGMENT_SHADER);
 	}
 
-	if (!m_VertexShader && !m_FragmentShader)
+	if (m_VertexSource.empty() && m_FragmentSource.empty())
 	{
 		Trace::Stream << "No shaders specifed" << endl;
 		return false;
 	}
-	#endif
-	return true;
-}
-
-bool GLSLShaderPair::Load(const string &vertexfilename, const string &fragmentfilename)
-{
-	#ifdef GLSL
-	if (!GLSLShader::m_Enabled) return true;
-
-	if (vertexfilename.empty())
-	{
-		m_VertexShader = 0;
-	}
-	else
-	{
-		m_VertexShader = LoadShader(SearchPaths::Get()->GetFullPath(vertexfilename),GL_VERTEX_SHADER);
-		if (m_VertexShader == 0) return false;
-	}
-
-	if (fragmentfilename.empty())
-	{
-		m_FragmentShader = 0;
-	}
-	else
-	{
-		m_FragmentShader = LoadShader(SearchPaths::Get()->GetFullPath(fragmentfilename),GL_FRAGMENT_SHADER);
-		if (m_FragmentShader == 0) return false;
-	}
 
-	if (!m_VertexShader && !m_FragmentShader)
+	if ((!m_VertexSource.empty() && m_VertexShader==0) || 
+		(!m_FragmentSource.empty() && m_FragmentShader==0))
 	{
-		Trace::Stream << "No shaders specifed" << endl;
+		Trace::Stream<<"Problem making shaderpair"<<endl;
 		return false;
 	}
 	#endif
 	return true;
 }
 
-
-unsigned int GLSLShaderPair::LoadShader(string filename, unsigned int type)
+bool GLSLShaderPair::LoadSource(const string &filename, string &source)
 {
 	#ifdef GLSL
-	if (!GLSLShader::m_Enabled) return 0;
+	if (!GLSLShader::m_Enabled || filename.empty()) return true;
 	FILE* file = fopen(filename.c_str(), "r");
 	if (!file)
 	{
 		Trace::Stream<<"Couldn't open shader ["<<filename<<"]"<<endl;
-		return 0;
+		return false;
 	}
 
 	fseek(file, 0, SEEK_END);
 	unsigned int size = ftell(file);
 	fseek(file, 0, SEEK_SET);
 
-	char* code = new char[size+1];
-	code[size]='\0';
-
-	if (fread(code,1,size,file)!=size)
+	source.resize(size);
+	if (size>0 && fread(&source[0],1,size,file)!=size)
 	{
 		Trace::Stream<<"Error reading shader ["<<filename<<"]"<<endl;
-		delete[] code;
-		fclose(file);
-		return 0;
-	}
-	else
-	{
-		unsigned int shader = MakeShader(filename,code,type);
-		delete[] code;
+		source.clear();
 		fclose(file);
-		return shader;
+		return false;
 	}
+	fclose(file);
 	#endif
-	return 0;
+	return true;
 }
 
-
 unsigned int GLSLShaderPair::MakeShader(const string &filename, const string &source, unsigned int type)
 {
 	#ifdef GLSL
@@ -199,18 +163,22 @@ unsigned int GLSLShaderPair::MakeShader(const string &filename, const string &so
 
 /////////////////////////////////////////
 
-GLSLShader::GLSLShader(const GLSLShaderPair &pair) :
+GLSLProgram::GLSLProgram(const GLSLShaderPair &pair, bool retrievable) :
 m_Program(0),
-m_RefCount(1)
+m_RefCount(1),
+m_IsValid(false),
+m_LastApplied(NULL)
 {
 	#ifdef GLSL
-	if (!m_Enabled) return;
+	if (!GLSLShader::m_Enabled) return;
 
 	m_Program = glCreateProgram();
 	if (pair.GetVertexShader())
 		glAttachShader(m_Program, pair.GetVertexShader());
 	if (pair.GetFragmentShader())
 		glAttachShader(m_Program, pair.GetFragmentShader());
+	if (retrievable)
+		glProgramParameteri(m_Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(m_Program);
 
 	GLint status = GL_FALSE;
@@ -221,7 +189,68 @@ m_RefCount(1)
 		glGetProgramInfoLog(m_Program, 1024, NULL, log);
 		Trace::Stream << log << endl;
 	}
+	else
+	{
+		Introspect();
+	}
+
+	Validate();
+	#endif
+}
 
+GLSLProgram::GLSLProgram(unsigned int format, const vector<char> &binary) :
+m_Program(0),
+m_RefCount(1),
+m_IsValid(false),
+m_LastApplied(NULL)
+{
+	#ifdef GLSL
+	if (!GLSLShader::m_Enabled || binary.empty()) return;
+
+	m_Program = glCreateProgram();
+	glProgramBinary(m_Program, format, &binary[0], binary.size());
+
+	// drivers throw away binaries from other versions, 
+	// which isn't worth complaining about
+	GLint status = GL_FALSE;
+	glGetProgramiv(m_Program, GL_LINK_STATUS, &status);
+	if (status == GL_TRUE)
+	{
+		Introspect();
+		Validate();
+	}
+	#endif
+}
+
+GLSLProgram::~GLSLProgram()
+{
+	#ifdef GLSL
+	if (!GLSLShader::m_Enabled) return;
+	glDeleteProgram(m_Program);
+	#endif
+}
+
+bool GLSLProgram::GetBinary(unsigned int &format, vector<char> &binary) const
+{
+	#ifdef GLSL
+	if (!GLSLShader::m_Enabled || !m_IsValid) return false;
+	GLint length = 0;
+	glGetProgramiv(m_Program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length<=0) return false;
+	binary.resize(length);
+	GLenum binaryformat = 0;
+	glGetProgramBinary(m_Program, length, NULL, &binaryformat, &binary[0]);
+	format = binaryformat;
+	return true;
+	#else
+	return false;
+	#endif
+}
+
+void GLSLProgram::Validate()
+{
+	#ifdef GLSL
+	GLint status = GL_FALSE;
 	glValidateProgram(m_Program);
 	glGetProgramiv(m_Program, GL_VALIDATE_STATUS, &status);
 	if (status != GL_TRUE)
@@ -237,14 +266,143 @@ m_RefCount(1)
 	#endif
 }
 
-GLSLShader::~GLSLShader()
+void GLSLProgram::Introspect()
 {
 	#ifdef GLSL
-	if (!m_Enabled) return;
-	glDeleteProgram(m_Program);
+	char name[256];
+	GLint count = 0;
+	glGetProgramiv(m_Program, GL_ACTIVE_UNIFORMS, &count);
+	for (int i=0; i<count; i++)
+	{
+		Variable v;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(m_Program, i, sizeof(name), NULL, &size, &type, name);
+		v.Name = name;
+		// arrays are named after their first element
+		if (v.Name.size()>3 && v.Name.compare(v.Name.size()-3,3,"[0]")==0)
+		{
+			v.Name.erase(v.Name.size()-3);
+		}
+		v.Location = glGetUniformLocation(m_Program, v.Name.c_str());
+		v.Type = type;
+		v.Size = size;
+		// builtins like gl_ModelViewMatrix have no location
+		if (v.Location<0) continue;
+		m_Uniforms.Add(v);
+
+		// the elements after the first get their own entries, as 
+		// their locations needn't follow on from the array's
+		for (int e=1; e<size; e++)
+		{
+			char element[16];
+			snprintf(element,16,"[%d]",e);
+			Variable ev = v;
+			ev.Name = v.Name+element;
+			ev.Location = glGetUniformLocation(m_Program, ev.Name.c_str());
+			ev.Size = size-e;
+			if (ev.Location>=0) m_Uniforms.Add(ev);
+		}
+	}
+	m_Changed.assign(m_Uniforms.Size(),false);
+
+	count = 0;
+	glGetProgramiv(m_Program, GL_ACTIVE_ATTRIBUTES, &count);
+	for (int i=0; i<count; i++)
+	{
+		Variable v;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveAttrib(m_Program, i, sizeof(name), NULL, &size, &type, name);
+		v.Name = name;
+		v.Location = glGetAttribLocation(m_Program, name);
+		v.Type = type;
+		v.Size = size;
+		if (v.Location>=0) m_Attribs.Add(v);
+	}
+	#endif
+}
+
+int GLSLProgram::FindUniform(const string &name) const
+{
+	if (name.size()>3 && name.compare(name.size()-3,3,"[0]")==0)
+	{
+		return m_Uniforms.Find(name.substr(0,name.size()-3));
+	}
+	return m_Uniforms.Find(name);
+}
+
+int GLSLProgram::GetAttribLocation(const string &name) const
+{
+	int i = m_Attribs.Find(name);
+	if (i<0) return -1;
+	return m_Attribs[i].Location;
+}
+
+void GLSLProgram::ResetUniform(unsigned int index)
+{
+	#ifdef GLSL
+	const Variable &v = m_Uniforms[index];
+	// big enough for the largest type, a mat4
+	vector<float> zeros(v.Size*16,0.0f);
+	vector<int> izeros(v.Size*4,0);
+	switch (v.Type)
+	{
+		case GL_FLOAT: glUniform1fv(v.Location,v.Size,&zeros[0]); break;
+		case GL_FLOAT_VEC2: glUniform2fv(v.Location,v.Size,&zeros[0]); break;
+		case GL_FLOAT_VEC3: glUniform3fv(v.Location,v.Size,&zeros[0]); break;
+		case GL_FLOAT_VEC4: glUniform4fv(v.Location,v.Size,&zeros[0]); break;
+		case GL_FLOAT_MAT2: glUniformMatrix2fv(v.Location,v.Size,GL_FALSE,&zeros[0]); break;
+		case GL_FLOAT_MAT3: glUniformMatrix3fv(v.Location,v.Size,GL_FALSE,&zeros[0]); break;
+		case GL_FLOAT_MAT4: glUniformMatrix4fv(v.Location,v.Size,GL_FALSE,&zeros[0]); break;
+		case GL_INT_VEC2: case GL_BOOL_VEC2: glUniform2iv(v.Location,v.Size,&izeros[0]); break;
+		case GL_INT_VEC3: case GL_BOOL_VEC3: glUniform3iv(v.Location,v.Size,&izeros[0]); break;
+		case GL_INT_VEC4: case GL_BOOL_VEC4: glUniform4iv(v.Location,v.Size,&izeros[0]); break;
+		// ints, bools and samplers
+		default: glUniform1iv(v.Location,v.Size,&izeros[0]); break;
+	}
 	#endif
 }
 
+/////////////////////////////////////////
+
+void GLSLProgram::VariableTable::Add(const Variable &v)
+{
+	m_Index.insert(make_pair(v.Name,(int)m_Variables.size()));
+	m_Variables.push_back(v);
+}
+
+int GLSLProgram::VariableTable::Find(const string &name) const
+{
+	unordered_map<string,int>::const_iterator i = m_Index.find(name);
+	if (i==m_Index.end()) return -1;
+	return i->second;
+}
+
+/////////////////////////////////////////
+
+GLSLShader::GLSLShader(GLSLProgram *program) :
+m_Program(program),
+m_RefCount(1),
+m_Dirty(false)
+{
+	if (m_Program!=NULL)
+	{
+		m_Program->IncRef();
+		m_Uniforms.resize(m_Program->GetNumUniforms());
+	}
+}
+
+GLSLShader::~GLSLShader()
+{
+	if (m_Program!=NULL)
+	{
+		// a new shader could end up at the same address
+		if (m_Program->m_LastApplied==this) m_Program->m_LastApplied=NULL;
+		if (m_Program->DecRef()) delete m_Program;
+	}
+}
+
 void GLSLShader::Init()
 {
 	#ifdef GLSL
@@ -255,8 +413,20 @@ void GLSLShader::Init()
 void GLSLShader::Apply()
 {
 	#ifdef GLSL
-	if (!m_Enabled) return;
-	glUseProgram(m_Program);
+	if (!m_Enabled || m_Program==NULL) return;
+	StateCache::UseProgram(m_Program->GetID());
+
+	// the program has another shader's uniforms
+	if (m_Program->m_LastApplied!=this)
+	{
+		SendUniforms(true);
+		m_Program->m_LastApplied=this;
+	}
+	else if (m_Dirty)
+	{
+		SendUniforms(false);
+	}
+	m_Dirty=false;
 	#endif
 }
 
@@ -264,135 +434,178 @@ void GLSLShader::Unapply()
 {
 	#ifdef GLSL
 	if (!m_Enabled) return;
-	glUseProgram(0);
+	StateCache::UseProgram(0);
 	#endif
 }
 
-void GLSLShader::SetInt(const string &name, int s)
+int GLSLShader::GetUniformHandle(const string &name) const
 {
-	#ifdef GLSL
-	if (!m_Enabled) return;
-	GLuint param = glGetUniformLocation(m_Program, name.c_str());
-	glUniform1i(param,s);
-	#endif
+	if (m_Program==NULL) return -1;
+	return m_Program->FindUniform(name);
 }
 
-void GLSLShader::SetFloat(const string &name, float s)
+string GLSLShader::GetUniformName(int handle) const
+{
+	if (handle<0 || handle>=(int)m_Uniforms.size()) return "";
+	return m_Program->m_Uniforms[handle].Name;
+}
+
+void GLSLShader::StoreInts(int handle, UniformType type, const int *s, unsigned int size)
+{
+	if (handle<0 || handle>=(int)m_Uniforms.size() || size==0) return;
+	Uniform &u=m_Uniforms[handle];
+	if (u.Set && u.Type==type && u.Ints.size()==size && equal(s,s+size,u.Ints.begin())) return;
+	u.Type=type;
+	u.Set=true;
+	u.Dirty=true;
+	u.Ints.assign(s,s+size);
+	u.Floats.clear();
+	m_Dirty=true;
+}
+
+void GLSLShader::StoreFloats(int handle, UniformType type, const float *s, unsigned int size)
+{
+	if (handle<0 || handle>=(int)m_Uniforms.size() || size==0) return;
+	Uniform &u=m_Uniforms[handle];
+	if (u.Set && u.Type==type && u.Floats.size()==size && equal(s,s+size,u.Floats.begin())) return;
+	u.Type=type;
+	u.Set=true;
+	u.Dirty=true;
+	u.Floats.assign(s,s+size);
+	u.Ints.clear();
+	m_Dirty=true;
+}
+
+void GLSLShader::SendUniforms(bool all)
 {
 	#ifdef GLSL
-	if (!m_Enabled) return;
-	GLuint param = glGetUniformLocation(m_Program, name.c_str());
-	glUniform1f(param,s);
+	for (unsigned int n=0; n<m_Uniforms.size(); n++)
+	{
+		Uniform *i = &m_Uniforms[n];
+		if (!i->Set)
+		{
+			// don't leave the last shader's value in place
+			if (all && m_Program->m_Changed[n])
+			{
+				m_Program->ResetUniform(n);
+				m_Program->m_Changed[n]=false;
+			}
+			continue;
+		}
+
+		if (all || i->Dirty)
+		{
+			GLint param = m_Program->m_Uniforms[n].Location;
+			switch (i->Type)
+			{
+				case UNIFORM_INT: glUniform1i(param,i->Ints[0]); break;
+				case UNIFORM_FLOAT: glUniform1f(param,i->Floats[0]); break;
+				case UNIFORM_VEC2: glUniform2fv(param,1,&i->Floats[0]); break;
+				case UNIFORM_VEC3: glUniform3fv(param,1,&i->Floats[0]); break;
+				case UNIFORM_VEC4: glUniform4fv(param,1,&i->Floats[0]); break;
+				case UNIFORM_MATRIX: glUniformMatrix4fv(param,1,GL_FALSE,&i->Floats[0]); break;
+				case UNIFORM_INT_ARRAY: glUniform1iv(param,i->Ints.size(),&i->Ints[0]); break;
+				case UNIFORM_FLOAT_ARRAY: glUniform1fv(param,i->Floats.size(),&i->Floats[0]); break;
+				case UNIFORM_VEC4_ARRAY: glUniform4fv(param,i->Floats.size()/4,&i->Floats[0]); break;
+			}
+			i->Dirty=false;
+			m_Program->m_Changed[n]=true;
+		}
+	}
 	#endif
 }
 
-void GLSLShader::SetVector(const string &name, dVector s, int size /* = 4 */)
+void GLSLShader::SetInt(int handle, int s)
 {
-	#ifdef GLSL
-	if (!m_Enabled) return;
+	StoreInts(handle,UNIFORM_INT,&s,1);
+}
 
-	GLuint param = glGetUniformLocation(m_Program, name.c_str());
+void GLSLShader::SetFloat(int handle, float s)
+{
+	StoreFloats(handle,UNIFORM_FLOAT,&s,1);
+}
+
+void GLSLShader::SetVector(int handle, dVector s, int size /* = 4 */)
+{
 	switch (size)
 	{
-		case 2:
-			glUniform2f(param, s.x, s.y);
-			break;
-		case 3:
-			glUniform3f(param, s.x, s.y, s.z);
-			break;
-		case 4:
-			glUniform4f(param, s.x, s.y, s.z, s.w);
-			break;
+		case 2: StoreFloats(handle,UNIFORM_VEC2,s.arr(),2); break;
+		case 3: StoreFloats(handle,UNIFORM_VEC3,s.arr(),3); break;
+		case 4: StoreFloats(handle,UNIFORM_VEC4,s.arr(),4); break;
 		default:
 			assert(false);
 			break;
 	}
-	#endif
 }
 
-void GLSLShader::SetMatrix(const string &name, dMatrix &m)
+void GLSLShader::SetMatrix(int handle, dMatrix &m)
 {
-	#ifdef GLSL
-	if (!m_Enabled) return;
+	StoreFloats(handle,UNIFORM_MATRIX,m.arr(),16);
+}
 
-	GLuint param = glGetUniformLocation(m_Program, name.c_str());
-	glUniformMatrix4fv(param, 1, GL_FALSE, m.arr());
-	#endif
+void GLSLShader::SetColour(int handle, dColour s)
+{
+	StoreFloats(handle,UNIFORM_VEC4,s.arr(),4);
 }
 
-void GLSLShader::SetColour(const string &name, dColour s)
+void GLSLShader::SetIntArray(int handle, const vector<int,FLX_ALLOC(int) > &s)
 {
-	#ifdef GLSL
-	if (!m_Enabled) return;
-	GLuint param = glGetUniformLocation(m_Program, name.c_str());
-	glUniform4f(param,s.r,s.g,s.b,s.a);
-	#endif
+	if (s.empty()) return;
+	StoreInts(handle,UNIFORM_INT_ARRAY,&s[0],s.size());
 }
 
-void GLSLShader::SetIntArray(const string &name, const vector<int,FLX_ALLOC(int) > &s)
+void GLSLShader::SetFloatArray(int handle, const vector<float,FLX_ALLOC(float) > &s)
 {
-	#ifdef GLSL
-	if (!m_Enabled) return;
-	GLuint param = glGetUniformLocation(m_Program, name.c_str());
-	glUniform1iv(param,s.size(),&(*s.begin()));
-	#endif
+	if (s.empty()) return;
+	StoreFloats(handle,UNIFORM_FLOAT_ARRAY,&s[0],s.size());
 }
 
-void GLSLShader::SetFloatArray(const string &name, const vector<float,FLX_ALLOC(float) > &s)
+void GLSLShader::SetVectorArray(int handle, const vector<dVector,FLX_ALLOC(dVector) > &s)
 {
-	#ifdef GLSL
-	if (!m_Enabled) return;
-	GLuint param = glGetUniformLocation(m_Program, name.c_str());
-	glUniform1fv(param,s.size(),&(*s.begin()));
-	#endif
+	if (s.empty()) return;
+	// dVectors are four floats, so they can go straight in
+	StoreFloats(handle,UNIFORM_VEC4_ARRAY,&s[0].x,s.size()*4);
 }
 
-void GLSLShader::SetVectorArray(const string &name, const vector<dVector,FLX_ALLOC(dVector) > &s)
+void GLSLShader::SetColourArray(int handle, const vector<dColour,FLX_ALLOC(dColour) > &s)
 {
-	#ifdef GLSL
-	if (!m_Enabled) return;
-	GLuint param = glGetUniformLocation(m_Program, name.c_str());
-	glUniform4fv(param,s.size(),&s.begin()->x);
-	#endif
+	if (s.empty()) return;
+	StoreFloats(handle,UNIFORM_VEC4_ARRAY,&s[0].r,s.size()*4);
 }
 
-void GLSLShader::SetColourArray(const string &name, const vector<dColour,FLX_ALLOC(dColour) > &s)
+void GLSLShader::SetAttrib(const string &name, int size, const float *data)
 {
 	#ifdef GLSL
-	if (!m_Enabled) return;
-	GLuint param = glGetUniformLocation(m_Program, name.c_str());
-	glUniform4fv(param,s.size(),&s.begin()->r);
+	if (!m_Enabled || m_Program==NULL) return;
+	// most pdata won't be used by the shader
+	int attrib = m_Program->GetAttribLocation(name);
+	if (attrib<0) return;
+	glEnableVertexAttribArray(attrib);
+	glVertexAttribPointer(attrib,size,GL_FLOAT,false,0,data);
 	#endif
 }
 
 void GLSLShader::SetFloatAttrib(const string &name, const vector<float,FLX_ALLOC(float) > &s)
 {
-	#ifdef GLSL
-	if (!m_Enabled) return;
-	GLuint attrib = glGetAttribLocation(m_Program, name.c_str());
-	glEnableVertexAttribArray(attrib);
-	glVertexAttribPointer(attrib,1,GL_FLOAT,false,0,&(*s.begin()));
-	#endif
+	SetAttrib(name,1,&(*s.begin()));
 }
 
 void GLSLShader::SetVectorAttrib(const string &name, const vector<dVector,FLX_ALLOC(dVector) > &s)
 {
-	#ifdef GLSL
-	if (!m_Enabled) return;
-	GLuint attrib = glGetAttribLocation(m_Program, name.c_str());
-	glEnableVertexAttribArray(attrib);
-	glVertexAttribPointer(attrib,4,GL_FLOAT,false,0,&(*s.begin()));
-	#endif
+	SetAttrib(name,4,&s.begin()->x);
 }
 
 void GLSLShader::SetColourAttrib(const string &name, const vector<dColour,FLX_ALLOC(dColour) > &s)
+{
+	SetAttrib(name,4,&s.begin()->r);
+}
+
+int GLSLShader::GetAttribLocation(const string &name)
 {
 	#ifdef GLSL
-	if (!m_Enabled) return;
-	GLuint attrib = glGetAttribLocation(m_Program, name.c_str());
-	glEnableVertexAttribArray(attrib);
-	glVertexAttribPointer(attrib,4,GL_FLOAT,false,0,&(*s.begin()));
+	if (!m_Enabled || m_Program==NULL) return -1;
+	return m_Program->GetAttribLocation(name);
+	#else
+	return -1;
 	#endif
 }
-
-
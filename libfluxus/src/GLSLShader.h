@@ -21,6 +21,7 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include "dada.h"
 #include "Allocator.h"
 
@@ -35,33 +36,135 @@ namespace Fluxus
 class GLSLShaderPair
 {
 public:
-	/// If load is true, the constructor attempts to load the shader pair immediately
-	/// if it's false, the strings are treated as the shader source.
+	/// If load is true, the strings are the files to load the shader pair from, 
+	/// if it's false, the strings are treated as the shader source. The shaders
+	/// aren't compiled until Compile is called, as a program binary saved from
+	/// the same source might be used instead
 	GLSLShaderPair(bool load, const string &vertex, const string &fragment);
 	~GLSLShaderPair();
 
+	/// Compiles the shaders, if they haven't been already
+	bool Compile();
+
+	const string &GetVertexSource() const { return m_VertexSource; }
+	const string &GetFragmentSource() const { return m_FragmentSource; }
 	unsigned int GetVertexShader() const { return m_VertexShader; }
 	unsigned int GetFragmentShader() const { return m_FragmentShader; }
 
 private:
-	/// Returns a handle to a compiled and linked GLSL program
-	bool Load(const string &vertexfilename, const string &fragmentfilename);
-	bool Make(const string &vertexsource, const string &fragmentsource);
-	unsigned int LoadShader(string filename, unsigned int type);
+	bool LoadSource(const string &filename, string &source);
 	unsigned int MakeShader(const string &filename, const string &source, unsigned int type);
 
+	string m_VertexName;
+	string m_FragmentName;
+	string m_VertexSource;
+	string m_FragmentSource;
+	bool m_Loaded;
+	bool m_Compiled;
 	unsigned int m_VertexShader;
 	unsigned int m_FragmentShader;
 };
 
+class GLSLShader;
+
+//////////////////////////////////////////////////////
+/// A linked GLSL program. These are shared between all
+/// the shaders made from the same pair by the ShaderCache,
+/// so assigning a shader to lots of objects only links 
+/// it once
+class GLSLProgram
+{
+public:
+	/// Links a compiled pair. If retrievable is set, the driver
+	/// is asked to keep the binary for GetBinary
+	GLSLProgram(const GLSLShaderPair &pair, bool retrievable=false);
+	/// Uses a binary from GetBinary, which may have been saved by an 
+	/// earlier run. The program isn't valid if the driver won't take it
+	GLSLProgram(unsigned int format, const vector<char> &binary);
+	~GLSLProgram();
+
+	/// Gets the linked program in the driver's own format, false
+	/// if it's not supported
+	bool GetBinary(unsigned int &format, vector<char> &binary) const;
+
+	void IncRef() { m_RefCount++; }
+	bool DecRef() { m_RefCount--; return (m_RefCount==0); }
+	unsigned int GetRefCount() const { return m_RefCount; }
+
+	unsigned int GetID() const { return m_Program; }
+	bool IsValid() const { return m_IsValid; }
+
+	/// Returns the index of an active uniform in the program, 
+	/// which is what the shader's uniform handles are, or -1 if 
+	/// the program doesn't use it. Arrays are found by their name 
+	/// with or without the [0], and name[i] is the array from its
+	/// i'th element on, which is sent after the whole array
+	int FindUniform(const string &name) const;
+	unsigned int GetNumUniforms() const { return m_Uniforms.Size(); }
+	/// Returns -1 if the program has no active attribute of this name
+	int GetAttribLocation(const string &name) const;
+
+private:
+	friend class GLSLShader;
+
+	/// An active uniform or attribute, as found after linking
+	struct Variable
+	{
+		string Name;
+		int Location;
+		unsigned int Type;
+		int Size;
+	};
+
+	/// Variables hashed by their names, so looking them up 
+	/// every frame doesn't need a trip to the driver. They 
+	/// are kept in the order they were added, as the index 
+	/// is the handle
+	class VariableTable
+	{
+	public:
+		void Add(const Variable &v);
+		int Find(const string &name) const;
+		unsigned int Size() const { return m_Variables.size(); }
+		const Variable &operator[](unsigned int i) const { return m_Variables[i]; }
+
+	private:
+		vector<Variable> m_Variables;
+		unordered_map<string,int> m_Index;
+	};
+
+	/// Checks a linked program is ready to use
+	void Validate();
+	/// Reads the active uniforms and attributes into the tables
+	void Introspect();
+	/// Sets a uniform back to zero, when the next shader to 
+	/// use the program hasn't set it
+	void ResetUniform(unsigned int index);
+
+	unsigned int m_Program;
+	unsigned int m_RefCount;
+	bool m_IsValid;
+
+	VariableTable m_Uniforms;
+	VariableTable m_Attribs;
+	/// Which uniforms a shader has sent values for
+	vector<bool> m_Changed;
+
+	/// The shader which last sent its uniforms to the program, so 
+	/// drawing the same one again only needs to send what's changed
+	const GLSLShader *m_LastApplied;
+};
+
 //////////////////////////////////////////////////////
-/// A hardware shader for use on an object
+/// A hardware shader for use on an object. Each object
+/// has its own uniform values, which are kept here and
+/// sent to the shared program when it's applied
 class GLSLShader
 {
 public:
-	/// The constructor attempts to load the shader pair immediately
-	GLSLShader() : m_RefCount(1), m_IsValid(false) {}
-	GLSLShader(const GLSLShaderPair &pair);
+	GLSLShader() : m_Program(NULL), m_RefCount(1), m_Dirty(false) {}
+	/// Uses the program, taking a reference to it
+	GLSLShader(GLSLProgram *program);
 	~GLSLShader();
 
 	// Temp fix, maybe
@@ -74,21 +177,41 @@ public:
 	static void Init();
 	void Apply();
 	static void Unapply();
-	bool IsValid() { return m_IsValid; }
+	bool IsValid() { return m_Program!=NULL && m_Program->IsValid(); }
+	/// The gl program, shared with other shaders from the same pair
+	unsigned int GetProgram() const { return m_Program!=NULL?m_Program->GetID():0; }
 	///@}
 
 	/////////////////////////////////////////////
 	///@name Uniform variables
+	/// These are stored, and sent when the shader is next applied - 
+	/// but only if they've changed. A handle is looked up once from
+	/// the name, and is the same for all the shaders made from the
+	/// same pair. Setting an invalid handle (-1) does nothing
 	///@{
-	void SetInt(const string &name, int s);
-	void SetFloat(const string &name, float s);
-	void SetVector(const string &name, dVector s, int size = 4);
-	void SetColour(const string &name, dColour s);
-	void SetIntArray(const string &name, const vector<int,FLX_ALLOC(int) > &s);
-	void SetFloatArray(const string &name, const vector<float,FLX_ALLOC(float) > &s);
-	void SetMatrix(const string &name, dMatrix &m);
-	void SetVectorArray(const string &name, const vector<dVector,FLX_ALLOC(dVector) > &s);
-	void SetColourArray(const string &name, const vector<dColour,FLX_ALLOC(dColour) > &s);
+	/// Returns -1 if the shader has no active uniform of this name
+	int GetUniformHandle(const string &name) const;
+	string GetUniformName(int handle) const;
+
+	void SetInt(int handle, int s);
+	void SetFloat(int handle, float s);
+	void SetVector(int handle, dVector s, int size = 4);
+	void SetColour(int handle, dColour s);
+	void SetIntArray(int handle, const vector<int,FLX_ALLOC(int) > &s);
+	void SetFloatArray(int handle, const vector<float,FLX_ALLOC(float) > &s);
+	void SetMatrix(int handle, dMatrix &m);
+	void SetVectorArray(int handle, const vector<dVector,FLX_ALLOC(dVector) > &s);
+	void SetColourArray(int handle, const vector<dColour,FLX_ALLOC(dColour) > &s);
+
+	void SetInt(const string &name, int s) { SetInt(GetUniformHandle(name),s); }
+	void SetFloat(const string &name, float s) { SetFloat(GetUniformHandle(name),s); }
+	void SetVector(const string &name, dVector s, int size = 4) { SetVector(GetUniformHandle(name),s,size); }
+	void SetColour(const string &name, dColour s) { SetColour(GetUniformHandle(name),s); }
+	void SetIntArray(const string &name, const vector<int,FLX_ALLOC(int) > &s) { SetIntArray(GetUniformHandle(name),s); }
+	void SetFloatArray(const string &name, const vector<float,FLX_ALLOC(float) > &s) { SetFloatArray(GetUniformHandle(name),s); }
+	void SetMatrix(const string &name, dMatrix &m) { SetMatrix(GetUniformHandle(name),m); }
+	void SetVectorArray(const string &name, const vector<dVector,FLX_ALLOC(dVector) > &s) { SetVectorArray(GetUniformHandle(name),s); }
+	void SetColourArray(const string &name, const vector<dColour,FLX_ALLOC(dColour) > &s) { SetColourArray(GetUniformHandle(name),s); }
 	///@}
 
 	/////////////////////////////////////////////
@@ -97,14 +220,40 @@ public:
 	void SetFloatAttrib(const string &name, const vector<float,FLX_ALLOC(float) > &s);
 	void SetVectorAttrib(const string &name, const vector<dVector,FLX_ALLOC(dVector) > &s);
 	void SetColourAttrib(const string &name, const vector<dColour,FLX_ALLOC(dColour) > &s);
+	/// Returns -1 if the shader has no attribute of this name
+	int GetAttribLocation(const string &name);
 	///@}
 
 	static bool m_Enabled;
 
 private:
-	unsigned int m_Program;
+	enum UniformType {UNIFORM_INT, UNIFORM_FLOAT, UNIFORM_VEC2, UNIFORM_VEC3, UNIFORM_VEC4,
+		UNIFORM_MATRIX, UNIFORM_INT_ARRAY, UNIFORM_FLOAT_ARRAY, UNIFORM_VEC4_ARRAY};
+
+	struct Uniform
+	{
+		Uniform() : Type(UNIFORM_INT), Set(false), Dirty(false) {}
+		UniformType Type;
+		bool Set;
+		/// Changed since it was last sent
+		bool Dirty;
+		vector<int> Ints;
+		vector<float> Floats;
+	};
+
+	/// Store a value, marking it dirty if it's different to the last one
+	void StoreInts(int handle, UniformType type, const int *s, unsigned int size);
+	void StoreFloats(int handle, UniformType type, const float *s, unsigned int size);
+	/// Sends the dirty uniforms, or all of them if another
+	/// shader's have been sent to the program since
+	void SendUniforms(bool all);
+	void SetAttrib(const string &name, int size, const float *data);
+
+	GLSLProgram *m_Program;
 	unsigned int m_RefCount;
-	bool m_IsValid;
+	/// Indexed by handle
+	vector<Uniform> m_Uniforms;
+	bool m_Dirty;
 };
 
 }
@@ -89,7 +89,7 @@ void ImagePrimitive::Render()
 	// override the state texture and disable depth test
 	glEnable(GL_TEXTURE_2D);
 	// FIXME: set texture states
-	glBindTexture(GL_TEXTURE_2D, m_Texture);
+	glBindTexture(GL_TEXTURE_2D, TexturePainter::Get()->GetBindID(m_Texture));
 
 	glDisable(GL_LIGHTING);
 	glDisable(GL_DEPTH_TEST);
@@ -113,6 +113,7 @@ void ImagePrimitive::Render()
 
 	glEnable(GL_LIGHTING);
 	glDisable(GL_TEXTURE_2D);
+	TexturePainter::Get()->InvalidateCurrent();
     if (!(m_State.Hints & HINT_IGNORE_DEPTH))
 		glEnable(GL_DEPTH_TEST);
 	if (m_State.Cull)
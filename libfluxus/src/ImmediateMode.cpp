@@ -19,59 +19,108 @@
 
 using namespace Fluxus;
 
-ImmediateMode::ImmediateMode()
+ImmediateMode::ImmediateMode() :
+m_NumItems(0)
 {
 }
 
 ImmediateMode::~ImmediateMode()
 {
+	Clear();
+	for(vector<IMItem*>::iterator i=m_IMRecord.begin(); i!=m_IMRecord.end(); ++i)
+	{
+		delete *i;
+	}
 }
 
 void ImmediateMode::Add(Primitive *p, State *s, bool del /* = false */)
 {
 	assert(p!=NULL);
 	assert(s!=NULL);
-	IMItem *newitem = new IMItem;
+
+	dColour colour=s->Colour;
+	if (s->Opacity != 1.0f) colour.a=s->Opacity;
+
+	// can we add this as another instance of the last item?
+	if (m_NumItems>0 && !del && !(s->Hints & HINT_CAST_SHADOW))
+	{
+		IMItem *last=m_IMRecord[m_NumItems-1];
+		if (last->m_Primitive==p && !last->m_DelPrim && last->m_State.Batchable(*s))
+		{
+			if (last->m_Transforms.empty())
+			{
+				dColour first=last->m_State.Colour;
+				if (last->m_State.Opacity != 1.0f) first.a=last->m_State.Opacity;
+				last->m_Transforms.push_back(last->m_State.Transform);
+				last->m_Colours.push_back(first);
+			}
+			last->m_Transforms.push_back(s->Transform);
+			last->m_Colours.push_back(colour);
+			return;
+		}
+	}
+
+	if (m_NumItems==m_IMRecord.size())
+	{
+		m_IMRecord.push_back(new IMItem);
+	}
+
+	IMItem *newitem = m_IMRecord[m_NumItems++];
 	newitem->m_State = *s;
 	newitem->m_Primitive = p;
 	newitem->m_DelPrim = del;
-	m_IMRecord.push_back(newitem);
 }
 
 void ImmediateMode::Render(unsigned int CamIndex, ShadowVolumeGen *shadowgen)
 {
 	///\todo: not using camera visibility in immediate mode...
-	for(vector<IMItem*>::iterator i=m_IMRecord.begin(); i!=m_IMRecord.end(); ++i)
+	for (unsigned int n=0; n<m_NumItems; n++)
 	{
+		IMItem *item=m_IMRecord[n];
+		bool instanced=!item->m_Transforms.empty();
+
+		// the instances carry their own transforms
+		if (instanced) item->m_State.Transform.init();
+
 		glPushMatrix();
-		(*i)->m_State.Apply();
+		item->m_State.Apply();
 		// need to set the state to the primitive to update the parts of the state the
 		// render call acts on. need to look at this.
-		assert((*i)->m_Primitive!=NULL);
-	    (*i)->m_Primitive->SetState(&(*i)->m_State);
-		(*i)->m_Primitive->Prerender();
-		(*i)->m_Primitive->Render();
+		assert(item->m_Primitive!=NULL);
+	    item->m_Primitive->SetState(&item->m_State);
+		item->m_Primitive->Prerender();
+
+		if (instanced)
+		{
+			item->m_Primitive->RenderInstances(&item->m_Transforms[0],
+				&item->m_Colours[0],item->m_Transforms.size());
+		}
+		else
+		{
+			item->m_Primitive->Render();
+		}
 
-		if (shadowgen && (*i)->m_Primitive->GetState()->Hints & HINT_CAST_SHADOW)
+		if (shadowgen && item->m_Primitive->GetState()->Hints & HINT_CAST_SHADOW)
 		{
-			shadowgen->Generate((*i)->m_Primitive);
+			shadowgen->Generate(item->m_Primitive);
 		}
-		(*i)->m_State.Unapply();
+		item->m_State.Unapply();
 		glPopMatrix();
 	}
 }
 
 void ImmediateMode::Clear()
 {
-	for(vector<IMItem*>::iterator i=m_IMRecord.begin(); i!=m_IMRecord.end(); ++i)
+	for (unsigned int n=0; n<m_NumItems; n++)
 	{
-		if ((*i)->m_DelPrim)
+		IMItem *item=m_IMRecord[n];
+		if (item->m_DelPrim)
 		{
-			delete (*i)->m_Primitive;
+			delete item->m_Primitive;
 		}
-		delete *i;
+		item->m_Transforms.clear();
+		item->m_Colours.clear();
 	}
 
-	m_IMRecord.clear();
+	m_NumItems=0;
 }
-
@@ -28,7 +28,10 @@ namespace Fluxus
 /// Immediate Mode
 /// A store for immediate mode primitives, which we can
 /// be given at any time, we keep pointers to them and
-/// render them all in one when the renderer is ready
+/// render them all in one when the renderer is ready.
+/// Consecutive calls which draw the same primitive with
+/// a state that only differs by transform and colour are
+/// gathered together, and drawn as instances.
 class ImmediateMode
 {
 public:
@@ -46,8 +49,15 @@ private:
 		State m_State;
 		Primitive *m_Primitive;
 		bool m_DelPrim; // delete primitive on clear
+		// per instance, empty if there is only one
+		vector<dMatrix> m_Transforms;
+		vector<dColour> m_Colours;
 	};
+	
+	/// Items are kept between frames to avoid reallocating
+	/// them, only the first m_NumItems are in use
 	vector<IMItem*> m_IMRecord;
+	unsigned int m_NumItems;
 };
 
 }
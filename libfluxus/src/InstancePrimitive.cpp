@@ -0,0 +1,93 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include "InstancePrimitive.h"
+#include "State.h"
+
+using namespace Fluxus;
+
+InstancePrimitive::InstancePrimitive(const Primitive *source, unsigned int count) :
+m_Source(source->Clone())
+{
+	AddData("m",new TypedPData<dMatrix>(count));
+	AddData("c",new TypedPData<dColour>(count));
+
+	// direct access for speed
+	PDataDirty();
+}
+
+InstancePrimitive::InstancePrimitive(const InstancePrimitive &other) :
+Primitive(other),
+m_Source(other.m_Source->Clone())
+{
+	PDataDirty();
+}
+
+InstancePrimitive::~InstancePrimitive()
+{
+	delete m_Source;
+}
+
+InstancePrimitive* InstancePrimitive::Clone() const
+{
+	return new InstancePrimitive(*this);
+}
+
+void InstancePrimitive::PDataDirty()
+{
+	m_TransformData=GetDataVec<dMatrix>("m");
+	m_ColData=GetDataVec<dColour>("c");
+}
+
+void InstancePrimitive::Render()
+{
+	if (m_TransformData->empty()) return;
+
+	// the source renders with our hints, shader etc
+	m_Source->SetState(&m_State);
+	m_Source->Prerender();
+	m_Source->RenderInstances(&(*m_TransformData)[0],&(*m_ColData)[0],m_TransformData->size());
+}
+
+dBoundingBox InstancePrimitive::GetBoundingBox(const dMatrix &space)
+{
+	dBoundingBox box;
+	dBoundingBox local=m_Source->GetBoundingBox(dMatrix());
+	if (local.empty()) return box;
+
+	dVector corners[8];
+	local.getvertices(corners);
+
+	for (vector<dMatrix,FLX_ALLOC(dMatrix) >::iterator i=m_TransformData->begin(); i!=m_TransformData->end(); ++i)
+	{
+		dMatrix m=space*(*i);
+		for (int c=0; c<8; c++)
+		{
+			box.expand(m.transform(corners[c]));
+		}
+	}
+	return box;
+}
+
+void InstancePrimitive::ApplyTransform(bool ScaleRotOnly)
+{
+	for (vector<dMatrix,FLX_ALLOC(dMatrix) >::iterator i=m_TransformData->begin(); i!=m_TransformData->end(); ++i)
+	{
+		*i=GetState()->Transform*(*i);
+	}
+	GetDataRaw("m")->SetDirty();
+	GetState()->Transform.init();
+}
@@ -0,0 +1,62 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_INSTANCEPRIM
+#define N_INSTANCEPRIM
+
+#include "Primitive.h"
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// A set of instances of another primitive, each 
+/// with a transform ("m" pdata) and colour ("c" 
+/// pdata), drawn with hardware instancing where the
+/// source primitive supports it. The source geometry
+/// is copied, so it's independant of the original.
+class InstancePrimitive : public Primitive
+{
+public:
+	InstancePrimitive(const Primitive *source, unsigned int count);
+	InstancePrimitive(const InstancePrimitive &other);
+	virtual ~InstancePrimitive();
+	
+	///////////////////////////////////////////////////
+	///@name Primitive Interface
+	///@{
+	virtual InstancePrimitive* Clone() const;
+	virtual void Render();
+	virtual dBoundingBox GetBoundingBox(const dMatrix &space);
+	virtual void ApplyTransform(bool ScaleRotOnly=false);
+	virtual string GetTypeName() { return "InstancePrimitive"; }
+	virtual Evaluator *MakeEvaluator() { return NULL; }
+	///@}
+	
+protected:
+
+	virtual void PDataDirty();
+
+private:
+
+	Primitive *m_Source;
+	vector<dMatrix,FLX_ALLOC(dMatrix) > *m_TransformData;
+	vector<dColour,FLX_ALLOC(dColour) > *m_ColData;
+};
+
+}
+
+#endif
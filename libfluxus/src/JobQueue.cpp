@@ -0,0 +1,193 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <unistd.h>
+#include "JobQueue.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+
+JobQueue *JobQueue::m_Singleton=NULL;
+
+JobQueue::JobQueue() :
+m_NumThreads(1),
+m_NextTask(0),
+m_Remaining(0),
+m_Batch(0),
+m_Running(false),
+m_Quit(false)
+{
+	pthread_mutex_init(&m_Mutex,NULL);
+	pthread_cond_init(&m_Start,NULL);
+	pthread_cond_init(&m_Finished,NULL);
+
+	long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus>1) m_NumThreads=cpus;
+}
+
+JobQueue::~JobQueue()
+{
+	StopThreads();
+	for (vector<Job*>::iterator i=m_Jobs.begin(); i!=m_Jobs.end(); ++i)
+	{
+		delete *i;
+	}
+	pthread_cond_destroy(&m_Finished);
+	pthread_cond_destroy(&m_Start);
+	pthread_mutex_destroy(&m_Mutex);
+}
+
+void JobQueue::SetNumThreads(unsigned int s)
+{
+	if (s<1) s=1;
+	if (s==m_NumThreads) return;
+	StopThreads();
+	m_NumThreads=s;
+}
+
+void JobQueue::Add(Job *job, unsigned int size, unsigned int grain)
+{
+	m_Jobs.push_back(job);
+	if (size==0) return;
+	if (grain<1) grain=1;
+
+	// no point making more tasks than there are threads to
+	// run them, but a few extra help even out the load
+	unsigned int tasks=(size+grain-1)/grain;
+	if (tasks>m_NumThreads*4) tasks=m_NumThreads*4;
+	unsigned int step=(size+tasks-1)/tasks;
+
+	pthread_mutex_lock(&m_Mutex);
+	for (unsigned int start=0; start<size; start+=step)
+	{
+		m_Tasks.push_back(Task(job,start,start+step<size?start+step:size));
+	}
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void JobQueue::Run()
+{
+	if (m_Tasks.size()>1 && m_NumThreads>1)
+	{
+		if (m_Threads.empty()) StartThreads();
+
+		pthread_mutex_lock(&m_Mutex);
+		m_NextTask=0;
+		m_Remaining=m_Tasks.size();
+		m_Running=true;
+		pthread_cond_broadcast(&m_Start);
+		pthread_mutex_unlock(&m_Mutex);
+
+		RunTasks();
+
+		pthread_mutex_lock(&m_Mutex);
+		while (m_Remaining>0)
+		{
+			pthread_cond_wait(&m_Finished,&m_Mutex);
+		}
+		m_Running=false;
+		m_Tasks.clear();
+		pthread_mutex_unlock(&m_Mutex);
+	}
+	else
+	{
+		// not worth waking anyone up for
+		for (vector<Task>::iterator i=m_Tasks.begin(); i!=m_Tasks.end(); ++i)
+		{
+			i->TheJob->Run(i->Start,i->End);
+		}
+		m_Tasks.clear();
+	}
+
+	for (vector<Job*>::iterator i=m_Jobs.begin(); i!=m_Jobs.end(); ++i)
+	{
+		delete *i;
+	}
+	m_Jobs.clear();
+	m_Batch++;
+}
+
+void JobQueue::RunTasks()
+{
+	pthread_mutex_lock(&m_Mutex);
+	while (m_Running && m_NextTask<m_Tasks.size())
+	{
+		Task task=m_Tasks[m_NextTask++];
+		pthread_mutex_unlock(&m_Mutex);
+
+		task.TheJob->Run(task.Start,task.End);
+
+		pthread_mutex_lock(&m_Mutex);
+		if (--m_Remaining==0)
+		{
+			pthread_cond_signal(&m_Finished);
+		}
+	}
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+void *JobQueue::WorkerThread(void *context)
+{
+	JobQueue *queue=(JobQueue*)context;
+
+	pthread_mutex_lock(&queue->m_Mutex);
+	while (!queue->m_Quit)
+	{
+		if (queue->m_Running && queue->m_NextTask<queue->m_Tasks.size())
+		{
+			pthread_mutex_unlock(&queue->m_Mutex);
+			queue->RunTasks();
+			pthread_mutex_lock(&queue->m_Mutex);
+		}
+		else
+		{
+			pthread_cond_wait(&queue->m_Start,&queue->m_Mutex);
+		}
+	}
+	pthread_mutex_unlock(&queue->m_Mutex);
+	return NULL;
+}
+
+void JobQueue::StartThreads()
+{
+	m_Quit=false;
+	for (unsigned int i=1; i<m_NumThreads; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,WorkerThread,this)!=0)
+		{
+			Trace::Stream<<"JobQueue::StartThreads: couldn't start worker thread"<<endl;
+			break;
+		}
+		m_Threads.push_back(thread);
+	}
+}
+
+void JobQueue::StopThreads()
+{
+	if (m_Threads.empty()) return;
+
+	pthread_mutex_lock(&m_Mutex);
+	m_Quit=true;
+	pthread_cond_broadcast(&m_Start);
+	pthread_mutex_unlock(&m_Mutex);
+
+	for (vector<pthread_t>::iterator i=m_Threads.begin(); i!=m_Threads.end(); ++i)
+	{
+		pthread_join(*i,NULL);
+	}
+	m_Threads.clear();
+}
@@ -0,0 +1,121 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_JOB_QUEUE
+#define N_JOB_QUEUE
+
+#include <vector>
+#include <pthread.h>
+
+using namespace std;
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////
+/// A piece of work which can be split into ranges
+/// of elements (usually vertices) and run on more
+/// than one thread at once. Run may be called from
+/// any thread, so it must only write to its own
+/// range, and not touch the scenegraph or make pdata
+/// dirty - do that before adding it to the queue.
+class Job
+{
+public:
+	Job() {}
+	virtual ~Job() {}
+
+	/// Process the elements in [start,end)
+	virtual void Run(unsigned int start, unsigned int end)=0;
+};
+
+//////////////////////////////////////////////////
+/// Runs jobs on a pool of worker threads. Jobs are
+/// collected with Add, then Run shares them out
+/// between the workers and the calling thread, and
+/// returns when they are all finished. Only one
+/// thread should add and run jobs.
+class JobQueue
+{
+public:
+	static JobQueue *Get()
+	{
+		if (m_Singleton==NULL) m_Singleton=new JobQueue;
+		return m_Singleton;
+	}
+
+	static void Shutdown()
+	{
+		if (m_Singleton!=NULL) delete m_Singleton;
+		m_Singleton=NULL;
+	}
+
+	/// Sets the number of threads used, including the calling
+	/// thread - so 1 means no workers. Defaults to the number
+	/// of cpus
+	void SetNumThreads(unsigned int s);
+	unsigned int GetNumThreads() { return m_NumThreads; }
+
+	/// Queues a job over size elements, split into tasks of at
+	/// least grain elements. The queue takes ownership of the
+	/// job, and deletes it after it's been run
+	void Add(Job *job, unsigned int size, unsigned int grain);
+
+	/// Runs all the queued jobs, and waits for them to finish
+	void Run();
+
+	/// Counts the times Run has been called, so things jobs refer
+	/// to can tell if they might still be in use
+	unsigned int GetBatch() const { return m_Batch; }
+
+private:
+	JobQueue();
+	~JobQueue();
+
+	struct Task
+	{
+		Task(Job *j, unsigned int s, unsigned int e) : TheJob(j), Start(s), End(e) {}
+		Job *TheJob;
+		unsigned int Start;
+		unsigned int End;
+	};
+
+	void StartThreads();
+	void StopThreads();
+	/// Runs tasks until there are none left to start
+	void RunTasks();
+	static void *WorkerThread(void *context);
+
+	static JobQueue *m_Singleton;
+
+	unsigned int m_NumThreads;
+	vector<pthread_t> m_Threads;
+	vector<Job*> m_Jobs;
+	vector<Task> m_Tasks;
+	unsigned int m_NextTask;
+	unsigned int m_Remaining;
+	unsigned int m_Batch;
+	bool m_Running;
+	bool m_Quit;
+
+	pthread_mutex_t m_Mutex;
+	pthread_cond_t m_Start;
+	pthread_cond_t m_Finished;
+};
+
+}
+
+#endif
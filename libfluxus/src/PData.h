@@ -19,6 +19,7 @@
 
 #include <vector>
 #include <string>
+#include <limits.h>
 #include "dada.h"
 #include "Allocator.h"
 
@@ -32,19 +33,61 @@ namespace Fluxus
 class PData
 {
 public:
-	PData() {}
+	PData() : m_DirtyStart(0), m_DirtyEnd(UINT_MAX), m_Version(NextVersion()) {}
 	virtual ~PData() {}
 	virtual PData *Copy() const=0;
 	virtual unsigned int Size() const=0;
 	virtual void Resize(unsigned int size)=0;
 	
+	/// Raw access to the elements, for handing to OpenGL
+	virtual void *GetRaw()=0;
+	virtual unsigned int GetElementSize() const=0;
+	
 	char GetType() const { return m_Type; }
 	
+	///////////////////////////////////////////////////
+	///@name Dirty range tracking
+	/// Copies of this array kept elsewhere (vertex buffers
+	/// in video memory) only need updating over the range 
+	/// of elements which have changed since they were last 
+	/// cleared. New arrays start off completely dirty.
+	///@{
+	void SetDirty() { m_DirtyStart=0; m_DirtyEnd=UINT_MAX; m_Version=NextVersion(); }
+	void SetDirty(unsigned int index) 
+	{ 
+		if (m_DirtyStart>=m_DirtyEnd) { m_DirtyStart=index; m_DirtyEnd=index+1; }
+		else if (index<m_DirtyStart) m_DirtyStart=index;
+		else if (index>=m_DirtyEnd) m_DirtyEnd=index+1;
+		m_Version=NextVersion();
+	}
+	bool IsDirty() const { return m_DirtyStart<m_DirtyEnd; }
+	void ClearDirty() { m_DirtyStart=m_DirtyEnd=0; }
+	/// Returns the dirty range as [start,end), clamped to the size
+	void GetDirtyRange(unsigned int &start, unsigned int &end) const
+	{
+		end=m_DirtyEnd<Size()?m_DirtyEnd:Size();
+		start=m_DirtyStart<end?m_DirtyStart:end;
+	}
+	/// Changes every time the array is made dirty, and is never
+	/// shared between arrays, so things calculated from the data
+	/// (like a primitive's topology) can tell when to redo it
+	unsigned int GetVersion() const { return m_Version; }
+	/// The newest version given to any array, so a check that no
+	/// pdata has changed at all can skip looking at each one
+	static unsigned int GetLatestVersion() { return LatestVersion(); }
+	///@}
+	
 protected:
 	void SetType(const char s) { m_Type=s; }
 	
 private:
+	static unsigned int &LatestVersion() { static unsigned int Version=0; return Version; }
+	static unsigned int NextVersion() { return ++LatestVersion(); }
+
 	char m_Type;
+	unsigned int m_DirtyStart;
+	unsigned int m_DirtyEnd;
+	unsigned int m_Version;
 };
 
 /////////////////////////////////////////////////
@@ -74,6 +117,18 @@ public:
 	virtual void Resize(unsigned int size)
 	{
 		m_Data.resize(size);
+		SetDirty();
+	}
+	
+	virtual void *GetRaw()
+	{
+		if (m_Data.empty()) return NULL;
+		return &m_Data[0];
+	}
+	
+	virtual unsigned int GetElementSize() const
+	{
+		return sizeof(T);
 	}
 	
 	///\todo add operator[] and make m_Data private
@@ -15,111 +15,131 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include "PDataArithmetic.h"
+#include "SimplexNoise.h"
+#include "SIMD.h"
 
 using namespace Fluxus;
 
+// the SIMD kernels treat arrays of these as runs of 4 floats
+typedef char dVectorIsFourFloats[sizeof(dVector)==4*sizeof(float)?1:-1];
+typedef char dColourIsFourFloats[sizeof(dColour)==4*sizeof(float)?1:-1];
+typedef char dMatrixIsSixteenFloats[sizeof(dMatrix)==16*sizeof(float)?1:-1];
+
+// lanes to use for the components the scalar operators change
+static const unsigned int XYZ=0x7;
+static const unsigned int XYZW=0xf;
+
+template<class T>
+static float *Floats(TypedPData<T> *p)
+{
+	if (p->m_Data.empty()) return NULL;
+	return (float*)&p->m_Data[0];
+}
+
+template<class T>
+static unsigned int NumFloats(TypedPData<T> *p)
+{
+	return p->Size()*sizeof(T)/sizeof(float);
+}
+
+static void OpConst(SIMD::Op op, TypedPData<float> *a, float b)
+{
+	float c[4]={b,b,b,b};
+	SIMD::OpConst(op,Floats(a),c,XYZW,a->Size());
+}
+
+template<class T>
+static void OpConst(SIMD::Op op, TypedPData<T> *a, float b, unsigned int lanes)
+{
+	float c[4]={b,b,b,b};
+	SIMD::OpConst(op,Floats(a),c,lanes,NumFloats(a));
+}
+
+template<class T>
+static void OpConst(SIMD::Op op, TypedPData<T> *a, const T &b, unsigned int lanes)
+{
+	SIMD::OpConst(op,Floats(a),(const float*)&b,lanes,NumFloats(a));
+}
+
+template<class T, class S>
+static void OpArray(SIMD::Op op, TypedPData<T> *a, TypedPData<S> *b, unsigned int lanes)
+{
+	SIMD::OpArray(op,Floats(a),Floats(b),lanes,NumFloats(a));
+}
+
+template<class T>
+static void OpSplat(SIMD::Op op, TypedPData<T> *a, TypedPData<float> *b, unsigned int lanes)
+{
+	SIMD::OpSplat(op,Floats(a),Floats(b),lanes,a->Size());
+}
+
 template <>
 PData *AddOperator::Operate(TypedPData<float> *a, float b)
 {
-	for (vector<float,FLX_ALLOC(float) >::iterator i=a->m_Data.begin(); i!=a->m_Data.end(); i++)
-	{
-		*i+=b;
-	}
-	
+	OpConst(SIMD::ADD,a,b);
 	return NULL;
 }
 
 template <>
 PData *AddOperator::Operate(TypedPData<dVector> *a, float b)
 {
-	for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=a->m_Data.begin(); i!=a->m_Data.end(); i++)
-	{
-		i->x+=b;
-		i->y+=b;
-		i->z+=b;
-	}
+	OpConst(SIMD::ADD,a,b,XYZ);
 	return NULL;
 }
 
 template <>
 PData *AddOperator::Operate(TypedPData<dVector> *a, dVector b)
 {
-	for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=a->m_Data.begin(); i!=a->m_Data.end(); i++)
-	{
-		i->x+=b.x;
-		i->y+=b.y;
-		i->z+=b.z;
-	}
+	OpConst(SIMD::ADD,a,b,XYZ);
 	return NULL;
 }
 
 template <>
 PData *AddOperator::Operate(TypedPData<float> *a, TypedPData<float> *b)
 {
-	for (unsigned int i=0; i<a->Size(); i++) a->m_Data[i]+=b->m_Data[i];
+	OpArray(SIMD::ADD,a,b,XYZW);
 	return NULL;
 }
 
 template <>
 PData *AddOperator::Operate(TypedPData<dVector> *a, TypedPData<float> *b)
 {
-	for (unsigned int i=0; i<a->Size(); i++) 
-	{
-		a->m_Data[i].x+=b->m_Data[i];
-		a->m_Data[i].y+=b->m_Data[i];
-		a->m_Data[i].z+=b->m_Data[i];
-	}
+	OpSplat(SIMD::ADD,a,b,XYZ);
 	return NULL;
 }
 
 template <>
 PData *AddOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b)
 {
-	for (unsigned int i=0; i<a->Size(); i++) a->m_Data[i]+=b->m_Data[i];
+	OpArray(SIMD::ADD,a,b,XYZ);
 	return NULL;
 }
 
 template <>
 PData *AddOperator::Operate(TypedPData<dColour> *a, float b)
 {
-	for (vector<dColour,FLX_ALLOC(dColour) >::iterator i=a->m_Data.begin(); i!=a->m_Data.end(); i++)
-	{
-		i->r+=b;
-		i->g+=b;
-		i->b+=b;
-	}
+	OpConst(SIMD::ADD,a,b,XYZ);
 	return NULL;
 }
 
 template <>
 PData *AddOperator::Operate(TypedPData<dColour> *c, TypedPData<float> *d)
 {
-	for (unsigned int i=0; i<c->Size(); i++)
-	{
-		c->m_Data[i].r+=d->m_Data[i];
-		c->m_Data[i].g+=d->m_Data[i];
-		c->m_Data[i].b+=d->m_Data[i];
-	}
+	OpSplat(SIMD::ADD,c,d,XYZ);
 	return NULL;
 }
 
 template <>
 PData *AddOperator::Operate(TypedPData<dColour> *c, dColour d)
 {
-	for (vector<dColour,FLX_ALLOC(dColour) >::iterator i=c->m_Data.begin(); i!=c->m_Data.end(); i++)
-	{
-		i->r+=d.r;
-		i->g+=d.g;
-		i->b+=d.b;
-		i->a+=d.a;
-	}
+	OpConst(SIMD::ADD,c,d,XYZW);
 	return NULL;
 }
 
 template <>
 PData *AddOperator::Operate(TypedPData<dColour> *c, TypedPData<dColour> *d)
 {
-	for (unsigned int i=0; i<c->Size(); i++) c->m_Data[i]+=d->m_Data[i];
+	OpArray(SIMD::ADD,c,d,XYZW);
 	return NULL;
 }
 ////////////////////////////////////////////////////////////////////////////
@@ -127,71 +147,49 @@ PData *AddOperator::Operate(TypedPData<dColour> *c, TypedPData<dColour> *d)
 template <>
 PData *MultOperator::Operate(TypedPData<float> *a, float b)
 {
-	for (vector<float,FLX_ALLOC(float) >::iterator i=a->m_Data.begin(); i!=a->m_Data.end(); i++)
-	{
-		(*i)*=b;
-	}
+	OpConst(SIMD::MUL,a,b);
 	return NULL;
 }
 
 template <>
 PData *MultOperator::Operate(TypedPData<dVector> *a, float b)
 {
-	for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=a->m_Data.begin(); i!=a->m_Data.end(); i++)
-	{
-		(*i)*=b;
-	}
+	OpConst(SIMD::MUL,a,b,XYZ);
 	return NULL;
 }
 
 template <>
 PData *MultOperator::Operate(TypedPData<dColour> *a, float b)
 {
-	for (vector<dColour,FLX_ALLOC(dColour) >::iterator i=a->m_Data.begin(); i!=a->m_Data.end(); i++)
-	{
-		(*i)*=b;
-	}
+	OpConst(SIMD::MUL,a,b,XYZW);
 	return NULL;
 }
 
 template <>
 PData *MultOperator::Operate(TypedPData<dVector> *a, dVector b)
 {
-	for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=a->m_Data.begin(); i!=a->m_Data.end(); i++)
-	{
-		(*i).x*=b.x;
-		(*i).y*=b.y;
-		(*i).z*=b.z;
-	}
+	OpConst(SIMD::MUL,a,b,XYZ);
 	return NULL;
 }
 
 template <>
 PData *MultOperator::Operate(TypedPData<float> *a, TypedPData<float> *b)
 {
-	for (unsigned int i=0; i<a->Size(); i++) a->m_Data[i]*=b->m_Data[i];
+	OpArray(SIMD::MUL,a,b,XYZW);
 	return NULL;
 }
 
 template <>
 PData *MultOperator::Operate(TypedPData<dVector> *a, TypedPData<float> *b)
 {
-	for (unsigned int i=0; i<a->Size(); i++) 
-	{
-		a->m_Data[i]*=b->m_Data[i];
-	}
+	OpSplat(SIMD::MUL,a,b,XYZ);
 	return NULL;
 }
 
 template <>
 PData *MultOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b)
 {
-	for (unsigned int i=0; i<a->Size(); i++)
-	{
-		a->m_Data[i].x*=b->m_Data[i].x;
-		a->m_Data[i].y*=b->m_Data[i].y;
-		a->m_Data[i].z*=b->m_Data[i].z;
-	}
+	OpArray(SIMD::MUL,a,b,XYZ);
 	return NULL;
 }
 
@@ -200,10 +198,7 @@ PData *MultOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b)
 template <>
 PData *SineOperator::Operate(TypedPData<float> *a, TypedPData<float> *b)
 {
-	for (unsigned int i=0; i<a->Size(); i++)
-	{
-		a->m_Data[i]=sin(b->m_Data[i]);
-	}
+	SIMD::Sin(Floats(a),Floats(b),a->Size());
 	return NULL;
 }
 
@@ -212,10 +207,7 @@ PData *SineOperator::Operate(TypedPData<float> *a, TypedPData<float> *b)
 template <>
 PData *CosineOperator::Operate(TypedPData<float> *a, TypedPData<float> *b)
 {
-	for (unsigned int i=0; i<a->Size(); i++)
-	{	
-		a->m_Data[i]=cos(b->m_Data[i]);	
-	}
+	SIMD::Cos(Floats(a),Floats(b),a->Size());
 	return NULL;
 }
 
@@ -267,3 +259,324 @@ PData *ClosestOperator::Operate(TypedPData<dVector> *a, float b)
 	return ret;
 }
 
+
+///////////////////////////////////////////////////////
+
+template <>
+PData *MultOperator::Operate(TypedPData<dColour> *a, TypedPData<float> *b)
+{
+	OpSplat(SIMD::MUL,a,b,XYZW);
+	return NULL;
+}
+
+///////////////////////////////////////////////////////
+
+template <>
+PData *SubOperator::Operate(TypedPData<float> *a, float b)
+{
+	OpConst(SIMD::SUB,a,b);
+	return NULL;
+}
+
+template <>
+PData *SubOperator::Operate(TypedPData<dVector> *a, float b)
+{
+	OpConst(SIMD::SUB,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *SubOperator::Operate(TypedPData<dVector> *a, dVector b)
+{
+	OpConst(SIMD::SUB,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *SubOperator::Operate(TypedPData<dColour> *a, float b)
+{
+	OpConst(SIMD::SUB,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *SubOperator::Operate(TypedPData<dColour> *a, dColour b)
+{
+	OpConst(SIMD::SUB,a,b,XYZW);
+	return NULL;
+}
+
+template <>
+PData *SubOperator::Operate(TypedPData<float> *a, TypedPData<float> *b)
+{
+	OpArray(SIMD::SUB,a,b,XYZW);
+	return NULL;
+}
+
+template <>
+PData *SubOperator::Operate(TypedPData<dVector> *a, TypedPData<float> *b)
+{
+	OpSplat(SIMD::SUB,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *SubOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b)
+{
+	OpArray(SIMD::SUB,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *SubOperator::Operate(TypedPData<dColour> *a, TypedPData<float> *b)
+{
+	OpSplat(SIMD::SUB,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *SubOperator::Operate(TypedPData<dColour> *a, TypedPData<dColour> *b)
+{
+	OpArray(SIMD::SUB,a,b,XYZW);
+	return NULL;
+}
+
+///////////////////////////////////////////////////////
+
+template <>
+PData *TransformOperator::Operate(TypedPData<dVector> *a, dMatrix b)
+{
+	SIMD::Transform(Floats(a),b.arr(),true,a->Size());
+	return NULL;
+}
+
+template <>
+PData *TransformOperator::Operate(TypedPData<dVector> *a, TypedPData<dMatrix> *b)
+{
+	for (unsigned int i=0; i<a->Size(); i++) 
+	{
+		a->m_Data[i]=b->m_Data[i].transform_persp(a->m_Data[i]);
+	}
+	return NULL;
+}
+
+template <>
+PData *TransformOperator::Operate(TypedPData<dMatrix> *a, dMatrix b)
+{
+	for (unsigned int i=0; i<a->Size(); i++) a->m_Data[i]=b*a->m_Data[i];
+	return NULL;
+}
+
+template <>
+PData *TransformOperator::Operate(TypedPData<dMatrix> *a, TypedPData<dMatrix> *b)
+{
+	for (unsigned int i=0; i<a->Size(); i++) a->m_Data[i]=b->m_Data[i]*a->m_Data[i];
+	return NULL;
+}
+
+///////////////////////////////////////////////////////
+
+template <>
+PData *NormaliseOperator::Operate(TypedPData<dVector> *a, float b)
+{
+	SIMD::Normalise(Floats(a),b,a->Size());
+	return NULL;
+}
+
+///////////////////////////////////////////////////////
+
+template <>
+PData *MinOperator::Operate(TypedPData<float> *a, float b)
+{
+	OpConst(SIMD::MIN,a,b);
+	return NULL;
+}
+
+template <>
+PData *MinOperator::Operate(TypedPData<dVector> *a, float b)
+{
+	OpConst(SIMD::MIN,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *MinOperator::Operate(TypedPData<dColour> *a, float b)
+{
+	OpConst(SIMD::MIN,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *MinOperator::Operate(TypedPData<float> *a, TypedPData<float> *b)
+{
+	OpArray(SIMD::MIN,a,b,XYZW);
+	return NULL;
+}
+
+template <>
+PData *MinOperator::Operate(TypedPData<dVector> *a, dVector b)
+{
+	OpConst(SIMD::MIN,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *MinOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b)
+{
+	OpArray(SIMD::MIN,a,b,XYZ);
+	return NULL;
+}
+
+///////////////////////////////////////////////////////
+
+template <>
+PData *MaxOperator::Operate(TypedPData<float> *a, float b)
+{
+	OpConst(SIMD::MAX,a,b);
+	return NULL;
+}
+
+template <>
+PData *MaxOperator::Operate(TypedPData<dVector> *a, float b)
+{
+	OpConst(SIMD::MAX,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *MaxOperator::Operate(TypedPData<dColour> *a, float b)
+{
+	OpConst(SIMD::MAX,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *MaxOperator::Operate(TypedPData<float> *a, TypedPData<float> *b)
+{
+	OpArray(SIMD::MAX,a,b,XYZW);
+	return NULL;
+}
+
+template <>
+PData *MaxOperator::Operate(TypedPData<dVector> *a, dVector b)
+{
+	OpConst(SIMD::MAX,a,b,XYZ);
+	return NULL;
+}
+
+template <>
+PData *MaxOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b)
+{
+	OpArray(SIMD::MAX,a,b,XYZ);
+	return NULL;
+}
+
+///////////////////////////////////////////////////////
+
+template <>
+PData *NoiseOperator::Operate(TypedPData<dVector> *a, float b)
+{
+	for (unsigned int i=0; i<a->Size(); i++) 
+	{
+		dVector &p=a->m_Data[i];
+		// offset the lookups so the axes move independently
+		dVector d(SimplexNoise::noise(p.x,p.y,p.z),
+				  SimplexNoise::noise(p.x+31.4f,p.y+12.7f,p.z+5.3f),
+				  SimplexNoise::noise(p.x-17.1f,p.y+43.9f,p.z-23.6f));
+		p+=d*b;
+	}
+	return NULL;
+}
+
+template <>
+PData *NoiseOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b)
+{
+	for (unsigned int i=0; i<a->Size(); i++) 
+	{
+		dVector &p=a->m_Data[i];
+		p+=b->m_Data[i]*SimplexNoise::noise(p.x,p.y,p.z);
+	}
+	return NULL;
+}
+
+template <>
+PData *NoiseOperator::Operate(TypedPData<float> *a, TypedPData<dVector> *b)
+{
+	for (unsigned int i=0; i<a->Size(); i++) 
+	{
+		const dVector &p=b->m_Data[i];
+		a->m_Data[i]=SimplexNoise::noise(p.x,p.y,p.z);
+	}
+	return NULL;
+}
+
+///////////////////////////////////////////////////////
+
+template <>
+PData *LerpOperator::Operate(TypedPData<float> *a, float b, float c)
+{
+	float d[4]={b,b,b,b};
+	SIMD::LerpConst(Floats(a),d,c,XYZW,a->Size());
+	return NULL;
+}
+
+template <>
+PData *LerpOperator::Operate(TypedPData<dVector> *a, dVector b, float c)
+{
+	SIMD::LerpConst(Floats(a),b.arr(),c,XYZ,NumFloats(a));
+	return NULL;
+}
+
+template <>
+PData *LerpOperator::Operate(TypedPData<dColour> *a, dColour b, float c)
+{
+	SIMD::LerpConst(Floats(a),b.arr(),c,XYZW,NumFloats(a));
+	return NULL;
+}
+
+template <>
+PData *LerpOperator::Operate(TypedPData<float> *a, TypedPData<float> *b, float c)
+{
+	SIMD::Lerp(Floats(a),Floats(b),c,XYZW,a->Size());
+	return NULL;
+}
+
+template <>
+PData *LerpOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b, float c)
+{
+	SIMD::Lerp(Floats(a),Floats(b),c,XYZ,NumFloats(a));
+	return NULL;
+}
+
+template <>
+PData *LerpOperator::Operate(TypedPData<dColour> *a, TypedPData<dColour> *b, float c)
+{
+	SIMD::Lerp(Floats(a),Floats(b),c,XYZW,NumFloats(a));
+	return NULL;
+}
+
+///////////////////////////////////////////////////////
+
+template <>
+PData *ClampOperator::Operate(TypedPData<float> *a, float b, float c)
+{
+	OpConst(SIMD::MAX,a,b);
+	OpConst(SIMD::MIN,a,c);
+	return NULL;
+}
+
+template <>
+PData *ClampOperator::Operate(TypedPData<dVector> *a, float b, float c)
+{
+	OpConst(SIMD::MAX,a,b,XYZ);
+	OpConst(SIMD::MIN,a,c,XYZ);
+	return NULL;
+}
+
+template <>
+PData *ClampOperator::Operate(TypedPData<dColour> *a, float b, float c)
+{
+	OpConst(SIMD::MAX,a,b,XYZ);
+	OpConst(SIMD::MIN,a,c,XYZ);
+	return NULL;
+}
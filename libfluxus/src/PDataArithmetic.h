@@ -100,6 +100,8 @@ template<>
 PData *MultOperator::Operate(TypedPData<dVector> *a, TypedPData<float> *b);
 template<>
 PData *MultOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b);
+template<>
+PData *MultOperator::Operate(TypedPData<dColour> *a, TypedPData<float> *b);
 
 class SineOperator : public PDataOperator
 {
@@ -157,6 +159,222 @@ PData *ClosestOperator::Operate(TypedPData<dVector> *a, dVector b);
 template<>
 PData *ClosestOperator::Operate(TypedPData<dVector> *a, float b);
 
+class SubOperator : public PDataOperator
+{
+public:
+	SubOperator() {}
+	
+	template <class S, class T>
+	static PData *Operate(TypedPData<S> *a, T b)
+	{
+		Trace::Stream<<"SubOperator has no operator for types: "<<typeid(a).name()<<" and "	
+			<<typeid(b).name()<<endl;
+		return NULL;
+	}
+	
+};
+
+template<>
+PData *SubOperator::Operate(TypedPData<float> *a, float b);
+template<>
+PData *SubOperator::Operate(TypedPData<dVector> *a, float b);
+template<>
+PData *SubOperator::Operate(TypedPData<dVector> *a, dVector b);
+template<>
+PData *SubOperator::Operate(TypedPData<dColour> *a, float b);
+template<>
+PData *SubOperator::Operate(TypedPData<dColour> *a, dColour b);
+template<>
+PData *SubOperator::Operate(TypedPData<float> *a, TypedPData<float> *b);
+template<>
+PData *SubOperator::Operate(TypedPData<dVector> *a, TypedPData<float> *b);
+template<>
+PData *SubOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b);
+template<>
+PData *SubOperator::Operate(TypedPData<dColour> *a, TypedPData<float> *b);
+template<>
+PData *SubOperator::Operate(TypedPData<dColour> *a, TypedPData<dColour> *b);
+
+/// Transforms vectors by a matrix, including the perspective divide like vtransform
+class TransformOperator : public PDataOperator
+{
+public:
+	TransformOperator() {}
+	
+	template <class S, class T>
+	static PData *Operate(TypedPData<S> *a, T b)
+	{
+		Trace::Stream<<"TransformOperator has no operator for types: "<<typeid(a).name()<<" and "	
+			<<typeid(b).name()<<endl;
+		return NULL;
+	}
+	
+};
+
+template<>
+PData *TransformOperator::Operate(TypedPData<dVector> *a, dMatrix b);
+template<>
+PData *TransformOperator::Operate(TypedPData<dVector> *a, TypedPData<dMatrix> *b);
+template<>
+PData *TransformOperator::Operate(TypedPData<dMatrix> *a, dMatrix b);
+template<>
+PData *TransformOperator::Operate(TypedPData<dMatrix> *a, TypedPData<dMatrix> *b);
+
+/// Normalises vectors, then scales them to the given length
+class NormaliseOperator : public PDataOperator
+{
+public:
+	NormaliseOperator() {}
+	
+	template <class S, class T>
+	static PData *Operate(TypedPData<S> *a, T b)
+	{
+		Trace::Stream<<"NormaliseOperator has no operator for types: "<<typeid(a).name()<<" and "	
+			<<typeid(b).name()<<endl;
+		return NULL;
+	}
+	
+};
+
+template<>
+PData *NormaliseOperator::Operate(TypedPData<dVector> *a, float b);
+
+class MinOperator : public PDataOperator
+{
+public:
+	MinOperator() {}
+	
+	template <class S, class T>
+	static PData *Operate(TypedPData<S> *a, T b)
+	{
+		Trace::Stream<<"MinOperator has no operator for types: "<<typeid(a).name()<<" and "	
+			<<typeid(b).name()<<endl;
+		return NULL;
+	}
+	
+};
+
+template<>
+PData *MinOperator::Operate(TypedPData<float> *a, float b);
+template<>
+PData *MinOperator::Operate(TypedPData<dVector> *a, float b);
+template<>
+PData *MinOperator::Operate(TypedPData<dColour> *a, float b);
+template<>
+PData *MinOperator::Operate(TypedPData<float> *a, TypedPData<float> *b);
+template<>
+PData *MinOperator::Operate(TypedPData<dVector> *a, dVector b);
+template<>
+PData *MinOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b);
+
+class MaxOperator : public PDataOperator
+{
+public:
+	MaxOperator() {}
+	
+	template <class S, class T>
+	static PData *Operate(TypedPData<S> *a, T b)
+	{
+		Trace::Stream<<"MaxOperator has no operator for types: "<<typeid(a).name()<<" and "	
+			<<typeid(b).name()<<endl;
+		return NULL;
+	}
+	
+};
+
+template<>
+PData *MaxOperator::Operate(TypedPData<float> *a, float b);
+template<>
+PData *MaxOperator::Operate(TypedPData<dVector> *a, float b);
+template<>
+PData *MaxOperator::Operate(TypedPData<dColour> *a, float b);
+template<>
+PData *MaxOperator::Operate(TypedPData<float> *a, TypedPData<float> *b);
+template<>
+PData *MaxOperator::Operate(TypedPData<dVector> *a, dVector b);
+template<>
+PData *MaxOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b);
+
+/// Displaces vectors by simplex noise. With a number the noise is 3D with that
+/// amplitude, with a vector array (normals) each vector moves along its normal.
+/// A float array is filled with the noise at the positions in a vector array.
+class NoiseOperator : public PDataOperator
+{
+public:
+	NoiseOperator() {}
+	
+	template <class S, class T>
+	static PData *Operate(TypedPData<S> *a, T b)
+	{
+		Trace::Stream<<"NoiseOperator has no operator for types: "<<typeid(a).name()<<" and "	
+			<<typeid(b).name()<<endl;
+		return NULL;
+	}
+	
+};
+
+template<>
+PData *NoiseOperator::Operate(TypedPData<dVector> *a, float b);
+template<>
+PData *NoiseOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b);
+template<>
+PData *NoiseOperator::Operate(TypedPData<float> *a, TypedPData<dVector> *b);
+
+///////////////////////////////////////////////////////////////
+/// Operators which take an extra number as a second operand
+
+/// Linearly interpolates towards the operand by the number
+class LerpOperator : public PDataOperator
+{
+public:
+	LerpOperator() {}
+	
+	template <class S, class T>
+	static PData *Operate(TypedPData<S> *a, T b, float c)
+	{
+		Trace::Stream<<"LerpOperator has no operator for types: "<<typeid(a).name()<<" and "	
+			<<typeid(b).name()<<endl;
+		return NULL;
+	}
+	
+};
+
+template<>
+PData *LerpOperator::Operate(TypedPData<float> *a, float b, float c);
+template<>
+PData *LerpOperator::Operate(TypedPData<dVector> *a, dVector b, float c);
+template<>
+PData *LerpOperator::Operate(TypedPData<dColour> *a, dColour b, float c);
+template<>
+PData *LerpOperator::Operate(TypedPData<float> *a, TypedPData<float> *b, float c);
+template<>
+PData *LerpOperator::Operate(TypedPData<dVector> *a, TypedPData<dVector> *b, float c);
+template<>
+PData *LerpOperator::Operate(TypedPData<dColour> *a, TypedPData<dColour> *b, float c);
+
+/// Clamps each element between the operand and the number
+class ClampOperator : public PDataOperator
+{
+public:
+	ClampOperator() {}
+	
+	template <class S, class T>
+	static PData *Operate(TypedPData<S> *a, T b, float c)
+	{
+		Trace::Stream<<"ClampOperator has no operator for types: "<<typeid(a).name()<<" and "	
+			<<typeid(b).name()<<endl;
+		return NULL;
+	}
+	
+};
+
+template<>
+PData *ClampOperator::Operate(TypedPData<float> *a, float b, float c);
+template<>
+PData *ClampOperator::Operate(TypedPData<dVector> *a, float b, float c);
+template<>
+PData *ClampOperator::Operate(TypedPData<dColour> *a, float b, float c);
+
 }
 
 #endif
@@ -18,11 +18,13 @@
 
 using namespace Fluxus;
 
-PDataContainer::PDataContainer() 
+PDataContainer::PDataContainer() :
+m_LayoutVersion(NextLayoutVersion())
 {
 }
 
-PDataContainer::PDataContainer(const PDataContainer &other) 
+PDataContainer::PDataContainer(const PDataContainer &other) :
+m_LayoutVersion(NextLayoutVersion())
 {
 	Clear();
 	for (map<string,PData*>::const_iterator i=other.m_PData.begin(); 
@@ -51,6 +53,7 @@ void PDataContainer::Resize(unsigned int size)
 	{
 		i->second->Resize(size);
 	}
+	LayoutChanged();
 }
 
 	
@@ -106,6 +109,7 @@ void PDataContainer::AddData(const string &name, PData* pd)
 	}
 	
 	m_PData[name]=pd;
+	LayoutChanged();
 }
 
 void PDataContainer::CopyData(const string &name, string newname)
@@ -126,6 +130,7 @@ void PDataContainer::CopyData(const string &name, string newname)
 	
 	m_PData[newname]=i->second->Copy();
 	
+	LayoutChanged();
 	PDataDirty();
 }
 
@@ -140,6 +145,7 @@ void PDataContainer::RemoveDataVec(const string &name)
 	
 	delete i->second;
 	m_PData.erase(i);
+	LayoutChanged();
 }
 
 PData* PDataContainer::GetDataRaw(const string &name)
@@ -174,6 +180,7 @@ void PDataContainer::SetDataRaw(const string &name, PData* pd)
 	}
 	delete i->second;
 	i->second = pd;
+	LayoutChanged();
 	PDataDirty();
 }
 
@@ -72,15 +72,21 @@ public:
 	bool GetDataInfo(const string &name, char &type, unsigned int &size) const;
 	
 	/// Sets an element of the array. Not checked, for 
-	/// speed - use GetDataInfo() to check
+	/// speed - use GetDataInfo() to check. Marks the 
+	/// element as dirty.
 	template<class T> void SetData(const string &name, unsigned int index, T s);
 	
 	/// Gets an element of the array. Not checked, for 
 	/// speed - use GetDataInfo() to check
 	template<class T> T GetData(const string &name, unsigned int index) const;
 		
-	/// Runs a pdata operation on the given pdata array
+	/// Runs a pdata operation on the given pdata array,
+	/// the whole array is marked as dirty
 	template<class T> PData *DataOp(const string &op, const string &name, T operand);
+
+	/// Runs a pdata operation which takes an extra number,
+	/// such as "lerp" or "clamp"
+	template<class T> PData *DataOp(const string &op, const string &name, T operand, float operand2);
 	
 	/// Gets the whole pdata array, returns NULL if it doesn't exist
 	PData* GetDataRaw(const string &name);
@@ -94,6 +100,7 @@ public:
 	/// Maps the name of a pdata operator to the actual object, all pdata ops
 	/// need to be registered inside this function (see below)
 	template <class S, class T> PData *FindOperate(const string &name, TypedPData<S> *a, T b);
+	template <class S, class T> PData *FindOperate(const string &name, TypedPData<S> *a, T b, float c);
 	
 	/// Erases all current data!
 	void Resize(unsigned int size);
@@ -104,21 +111,34 @@ public:
 	/// Returns a vector of names of PData that this container contains
 	void GetDataNames(vector<string> &names) const;
 
+	/// Changes whenever arrays are added, removed, replaced or 
+	/// resized, and is never shared between containers, so 
+	/// pointers into the pdata can be cached until it changes
+	unsigned int GetLayoutVersion() const { return m_LayoutVersion; }
+
 protected:
 
 	/// Called when a named pdata mapping changes 
 	virtual void PDataDirty()=0;
+
+	void LayoutChanged() { m_LayoutVersion=NextLayoutVersion(); }
 	
 	///Todo: no const [] for m_PData[name] so m_PData has to be mutable??? (see below)
 	///\todo replace with a hashmap?
 	mutable map<string,PData*> m_PData;
 
+private:
+	static unsigned int NextLayoutVersion() { static unsigned int Version=0; return ++Version; }
+
+	unsigned int m_LayoutVersion;
 };
 
 template<class T> 
 void PDataContainer::SetData(const string &name, unsigned int index, T s)	
 {
-	static_cast<TypedPData<T>*>(m_PData[name])->m_Data[index]=s;
+	TypedPData<T> *data=static_cast<TypedPData<T>*>(m_PData[name]);
+	data->m_Data[index]=s;
+	data->SetDirty(index);
 }
 
 ///Todo: no const [] for m_PData[name] so m_PData has to be mutable???
@@ -158,6 +178,9 @@ PData *PDataContainer::DataOp(const string &op, const string &name, T operand)
 		return NULL;
 	}
 	
+	// operators which don't return anything work in place
+	i->second->SetDirty();
+	
 	TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(i->second);	
 	if (data) return FindOperate<dVector,T>(op, data, operand);
 	else
@@ -179,6 +202,39 @@ PData *PDataContainer::DataOp(const string &op, const string &name, T operand)
 	return NULL;
 }
 
+template<class T>
+PData *PDataContainer::DataOp(const string &op, const string &name, T operand, float operand2)
+{
+	map<string,PData*>::iterator i=m_PData.find(name);
+	if (i==m_PData.end())
+	{
+		Trace::Stream<<"Primitive::DataOp: pdata: "<<name<<" doesn't exists"<<endl;
+		return NULL;
+	}
+	
+	i->second->SetDirty();
+	
+	TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(i->second);	
+	if (data) return FindOperate<dVector,T>(op, data, operand, operand2);
+	else
+	{
+		TypedPData<dColour> *data = dynamic_cast<TypedPData<dColour>*>(i->second);
+		if (data) return FindOperate<dColour, T>(op, data, operand, operand2);
+		else 
+		{
+			TypedPData<float> *data = dynamic_cast<TypedPData<float>*>(i->second);
+			if (data) return FindOperate<float, T>(op, data, operand, operand2);
+			else 
+			{
+				TypedPData<dMatrix> *data = dynamic_cast<TypedPData<dMatrix>*>(i->second);
+				if (data) return FindOperate<dMatrix, T>(op, data, operand, operand2);
+			}
+		}
+	}
+	
+	return NULL;
+}
+
 template <class S, class T>
 PData *PDataContainer::FindOperate(const string &name, TypedPData<S> *a, T b)
 {
@@ -187,6 +243,22 @@ PData *PDataContainer::FindOperate(const string &name, TypedPData<S> *a, T b)
 	else if (name=="closest") return ClosestOperator::Operate<S,T>(a,b);
 	else if (name=="sin") return SineOperator::Operate<S,T>(a,b);
 	else if (name=="cos") return CosineOperator::Operate<S,T>(a,b);
+	else if (name=="-") return SubOperator::Operate<S,T>(a,b);
+	else if (name=="transform") return TransformOperator::Operate<S,T>(a,b);
+	else if (name=="normalise") return NormaliseOperator::Operate<S,T>(a,b);
+	else if (name=="min") return MinOperator::Operate<S,T>(a,b);
+	else if (name=="max") return MaxOperator::Operate<S,T>(a,b);
+	else if (name=="noise") return NoiseOperator::Operate<S,T>(a,b);
+	
+	Trace::Stream<<"operator "<<name<<" not found"<<endl;
+	return NULL;
+}
+
+template <class S, class T>
+PData *PDataContainer::FindOperate(const string &name, TypedPData<S> *a, T b, float c)
+{
+	if (name=="lerp") return LerpOperator::Operate<S,T>(a,b,c);
+	else if (name=="clamp") return ClampOperator::Operate<S,T>(a,b,c);
 	
 	Trace::Stream<<"operator "<<name<<" not found"<<endl;
 	return NULL;
@@ -24,13 +24,13 @@
 using namespace Fluxus;
 using namespace std;
 
-void PNGLoader::Load(const string &Filename, TexturePainter::TextureDesc &desc)
+void PNGLoader::Load(const string &Filename, TexturePainter::TextureDesc &desc, ostream &log)
 {
 	desc.ImageData = NULL;
 	FILE *fp=fopen(Filename.c_str(),"rb");
 	if (!fp || Filename=="")
 	{
-		Trace::Stream<<"Couldn't open image ["<<Filename<<"]"<<endl;
+		log<<"Couldn't open image ["<<Filename<<"]"<<endl;
 	}
 	else
 	{
@@ -40,7 +40,7 @@ void PNGLoader::Load(const string &Filename, TexturePainter::TextureDesc &desc)
 		if (setjmp(png_jmpbuf(png_ptr)))
 		{
 			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-			Trace::Stream<<"Error reading image ["<<Filename<<"]"<<endl;
+			log<<"Error reading image ["<<Filename<<"]"<<endl;
 			fclose(fp);
 			return;
 		}
@@ -98,7 +98,7 @@ void PNGLoader::Load(const string &Filename, TexturePainter::TextureDesc &desc)
 						desc.Size = width * height * 4;
 						break;
 			default:
-						Trace::Stream<<"PNG pixel format not supported : "<<(int)png_get_color_type(png_ptr, info_ptr)<<" "<<Filename<<endl;
+						log<<"PNG pixel format not supported : "<<(int)png_get_color_type(png_ptr, info_ptr)<<" "<<Filename<<endl;
 						delete[] desc.ImageData;
 						desc.ImageData=NULL;
 						break;
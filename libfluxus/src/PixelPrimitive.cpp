@@ -19,6 +19,7 @@
 #include "Renderer.h"
 #include "PixelPrimitive.h"
 #include "State.h"
+#include "StateCache.h"
 #include "Utils.h"
 #include "DebugGL.h"
 
@@ -120,6 +121,7 @@ m_RendererActive(RendererActive)
 		gluBuild2DMipmaps(GL_TEXTURE_2D, 4, m_Width, m_Height,
 				GL_RGBA, GL_FLOAT, &(*m_ColourData)[0]);
 		glBindTexture(GL_TEXTURE_2D, 0);
+		TexturePainter::Get()->InvalidateCurrent();
 
 		cerr << "FBO is not supported" << endl;
 	}
@@ -328,6 +330,7 @@ void PixelPrimitive::ResizeFBO(int w, int h)
 		/* unbind the fbo */
 		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 		glBindTexture(GL_TEXTURE_2D, 0);
+		TexturePainter::Get()->InvalidateCurrent();
 
 		m_FBOMaxS = (float)w / (float)m_FBOWidth;
 		m_FBOMaxT = (float)h / (float)m_FBOHeight;
@@ -404,6 +407,8 @@ void PixelPrimitive::Unbind()
 
 	glPopAttrib();
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	// the gl state has been restored behind the caches' backs
+	StateCache::Invalidate();
 
 	// generate mipmaps
 	glEnable(GL_TEXTURE_2D);
@@ -415,6 +420,7 @@ void PixelPrimitive::Unbind()
 #endif
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glDisable(GL_TEXTURE_2D);
+	TexturePainter::Get()->InvalidateCurrent();
 #endif
 }
 
@@ -499,6 +505,7 @@ void PixelPrimitive::Render()
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glEnable(GL_LIGHTING);
 	glDisable(GL_TEXTURE_2D);
+	TexturePainter::Get()->InvalidateCurrent();
 
 	if (m_State.Hints & HINT_NOBLEND)
 	{
@@ -549,6 +556,7 @@ void PixelPrimitive::UploadPData()
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_Width, m_Height,
 			GL_RGBA, GL_FLOAT, &(*m_ColourData)[0]);
 	glBindTexture(GL_TEXTURE_2D, 0);
+	TexturePainter::Get()->InvalidateCurrent();
 }
 
 void PixelPrimitive::DownloadPData()
@@ -15,6 +15,7 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <stdio.h>
+#include <algorithm>
 
 #include "OpenGL.h"
 
@@ -29,7 +30,12 @@
 using namespace Fluxus;
 
 PolyPrimitive::PolyPrimitive(Type t) :
+m_TopologyVersion(0),
+m_TopologyDirty(true),
 m_IndexMode(false),
+m_IndexDirty(true),
+m_IndexBuffer(GL_ELEMENT_ARRAY_BUFFER),
+m_InstanceCount(0),
 m_Type(t)
 {
 	AddData("p",new TypedPData<dVector>);
@@ -43,8 +49,13 @@ m_Type(t)
 
 PolyPrimitive::PolyPrimitive(const PolyPrimitive &other) :
 Primitive(other),
+m_TopologyVersion(0),
+m_TopologyDirty(true),
 m_IndexMode(other.m_IndexMode),
 m_IndexData(other.m_IndexData),
+m_IndexDirty(true),
+m_IndexBuffer(GL_ELEMENT_ARRAY_BUFFER),
+m_InstanceCount(0),
 m_Type(other.m_Type)
 {
 	PDataDirty();
@@ -52,6 +63,11 @@ m_Type(other.m_Type)
 
 PolyPrimitive::~PolyPrimitive()
 {
+	for (map<string,VertexBuffer*>::iterator i=m_VertexBuffers.begin(); 
+		i!=m_VertexBuffers.end(); ++i)
+	{
+		delete i->second;
+	}
 }
 
 PolyPrimitive *PolyPrimitive::Clone() const
@@ -62,9 +78,7 @@ PolyPrimitive *PolyPrimitive::Clone() const
 void PolyPrimitive::Clear()
 {
 	Resize(0);
-	m_ConnectedVerts.clear();
-	m_GeometricNormals.clear();
-	m_UniqueEdges.clear();
+	m_TopologyDirty=true;
 }
 
 void PolyPrimitive::PDataDirty()
@@ -83,9 +97,7 @@ void PolyPrimitive::AddVertex(const dVertex &Vert)
 	m_ColData->push_back(Vert.col); 	
 	m_TexData->push_back(dVector(Vert.s, Vert.t, 0));
 	
-	m_ConnectedVerts.clear();
-	m_GeometricNormals.clear();
-	m_UniqueEdges.clear();
+	m_TopologyDirty=true;
 }
 
 void PolyPrimitive::Render()
@@ -134,9 +146,11 @@ void PolyPrimitive::Render()
 	}
 	if (m_State.Hints & HINT_UNLIT) glDisable(GL_LIGHTING);
 
-	glVertexPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_VertData->begin()->arr());
-	glNormalPointer(GL_FLOAT,sizeof(dVector),(void*)m_NormData->begin()->arr());
-	glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_TexData->begin()->arr());
+	bool vbo = (m_State.Hints & HINT_VBO) && VertexBuffer::Supported();
+
+	glVertexPointer(3,GL_FLOAT,sizeof(dVector),ArrayPointer("p",GetDataRaw("p"),vbo));
+	glNormalPointer(GL_FLOAT,sizeof(dVector),ArrayPointer("n",GetDataRaw("n"),vbo));
+	glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),ArrayPointer("t",GetDataRaw("t"),vbo));
 
 	if (m_State.Hints & HINT_SPHERE_MAP)
 	{
@@ -162,11 +176,11 @@ void PolyPrimitive::Render()
 
 				if (tex!=NULL)
 				{
-					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),(void*)tex->m_Data.begin()->arr());
+					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),ArrayPointer(name,tex,vbo));
 				}
 				else // default to using the normal vertex coordinates
 				{
-					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_TexData->begin()->arr());
+					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),ArrayPointer("t",GetDataRaw("t"),vbo));
 				}
 			}
 		}
@@ -177,17 +191,29 @@ void PolyPrimitive::Render()
 	if (m_State.Hints & HINT_VERTCOLS)
 	{
 		glEnableClientState(GL_COLOR_ARRAY);
-		glColorPointer(4,GL_FLOAT,sizeof(dVector),(void*)m_ColData->begin()->arr());
+		glColorPointer(4,GL_FLOAT,sizeof(dVector),ArrayPointer("c",GetDataRaw("c"),vbo));
 	}
 	else
 	{
 		glDisableClientState(GL_COLOR_ARRAY);
 	}
 
+	const void *indices=NULL;
+	if (m_IndexMode)
+	{
+		if (vbo)
+		{
+			m_IndexBuffer.Update(&m_IndexData[0],m_IndexData.size()*sizeof(unsigned int),m_IndexDirty);
+			m_IndexDirty=false;
+		}
+		else indices=&m_IndexData[0];
+	}
+	
+	if (vbo) glBindBuffer(GL_ARRAY_BUFFER,0);
+
 	if (m_State.Hints & HINT_SOLID)
 	{
-		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,&(m_IndexData[0]));
-		else glDrawArrays(type,0,m_VertData->size());
+		Draw(type,indices);
 	}
 
 	if (m_State.Hints & HINT_WIRE)
@@ -203,8 +229,7 @@ void PolyPrimitive::Render()
 		}
 
 		glDisable(GL_LIGHTING);
-		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,&(m_IndexData[0]));
-		else glDrawArrays(type,0,m_VertData->size());
+		Draw(type,indices);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
 		glEnable(GL_LIGHTING);
 		glEnable(GL_TEXTURE_2D);
@@ -221,8 +246,7 @@ void PolyPrimitive::Render()
 		glPolygonMode(GL_FRONT_AND_BACK,GL_POINT);
 		glColor4fv(m_State.WireColour.arr());
 		glDisable(GL_LIGHTING);
-		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,&(m_IndexData[0]));
-		else glDrawArrays(type,0,m_VertData->size());
+		Draw(type,indices);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
 		glEnable(GL_LIGHTING);
 		glEnable(GL_TEXTURE_2D);
@@ -230,6 +254,8 @@ void PolyPrimitive::Render()
 	}
 
 
+	if (vbo && m_IndexMode) m_IndexBuffer.Unbind();
+
 	if (m_State.Hints & HINT_UNLIT) glEnable(GL_LIGHTING);
 	if (m_State.Hints & HINT_AALIAS) glDisable(GL_LINE_SMOOTH);
 	if (m_State.Hints & HINT_SPHERE_MAP)
@@ -239,10 +265,102 @@ void PolyPrimitive::Render()
 	}
 }
 
+const void *PolyPrimitive::ArrayPointer(const string &name, PData *data, bool vbo)
+{
+	if (!vbo) return data->GetRaw();
+
+	VertexBuffer *buffer=NULL;
+	map<string,VertexBuffer*>::iterator i=m_VertexBuffers.find(name);
+	if (i==m_VertexBuffers.end())
+	{
+		buffer = new VertexBuffer;
+		m_VertexBuffers[name]=buffer;
+	}
+	else buffer=i->second;
+
+	buffer->Update(data);
+	return NULL;
+}
+
+void PolyPrimitive::Draw(int type, const void *indices)
+{
+	if (m_InstanceCount>0)
+	{
+		if (m_IndexMode) glDrawElementsInstancedARB(type,m_IndexData.size(),GL_UNSIGNED_INT,indices,m_InstanceCount);
+		else glDrawArraysInstancedARB(type,0,m_VertData->size(),m_InstanceCount);
+	}
+	else
+	{
+		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,indices);
+		else glDrawArrays(type,0,m_VertData->size());
+	}
+}
+
+bool PolyPrimitive::InstancingSupported()
+{
+	static bool checked=false;
+	static bool supported=false;
+	if (!checked)
+	{
+		supported=glewIsSupported("GL_ARB_draw_instanced GL_ARB_instanced_arrays");
+		checked=true;
+	}
+	return supported;
+}
+
+void PolyPrimitive::RenderInstances(dMatrix *transforms, dColour *colours, unsigned int count)
+{
+	// hardware instancing needs a shader to read the per-instance 
+	// transform, otherwise draw them the slow way
+	int transformattrib=-1;
+	int colourattrib=-1;
+	if (m_State.Shader!=NULL && InstancingSupported())
+	{
+		transformattrib=m_State.Shader->GetAttribLocation("InstanceTransform");
+		colourattrib=m_State.Shader->GetAttribLocation("InstanceColour");
+	}
+
+	if (transformattrib<0)
+	{
+		Primitive::RenderInstances(transforms,colours,count);
+		return;
+	}
+
+	// a mat4 attribute takes up four consecutive locations, one per column
+	for (int c=0; c<4; c++)
+	{
+		glEnableVertexAttribArray(transformattrib+c);
+		glVertexAttribPointer(transformattrib+c,4,GL_FLOAT,GL_FALSE,sizeof(dMatrix),transforms->arr()+c*4);
+		glVertexAttribDivisorARB(transformattrib+c,1);
+	}
+
+	if (colourattrib>=0)
+	{
+		glEnableVertexAttribArray(colourattrib);
+		glVertexAttribPointer(colourattrib,4,GL_FLOAT,GL_FALSE,sizeof(dColour),colours->arr());
+		glVertexAttribDivisorARB(colourattrib,1);
+	}
+
+	m_InstanceCount=count;
+	Render();
+	m_InstanceCount=0;
+
+	for (int c=0; c<4; c++)
+	{
+		glVertexAttribDivisorARB(transformattrib+c,0);
+		glDisableVertexAttribArray(transformattrib+c);
+	}
+
+	if (colourattrib>=0)
+	{
+		glVertexAttribDivisorARB(colourattrib,0);
+		glDisableVertexAttribArray(colourattrib);
+	}
+}
+
 void PolyPrimitive::RecalculateNormals(bool smooth)
 {
 	GenerateTopology();
-	CalculateGeometricNormals();
 
 	if (!m_GeometricNormals.empty()) 
 	{
@@ -278,6 +396,8 @@ void PolyPrimitive::RecalculateNormals(bool smooth)
 			}
 		}
 		
+		GetDataRaw("n")->SetDirty();
+		
 		if (smooth && !m_IndexMode)
 		{
 			// smooth the normals
@@ -303,6 +423,7 @@ void PolyPrimitive::ConvertToIndexed()
 {
 	if (m_IndexMode) return;
 
+	CheckTopology();
 	if (m_ConnectedVerts.empty())
 	{
 		CalculateConnected();
@@ -314,36 +435,21 @@ void PolyPrimitive::ConvertToIndexed()
 	TypedPData<dVector> *NewTex = new TypedPData<dVector>;
 
 	m_IndexData.clear();
-	int vert=0;
-	int index=0;
-	map<int,int> verttoindex;
-	for (vector<vector<int> >::iterator i=m_ConnectedVerts.begin();
-		 i!=m_ConnectedVerts.end(); i++)
+	vector<int> verttoindex(m_WeldedVerts.size());
+	for (unsigned int vert=0; vert<m_WeldedVerts.size(); vert++)
 	{
-		if (!i->empty() && verttoindex.find(vert)==verttoindex.end())
-		{
-			// take the first connected as our new point - will trash non-shared
-			// normals, texture coords and colours
-			NewVerts->m_Data.push_back((*m_VertData)[(*i)[0]]);
-			NewNorms->m_Data.push_back((*m_NormData)[(*i)[0]]);
-			NewCols->m_Data.push_back((*m_ColData)[(*i)[0]]);
-			NewTex->m_Data.push_back((*m_TexData)[(*i)[0]]);
-			m_IndexData.push_back(index);
-			
-			// record all the verts that can point to this index
-			for (vector<int>::iterator v=i->begin(); v!=i->end(); v++)
-			{
-				verttoindex[*v]=index;
-			}
-			
-			index++;
-		}
-		else
+		int first=m_WeldedVerts[vert];
+		if (first==(int)vert)
 		{
-			m_IndexData.push_back(verttoindex[vert]);
+			// the first of a coincident group becomes the new point - will
+			// trash non-shared normals, texture coords and colours
+			verttoindex[vert]=NewVerts->m_Data.size();
+			NewVerts->m_Data.push_back((*m_VertData)[vert]);
+			NewNorms->m_Data.push_back((*m_NormData)[vert]);
+			NewCols->m_Data.push_back((*m_ColData)[vert]);
+			NewTex->m_Data.push_back((*m_TexData)[vert]);
 		}
-		
-		vert++;
+		m_IndexData.push_back(verttoindex[first]);
 	}
 	
 	SetDataRaw("p", NewVerts);
@@ -352,10 +458,28 @@ void PolyPrimitive::ConvertToIndexed()
 	SetDataRaw("t", NewTex);
 		
 	m_IndexMode=true;
+	m_IndexDirty=true;
+}
+
+void PolyPrimitive::CheckTopology()
+{
+	// throw away the topology if the points or the index have changed
+	unsigned int version=GetDataRaw("p")->GetVersion();
+	if (m_TopologyDirty || version!=m_TopologyVersion)
+	{
+		m_ConnectedVerts.clear();
+		m_WeldedVerts.clear();
+		m_GeometricNormals.clear();
+		m_UniqueEdges.clear();
+		m_TopologyVersion=version;
+		m_TopologyDirty=false;
+	}
 }
 
 void PolyPrimitive::GenerateTopology()
 {
+	CheckTopology();
+
 	if (m_ConnectedVerts.empty())
 	{
 		CalculateConnected();
@@ -367,44 +491,90 @@ void PolyPrimitive::GenerateTopology()
 	}
 }
 
+// the allowed error for verts to count as coincident, as dVector::feq
+static const float WELD_EPSILON=0.001;
+
+// spatial hash cells are the size of the allowed error, so coincident
+// verts are always in the same or neighbouring cells
+static void WeldCell(const dVector &p, long long cell[3])
+{
+	cell[0]=(long long)floor(p.x/(double)WELD_EPSILON);
+	cell[1]=(long long)floor(p.y/(double)WELD_EPSILON);
+	cell[2]=(long long)floor(p.z/(double)WELD_EPSILON);
+}
+
+static unsigned int WeldHash(long long x, long long y, long long z)
+{
+	return (unsigned int)((unsigned long long)x*73856093ULL ^ 
+	                      (unsigned long long)y*19349663ULL ^ 
+	                      (unsigned long long)z*83492791ULL);
+}
+
 void PolyPrimitive::CalculateConnected()
 { 
-	
-	if (m_IndexMode)
-	{		
-		for (unsigned int i=0; i<m_IndexData.size(); i++)
+	// in indexed mode we connect index positions, by index value or position
+	unsigned int count=m_IndexMode?m_IndexData.size():m_VertData->size();
+	vector<dVector> points(count);
+	for (unsigned int i=0; i<count; i++)
+	{
+		points[i]=(*m_VertData)[m_IndexMode?m_IndexData[i]:i];
+	}
+
+	// bucket the points in a hash table of grid cells, chained 
+	// through next, with twice as many buckets as points
+	unsigned int size=1;
+	while (size<count*2) size<<=1;
+	vector<int> head(size,-1);
+	vector<int> next(count,-1);
+	vector<long long> cells(count*3);
+	for (unsigned int i=0; i<count; i++)
+	{
+		long long *cell=&cells[i*3];
+		WeldCell(points[i],cell);
+		unsigned int bucket=WeldHash(cell[0],cell[1],cell[2])&(size-1);
+		next[i]=head[bucket];
+		head[bucket]=i;
+	}
+
+	m_ConnectedVerts.clear();
+	m_ConnectedVerts.resize(count);
+	m_WeldedVerts.assign(count,-1);
+	for (unsigned int i=0; i<count; i++)
+	{
+		vector<int> &connected=m_ConnectedVerts[i];
+		const long long *cell=&cells[i*3];
+		for (int x=-1; x<=1; x++)
 		{
-			vector<int> connected;
-			for (unsigned int b=0; b<m_IndexData.size(); b++)
+			for (int y=-1; y<=1; y++)
 			{
-				// compare index value
-				if (i!=b && (m_IndexData[i]==m_IndexData[b] || 
-				   // compare positions
-				   ((*m_VertData)[m_IndexData[i]].feq((*m_VertData)[m_IndexData[b]]))))
+				for (int z=-1; z<=1; z++)
 				{
-					connected.push_back(b);
+					unsigned int bucket=WeldHash(cell[0]+x,cell[1]+y,cell[2]+z)&(size-1);
+					for (int b=head[bucket]; b!=-1; b=next[b])
+					{
+						// skip other cells which hash to this bucket
+						const long long *other=&cells[b*3];
+						if (other[0]!=cell[0]+x || other[1]!=cell[1]+y || other[2]!=cell[2]+z) continue;
+						
+						if ((int)i!=b && ((m_IndexMode && m_IndexData[i]==m_IndexData[b]) ||
+						    points[i].feq(points[b],WELD_EPSILON)))
+						{
+							connected.push_back(b);
+						}
+					}
 				}
 			}
-			
-			m_ConnectedVerts.push_back(connected);
 		}
-	}
-	else
-	{
-		// cache the connected verts 
-		for (unsigned int i=0; i<m_VertData->size(); i++)
+		sort(connected.begin(),connected.end());
+		
+		// weld into the first group found, so each vert has one
+		if (m_WeldedVerts[i]==-1)
 		{
-			vector<int> connected;
-			for (unsigned int b=0; b<m_VertData->size(); b++)
+			m_WeldedVerts[i]=i;
+			for (vector<int>::iterator b=connected.begin(); b!=connected.end(); ++b)
 			{
-				// find all close verts
-				if (i!=b && (*m_VertData)[i].feq((*m_VertData)[b]))
-				{
-					connected.push_back(b);
-				}
-			}	
-
-			m_ConnectedVerts.push_back(connected);
+				if (m_WeldedVerts[*b]==-1) m_WeldedVerts[*b]=i;
+			}
 		}
 	}
 }
@@ -477,6 +647,7 @@ void PolyPrimitive::CalculateGeometricNormals()
 
 void PolyPrimitive::CalculateUniqueEdges()
 {
+	GenerateTopology();
 	if (m_UniqueEdges.empty())
 	{
 		// todo - need different approach for TRIFAN
@@ -486,84 +657,55 @@ void PolyPrimitive::CalculateUniqueEdges()
 		if (m_Type==TRILIST) stride=3;
 		if (stride>0)
 		{		
-			set<pair<int,int> > firstpass;
+			unsigned int vertcount=m_WeldedVerts.size();
 			
-			unsigned int vertcount=m_VertData->size();
-			if (m_IndexMode) vertcount=m_IndexData.size();
+			// edges are shared if their ends are welded to the same verts,
+			// so group them by a hash of the (sorted) welded verts - the 
+			// chains only hold the first edge of each group
+			unsigned int size=1;
+			while (size<vertcount*2) size<<=1;
+			vector<int> head(size,-1);
+			vector<int> next;
+			vector<pair<int,int> > keys;
 			
-			// first, record all valid edges from the topology type
 			for (unsigned int i=0; i<vertcount; i+=stride)
 			{
-				for (int n=0; n<stride-1; n++)
+				for (int n=0; n<stride; n++)
 				{
-					firstpass.insert(pair<int,int>(n+i,n+i+1));
+					// the edges of the face, wrapping round at the end
+					pair<int,int> edge(i+n,n<stride-1?i+n+1:i);
+					if (edge.first>=(int)vertcount || edge.second>=(int)vertcount) continue;
+					
+					pair<int,int> key(m_WeldedVerts[edge.first],m_WeldedVerts[edge.second]);
+					if (key.first>key.second) swap(key.first,key.second);
+					unsigned int bucket=((unsigned int)key.first*73856093u ^ (unsigned int)key.second*19349663u)&(size-1);
+					
+					int group=head[bucket];
+					while (group!=-1 && keys[group]!=key) group=next[group];
+					
+					if (group==-1)
+					{
+						group=m_UniqueEdges.size();
+						m_UniqueEdges.push_back(vector<pair<int,int> >());
+						keys.push_back(key);
+						next.push_back(head[bucket]);
+						head[bucket]=group;
+					}
+					
+					// don't store the same edge twice, either way round
+					vector<pair<int,int> > &edges=m_UniqueEdges[group];
+					bool found=false;
+					for (vector<pair<int,int> >::iterator e=edges.begin(); e!=edges.end() && !found; ++e)
+					{
+						found=(*e==edge || (e->first==edge.second && e->second==edge.first));
+					}
+					if (!found) edges.push_back(edge);
 				}
-				firstpass.insert(pair<int,int>(i+stride-1,i));
-			}
-
-			set<pair<int,int> > stored;
-			pair<int,int> key;
-
-			// now find all edges which share points and group them together
-			for (unsigned int i=0; i<vertcount; i+=stride)
-			{
-				for (int n=0; n<stride-1; n++)
-				{	
-					UniqueEdgesFindShared(pair<int,int>(n+i,n+i+1), firstpass, stored);
-				}	
-				UniqueEdgesFindShared(pair<int,int>(i+stride-1,i), firstpass, stored);	
 			}
 		}
 	}
 }
 
-void PolyPrimitive::UniqueEdgesFindShared(pair<int,int> edge, set<pair<int,int> > firstpass, set<pair<int,int> > &stored)
-{
-	vector<pair<int,int> > edges;
-	
-	if (stored.find(edge)==stored.end() && stored.find(pair<int,int>(edge.second,edge.first))==stored.end())
-	{
-		// first, store the test edge
-		edges.push_back(edge);
-		stored.insert(edge);
-		
-		//Trace::Stream<<"edge:"<<edge.first<<" "<<edge.second<<endl;
-		
-		// make all combinations of verts connected to the edge verts
-		for (vector<int>::iterator a=m_ConnectedVerts[edge.first].begin();
-			a!=m_ConnectedVerts[edge.first].end(); a++)
-		{
-			for (vector<int>::iterator b=m_ConnectedVerts[edge.second].begin();
-					b!=m_ConnectedVerts[edge.second].end(); b++)
-			{
-				//Trace::Stream<<*a<<" "<<*b<<endl;
-				pair<int, int> candidate(*a,*b);
-				if (firstpass.find(candidate)!=firstpass.end() && // if this is a real edge
-					stored.find(candidate)==stored.end() )        // and we've not stored it already
-				{
-					edges.push_back(candidate);
-					stored.insert(candidate);
-					//Trace::Stream<<"^ "<<candidate.first<<" "<<candidate.second<<endl;
-				}						
-
-				pair<int, int> rcandidate(*b,*a);
-				if (firstpass.find(rcandidate)!=firstpass.end() && // if this is a real edge
-					stored.find(rcandidate)==stored.end() )        // and we've not stored it already
-				{
-					edges.push_back(rcandidate);
-					stored.insert(rcandidate);
-					//Trace::Stream<<"^ "<<rcandidate.first<<" "<<rcandidate.second<<endl;
-				}						
-			}
-		}
-
-		if (!edges.empty())
-		{
-			m_UniqueEdges.push_back(edges);
-		}
-	}
-}
-
 dBoundingBox PolyPrimitive::GetBoundingBox(const dMatrix &space)
 {	
 	dBoundingBox box;
@@ -591,8 +733,10 @@ void PolyPrimitive::ApplyTransform(bool ScaleRotOnly)
 			(*m_VertData)[i]=GetState()->Transform.transform_no_trans((*m_VertData)[i]);
 			(*m_NormData)[i]=GetState()->Transform.transform_no_trans((*m_NormData)[i]).normalise();
 		}
+		GetDataRaw("n")->SetDirty();
 	}
 	
+	GetDataRaw("p")->SetDirty();
 	GetState()->Transform.init();
 }
 
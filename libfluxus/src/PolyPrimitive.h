@@ -21,6 +21,7 @@
 
 #include "Primitive.h"
 #include "PolyEvaluator.h"
+#include "VertexBuffer.h"
 
 namespace Fluxus
 {
@@ -45,6 +46,7 @@ public:
 	virtual dBoundingBox GetBoundingBox(const dMatrix &space);
 	virtual void RecalculateNormals(bool smooth);
 	virtual void ApplyTransform(bool ScaleRotOnly=false);
+	virtual void RenderInstances(dMatrix *transforms, dColour *colours, unsigned int count);
 	virtual string GetTypeName() { return "PolyPrimitive"; }
 	virtual Evaluator *MakeEvaluator() { return new PolyEvaluator(this); }
 	///@}
@@ -61,7 +63,8 @@ public:
 	///@name Topology functions
 	/// Functions to get topological information 
 	/// about the primitive. These are lazily computed
-	/// and stored as they can take some time.
+	/// and stored until the vertex positions or the
+	/// index change.
 	///@{
 
 	/// Connected verts is a list of lists of vertices 
@@ -71,6 +74,8 @@ public:
 	/// of the index is stored, otherwise it's done by 	
 	/// looking at the actual vertex positions, with a 
 	/// small allowed error, and the index is stored.
+	/// Coincident verts are found with a spatial hash,
+	/// so this is linear in the number of verts.
 	const vector<vector<int> > &GetConnectedVerts() { GenerateTopology(); return m_ConnectedVerts; }
 	
 	/// Unique edges is a list of coincident edges in 
@@ -86,9 +91,9 @@ public:
 	//////////////////////////////////////////////////
 	///@name Indexed mode access
 	///@{
-	void SetIndexMode(bool s) { m_IndexMode=s; }
+	void SetIndexMode(bool s) { m_IndexMode=s; m_TopologyDirty=true; }
 	bool IsIndexed() const { return m_IndexMode; }
-	vector<unsigned int> &GetIndex() { return m_IndexData; }
+	vector<unsigned int> &GetIndex() { m_IndexDirty=true; m_TopologyDirty=true; return m_IndexData; }
 	const vector<unsigned int> &GetIndexConst() const { return m_IndexData; }
 	/// Look at coincident verts and compress the poly
 	/// primitive into an indexed form
@@ -101,19 +106,40 @@ protected:
 	virtual void PDataDirty();
 	
 	// Topology generation commands
+	void CheckTopology();
 	void GenerateTopology();
 	void CalculateConnected();
 	void CalculateGeometricNormals();
 	void CalculateUniqueEdges();
-	void UniqueEdgesFindShared(pair<int,int> edge, set<pair<int,int> > firstpass, set<pair<int,int> > &stored);
 	void RecalculateNormalsIndexed();
 	
+	/// Returns the pointer to hand to the gl*Pointer calls for 
+	/// a pdata array - which is an offset into its vertex buffer
+	/// (left bound) when the primitive is hinted to use them
+	const void *ArrayPointer(const string &name, PData *data, bool vbo);
+	
+	/// Issues the draw call, instanced if we are in RenderInstances
+	void Draw(int type, const void *indices);
+	
+	static bool InstancingSupported();
+	
 	vector<vector<int> > m_ConnectedVerts;
+	/// The first vert of the coincident group each vert is welded into
+	vector<int> m_WeldedVerts;
 	vector<dVector> m_GeometricNormals;
 	vector<vector<pair<int,int> > > m_UniqueEdges;
+	/// The version of "p" the topology was calculated from
+	unsigned int m_TopologyVersion;
+	bool m_TopologyDirty;
 	
 	bool m_IndexMode;
 	vector<unsigned int> m_IndexData;
+	bool m_IndexDirty;
+	
+	map<string,VertexBuffer*> m_VertexBuffers;
+	VertexBuffer m_IndexBuffer;
+	
+	unsigned int m_InstanceCount;
 	
 	Type m_Type;
 	vector<dVector,FLX_ALLOC(dVector) > *m_VertData;
@@ -15,6 +15,7 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include "Primitive.h"
+#include "StateCache.h"
 
 using namespace Fluxus;
 
@@ -43,11 +44,17 @@ void Primitive::Prerender()
 	///\todo put other common state things here...
 	// (not all, as they are often primitive dependant)
 	if (m_State.Hints & HINT_ORIGIN) RenderAxes();
-	if (m_State.Hints & HINT_VERTCOLS) glEnable(GL_COLOR_MATERIAL);
+	if (m_State.Hints & HINT_VERTCOLS) 
+	{
+		glEnable(GL_COLOR_MATERIAL);
+		// the vertex colours will overwrite the material
+		StateCache::InvalidateMaterial();
+	}
 	else glDisable(GL_COLOR_MATERIAL);
 	if (m_State.Hints & HINT_IGNORE_DEPTH) glDisable(GL_DEPTH_TEST);
 	else glEnable(GL_DEPTH_TEST);
 	if (m_State.Hints & HINT_BOUND) RenderBoundingBox();
+	if (m_State.Hints & (HINT_ORIGIN|HINT_BOUND)) StateCache::InvalidateMaterial();
 
 	if (m_State.Shader!=NULL)
 	{
@@ -70,6 +77,22 @@ void Primitive::Prerender()
 
 }
 
+void Primitive::RenderInstances(dMatrix *transforms, dColour *colours, unsigned int count)
+{
+	dColour colour=m_State.Colour;
+	for (unsigned int i=0; i<count; i++)
+	{
+		glPushMatrix();
+		glMultMatrixf(transforms[i].arr());
+		m_State.Colour=colours[i];
+		glColor4fv(colours[i].arr());
+		StateCache::Material(GL_DIFFUSE,colours[i]);
+		Render();
+		glPopMatrix();
+	}
+	m_State.Colour=colour;
+}
+
 void Primitive::RenderAxes()
 {
 	glDisable(GL_LIGHTING);
@@ -52,13 +52,19 @@ public:
 	/// Only makes sense for certain primitive types
 	virtual void RecalculateNormals(bool smooth) {}
 
+	/// Renders count copies of the primitive, each with its own 
+	/// transform (relative to the current one) and colour. The 
+	/// default draws them one at a time, primitives which can 
+	/// use hardware instancing override this.
+	virtual void RenderInstances(dMatrix *transforms, dColour *colours, unsigned int count);
+
 	///////////////////////////////////////////////////
 	///@name Primitive Interface
 	///@{
 	void RenderBoundingBox();
 	void RenderAxes();
 	void Prerender();
-	void ApplyState()               { m_State.Apply(); }
+	void ApplyState(bool transform=true) { m_State.Apply(transform); }
 	void UnapplyState()             { m_State.Unapply(); }
 
 	/// The primitives state stores everything
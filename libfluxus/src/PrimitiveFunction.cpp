@@ -24,6 +24,7 @@ PrimitiveFunction::PrimitiveFunction()
 
 PrimitiveFunction::~PrimitiveFunction() 
 {
+	ClearArgs();
 }
 
 void PrimitiveFunction::ClearArgs()
@@ -22,6 +22,7 @@
 #include "PData.h"
 #include "Primitive.h"
 #include "SceneGraph.h"
+#include "JobQueue.h"
 
 using namespace std;
 
@@ -63,6 +64,12 @@ public:
 	
 	/// Do the work...
 	virtual void Run(Primitive &prim, const SceneGraph &world)=0;
+
+	/// Do the work on the job queue, so it can be split between 
+	/// threads and run alongside other functions on other 
+	/// primitives - the work is finished when the queue is run.
+	/// Functions which can't be split just run straight away.
+	virtual void Queue(Primitive &prim, const SceneGraph &world, JobQueue &queue) { Run(prim,world); }
 	
 	/// Get the result
 	template<class T>
@@ -131,6 +138,11 @@ bool PrimitiveFunction::ArgExists(const string &name)
 template<class T>
 void PrimitiveFunction::SetArg(const string &name, const T &arg)
 {
+	map<string,Arg*>::iterator i=m_Args.find(name);
+	if (i!=m_Args.end())
+	{
+		delete i->second;
+	}
 	m_Args[name]=new TypedArg<T>(arg);
 }
 
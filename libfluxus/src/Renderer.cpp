@@ -23,8 +23,10 @@
 #include "PrimitiveIO.h"
 #include "ShaderCache.h"
 #include "GLSLShader.h"
+#include "StateCache.h"
 #include "Trace.h"
 #include "FFGLManager.h"
+#include "JobQueue.h"
 #include <sys/time.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -87,6 +89,7 @@ Renderer::~Renderer()
 		TexturePainter::Shutdown();
 		SearchPaths::Shutdown();
 		FFGLManager::Shutdown();
+		JobQueue::Shutdown();
 	}
 }
 
@@ -118,6 +121,11 @@ void Renderer::Clear()
 
 void Renderer::Render()
 {
+	if (m_MainRenderer)
+	{
+		StateCache::NewFrame();
+	}
+
 	///\todo collapse all these clears into one call with the bitfield
 	if (m_ClearFrame && !m_MotionBlur)
 	{
@@ -223,6 +231,7 @@ void Renderer::RenderStencilShadows(unsigned int CamIndex)
 
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_ONE, GL_ONE);
+	StateCache::Invalidate();
 	glCullFace(GL_BACK);
 
 	glEnable(GL_LIGHT0+m_ShadowLight);
@@ -246,10 +255,10 @@ void Renderer::RenderStencilShadows(unsigned int CamIndex)
 	PostRender();
 }
 
-void Renderer::PreRender(unsigned int CamIndex, bool PickMode)
+void Renderer::PreRender(unsigned int CamIndex)
 {
 	Camera &Cam = m_CameraVec[CamIndex];
-    if (!m_Initialised || PickMode || Cam.NeedsInit())
+    if (!m_Initialised || Cam.NeedsInit())
     {
 		GLSLShader::Init();
 
@@ -263,14 +272,6 @@ void Renderer::PreRender(unsigned int CamIndex, bool PickMode)
 
 		glMatrixMode (GL_PROJECTION);
   		glLoadIdentity();
-		
-  		if (PickMode) 
-		{ 		
-			GLint viewport[4]={0,0,m_Width,m_Height};
-			gluPickMatrix(m_SelectInfo.x,m_Height-m_SelectInfo.y,
-						m_SelectInfo.size,m_SelectInfo.size,viewport);
-		}
-		
   		Cam.DoProjection();
   		
     	glEnable(GL_BLEND);
@@ -344,7 +345,14 @@ void Renderer::PreRender(unsigned int CamIndex, bool PickMode)
 		glDisable(GL_COLOR_MATERIAL);
 	}
 
-	if (m_FPSDisplay && !PickMode)
+	// send a bit more of any textures loading in the background
+	TexturePainter::Get()->Update();
+
+	// we've been setting gl state directly
+	StateCache::Invalidate();
+	TexturePainter::Get()->InvalidateCurrent();
+
+	if (m_FPSDisplay)
 	{
 		State DefaultState;
 		m_StateStack.push_back(DefaultState);
@@ -448,98 +456,57 @@ void Renderer::ClearLights()
 	AddLight(light);
 }
 
+dMatrix Renderer::GetPickTransform(unsigned int CamIndex, int x, int y, int size)
+{
+	Camera &Cam = m_CameraVec[CamIndex];
+
+	// the same as gluPickMatrix, maps the pick region
+	// of the camera's viewport to the whole view volume
+	float vx=Cam.GetViewportX()*(float)m_Width;
+	float vy=Cam.GetViewportY()*(float)m_Height;
+	float vw=Cam.GetViewportWidth()*(float)m_Width;
+	float vh=Cam.GetViewportHeight()*(float)m_Height;
+	if (size<1) size=1;
+
+	dMatrix pick;
+	pick.m[0][0]=vw/size;
+	pick.m[1][1]=vh/size;
+	pick.m[3][0]=(vw-2*(x-vx))/size;
+	pick.m[3][1]=(vh-2*((m_Height-y)-vy))/size;
+
+	return pick*Cam.CalculateProjection()*Cam.GetViewTransform();
+}
+
 int Renderer::Select(unsigned int CamIndex, int x, int y, int size)
 {
-	static const int SELECT_SIZE=512;
-	unsigned int IDs[SELECT_SIZE];
-	memset(IDs,0,SELECT_SIZE);
-	GLuint ID=0;
-	glSelectBuffer(SELECT_SIZE,(GLuint*)IDs);
-	glRenderMode(GL_SELECT);
-	glInitNames();
-	
-	m_SelectInfo.x=x;
-	m_SelectInfo.y=y;
-	m_SelectInfo.size=size;
-	
-	// the problem here is that select is called mid-scene, so we have to set up for 
-	// picking mode here...
-	PreRender(CamIndex,true);
-	
-	// render the scene for picking
-	m_World.Render(&m_ShadowVolumeGen,SceneGraph::SELECT);
-	
-	int hits=glRenderMode(GL_RENDER);
-	unsigned int *ptr=IDs, numnames;
-	float minz,maxz,closest=1000000;
+	if (CamIndex>=m_CameraVec.size()) return 0;
 
-	// process the hit records
-	for (int n=0; n<hits; n++)
-	{
-		numnames=*ptr;
-		ptr++;
-		minz = (float) *ptr++/0x7fffffff;
-		maxz = (float) *ptr++/0x7fffffff;
-				
-		// find the closest one
-		if (closest>minz) 
-		{
-			closest=minz;
-			ID=*ptr;
-		}
-		for (unsigned int i=0; i<numnames; i++) *ptr++;
-	}
-	
-	// ... and reset the scene back here so we can carry on afterwards as if nothing
-	// has happened...
-	m_Initialised=false;
-	PreRender(CamIndex);
-	
-	return ID;
+	// cast a ray through the middle of the pick region
+	dMatrix inv=GetPickTransform(CamIndex,x,y,size).inverse();
+	dVector start=inv.transform_persp(dVector(0,0,-1));
+	dVector end=inv.transform_persp(dVector(0,0,1));
+	return m_World.Pick(start,end,CamIndex);
 }
 
 int Renderer::SelectAll(unsigned int CamIndex, int x, int y, int size, unsigned int **rIDs)
 {
-	static const int SELECT_SIZE=512;
-	unsigned int IDs[SELECT_SIZE];
+	static const unsigned int SELECT_SIZE=512;
 	static unsigned int OutputIDs[SELECT_SIZE];
 
-	memset(IDs,0,SELECT_SIZE);
-	GLuint ID=0;
-	glSelectBuffer(SELECT_SIZE,(GLuint*)IDs);
-	glRenderMode(GL_SELECT);
-	glInitNames();
-
-	m_SelectInfo.x=x;
-	m_SelectInfo.y=y;
-	m_SelectInfo.size=size;
-
-	// the problem here is that select is called mid-scene, so we have to set up for 
-	// picking mode here...
-	PreRender(CamIndex,true);
-
-	// render the scene for picking
-	m_World.Render(&m_ShadowVolumeGen,SceneGraph::SELECT);
+	*rIDs = OutputIDs;
+	if (CamIndex>=m_CameraVec.size()) return 0;
 
-	int hits=glRenderMode(GL_RENDER);
-	unsigned int *ptr=IDs, numnames;
-	float minz,maxz,closest=1000000;
+	// everything in the frustum of the pick region
+	dPlane planes[6];
+	SceneGraph::GetFrustumPlanes(planes,GetPickTransform(CamIndex,x,y,size),false);
+	vector<int> ids;
+	m_World.Pick(planes,6,CamIndex,ids);
 
-	// process the hit records
-	for (int n=0; n<hits; n++)
+	unsigned int hits=0;
+	for (vector<int>::iterator i=ids.begin(); i!=ids.end() && hits<SELECT_SIZE; ++i)
 	{
-		numnames=*ptr;
-		ptr+=3;
-		OutputIDs[n] = *ptr; // save ID
-		for (unsigned int i=0; i<numnames; i++) *ptr++;
+		OutputIDs[hits++]=*i;
 	}
-
-	// ... and reset the scene back here so we can carry on afterwards as if nothing
-	// has happened...
-	m_Initialised=false;
-	PreRender(CamIndex);
-
-	*rIDs = OutputIDs;
 	return hits;
 }
 
@@ -95,7 +95,8 @@ public:
 	/// Immediate mode (don't delete prim till after Render() - when it
 	/// will actually be rendered
 	void         RenderPrimitive(Primitive *Prim, bool del = false);
-	/// Get primitive ID from screen space
+	/// Get primitive ID from screen space, by casting a 
+	/// ray into the scene
 	int          Select(unsigned int CamIndex, int x, int y, int size);
 	/// Get all primitive IDs from screen space
 	int          SelectAll(unsigned int CamIndex, int x, int y, int size, unsigned int **rIDs);
@@ -145,6 +146,7 @@ public:
 	void ShadowLight(unsigned int s)		 { m_ShadowLight=s; }
 	void DebugShadows(bool s)				 { m_ShadowVolumeGen.SetDebug(s); }
 	void ShadowLength(float s)				 { m_ShadowVolumeGen.SetLength(s); }
+	void SetStateSort(bool s)                { m_World.SetStateSort(s); }
 	double GetTime()                         { return m_Time; }
 	double GetDelta()                        { return m_Delta; }
 	bool SetStereoMode(stereo_mode_t mode);
@@ -163,7 +165,8 @@ public:
 
 
 private:
-	void PreRender(unsigned int CamIndex, bool PickMode=false);
+	void PreRender(unsigned int CamIndex);
+	dMatrix GetPickTransform(unsigned int CamIndex, int x, int y, int size);
 	void PostRender();
 	void RenderLights(bool camera);
 	void RenderStencilShadows(unsigned int CamIndex);
@@ -193,14 +196,6 @@ private:
 	ImmediateMode m_ImmediateMode;
 	ShadowVolumeGen m_ShadowVolumeGen;
 
-	// info for picking mode
-	struct SelectInfo
-	{
-		int x,y;
-		int size;
-	};
-
-	SelectInfo m_SelectInfo;
 	stereo_mode_t m_StereoMode;
 	bool m_MaskRed,m_MaskGreen,m_MaskBlue,m_MaskAlpha;
 
@@ -0,0 +1,150 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include "SIMDKernels.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace Fluxus;
+
+// in SIMDAVX.cpp, returns NULL if it wasn't built with avx
+extern const SIMD::Kernels *GetAVXKernels();
+
+namespace
+{
+
+#ifdef __SSE2__
+struct SSEPack
+{
+	typedef __m128 V;
+	static const unsigned int WIDTH=4;
+
+	static V Load(const float *p) { return _mm_loadu_ps(p); }
+	static void Store(float *p, V v) { _mm_storeu_ps(p,v); }
+	static V Set1(float f) { return _mm_set1_ps(f); }
+	static V Pattern(const float *c) { return _mm_loadu_ps(c); }
+	static V Splat(const float *p) { return _mm_load1_ps(p); }
+	static V Lanes(unsigned int mask)
+	{
+		return _mm_castsi128_ps(_mm_set_epi32(mask&8?-1:0,mask&4?-1:0,mask&2?-1:0,mask&1?-1:0));
+	}
+
+	static V Add(V a, V b) { return _mm_add_ps(a,b); }
+	static V Sub(V a, V b) { return _mm_sub_ps(a,b); }
+	static V Mul(V a, V b) { return _mm_mul_ps(a,b); }
+	static V Div(V a, V b) { return _mm_div_ps(a,b); }
+	static V Min(V a, V b) { return _mm_min_ps(b,a); }
+	static V Max(V a, V b) { return _mm_max_ps(b,a); }
+	static V Sqrt(V a) { return _mm_sqrt_ps(a); }
+	static V And(V a, V b) { return _mm_and_ps(a,b); }
+	static V AndNot(V a, V b) { return _mm_andnot_ps(a,b); }
+	static V Or(V a, V b) { return _mm_or_ps(a,b); }
+	static V CmpEq(V a, V b) { return _mm_cmpeq_ps(a,b); }
+	static V CmpGe(V a, V b) { return _mm_cmpge_ps(a,b); }
+	// round to nearest, using the current (default) rounding mode
+	static V Round(V a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+
+	template<int K>
+	static V Broadcast(V a) { return _mm_shuffle_ps(a,a,_MM_SHUFFLE(K,K,K,K)); }
+
+	// swaps rows and columns of the 4x4 block in a-d
+	static void Transpose4(V &a, V &b, V &c, V &d) { _MM_TRANSPOSE4_PS(a,b,c,d); }
+};
+
+// with one element per pack, masking out w costs more than sse
+// saves on the splat ops, so they use the plain loops
+const SIMD::Kernels SSEKernels=
+{
+	OpConst<SSEPack>,
+	OpArray<SSEPack>,
+	ScalarOpSplat,
+	Lerp<SSEPack>,
+	LerpConst<SSEPack>,
+	Transform<SSEPack>,
+	Normalise<SSEPack>,
+	Sin<SSEPack>,
+	Cos<SSEPack>
+};
+#endif
+
+const SIMD::Kernels ScalarKernels=
+{
+	ScalarOpConst,
+	ScalarOpArray,
+	ScalarOpSplat,
+	ScalarLerp,
+	ScalarLerpConst,
+	ScalarTransform,
+	ScalarNormalise,
+	ScalarSin,
+	ScalarCos
+};
+
+}
+
+const SIMD::Kernels *SIMD::m_Kernels=&ScalarKernels;
+SIMD::Level SIMD::m_Level=SIMD::SCALAR;
+
+SIMD::Level SIMD::GetSupported()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	if (GetAVXKernels()!=NULL && __builtin_cpu_supports("avx")) return AVX;
+#endif
+#ifdef __SSE2__
+	return SSE;
+#else
+	return SCALAR;
+#endif
+}
+
+void SIMD::SetLevel(Level level)
+{
+	Level supported=GetSupported();
+	if (level>supported) level=supported;
+
+	switch (level)
+	{
+		case AVX: m_Kernels=GetAVXKernels(); break;
+#ifdef __SSE2__
+		case SSE: m_Kernels=&SSEKernels; break;
+#endif
+		default: m_Kernels=&ScalarKernels; level=SCALAR; break;
+	}
+	m_Level=level;
+}
+
+const char *SIMD::GetLevelName(Level level)
+{
+	switch (level)
+	{
+		case AVX: return "avx";
+		case SSE: return "sse";
+		default: return "scalar";
+	}
+}
+
+namespace
+{
+
+// pick the best kernels before anything uses them
+struct SIMDInit
+{
+	SIMDInit() { SIMD::SetLevel(SIMD::AVX); }
+} Init;
+
+}
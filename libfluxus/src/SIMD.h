@@ -0,0 +1,102 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_SIMD
+#define N_SIMD
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// Vectorised kernels for the pdata operators, working on flat
+/// float arrays. Arrays of dVector and dColour are treated as
+/// runs of 4 floats, and a lane mask (bit 0 for x/r to bit 3 for
+/// w/a) leaves out the components the scalar operators don't
+/// touch. The implementation is picked at startup from what the
+/// cpu supports - AVX, SSE or plain C++.
+class SIMD
+{
+public:
+	enum Level {SCALAR, SSE, AVX};
+	enum Op {ADD, SUB, MUL, MIN, MAX};
+
+	/// The best level this cpu and build supports
+	static Level GetSupported();
+	/// Switches implementation, to compare them. Clamped to the supported level
+	static void SetLevel(Level level);
+	static Level GetLevel() { return m_Level; }
+	static const char *GetLevelName(Level level);
+
+	/// a[i] = a[i] op c[i%4] over count floats, for the lanes in the mask.
+	/// Use a constant repeated 4 times for arrays of single floats
+	static void OpConst(Op op, float *a, const float c[4], unsigned int lanes, unsigned int count)
+		{ m_Kernels->OpConst(op,a,c,lanes,count); }
+
+	/// a[i] = a[i] op b[i] over count floats, for the lanes in the mask
+	static void OpArray(Op op, float *a, const float *b, unsigned int lanes, unsigned int count)
+		{ m_Kernels->OpArray(op,a,b,lanes,count); }
+
+	/// a[i*4+n] = a[i*4+n] op b[i] over count 4 float elements, for the lanes in the mask
+	static void OpSplat(Op op, float *a, const float *b, unsigned int lanes, unsigned int count)
+		{ m_Kernels->OpSplat(op,a,b,lanes,count); }
+
+	/// a[i] += (b[i]-a[i])*t over count floats, for the lanes in the mask
+	static void Lerp(float *a, const float *b, float t, unsigned int lanes, unsigned int count)
+		{ m_Kernels->Lerp(a,b,t,lanes,count); }
+
+	/// a[i] += (c[i%4]-a[i])*t over count floats, for the lanes in the mask
+	static void LerpConst(float *a, const float c[4], float t, unsigned int lanes, unsigned int count)
+		{ m_Kernels->LerpConst(a,c,t,lanes,count); }
+
+	/// Transforms count 4 float points by a matrix laid out like dMatrix,
+	/// optionally dividing through by w like dMatrix::transform_persp
+	static void Transform(float *v, const float *m, bool persp, unsigned int count)
+		{ m_Kernels->Transform(v,m,persp,count); }
+
+	/// Normalises the xyz of count 4 float elements to the given length, leaving w
+	static void Normalise(float *v, float length, unsigned int count)
+		{ m_Kernels->Normalise(v,length,count); }
+
+	/// a[i] = sin(b[i]) over count floats
+	static void Sin(float *a, const float *b, unsigned int count)
+		{ m_Kernels->Sin(a,b,count); }
+
+	/// a[i] = cos(b[i]) over count floats
+	static void Cos(float *a, const float *b, unsigned int count)
+		{ m_Kernels->Cos(a,b,count); }
+
+	/// A table of kernels for one implementation
+	struct Kernels
+	{
+		void (*OpConst)(Op op, float *a, const float c[4], unsigned int lanes, unsigned int count);
+		void (*OpArray)(Op op, float *a, const float *b, unsigned int lanes, unsigned int count);
+		void (*OpSplat)(Op op, float *a, const float *b, unsigned int lanes, unsigned int count);
+		void (*Lerp)(float *a, const float *b, float t, unsigned int lanes, unsigned int count);
+		void (*LerpConst)(float *a, const float c[4], float t, unsigned int lanes, unsigned int count);
+		void (*Transform)(float *v, const float *m, bool persp, unsigned int count);
+		void (*Normalise)(float *v, float length, unsigned int count);
+		void (*Sin)(float *a, const float *b, unsigned int count);
+		void (*Cos)(float *a, const float *b, unsigned int count);
+	};
+
+private:
+	static const Kernels *m_Kernels;
+	static Level m_Level;
+};
+
+}
+
+#endif
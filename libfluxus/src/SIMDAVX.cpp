@@ -0,0 +1,102 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+// This file is compiled with -mavx, and is only called into after
+// checking the cpu supports it (see SIMD::GetSupported)
+
+#include "SIMDKernels.h"
+
+using namespace Fluxus;
+
+#ifdef __AVX__
+
+#include <immintrin.h>
+
+namespace
+{
+
+// 8 floats, two dVectors/dColours at a time. Only uses AVX1
+// instructions, so there is no integer maths in here
+struct AVXPack
+{
+	typedef __m256 V;
+	static const unsigned int WIDTH=8;
+
+	static V Load(const float *p) { return _mm256_loadu_ps(p); }
+	static void Store(float *p, V v) { _mm256_storeu_ps(p,v); }
+	static V Set1(float f) { return _mm256_set1_ps(f); }
+	static V Pattern(const float *c)
+	{
+		__m128 v=_mm_loadu_ps(c);
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(v),v,1);
+	}
+	static V Splat(const float *p)
+	{
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(p[0])),_mm_set1_ps(p[1]),1);
+	}
+	static V Lanes(unsigned int mask)
+	{
+		__m128 v=_mm_castsi128_ps(_mm_set_epi32(mask&8?-1:0,mask&4?-1:0,mask&2?-1:0,mask&1?-1:0));
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(v),v,1);
+	}
+
+	static V Add(V a, V b) { return _mm256_add_ps(a,b); }
+	static V Sub(V a, V b) { return _mm256_sub_ps(a,b); }
+	static V Mul(V a, V b) { return _mm256_mul_ps(a,b); }
+	static V Div(V a, V b) { return _mm256_div_ps(a,b); }
+	static V Min(V a, V b) { return _mm256_min_ps(b,a); }
+	static V Max(V a, V b) { return _mm256_max_ps(b,a); }
+	static V Sqrt(V a) { return _mm256_sqrt_ps(a); }
+	static V And(V a, V b) { return _mm256_and_ps(a,b); }
+	static V AndNot(V a, V b) { return _mm256_andnot_ps(a,b); }
+	static V Or(V a, V b) { return _mm256_or_ps(a,b); }
+	static V CmpEq(V a, V b) { return _mm256_cmp_ps(a,b,_CMP_EQ_OQ); }
+	static V CmpGe(V a, V b) { return _mm256_cmp_ps(a,b,_CMP_GE_OQ); }
+	static V Round(V a) { return _mm256_round_ps(a,_MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC); }
+
+	template<int K>
+	static V Broadcast(V a) { return _mm256_permute_ps(a,_MM_SHUFFLE(K,K,K,K)); }
+
+	// transposes the 4x4 blocks in each half of a-d, so with 8
+	// elements loaded a holds x0 x2 x4 x6 | x1 x3 x5 x7 and so on
+	static void Transpose4(V &a, V &b, V &c, V &d)
+	{
+		V t0=_mm256_unpacklo_ps(a,b), t1=_mm256_unpackhi_ps(a,b);
+		V t2=_mm256_unpacklo_ps(c,d), t3=_mm256_unpackhi_ps(c,d);
+		a=_mm256_shuffle_ps(t0,t2,_MM_SHUFFLE(1,0,1,0));
+		b=_mm256_shuffle_ps(t0,t2,_MM_SHUFFLE(3,2,3,2));
+		c=_mm256_shuffle_ps(t1,t3,_MM_SHUFFLE(1,0,1,0));
+		d=_mm256_shuffle_ps(t1,t3,_MM_SHUFFLE(3,2,3,2));
+	}
+};
+
+const SIMD::Kernels AVXKernels=SIMD_KERNELS(AVXPack);
+
+}
+
+const SIMD::Kernels *GetAVXKernels()
+{
+	return &AVXKernels;
+}
+
+#else
+
+const SIMD::Kernels *GetAVXKernels()
+{
+	return NULL;
+}
+
+#endif
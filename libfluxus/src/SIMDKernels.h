@@ -0,0 +1,559 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+// The kernels behind SIMD.h, written once against a "pack" of floats
+// and compiled for each instruction set. This is included by SIMD.cpp
+// and by SIMDAVX.cpp, which is built with AVX enabled, so everything
+// here has internal linkage - otherwise the linker could pick the AVX
+// build of a function for a cpu without it.
+
+#ifndef N_SIMD_KERNELS
+#define N_SIMD_KERNELS
+
+#include <math.h>
+#include "SIMD.h"
+
+namespace
+{
+
+using Fluxus::SIMD;
+
+///////////////////////////////////////////////////////////////
+// Plain C++ versions, also used for the ends of arrays which
+// don't fill a whole pack
+
+// the operations, for single floats and for packs
+struct AddF
+{
+	static float Do(float a, float b) { return a+b; }
+	template<class P> static typename P::V Do(typename P::V a, typename P::V b) { return P::Add(a,b); }
+};
+
+struct SubF
+{
+	static float Do(float a, float b) { return a-b; }
+	template<class P> static typename P::V Do(typename P::V a, typename P::V b) { return P::Sub(a,b); }
+};
+
+struct MulF
+{
+	static float Do(float a, float b) { return a*b; }
+	template<class P> static typename P::V Do(typename P::V a, typename P::V b) { return P::Mul(a,b); }
+};
+
+struct MinF
+{
+	static float Do(float a, float b) { return b<a?b:a; }
+	template<class P> static typename P::V Do(typename P::V a, typename P::V b) { return P::Min(a,b); }
+};
+
+struct MaxF
+{
+	static float Do(float a, float b) { return a<b?b:a; }
+	template<class P> static typename P::V Do(typename P::V a, typename P::V b) { return P::Max(a,b); }
+};
+
+// calls Func<F> with the functor for the op
+#define SIMD_DISPATCH(op, Func, args) \
+	switch (op) \
+	{ \
+		case SIMD::ADD: Func<AddF> args; break; \
+		case SIMD::SUB: Func<SubF> args; break; \
+		case SIMD::MUL: Func<MulF> args; break; \
+		case SIMD::MIN: Func<MinF> args; break; \
+		case SIMD::MAX: Func<MaxF> args; break; \
+	}
+
+// The scalar loops are written for a fixed number of lanes, xyz or
+// all four, so the lane tests go away at compile time and they are
+// as tight as the per-element loops they replaced. Other masks go
+// through each lane in turn with a stride of 4
+template<class F, unsigned int L>
+void ScalarOpConstLanes(float *a, const float c[4], unsigned int count)
+{
+	unsigned int i=0;
+	for (; i+4<=count; i+=4)
+	{
+		for (unsigned int n=0; n<L; n++) a[i+n]=F::Do(a[i+n],c[n]);
+	}
+	for (unsigned int n=0; i<count && n<L; i++, n++) a[i]=F::Do(a[i],c[n]);
+}
+
+template<class F>
+void ScalarOpConstLoop(float *a, const float c[4], unsigned int lanes, unsigned int count)
+{
+	switch (lanes)
+	{
+		case 0xf: ScalarOpConstLanes<F,4>(a,c,count); break;
+		case 0x7: ScalarOpConstLanes<F,3>(a,c,count); break;
+		default:
+			for (unsigned int n=0; n<4; n++)
+			{
+				if (lanes&(1<<n))
+				{
+					for (unsigned int i=n; i<count; i+=4) a[i]=F::Do(a[i],c[n]);
+				}
+			}
+		break;
+	}
+}
+
+void ScalarOpConst(SIMD::Op op, float *a, const float c[4], unsigned int lanes, unsigned int count)
+{
+	SIMD_DISPATCH(op,ScalarOpConstLoop,(a,c,lanes,count));
+}
+
+template<class F, unsigned int L>
+void ScalarOpArrayLanes(float *a, const float *b, unsigned int count)
+{
+	unsigned int i=0;
+	for (; i+4<=count; i+=4)
+	{
+		for (unsigned int n=0; n<L; n++) a[i+n]=F::Do(a[i+n],b[i+n]);
+	}
+	for (unsigned int n=0; i<count && n<L; i++, n++) a[i]=F::Do(a[i],b[i]);
+}
+
+template<class F>
+void ScalarOpArrayLoop(float *a, const float *b, unsigned int lanes, unsigned int count)
+{
+	switch (lanes)
+	{
+		case 0xf: ScalarOpArrayLanes<F,4>(a,b,count); break;
+		case 0x7: ScalarOpArrayLanes<F,3>(a,b,count); break;
+		default:
+			for (unsigned int n=0; n<4; n++)
+			{
+				if (lanes&(1<<n))
+				{
+					for (unsigned int i=n; i<count; i+=4) a[i]=F::Do(a[i],b[i]);
+				}
+			}
+		break;
+	}
+}
+
+void ScalarOpArray(SIMD::Op op, float *a, const float *b, unsigned int lanes, unsigned int count)
+{
+	SIMD_DISPATCH(op,ScalarOpArrayLoop,(a,b,lanes,count));
+}
+
+template<class F, unsigned int L>
+void ScalarOpSplatLanes(float *a, const float *b, unsigned int count)
+{
+	for (unsigned int i=0; i<count; i++, a+=4)
+	{
+		for (unsigned int n=0; n<L; n++) a[n]=F::Do(a[n],b[i]);
+	}
+}
+
+template<class F>
+void ScalarOpSplatLoop(float *a, const float *b, unsigned int lanes, unsigned int count)
+{
+	switch (lanes)
+	{
+		case 0xf: ScalarOpSplatLanes<F,4>(a,b,count); break;
+		case 0x7: ScalarOpSplatLanes<F,3>(a,b,count); break;
+		default:
+			for (unsigned int n=0; n<4; n++)
+			{
+				if (lanes&(1<<n))
+				{
+					for (unsigned int i=0; i<count; i++) a[i*4+n]=F::Do(a[i*4+n],b[i]);
+				}
+			}
+		break;
+	}
+}
+
+void ScalarOpSplat(SIMD::Op op, float *a, const float *b, unsigned int lanes, unsigned int count)
+{
+	SIMD_DISPATCH(op,ScalarOpSplatLoop,(a,b,lanes,count));
+}
+
+template<unsigned int L>
+void ScalarLerpLanes(float *a, const float *b, float t, unsigned int count)
+{
+	unsigned int i=0;
+	for (; i+4<=count; i+=4)
+	{
+		for (unsigned int n=0; n<L; n++) a[i+n]+=(b[i+n]-a[i+n])*t;
+	}
+	for (unsigned int n=0; i<count && n<L; i++, n++) a[i]+=(b[i]-a[i])*t;
+}
+
+void ScalarLerp(float *a, const float *b, float t, unsigned int lanes, unsigned int count)
+{
+	switch (lanes)
+	{
+		case 0xf: ScalarLerpLanes<4>(a,b,t,count); break;
+		case 0x7: ScalarLerpLanes<3>(a,b,t,count); break;
+		default:
+			for (unsigned int n=0; n<4; n++)
+			{
+				if (lanes&(1<<n))
+				{
+					for (unsigned int i=n; i<count; i+=4) a[i]+=(b[i]-a[i])*t;
+				}
+			}
+		break;
+	}
+}
+
+template<unsigned int L>
+void ScalarLerpConstLanes(float *a, const float c[4], float t, unsigned int count)
+{
+	unsigned int i=0;
+	for (; i+4<=count; i+=4)
+	{
+		for (unsigned int n=0; n<L; n++) a[i+n]+=(c[n]-a[i+n])*t;
+	}
+	for (unsigned int n=0; i<count && n<L; i++, n++) a[i]+=(c[n]-a[i])*t;
+}
+
+void ScalarLerpConst(float *a, const float c[4], float t, unsigned int lanes, unsigned int count)
+{
+	switch (lanes)
+	{
+		case 0xf: ScalarLerpConstLanes<4>(a,c,t,count); break;
+		case 0x7: ScalarLerpConstLanes<3>(a,c,t,count); break;
+		default:
+			for (unsigned int n=0; n<4; n++)
+			{
+				if (lanes&(1<<n))
+				{
+					for (unsigned int i=n; i<count; i+=4) a[i]+=(c[n]-a[i])*t;
+				}
+			}
+		break;
+	}
+}
+
+// divides through by w where it's not 0 or 1, like dVector::homog
+inline void Homog(float *v)
+{
+	if (v[3] && v[3]!=1.0f)
+	{
+		v[0]/=v[3]; v[1]/=v[3]; v[2]/=v[3]; v[3]=1;
+	}
+}
+
+void ScalarTransform(float *v, const float *mp, bool persp, unsigned int count)
+{
+	// a copy, as otherwise the stores to v mean it's reloaded every time
+	float m[16];
+	for (unsigned int n=0; n<16; n++) m[n]=mp[n];
+	for (unsigned int i=0; i<count; i++, v+=4)
+	{
+		float x=v[0], y=v[1], z=v[2], w=v[3];
+		v[0]=x*m[0] + y*m[4] + z*m[8] + w*m[12];
+		v[1]=x*m[1] + y*m[5] + z*m[9] + w*m[13];
+		v[2]=x*m[2] + y*m[6] + z*m[10] + w*m[14];
+		v[3]=x*m[3] + y*m[7] + z*m[11] + w*m[15];
+		if (persp) Homog(v);
+	}
+}
+
+void ScalarNormalise(float *v, float length, unsigned int count)
+{
+	for (unsigned int i=0; i<count; i++, v+=4)
+	{
+		float mag=sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+		if (mag)
+		{
+			v[0]/=mag; v[1]/=mag; v[2]/=mag;
+		}
+		if (length!=1)
+		{
+			v[0]*=length; v[1]*=length; v[2]*=length;
+		}
+	}
+}
+
+void ScalarSin(float *a, const float *b, unsigned int count)
+{
+	for (unsigned int i=0; i<count; i++) a[i]=sin(b[i]);
+}
+
+void ScalarCos(float *a, const float *b, unsigned int count)
+{
+	for (unsigned int i=0; i<count; i++) a[i]=cos(b[i]);
+}
+
+///////////////////////////////////////////////////////////////
+// The vector versions, P is a pack type providing the operations
+// on P::WIDTH floats (a multiple of 4, so lane n%4 is always the
+// same component). When all 4 lanes of an array are used the plain
+// loops have nothing to mask, and the compiler vectorises them at
+// least as well as these, so they are left to do it
+
+// chooses a where the mask is set, b otherwise
+template<class P>
+inline typename P::V Select(typename P::V mask, typename P::V a, typename P::V b)
+{
+	return P::Or(P::And(mask,a),P::AndNot(mask,b));
+}
+
+template<class P, class F>
+unsigned int OpConstLoop(float *a, const float c[4], unsigned int lanes, unsigned int count)
+{
+	typename P::V cv=P::Pattern(c);
+	typename P::V mask=P::Lanes(lanes);
+	unsigned int i=0;
+	for (; i+P::WIDTH<=count; i+=P::WIDTH)
+	{
+		typename P::V v=P::Load(a+i);
+		P::Store(a+i,Select<P>(mask,F::template Do<P>(v,cv),v));
+	}
+	return i;
+}
+
+template<class P>
+void OpConst(SIMD::Op op, float *a, const float c[4], unsigned int lanes, unsigned int count)
+{
+	if (lanes==0xf)
+	{
+		ScalarOpConst(op,a,c,lanes,count);
+		return;
+	}
+
+	unsigned int done=0;
+	switch (op)
+	{
+		case SIMD::ADD: done=OpConstLoop<P,AddF>(a,c,lanes,count); break;
+		case SIMD::SUB: done=OpConstLoop<P,SubF>(a,c,lanes,count); break;
+		case SIMD::MUL: done=OpConstLoop<P,MulF>(a,c,lanes,count); break;
+		case SIMD::MIN: done=OpConstLoop<P,MinF>(a,c,lanes,count); break;
+		case SIMD::MAX: done=OpConstLoop<P,MaxF>(a,c,lanes,count); break;
+	}
+	ScalarOpConst(op,a+done,c,lanes,count-done);
+}
+
+template<class P, class F>
+unsigned int OpArrayLoop(float *a, const float *b, unsigned int lanes, unsigned int count)
+{
+	typename P::V mask=P::Lanes(lanes);
+	unsigned int i=0;
+	for (; i+P::WIDTH<=count; i+=P::WIDTH)
+	{
+		typename P::V v=P::Load(a+i);
+		P::Store(a+i,Select<P>(mask,F::template Do<P>(v,P::Load(b+i)),v));
+	}
+	return i;
+}
+
+template<class P>
+void OpArray(SIMD::Op op, float *a, const float *b, unsigned int lanes, unsigned int count)
+{
+	if (lanes==0xf)
+	{
+		ScalarOpArray(op,a,b,lanes,count);
+		return;
+	}
+
+	unsigned int done=0;
+	switch (op)
+	{
+		case SIMD::ADD: done=OpArrayLoop<P,AddF>(a,b,lanes,count); break;
+		case SIMD::SUB: done=OpArrayLoop<P,SubF>(a,b,lanes,count); break;
+		case SIMD::MUL: done=OpArrayLoop<P,MulF>(a,b,lanes,count); break;
+		case SIMD::MIN: done=OpArrayLoop<P,MinF>(a,b,lanes,count); break;
+		case SIMD::MAX: done=OpArrayLoop<P,MaxF>(a,b,lanes,count); break;
+	}
+	ScalarOpArray(op,a+done,b+done,lanes,count-done);
+}
+
+template<class P, class F>
+unsigned int OpSplatLoop(float *a, const float *b, unsigned int lanes, unsigned int count)
+{
+	const unsigned int elements=P::WIDTH/4;
+	typename P::V mask=P::Lanes(lanes);
+	unsigned int i=0;
+	for (; i+elements<=count; i+=elements)
+	{
+		typename P::V v=P::Load(a+i*4);
+		P::Store(a+i*4,Select<P>(mask,F::template Do<P>(v,P::Splat(b+i)),v));
+	}
+	return i;
+}
+
+template<class P>
+void OpSplat(SIMD::Op op, float *a, const float *b, unsigned int lanes, unsigned int count)
+{
+	unsigned int done=0;
+	switch (op)
+	{
+		case SIMD::ADD: done=OpSplatLoop<P,AddF>(a,b,lanes,count); break;
+		case SIMD::SUB: done=OpSplatLoop<P,SubF>(a,b,lanes,count); break;
+		case SIMD::MUL: done=OpSplatLoop<P,MulF>(a,b,lanes,count); break;
+		case SIMD::MIN: done=OpSplatLoop<P,MinF>(a,b,lanes,count); break;
+		case SIMD::MAX: done=OpSplatLoop<P,MaxF>(a,b,lanes,count); break;
+	}
+	ScalarOpSplat(op,a+done*4,b+done,lanes,count-done);
+}
+
+template<class P>
+void Lerp(float *a, const float *b, float t, unsigned int lanes, unsigned int count)
+{
+	if (lanes==0xf)
+	{
+		ScalarLerp(a,b,t,lanes,count);
+		return;
+	}
+
+	typename P::V tv=P::Set1(t);
+	typename P::V mask=P::Lanes(lanes);
+	unsigned int i=0;
+	for (; i+P::WIDTH<=count; i+=P::WIDTH)
+	{
+		typename P::V v=P::Load(a+i);
+		typename P::V r=P::Add(v,P::Mul(P::Sub(P::Load(b+i),v),tv));
+		P::Store(a+i,Select<P>(mask,r,v));
+	}
+	ScalarLerp(a+i,b+i,t,lanes,count-i);
+}
+
+template<class P>
+void LerpConst(float *a, const float c[4], float t, unsigned int lanes, unsigned int count)
+{
+	typename P::V tv=P::Set1(t);
+	typename P::V cv=P::Pattern(c);
+	typename P::V mask=P::Lanes(lanes);
+	unsigned int i=0;
+	for (; i+P::WIDTH<=count; i+=P::WIDTH)
+	{
+		typename P::V v=P::Load(a+i);
+		typename P::V r=P::Add(v,P::Mul(P::Sub(cv,v),tv));
+		P::Store(a+i,Select<P>(mask,r,v));
+	}
+	ScalarLerpConst(a+i,c,t,lanes,count-i);
+}
+
+template<class P>
+void Transform(float *v, const float *m, bool persp, unsigned int count)
+{
+	const unsigned int elements=P::WIDTH/4;
+	typename P::V r0=P::Pattern(m), r1=P::Pattern(m+4), r2=P::Pattern(m+8), r3=P::Pattern(m+12);
+	unsigned int i=0;
+	for (; i+elements<=count; i+=elements)
+	{
+		typename P::V p=P::Load(v+i*4);
+		typename P::V t=P::Mul(P::template Broadcast<0>(p),r0);
+		t=P::Add(t,P::Mul(P::template Broadcast<1>(p),r1));
+		t=P::Add(t,P::Mul(P::template Broadcast<2>(p),r2));
+		t=P::Add(t,P::Mul(P::template Broadcast<3>(p),r3));
+		P::Store(v+i*4,t);
+		// dividing by w is rare, and testing each w after the store is
+		// quicker than doing it with masks
+		if (persp)
+		{
+			for (unsigned int n=0; n<elements; n++) Homog(v+(i+n)*4);
+		}
+	}
+	ScalarTransform(v+i*4,m,persp,count-i);
+}
+
+template<class P>
+void Normalise(float *v, float length, unsigned int count)
+{
+	typename P::V lv=P::Set1(length), zero=P::Set1(0);
+	unsigned int i=0;
+	// WIDTH elements at a time, transposed so x, y, z and w are in
+	// their own packs and one sqrt and divide covers all of them
+	for (; i+P::WIDTH<=count; i+=P::WIDTH)
+	{
+		float *e=v+i*4;
+		typename P::V x=P::Load(e), y=P::Load(e+P::WIDTH);
+		typename P::V z=P::Load(e+P::WIDTH*2), w=P::Load(e+P::WIDTH*3);
+		P::Transpose4(x,y,z,w);
+		typename P::V mag=P::Sqrt(P::Add(P::Add(P::Mul(x,x),P::Mul(y,y)),P::Mul(z,z)));
+		// zero length vectors stay zero
+		typename P::V scale=Select<P>(P::CmpEq(mag,zero),zero,P::Div(lv,mag));
+		x=P::Mul(x,scale);
+		y=P::Mul(y,scale);
+		z=P::Mul(z,scale);
+		P::Transpose4(x,y,z,w);
+		P::Store(e,x);
+		P::Store(e+P::WIDTH,y);
+		P::Store(e+P::WIDTH*2,z);
+		P::Store(e+P::WIDTH*3,w);
+	}
+	ScalarNormalise(v+i*4,length,count-i);
+}
+
+// sin and cos from the cephes single precision polynomials, with the
+// argument reduced to +/- pi/4 and the quadrant picking which one
+// to use. offset is 0 for sin and 1 for cos
+template<class P>
+inline typename P::V SinCos(typename P::V x, float offset)
+{
+	typedef typename P::V V;
+	V j=P::Round(P::Mul(x,P::Set1(0.63661977236758134308f))); // 2/pi
+	// pi/2 split into three parts so the reduction keeps its precision
+	V r=P::Sub(x,P::Mul(j,P::Set1(1.5703125f)));
+	r=P::Sub(r,P::Mul(j,P::Set1(4.837512969970703125e-4f)));
+	r=P::Sub(r,P::Mul(j,P::Set1(7.54978995489188216e-8f)));
+
+	// quadrant = (j+offset) mod 4, worked out without integers so
+	// it runs with plain avx
+	V q=P::Add(j,P::Set1(offset));
+	q=P::Sub(q,P::Mul(P::Set1(4),P::Round(P::Mul(P::Sub(q,P::Set1(1.5f)),P::Set1(0.25f)))));
+
+	V r2=P::Mul(r,r);
+	V s=P::Add(P::Mul(P::Set1(-1.9515295891e-4f),r2),P::Set1(8.3321608736e-3f));
+	s=P::Add(P::Mul(s,r2),P::Set1(-1.6666654611e-1f));
+	s=P::Add(P::Mul(P::Mul(s,r2),r),r);
+
+	V c=P::Add(P::Mul(P::Set1(2.443315711809948e-5f),r2),P::Set1(-1.388731625493765e-3f));
+	c=P::Add(P::Mul(c,r2),P::Set1(4.166664568298827e-2f));
+	c=P::Add(P::Mul(P::Mul(c,r2),r2),P::Sub(P::Set1(1),P::Mul(r2,P::Set1(0.5f))));
+
+	V odd=P::Or(P::CmpEq(q,P::Set1(1)),P::CmpEq(q,P::Set1(3)));
+	V negate=P::CmpGe(q,P::Set1(2));
+	V ret=Select<P>(odd,c,s);
+	return Select<P>(negate,P::Sub(P::Set1(0),ret),ret);
+}
+
+template<class P>
+void Sin(float *a, const float *b, unsigned int count)
+{
+	unsigned int i=0;
+	for (; i+P::WIDTH<=count; i+=P::WIDTH)
+	{
+		P::Store(a+i,SinCos<P>(P::Load(b+i),0));
+	}
+	ScalarSin(a+i,b+i,count-i);
+}
+
+template<class P>
+void Cos(float *a, const float *b, unsigned int count)
+{
+	unsigned int i=0;
+	for (; i+P::WIDTH<=count; i+=P::WIDTH)
+	{
+		P::Store(a+i,SinCos<P>(P::Load(b+i),1));
+	}
+	ScalarCos(a+i,b+i,count-i);
+}
+
+// the table for a pack type, written out in full so it's filled
+// in at compile time rather than by a static constructor
+#define SIMD_KERNELS(P) { OpConst<P>, OpArray<P>, OpSplat<P>, Lerp<P>, LerpConst<P>, \
+	Transform<P>, Normalise<P>, Sin<P>, Cos<P> }
+
+}
+
+#endif
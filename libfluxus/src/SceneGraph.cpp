@@ -17,10 +17,18 @@
 #include "SceneGraph.h"
 #include "PolyPrimitive.h"
 #include "PixelPrimitive.h"
+#include "Evaluator.h"
+#include <string.h>
+#include <algorithm>
 
 using namespace Fluxus;
 
 SceneGraph::SceneGraph() :
+m_RenderListDirty(true),
+m_StructureVersion(0),
+m_StateSort(false),
+m_AABBVersion(0),
+m_FrustumCulling(false),
 m_NumRendered(0),
 m_HighWater(0)
 {
@@ -32,7 +40,7 @@ SceneGraph::~SceneGraph()
 {
 }
 
-void SceneGraph::Render(ShadowVolumeGen *shadowgen, unsigned int camera, Mode rendermode)
+void SceneGraph::Render(ShadowVolumeGen *shadowgen, unsigned int camera)
 {
 	glGetFloatv(GL_MODELVIEW_MATRIX,m_TopTransform.arr());
 	
@@ -46,12 +54,111 @@ void SceneGraph::Render(ShadowVolumeGen *shadowgen, unsigned int camera, Mode re
 
 	m_NumRendered=0;
 
-	// render all the children of the root
-	for (vector<Node*>::iterator i=m_Root->Children.begin(); i!=m_Root->Children.end(); ++i)
+	if (m_RenderListDirty) BuildRenderList();
+	UpdateRenderList();
+	if (m_FrustumCulling) FrustumCull();
+
+	// the nodes which have applied their state, which stays
+	// in effect until all their children have been rendered
+	m_OpenNodes.clear();
+	m_DrawList.clear();
+
+	unsigned int i=0;
+	while (i<m_RenderList.Size())
 	{
-		RenderWalk((SceneNode*)*i,0,cameracode,shadowgen,rendermode);
+		while (!m_OpenNodes.empty() && m_RenderList.End[m_OpenNodes.back()]<=i)
+		{
+			m_RenderList.Nodes[m_OpenNodes.back()]->Prim->UnapplyState();
+			m_OpenNodes.pop_back();
+		}
+
+		SceneNode *node=m_RenderList.Nodes[i];
+		unsigned int hints=m_RenderList.Hints[i];
+
+		if ((m_RenderList.Visibility[i]&cameracode)==0)
+		{
+			// skip the whole subtree
+			i=m_RenderList.End[i];
+			continue;
+		}
+
+		bool visible = !(hints & HINT_FRUSTUM_CULL) || m_InFrustum[i];
+
+		if (visible && hints & HINT_DEPTH_SORT)
+		{
+			// render it later, and after depth sorting
+			int parent=m_RenderList.Parents[i];
+			if (parent==-1)
+			{
+				m_DepthSorter.Add(m_TopTransform,node->Prim,node->ID);
+			}
+			else
+			{
+				m_DepthSorter.Add(m_RenderList.World[parent],node->Prim,node->ID);
+			}
+		}
+		else if (visible && m_StateSort)
+		{
+			// render it later, grouped by state
+			m_DrawList.push_back(DrawItem(i,node->Prim->GetState()));
+		}
+		else if (!m_StateSort)
+		{
+			// the world matrices are already concatenated
+			glLoadMatrixf(m_RenderList.World[i].arr());
+			node->Prim->ApplyState(false);
+
+			if (visible)
+			{
+				glPushName(m_RenderList.IDs[i]);
+				node->Prim->Prerender();
+				node->Prim->Render();
+				glPopName();
+				m_OpenNodes.push_back(i);
+			}
+			else
+			{
+				node->Prim->UnapplyState();
+			}
+		}
+
+		if (visible) m_NumRendered++;
+
+		if (hints & HINT_CAST_SHADOW)
+		{
+			shadowgen->Generate(node->Prim);
+		}
+
+		// culled nodes hide their children too
+		if (visible) i++;
+		else i=m_RenderList.End[i];
+	}
+
+	while (!m_OpenNodes.empty())
+	{
+		m_RenderList.Nodes[m_OpenNodes.back()]->Prim->UnapplyState();
+		m_OpenNodes.pop_back();
+	}
+
+	if (m_StateSort)
+	{
+		sort(m_DrawList.begin(),m_DrawList.end());
+
+		for (vector<DrawItem>::iterator d=m_DrawList.begin(); d!=m_DrawList.end(); ++d)
+		{
+			Primitive *prim=m_RenderList.Nodes[d->Index]->Prim;
+			glLoadMatrixf(m_RenderList.World[d->Index].arr());
+			prim->ApplyState(false);
+			glPushName(m_RenderList.IDs[d->Index]);
+			prim->Prerender();
+			prim->Render();
+			glPopName();
+			prim->UnapplyState();
+		}
 	}
 
+	glLoadMatrixf(m_TopTransform.arr());
+
 	// now render the depth sorted primitives:
 	m_DepthSorter.Render();
 	m_DepthSorter.Clear();
@@ -59,71 +166,269 @@ void SceneGraph::Render(ShadowVolumeGen *shadowgen, unsigned int camera, Mode re
 	if (m_NumRendered>m_HighWater) m_HighWater=m_NumRendered;
 }
 
-void SceneGraph::RenderWalk(SceneNode *node,  int depth, unsigned int cameracode, ShadowVolumeGen *shadowgen, Mode rendermode)
+void SceneGraph::UpdateRenderList()
 {
-	// max gl matrix stack is 32
-	/*if (depth>=30)
+	m_FrustumCulling=false;
+
+	// pick up this frame's transforms and hints, the parents
+	// always come before their children so a single pass
+	// concatenates the world matrices
+	for (unsigned int i=0; i<m_RenderList.Size(); i++)
 	{
-		Trace::Stream<<"SceneGraph::RenderWalk: max stack reached"<<endl;
-		return;
-	}*/
+		SceneNode *node=m_RenderList.Nodes[i];
+		const State *state=node->Prim->GetState();
+		m_RenderList.Hints[i]=state->Hints;
+		m_RenderList.Visibility[i]=node->Prim->GetVisibility();
+		if (state->Hints & HINT_FRUSTUM_CULL) m_FrustumCulling=true;
+
+		int parent=m_RenderList.Parents[i];
+
+		// if we are a lazy parent then we need to ignore
+		// the effects of the heirachical transform - we
+		// treat their transform as a world space one
+		if (parent==-1 || state->Hints & HINT_LAZY_PARENT)
+		{
+			m_RenderList.Global[i]=state->Transform;
+		}
+		else
+		{
+			m_RenderList.Global[i]=m_RenderList.Global[parent]*state->Transform;
+		}
+		m_RenderList.World[i]=m_TopTransform*m_RenderList.Global[i];
 
-	if ((node->Prim->GetVisibility()&cameracode)==0) return;
-	if (rendermode==SELECT && !node->Prim->IsSelectable()) return;
+		// refit the bounding box if the node's points have
+		// changed, or it has moved
+		const dMatrix &global=m_RenderList.Global[i];
+		unsigned int version=PositionsVersion(node);
+		if (version!=node->m_PositionsVersion)
+		{
+			node->m_LocalAABB=node->Prim->GetBoundingBox(dMatrix());
+			node->m_PositionsVersion=version;
+			RefitAABB(node,global);
+		}
+		else if (memcmp(global.m,node->m_AABBTransform.m,sizeof(global.m)))
+		{
+			RefitAABB(node,global);
+		}
+	}
+	m_AABBVersion=PData::GetLatestVersion();
+}
 
-	dMatrix parent;
-	// see if we need the parent (result of all the parents) transform
-	if (node->Prim->GetState()->Hints & HINT_DEPTH_SORT)
+unsigned int SceneGraph::PositionsVersion(SceneNode *node)
+{
+	if (node->m_PositionsLayout!=node->Prim->GetLayoutVersion())
 	{
-		glGetFloatv(GL_MODELVIEW_MATRIX,parent.arr());
+		node->m_Positions=node->Prim->GetDataRawConst("p");
+		node->m_PositionsLayout=node->Prim->GetLayoutVersion();
 	}
+	return node->m_Positions?node->m_Positions->GetVersion():0;
+}
 
-	glPushMatrix();
+void SceneGraph::RefitAABB(SceneNode *node, const dMatrix &global)
+{
+	dVector corners[8];
+	node->m_LocalAABB.getvertices(corners);
+	node->m_GlobalAABB=dBoundingBox();
+	if (!node->m_LocalAABB.empty())
+	{
+		for (int c=0; c<8; c++)
+		{
+			node->m_GlobalAABB.expand(global.transform(corners[c]));
+		}
+	}
+	node->m_AABBTransform=global;
+	m_BVH.Update(node->m_BVHLeaf,node->m_GlobalAABB);
+}
 
-	// if we are a lazy parent then we need to ignore
-	// the effects of the heirachical transform - we
-	// treat their transform as a world space one
-	if (node->Prim->GetState()->Hints & HINT_LAZY_PARENT)
+void SceneGraph::RefreshAABBs()
+{
+	// transforms don't have versions, so they are all 
+	// checked, concatenated on the way down as in 
+	// UpdateRenderList
+	if (m_Root==NULL) return;
+	dMatrix identity;
+	for (vector<Node*>::iterator i=m_Root->Children.begin(); i!=m_Root->Children.end(); ++i)
 	{
-		glLoadMatrixf(m_TopTransform.arr());
+		RefreshAABBsWalk(static_cast<SceneNode*>(*i),identity);
 	}
+	m_AABBVersion=PData::GetLatestVersion();
+}
 
+void SceneGraph::RefreshAABBsWalk(SceneNode *node, const dMatrix &parent)
+{
+	const State *state=node->Prim->GetState();
+	dMatrix global;
+	if (state->Hints & HINT_LAZY_PARENT) global=state->Transform;
+	else global=parent*state->Transform;
+
+	// only look at the points if some pdata has changed
+	unsigned int version=node->m_PositionsVersion;
+	if (PData::GetLatestVersion()!=m_AABBVersion) version=PositionsVersion(node);
+	if (version!=node->m_PositionsVersion)
+	{
+		node->m_LocalAABB=node->Prim->GetBoundingBox(dMatrix());
+		node->m_PositionsVersion=version;
+		RefitAABB(node,global);
+	}
+	else if (memcmp(global.m,node->m_AABBTransform.m,sizeof(global.m)))
+	{
+		RefitAABB(node,global);
+	}
 
-	node->Prim->ApplyState();
+	for (vector<Node*>::iterator i=node->Children.begin(); i!=node->Children.end(); ++i)
+	{
+		RefreshAABBsWalk(static_cast<SceneNode*>(*i),global);
+	}
+}
 
-	if (!(node->Prim->GetState()->Hints & HINT_FRUSTUM_CULL) || FrustumClip(node))
+void SceneGraph::BuildRenderList()
+{
+	m_RenderList.Clear();
+	if (m_Root)
 	{
-		if (node->Prim->GetState()->Hints & HINT_DEPTH_SORT)
+		for (vector<Node*>::iterator i=m_Root->Children.begin(); i!=m_Root->Children.end(); ++i)
 		{
-			// render it later, and after depth sorting
-			m_DepthSorter.Add(parent,node->Prim,node->ID);
+			BuildRenderListWalk((SceneNode*)*i,-1);
 		}
-		else
+	}
+	m_RenderListDirty=false;
+}
+
+void SceneGraph::BuildRenderListWalk(SceneNode *node, int parent)
+{
+	unsigned int index=m_RenderList.Size();
+	m_RenderList.Add(node,parent);
+	for (vector<Node*>::iterator i=node->Children.begin(); i!=node->Children.end(); ++i)
+	{
+		BuildRenderListWalk((SceneNode*)*i,index);
+	}
+	m_RenderList.End[index]=m_RenderList.Size();
+}
+
+bool SceneGraph::DrawItem::operator<(const DrawItem &other) const
+{
+	// the most expensive changes first
+	// shaders made from the same pair share a program
+	unsigned int program=StateRef->Shader?StateRef->Shader->GetProgram():0;
+	unsigned int otherprogram=other.StateRef->Shader?other.StateRef->Shader->GetProgram():0;
+	if (program!=otherprogram) return program<otherprogram;
+	if (StateRef->Shader!=other.StateRef->Shader) return StateRef->Shader<other.StateRef->Shader;
+	for (int n=0; n<MAX_TEXTURES; n++)
+	{
+		if (StateRef->Textures[n]!=other.StateRef->Textures[n]) 
 		{
-			glPushName(node->ID);
-			node->Prim->Prerender();
-			node->Prim->Render();
-			glPopName();
+			return StateRef->Textures[n]<other.StateRef->Textures[n];
 		}
+	}
+	if (StateRef->Hints!=other.StateRef->Hints) return StateRef->Hints<other.StateRef->Hints;
+	if (StateRef->SourceBlend!=other.StateRef->SourceBlend) return StateRef->SourceBlend<other.StateRef->SourceBlend;
+	if (StateRef->DestinationBlend!=other.StateRef->DestinationBlend) return StateRef->DestinationBlend<other.StateRef->DestinationBlend;
+	if (StateRef->Cull!=other.StateRef->Cull) return StateRef->Cull<other.StateRef->Cull;
+	// keep the scene order within the same state
+	return Index<other.Index;
+}
+
+void SceneGraph::RenderList::Clear()
+{
+	Nodes.clear();
+	IDs.clear();
+	Parents.clear();
+	End.clear();
+	World.clear();
+	Global.clear();
+	Hints.clear();
+	Visibility.clear();
+}
+
+void SceneGraph::RenderList::Add(SceneNode *node, int parent)
+{
+	node->m_RenderIndex=Nodes.size();
+	Nodes.push_back(node);
+	IDs.push_back(node->ID);
+	Parents.push_back(parent);
+	End.push_back(Nodes.size());
+	World.push_back(dMatrix());
+	Global.push_back(dMatrix());
+	Hints.push_back(0);
+	Visibility.push_back(0);
+}
+
+int SceneGraph::AddNode(int ParentID, Node *node)
+{
+	bool root=(m_Root==NULL);
+	int ret=Tree::AddNode(ParentID,node);
+	m_StructureVersion++;
 
-		m_NumRendered++;
-		depth++;
+	if (ret!=0 && !root)
+	{
+		SceneNode *scenenode=(SceneNode*)node;
+		scenenode->m_BVHLeaf=m_BVH.Insert(scenenode->m_GlobalAABB,scenenode);
+	}
+
+	if (ret==0 || root || m_RenderListDirty)
+	{
+		m_RenderListDirty=true;
+		return ret;
+	}
 
-		for (vector<Node*>::iterator i=node->Children.begin(); i!=node->Children.end(); ++i)
+	// the common case is adding to the end of the depth
+	// first order, (to the root, or to the last subtree)
+	// which we can do without a rebuild
+	SceneNode *scenenode=(SceneNode*)node;
+	if (node->Parent==m_Root)
+	{
+		m_RenderList.Add(scenenode,-1);
+		return ret;
+	}
+
+	unsigned int parent=((SceneNode*)node->Parent)->m_RenderIndex;
+	if (m_RenderList.End[parent]==m_RenderList.Size())
+	{
+		m_RenderList.Add(scenenode,parent);
+		// all the ancestors' subtrees end here too
+		for (int p=parent; p!=-1; p=m_RenderList.Parents[p])
 		{
-			RenderWalk((SceneNode*)*i,depth,cameracode,shadowgen,rendermode);
+			m_RenderList.End[p]=m_RenderList.Size();
 		}
 	}
+	else
+	{
+		m_RenderListDirty=true;
+	}
+	return ret;
+}
+
+void SceneGraph::RemoveNode(Node *node)
+{
+	RemoveLeaves(node);
+	Tree::RemoveNode(node);
+	m_RenderListDirty=true;
+	m_StructureVersion++;
+}
 
-	node->Prim->UnapplyState();
-	glPopMatrix();
+void SceneGraph::RemoveLeaves(Node *node)
+{
+	if (node==NULL) return;
+	SceneNode *scenenode=(SceneNode*)node;
+	if (scenenode->m_BVHLeaf!=-1)
+	{
+		m_BVH.Remove(scenenode->m_BVHLeaf);
+		scenenode->m_BVHLeaf=-1;
+	}
 
-	if (node->Prim->GetState()->Hints & HINT_CAST_SHADOW)
+	for (vector<Node*>::iterator i=node->Children.begin(); i!=node->Children.end(); ++i)
 	{
-		shadowgen->Generate(node->Prim);
+		RemoveLeaves(*i);
 	}
 }
 
+void SceneGraph::ReparentNode(int NodeID, int NewParentID)
+{
+	Tree::ReparentNode(NodeID,NewParentID);
+	m_RenderListDirty=true;
+	m_StructureVersion++;
+}
+
 // from Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix
 // by Gil Gribb and Klaus Hartmann, thanks to flipcode
 void SceneGraph::GetFrustumPlanes(dPlane *planes, dMatrix m, bool normalise)
@@ -172,17 +477,18 @@ void SceneGraph::GetFrustumPlanes(dPlane *planes, dMatrix m, bool normalise)
 }
 
 
-bool SceneGraph::FrustumClip(SceneNode *node)
+void SceneGraph::FrustumCull()
 {
-	// do the frustum clip
-  	for (int n=0; n<6; n++)
-	{	
-		if (!Intersect(m_FrustumPlanes[n], node, 0))
-		{
-			return false;
-		}
+	// mark the nodes the bounding volume hierarchy
+	// finds inside all the frustum planes
+	m_InFrustum.assign(m_RenderList.Size(),0);
+	m_QueryResult.clear();
+	m_BVH.Intersect(m_FrustumPlanes,6,m_QueryResult);
+	for (vector<void*>::iterator i=m_QueryResult.begin(); i!=m_QueryResult.end(); ++i)
+	{
+		unsigned int index=static_cast<SceneNode*>(*i)->m_RenderIndex;
+		if (index<m_InFrustum.size()) m_InFrustum[index]=1;
 	}
-	return true;
 }
 
 void SceneGraph::CohenSutherland(const dVector &p, char &cs)
@@ -216,6 +522,8 @@ void SceneGraph::Detach(SceneNode *node)
 		node->Parent->RemoveChild(node->ID);
 		m_Root->Children.push_back(node);
 		node->Parent=m_Root;
+		m_RenderListDirty=true;
+		m_StructureVersion++;
 	}
 }
 
@@ -307,7 +615,12 @@ void SceneGraph::Clear()
 	
 void SceneGraph::RecalcAABB(SceneNode *node)
 {
-	node->m_GlobalAABB=node->Prim->GetBoundingBox(GetGlobalTransform(node));
+	dMatrix global=GetGlobalTransform(node);
+	node->m_GlobalAABB=node->Prim->GetBoundingBox(global);
+	node->m_LocalAABB=node->Prim->GetBoundingBox(dMatrix());
+	node->m_PositionsVersion=PositionsVersion(node);
+	node->m_AABBTransform=global;
+	m_BVH.Update(node->m_BVHLeaf,node->m_GlobalAABB);
 }
 
 bool SceneGraph::Intersect(const SceneNode *a, const SceneNode *b, float threshold)
@@ -325,6 +638,114 @@ bool SceneGraph::Intersect(const dPlane &plane, const SceneNode *node, float thr
 	return node->m_GlobalAABB.inside(plane,threshold);
 }
 
+void SceneGraph::Intersect(const SceneNode *node, float threshold, vector<int> &ids)
+{
+	m_QueryResult.clear();
+	m_BVH.Intersect(node->m_GlobalAABB,threshold,m_QueryResult);
+	for (vector<void*>::iterator i=m_QueryResult.begin(); i!=m_QueryResult.end(); ++i)
+	{
+		if (*i!=node) ids.push_back(static_cast<SceneNode*>(*i)->ID);
+	}
+}
+
+void SceneGraph::Intersect(const dVector &point, float threshold, vector<int> &ids)
+{
+	m_QueryResult.clear();
+	m_BVH.Intersect(point,threshold,m_QueryResult);
+	for (vector<void*>::iterator i=m_QueryResult.begin(); i!=m_QueryResult.end(); ++i)
+	{
+		ids.push_back(static_cast<SceneNode*>(*i)->ID);
+	}
+}
+
+void SceneGraph::Intersect(const dVector &start, const dVector &end, vector<int> &ids)
+{
+	vector<pair<float,void*> > hits;
+	m_BVH.Intersect(start,end,hits);
+	sort(hits.begin(),hits.end());
+	for (vector<pair<float,void*> >::iterator i=hits.begin(); i!=hits.end(); ++i)
+	{
+		ids.push_back(static_cast<SceneNode*>(i->second)->ID);
+	}
+}
+
+bool SceneGraph::Pickable(const SceneNode *node, unsigned int cameracode) const
+{
+	// hidden or unselectable parents hide their children too
+	while (node!=NULL && node->Prim!=NULL)
+	{
+		if ((node->Prim->GetVisibility()&cameracode)==0 ||
+			!node->Prim->IsSelectable())
+		{
+			return false;
+		}
+		node=static_cast<const SceneNode*>(node->Parent);
+	}
+	return true;
+}
+
+int SceneGraph::Pick(const dVector &start, const dVector &end, unsigned int camera)
+{
+	unsigned int cameracode = 1<<camera;
+	RefreshAABBs();
+	vector<pair<float,void*> > hits;
+	m_BVH.Intersect(start,end,hits);
+	sort(hits.begin(),hits.end());
+
+	int closest=0;
+	float closestt=2.0f;
+	for (vector<pair<float,void*> >::iterator i=hits.begin(); i!=hits.end(); ++i)
+	{
+		// nothing further along can be closer
+		if (i->first>closestt) break;
+
+		SceneNode *node=static_cast<SceneNode*>(i->second);
+		if (!Pickable(node,cameracode)) continue;
+
+		Evaluator *eval=node->Prim->MakeEvaluator();
+		if (eval)
+		{
+			// test the actual geometry, in the primitive's space
+			dMatrix inv=GetGlobalTransform(node).inverse();
+			vector<Evaluator::Point> points;
+			eval->IntersectLine(inv.transform(start),inv.transform(end),points);
+			for (vector<Evaluator::Point>::iterator p=points.begin(); p!=points.end(); ++p)
+			{
+				if (p->m_T<closestt)
+				{
+					closestt=p->m_T;
+					closest=node->ID;
+				}
+				for (vector<Evaluator::Blend*>::iterator b=p->m_Blends.begin(); b!=p->m_Blends.end(); ++b)
+				{
+					delete *b;
+				}
+			}
+			delete eval;
+		}
+		else
+		{
+			// no geometry to test, so the bounding box will have to do
+			closestt=i->first;
+			closest=node->ID;
+		}
+	}
+	return closest;
+}
+
+void SceneGraph::Pick(const dPlane *planes, int numplanes, unsigned int camera, vector<int> &ids)
+{
+	unsigned int cameracode = 1<<camera;
+	RefreshAABBs();
+	m_QueryResult.clear();
+	m_BVH.Intersect(planes,numplanes,m_QueryResult);
+	for (vector<void*>::iterator i=m_QueryResult.begin(); i!=m_QueryResult.end(); ++i)
+	{
+		SceneNode *node=static_cast<SceneNode*>(*i);
+		if (Pickable(node,cameracode)) ids.push_back(node->ID);
+	}
+}
+
 void SceneGraph::RenderAxes()
 {
 	glDisable(GL_LIGHTING);
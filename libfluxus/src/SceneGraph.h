@@ -23,6 +23,7 @@
 #include "State.h"
 #include "ShadowVolumeGen.h"
 #include "DepthSorter.h"
+#include "AABBTree.h"
 
 using namespace std;
 
@@ -36,10 +37,24 @@ namespace Fluxus
 class SceneNode : public Node
 {
 public:
-	SceneNode(Primitive *p) : Prim(p) {}
+	SceneNode(Primitive *p) : Prim(p), m_RenderIndex(0), m_BVHLeaf(-1),
+		m_Positions(NULL), m_PositionsLayout(0), m_PositionsVersion(0) {}
 	virtual ~SceneNode() { if (Prim) delete Prim; }
 	Primitive *Prim;
 	dBoundingBox m_GlobalAABB;
+	/// The primitive's own bounding box, and the global 
+	/// transform m_GlobalAABB was last made with
+	dBoundingBox m_LocalAABB;
+	dMatrix m_AABBTransform;
+	/// Position in the scenegraph's render list
+	unsigned int m_RenderIndex;
+	/// Leaf in the scenegraph's bounding volume hierarchy
+	int m_BVHLeaf;
+	/// The primitive's "p" array, cached until its pdata layout
+	/// changes, and the version m_LocalAABB was made from
+	const PData *m_Positions;
+	unsigned int m_PositionsLayout;
+	unsigned int m_PositionsVersion;
 };
 
 istream &operator>>(istream &s, SceneNode &o);
@@ -53,15 +68,31 @@ public:
 	SceneGraph();
 	~SceneGraph();
 
-	enum Mode{RENDER,SELECT};
-
 	/// Traverses the graph depth first, rendering
 	/// all nodes
-	void Render(ShadowVolumeGen *shadowgen, unsigned int camera, Mode rendermode=RENDER);
+	void Render(ShadowVolumeGen *shadowgen, unsigned int camera);
 
 	/// Clears the graph of all primitives
 	virtual void Clear();
 
+	/// Draws the primitives grouped by state rather than in
+	/// scene order, so fewer gl state changes are needed.
+	/// Only suitable if the draw order doesn't matter, and
+	/// hints are not inherited by children while on
+	void SetStateSort(bool s) { m_StateSort=s; }
+	bool GetStateSort() { return m_StateSort; }
+
+	///@name Tree overrides, to keep the render list up to date
+	///@{
+	virtual int AddNode(int ParentID, Node *node);
+	virtual void RemoveNode(Node *node);
+	virtual void ReparentNode(int NodeID, int NewParentID);
+	///@}
+
+	/// Changes whenever nodes are added, removed or reparented,
+	/// so flattened lists of nodes can be cached until it does
+	unsigned int GetStructureVersion() const { return m_StructureVersion; }
+
 	/// Parents the node to the root, and sets its
 	/// transform to keep it physically in the same
 	/// place in the world.
@@ -90,6 +121,26 @@ public:
 	bool Intersect(const dVector &point, const SceneNode *node, float threshold);
 	bool Intersect(const dPlane &plane, const SceneNode *node, float threshold);
 
+	///@name Bounding box queries
+	/// Use the bounding volume hierarchy to find all the 
+	/// nodes which intersect, returning their ids
+	///@{
+	void Intersect(const SceneNode *node, float threshold, vector<int> &ids);
+	void Intersect(const dVector &point, float threshold, vector<int> &ids);
+	/// Sorted by distance from the start
+	void Intersect(const dVector &start, const dVector &end, vector<int> &ids);
+	///@}
+
+	///@name Picking
+	///@{
+	/// Returns the id of the closest selectable node hit by the
+	/// line, using the primitive's evaluator for the exact hit 
+	/// if it has one, or 0 for none
+	int Pick(const dVector &start, const dVector &end, unsigned int camera);
+	/// Gets all selectable nodes inside the planes
+	void Pick(const dPlane *planes, int numplanes, unsigned int camera, vector<int> &ids);
+	///@}
+
 	/// Some statistics
 	unsigned int GetNumRendered() { return m_NumRendered; }
 	unsigned int GetHighWater() { return m_HighWater; }
@@ -97,16 +148,74 @@ public:
 	/// Render origin
 	static void RenderAxes();
 
+	/// Extracts the clipping planes from a projection matrix
+	static void GetFrustumPlanes(dPlane *planes, dMatrix m, bool normalise);
+
 private:
-	void RenderWalk(SceneNode *node, int depth, unsigned int cameracode, ShadowVolumeGen *shadowgen, Mode rendermode);
+	/// The tree flattened depth first into arrays, so
+	/// rendering is a linear pass rather than a walk
+	/// of the heap allocated nodes. Each node's subtree
+	/// is the range [index,End) so it can be skipped
+	/// in one step when culled.
+	struct RenderList
+	{
+		void Clear();
+		void Add(SceneNode *node, int parent);
+		unsigned int Size() const { return Nodes.size(); }
+
+		vector<SceneNode*> Nodes;
+		vector<int> IDs;
+		vector<int> Parents; // -1 for children of the root
+		vector<unsigned int> End;
+		vector<dMatrix> World;
+		vector<dMatrix> Global; // without the camera
+		vector<unsigned int> Hints;
+		vector<unsigned int> Visibility;
+	};
+
+	/// A deferred draw for state sorting
+	struct DrawItem
+	{
+		DrawItem(unsigned int i, const State *s) : Index(i), StateRef(s) {}
+		bool operator<(const DrawItem &other) const;
+
+		unsigned int Index;
+		const State *StateRef;
+	};
+
+	void BuildRenderList();
+	void BuildRenderListWalk(SceneNode *node, int parent);
+	void UpdateRenderList();
 	void GetBoundingBox(SceneNode *node, dMatrix mat, dBoundingBox &result);
-	bool FrustumClip(SceneNode *node);
+	void FrustumCull();
+	bool Pickable(const SceneNode *node, unsigned int cameracode) const;
+	/// The version of the node's "p" array, or 0 if it has none
+	unsigned int PositionsVersion(SceneNode *node);
+	/// Transforms the node's local box into the hierarchy
+	void RefitAABB(SceneNode *node, const dMatrix &global);
+	/// Refits the nodes whose points or transforms have changed 
+	/// since they were last fitted, so picking sees what scripts 
+	/// have done since the last frame
+	void RefreshAABBs();
+	void RefreshAABBsWalk(SceneNode *node, const dMatrix &parent);
+	void RemoveLeaves(Node *node);
 	void CohenSutherland(const dVector &p, char &cs);
-	void GetFrustumPlanes(dPlane *planes, dMatrix m, bool normalise);
 
 	DepthSorter m_DepthSorter;
+	RenderList m_RenderList;
+	bool m_RenderListDirty;
+	unsigned int m_StructureVersion;
+	vector<unsigned int> m_OpenNodes;
+	bool m_StateSort;
+	vector<DrawItem> m_DrawList;
 	dMatrix m_TopTransform;
 	dPlane m_FrustumPlanes[6];
+	AABBTree m_BVH;
+	/// PData::GetLatestVersion when the boxes were last brought up to date
+	unsigned int m_AABBVersion;
+	vector<void*> m_QueryResult;
+	vector<char> m_InFrustum;
+	bool m_FrustumCulling;
 
 	unsigned int m_NumRendered;
 	unsigned int m_HighWater;
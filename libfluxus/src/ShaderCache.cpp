@@ -14,11 +14,66 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <errno.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include "ShaderCache.h"
+#include "Trace.h"
 
 using namespace Fluxus;
+
+// binaries not used for this long are deleted
+static const time_t BINARY_EXPIRE = 30*24*60*60;
+static const char BINARY_MAGIC[8] = {'F','L','X','P','R','O','G','1'};
+// format, driver, vertex, fragment and binary lengths
+static const unsigned int BINARY_HEADER = sizeof(BINARY_MAGIC)+5*sizeof(unsigned int);
+
+static string DefaultBinaryDir()
+{
+	const char *cache = getenv("XDG_CACHE_HOME");
+	if (cache!=NULL && cache[0]!='\0') return string(cache)+"/fluxus/shaders";
+	const char *home = getenv("HOME");
+	if (home!=NULL) return string(home)+"/.cache/fluxus/shaders";
+	return "";
+}
+
+// like mkdir -p
+static bool MakeDirectory(const string &path)
+{
+	for (size_t i=1; i<=path.size(); i++)
+	{
+		if (i==path.size() || path[i]=='/')
+		{
+			if (mkdir(path.substr(0,i).c_str(),0755)!=0 && errno!=EEXIST) return false;
+		}
+	}
+	return true;
+}
+
+static unsigned long long Hash(unsigned long long h, const string &s)
+{
+	// fnv-1a, with the terminator so the strings can't run together
+	for (string::const_iterator i=s.begin(); i!=s.end(); ++i)
+	{
+		h = (h^(unsigned char)*i)*1099511628211ULL;
+	}
+	return h*1099511628211ULL;
+}
 	
-std::map<std::string,GLSLShaderPair *> ShaderCache::m_Cache;
+std::map<std::string,GLSLProgram *> ShaderCache::m_Cache;
+std::map<std::string,GLSLProgram *> ShaderCache::m_SourceCache;
+std::string ShaderCache::m_BinaryDir = DefaultBinaryDir();
+std::string ShaderCache::m_Driver;
+bool ShaderCache::m_BinaryChecked = false;
+unsigned int ShaderCache::m_BinaryHits = 0;
+unsigned int ShaderCache::m_BinaryMisses = 0;
 	
 ShaderCache::ShaderCache()
 {
@@ -28,43 +83,245 @@ ShaderCache::~ShaderCache()
 {
 	Clear();
 }
+
+GLSLShader *ShaderCache::Share(map<string,GLSLProgram *> &cache, const string &key,
+	bool load, const string &vert, const string &frag)
+{
+	// look in the cache, and share it if it is there
+	map<string, GLSLProgram *>::iterator i = cache.find(key);
+	if (i!=cache.end()) return new GLSLShader(i->second);
+	
+	GLSLShaderPair pair(load,vert,frag);
+	GLSLProgram *program = NULL;
+	string path = BinaryPath(pair);
+	if (!path.empty())
+	{
+		program = LoadBinary(pair,path);
+		if (program!=NULL) m_BinaryHits++;
+		else m_BinaryMisses++;
+	}
+
+	if (program==NULL)
+	{
+		// the program keeps hold of the compiled shaders it needs
+		pair.Compile();
+		program = new GLSLProgram(pair,!path.empty());
+		if (!path.empty() && program->IsValid()) SaveBinary(pair,path,program);
+	}
+	cache[key] = program;
+	return new GLSLShader(program);
+}
 	
 GLSLShader *ShaderCache::Get(const string &vert, const string &frag)
 {
-	// look in the cache, and copy it if it is there
-	string key = vert+" "+frag;
-	map<string, GLSLShaderPair *>::iterator i = m_Cache.find(key);
-	if (i!=m_Cache.end()) return new GLSLShader(*i->second);
-	
-	GLSLShaderPair *pair = new GLSLShaderPair(true,vert,frag);
-	m_Cache[key] = pair;
-	return new GLSLShader(*pair);
+	return Share(m_Cache,vert+" "+frag,true,vert,frag);
 }
 
 GLSLShader *ShaderCache::Make(const string &vertsource, const string &fragsource)
 {	
-	GLSLShaderPair *pair = new GLSLShaderPair(false,vertsource,fragsource);
-	GLSLShader *shader = new GLSLShader(*pair);
-	delete pair;
-	return shader;
+	string key = vertsource;
+	key += '\0';
+	key += fragsource;
+	
+	if (m_SourceCache.find(key)==m_SourceCache.end())
+	{
+		// sources are edited a lot while livecoding, so let go of the
+		// programs nothing is using any more before linking a new one
+		for (map<string, GLSLProgram *>::iterator i=m_SourceCache.begin();
+			i!=m_SourceCache.end();)
+		{
+			if (i->second->GetRefCount()==1)
+			{
+				delete i->second;
+				m_SourceCache.erase(i++);
+			}
+			else ++i;
+		}
+	}
+	
+	return Share(m_SourceCache,key,false,vertsource,fragsource);
 }
 
-void ShaderCache::Clear()
+void ShaderCache::Release(map<string,GLSLProgram *> &cache)
 {
-	for (map<string, GLSLShaderPair *>::iterator i=m_Cache.begin();
-		i!=m_Cache.end(); ++i)
+	for (map<string, GLSLProgram *>::iterator i=cache.begin();
+		i!=cache.end(); ++i)
 	{
-		delete i->second;
+		if (i->second->DecRef()) delete i->second;
 	}
-	m_Cache.clear();
+	cache.clear();
+}
+
+void ShaderCache::Clear()
+{
+	Release(m_Cache);
+	Release(m_SourceCache);
 }
 
 void ShaderCache::Dump()
 {
-	for (map<string, GLSLShaderPair *>::iterator i=m_Cache.begin();
+	for (map<string, GLSLProgram *>::iterator i=m_Cache.begin();
 		i!=m_Cache.end(); ++i)
 	{
-		Trace::Stream<<i->first<<endl;
+		Trace::Stream<<i->first<<" used by "<<i->second->GetRefCount()-1<<endl;
+	}
+	Trace::Stream<<m_SourceCache.size()<<" from source"<<endl;
+	Trace::Stream<<m_BinaryHits<<" binaries loaded, "<<m_BinaryMisses<<" compiled"<<endl;
+}
+
+void ShaderCache::SetBinaryDir(const string &dir)
+{
+	m_BinaryDir = dir;
+	m_BinaryChecked = false;
+}
+
+string ShaderCache::BinaryPath(const GLSLShaderPair &pair)
+{
+	#ifdef GLSL
+	if (!GLSLShader::m_Enabled) return "";
+
+	if (!m_BinaryChecked)
+	{
+		m_BinaryChecked = true;
+		m_Driver = "";
+		GLint formats = 0;
+		if (glewIsSupported("GL_ARB_get_program_binary"))
+		{
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		}
+
+		if (formats>0 && !m_BinaryDir.empty())
+		{
+			if (MakeDirectory(m_BinaryDir))
+			{
+				// the binaries only work with the driver they came from
+				m_Driver = string((const char*)glGetString(GL_VENDOR))+"\n"+
+					(const char*)glGetString(GL_RENDERER)+"\n"+
+					(const char*)glGetString(GL_VERSION);
+				PruneBinaries();
+			}
+			else
+			{
+				Trace::Stream<<"Couldn't make shader cache directory ["<<m_BinaryDir<<"]"<<endl;
+			}
+		}
+	}
+
+	if (m_Driver.empty()) return "";
+
+	unsigned long long h = 14695981039346656037ULL;
+	h = Hash(h,m_Driver);
+	h = Hash(h,pair.GetVertexSource());
+	h = Hash(h,pair.GetFragmentSource());
+	char name[32];
+	snprintf(name,sizeof(name),"%016llx.bin",h);
+	return m_BinaryDir+"/"+name;
+	#else
+	return "";
+	#endif
+}
+
+GLSLProgram *ShaderCache::LoadBinary(const GLSLShaderPair &pair, const string &path)
+{
+	FILE *file = fopen(path.c_str(),"rb");
+	if (!file) return NULL;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	vector<char> data(size>0?size:0);
+	bool ok = size>(long)BINARY_HEADER && fread(&data[0],1,size,file)==(size_t)size;
+	fclose(file);
+	if (!ok || memcmp(&data[0],BINARY_MAGIC,sizeof(BINARY_MAGIC))!=0) return NULL;
+
+	unsigned int header[5];
+	memcpy(header,&data[sizeof(BINARY_MAGIC)],sizeof(header));
+	unsigned int format = header[0];
+	const char *driver = &data[BINARY_HEADER];
+	const char *vert = driver+header[1];
+	const char *frag = vert+header[2];
+	const char *binary = frag+header[3];
+	if ((unsigned long)size!=(unsigned long)BINARY_HEADER+header[1]+header[2]+header[3]+header[4]) return NULL;
+
+	// check it really is the same, in case the hashes collide
+	if (m_Driver.compare(0,string::npos,driver,header[1])!=0 ||
+		pair.GetVertexSource().compare(0,string::npos,vert,header[2])!=0 ||
+		pair.GetFragmentSource().compare(0,string::npos,frag,header[3])!=0)
+	{
+		return NULL;
+	}
+
+	GLSLProgram *program = new GLSLProgram(format,vector<char>(binary,binary+header[4]));
+	if (!program->IsValid())
+	{
+		delete program;
+		return NULL;
+	}
+
+	// so it's not pruned while it's still being used
+	utime(path.c_str(),NULL);
+	return program;
+}
+
+void ShaderCache::SaveBinary(const GLSLShaderPair &pair, const string &path, const GLSLProgram *program)
+{
+	unsigned int format = 0;
+	vector<char> binary;
+	if (!program->GetBinary(format,binary)) return;
+
+	// write it somewhere else first, so another fluxus
+	// can't load half of it
+	char tmp[32];
+	snprintf(tmp,sizeof(tmp),".%d.tmp",(int)getpid());
+	string tmppath = path+tmp;
+	FILE *file = fopen(tmppath.c_str(),"wb");
+	if (!file)
+	{
+		Trace::Stream<<"Couldn't save shader binary ["<<tmppath<<"]"<<endl;
+		return;
+	}
+
+	unsigned int header[5];
+	header[0] = format;
+	header[1] = m_Driver.size();
+	header[2] = pair.GetVertexSource().size();
+	header[3] = pair.GetFragmentSource().size();
+	header[4] = binary.size();
+
+	bool ok = fwrite(BINARY_MAGIC,sizeof(BINARY_MAGIC),1,file)==1 &&
+		fwrite(header,sizeof(header),1,file)==1 &&
+		fwrite(m_Driver.data(),1,header[1],file)==header[1] &&
+		fwrite(pair.GetVertexSource().data(),1,header[2],file)==header[2] &&
+		fwrite(pair.GetFragmentSource().data(),1,header[3],file)==header[3] &&
+		fwrite(&binary[0],1,header[4],file)==header[4];
+	if (fclose(file)!=0) ok = false;
+
+	if (!ok || rename(tmppath.c_str(),path.c_str())!=0)
+	{
+		Trace::Stream<<"Couldn't save shader binary ["<<path<<"]"<<endl;
+		unlink(tmppath.c_str());
+	}
+}
+
+void ShaderCache::PruneBinaries()
+{
+	DIR *dir = opendir(m_BinaryDir.c_str());
+	if (dir==NULL) return;
+
+	time_t now = time(NULL);
+	struct dirent *entry;
+	while ((entry = readdir(dir))!=NULL)
+	{
+		string name = entry->d_name;
+		if (name.size()<4 || (name.compare(name.size()-4,4,".bin")!=0 && 
+			name.compare(name.size()-4,4,".tmp")!=0)) continue;
+
+		string path = m_BinaryDir+"/"+name;
+		struct stat sb;
+		if (stat(path.c_str(),&sb)==0 && now-sb.st_mtime>BINARY_EXPIRE)
+		{
+			unlink(path.c_str());
+		}
 	}
-	m_Cache.clear();
+	closedir(dir);
 }
@@ -26,20 +26,63 @@ namespace Fluxus
 {
 
 //////////////////////////////////////////////////////
-/// A hardware shader
+/// Keeps the linked programs for each pair of shaders, 
+/// so every shader made from the same pair shares one 
+/// program, and only has its own uniform values
 class ShaderCache
 {
 public:
 	ShaderCache();
 	~ShaderCache();
 	
+	/// A new shader from a pair of files, which are only 
+	/// loaded and linked the first time
 	static GLSLShader *Get(const std::string &vert, const std::string &frag);
+	/// A new shader from source, which is only linked again
+	/// if the source has changed
 	static GLSLShader *Make(const std::string &vertsource, const std::string &fragsource);
+	/// Forgets the programs, they are deleted when the last 
+	/// shader using them goes
 	static void Clear();
 	static void Dump();
+
+	///////////////////////////////////////////////
+	///@name Program binaries
+	/// Linked programs are saved to disk, named by a hash of 
+	/// their source and the driver, so they don't need compiling 
+	/// the next time they're used. If the driver won't take one 
+	/// back (usually after it's been updated) it's compiled again
+	///@{
+	/// Defaults to $XDG_CACHE_HOME/fluxus/shaders, or 
+	/// ~/.cache/fluxus/shaders, an empty string switches it off
+	static void SetBinaryDir(const std::string &dir);
+	/// Programs loaded from disk
+	static unsigned int GetBinaryHits() { return m_BinaryHits; }
+	/// Programs which had to be compiled
+	static unsigned int GetBinaryMisses() { return m_BinaryMisses; }
+	///@}
 	
 private:
-	static std::map<std::string,GLSLShaderPair *> m_Cache;
+	static GLSLShader *Share(std::map<std::string,GLSLProgram *> &cache, const std::string &key, 
+		bool load, const std::string &vert, const std::string &frag);
+	static void Release(std::map<std::string,GLSLProgram *> &cache);
+
+	/// Where the binary for this pair lives, or an empty 
+	/// string if binaries aren't being used
+	static std::string BinaryPath(const GLSLShaderPair &pair);
+	static GLSLProgram *LoadBinary(const GLSLShaderPair &pair, const std::string &path);
+	static void SaveBinary(const GLSLShaderPair &pair, const std::string &path, const GLSLProgram *program);
+	/// Deletes binaries which haven't been used for a while
+	static void PruneBinaries();
+
+	static std::map<std::string,GLSLProgram *> m_Cache;
+	static std::map<std::string,GLSLProgram *> m_SourceCache;
+
+	static std::string m_BinaryDir;
+	static std::string m_Driver;
+	static bool m_BinaryChecked;
+	static unsigned int m_BinaryHits;
+	static unsigned int m_BinaryMisses;
 };
 
 }
@@ -16,6 +16,7 @@
 
 #include <algorithm>
 #include "ShadowVolumeGen.h"
+#include "StateCache.h"
 
 using namespace Fluxus;
 
@@ -78,16 +79,16 @@ void ShadowVolumeGen::PolyGen(PolyPrimitive *src)
 	if (src->GetType()==PolyPrimitive::TRILIST) stride=3;
 	if (stride>0)
 	{
-		SharedEdgeContainer edges = src->GetUniqueEdges();
+		const SharedEdgeContainer &edges = src->GetUniqueEdges();
 		vector<pair<dVector,dVector> > silhouette;
 			
 		if (src->IsIndexed())
 		{
-			vector<unsigned int> index = src->GetIndex();
+			const vector<unsigned int> &index = src->GetIndexConst();
 			// loop over all the edges
-			for (SharedEdgeContainer::iterator i=edges.begin(); i!=edges.end(); ++i)
+			for (SharedEdgeContainer::const_iterator i=edges.begin(); i!=edges.end(); ++i)
 			{
-				EdgeContainer sharededges = *i;
+				const EdgeContainer &sharededges = *i;
 
 				dVector lightdir = transform.transform(points->m_Data[index[sharededges.begin()->first]])-m_LightPosition;
 				lightdir.normalise();
@@ -97,10 +98,10 @@ void ShadowVolumeGen::PolyGen(PolyPrimitive *src)
 					bool backface=false;
 					bool frontface=false;
 
-					EdgeContainer::iterator frontedge;
+					EdgeContainer::const_iterator frontedge;
 
 					// loop over the edges shared by this one
-					for (EdgeContainer::iterator edge=sharededges.begin(); edge!=sharededges.end(); ++edge)
+					for (EdgeContainer::const_iterator edge=sharededges.begin(); edge!=sharededges.end(); ++edge)
 					{			
 						// only check the first vert, as they should have 
 						// the same geometric normal if the poly is planar..
@@ -124,9 +125,9 @@ void ShadowVolumeGen::PolyGen(PolyPrimitive *src)
 		else
 		{
 			// loop over all the edges
-			for (SharedEdgeContainer::iterator i=edges.begin(); i!=edges.end(); ++i)
+			for (SharedEdgeContainer::const_iterator i=edges.begin(); i!=edges.end(); ++i)
 			{
-				EdgeContainer sharededges = *i;
+				const EdgeContainer &sharededges = *i;
 
 				dVector lightdir = transform.transform(points->m_Data[sharededges.begin()->first])-m_LightPosition;
 				lightdir.normalise();
@@ -137,10 +138,10 @@ void ShadowVolumeGen::PolyGen(PolyPrimitive *src)
 					bool backface=false;
 					bool frontface=false;
 
-					EdgeContainer::iterator frontedge;
+					EdgeContainer::const_iterator frontedge;
 
 					// loop over the edges shared by this one
-					for (EdgeContainer::iterator edge=sharededges.begin(); edge!=sharededges.end(); ++edge)
+					for (EdgeContainer::const_iterator edge=sharededges.begin(); edge!=sharededges.end(); ++edge)
 					{			
 						// only check the first vert, as they should have 
 						// the same geometric normal if the poly is planar..
@@ -175,7 +176,7 @@ void ShadowVolumeGen::AddEdge(dVector start, dVector end)
 	if (m_Debug)
 	{
 		glDisable(GL_LIGHTING);
-		glLineWidth(3);
+		StateCache::LineWidth(3);
 		glBegin(GL_LINES);					
 			glColor3f(1,0,0);
 			glVertex3fv(start.arr());
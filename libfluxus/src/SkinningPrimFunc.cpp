@@ -15,12 +15,84 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <stdio.h>
+#include <string.h>
 #include "SkinningPrimFunc.h"
 #include "Primitive.h"
 #include "SceneGraph.h"
 
 using namespace Fluxus;
 
+// skins this many verts at a time
+static const unsigned int SKIN_GRAIN=1024;
+// forget primitives we've not been run on for this many batches
+static const unsigned int SKIN_EXPIRE=100;
+
+namespace
+{
+
+// does the actual skinning for a range of verts, using
+// the skin's transforms and weights, which don't change
+// until the next time it's queued
+class SkinJob : public Job
+{
+public:
+	SkinJob(const SkinningPrimFunc::Skin &skin) : m_Skin(skin) {}
+
+	virtual void Run(unsigned int start, unsigned int end)
+	{
+		const dMatrix *transforms=m_Skin.Transforms.empty()?NULL:&m_Skin.Transforms[0];
+		const unsigned int *influencestart=&m_Skin.InfluenceStart[0];
+		const unsigned int *bones=m_Skin.InfluenceBone.empty()?NULL:&m_Skin.InfluenceBone[0];
+		const float *weights=m_Skin.InfluenceWeight.empty()?NULL:&m_Skin.InfluenceWeight[0];
+		dVector *p=&(*m_Skin.P)[0];
+		const dVector *pref=&(*m_Skin.PRef)[0];
+		dVector *n=m_Skin.SkinNormals?&(*m_Skin.N)[0]:NULL;
+		const dVector *nref=m_Skin.SkinNormals?&(*m_Skin.NRef)[0]:NULL;
+
+		dMatrix mat;
+		float *m=mat.arr();
+		for (unsigned int i=start; i<end; i++)
+		{
+			// blend the matrices in place, as the operators
+			// make a lot of temporaries for this
+			for (unsigned int k=0; k<16; k++) m[k]=0;
+			for (unsigned int b=influencestart[i]; b<influencestart[i+1]; b++)
+			{
+				const float *t=&transforms[bones[b]].m[0][0];
+				float w=weights[b];
+				for (unsigned int k=0; k<16; k++) m[k]+=t[k]*w;
+			}
+
+			p[i]=mat.transform(pref[i]);
+
+			if (n)
+			{
+				n[i]=mat.transform_no_trans(nref[i]);
+			}
+		}
+	}
+
+private:
+	const SkinningPrimFunc::Skin &m_Skin;
+};
+
+}
+
+SkinningPrimFunc::Skin::Skin() :
+World(NULL),
+StructureVersion(0),
+LayoutVersion(0),
+Root(0),
+BindPoseRoot(0),
+SkinNormals(false),
+LastUsed(0),
+P(NULL),
+PRef(NULL),
+N(NULL),
+NRef(NULL)
+{
+}
+
 SkinningPrimFunc::SkinningPrimFunc()
 {
 }
@@ -30,98 +102,231 @@ SkinningPrimFunc::~SkinningPrimFunc()
 }
 
 void SkinningPrimFunc::Run(Primitive &prim, const SceneGraph &world)
+{
+	JobQueue *queue=JobQueue::Get();
+	Queue(prim,world,*queue);
+	queue->Run();
+}
+
+void SkinningPrimFunc::Queue(Primitive &prim, const SceneGraph &world, JobQueue &queue)
+{
+	Skin &skin=FindSkin(&prim,queue.GetBatch());
+	if (!Update(skin,prim,world) || prim.Size()==0) return;
+
+	UpdateTransforms(skin,world);
+
+	queue.Add(new SkinJob(skin),prim.Size(),SKIN_GRAIN);
+
+	prim.GetDataRaw("p")->SetDirty();
+	if (skin.SkinNormals) prim.GetDataRaw("n")->SetDirty();
+}
+
+SkinningPrimFunc::Skin &SkinningPrimFunc::FindSkin(const Primitive *prim, unsigned int batch)
+{
+	map<const Primitive*,Skin>::iterator i=m_Skins.find(prim);
+	if (i==m_Skins.end())
+	{
+		// a good time to forget about primitives which have gone 
+		// away, none of these can be referred to by queued jobs
+		map<const Primitive*,Skin>::iterator s=m_Skins.begin();
+		while (s!=m_Skins.end())
+		{
+			if (batch-s->second.LastUsed>SKIN_EXPIRE) m_Skins.erase(s++);
+			else ++s;
+		}
+		i=m_Skins.insert(pair<const Primitive*,Skin>(prim,Skin())).first;
+	}
+	i->second.LastUsed=batch;
+	return i->second;
+}
+
+bool SkinningPrimFunc::Update(Skin &skin, Primitive &prim, const SceneGraph &world)
 {
 	int rootid = GetArg<int>("skeleton-root",0);
 	int bindposerootid = GetArg<int>("bindpose-root",0);
 	bool skinnormals = GetArg<int>("skin-normals",0);
-	vector<dVector, FLX_ALLOC(dVector) > *p = prim.GetDataVec<dVector>("p");
-	vector<dVector, FLX_ALLOC(dVector) > *pref = prim.GetDataVec<dVector>("pref");
-	vector<dVector, FLX_ALLOC(dVector) > *n = NULL;
-	vector<dVector, FLX_ALLOC(dVector) > *nref = NULL;
 
-	if (!pref)
+	if (skin.World!=&world || 
+		skin.StructureVersion!=world.GetStructureVersion() ||
+		skin.LayoutVersion!=prim.GetLayoutVersion() ||
+		skin.Root!=rootid || skin.BindPoseRoot!=bindposerootid ||
+		skin.SkinNormals!=skinnormals)
 	{
-		///\todo sort out a proper error messaging thing
-		Trace::Stream<<"SkinningPrimFunc::Run: aborting: primitive needs a pref (copy of p)"<<endl;
-		return;
-	}
+		// look everything up again, and if anything's missing
+		// leave the skin out of date so we try again next time
+		skin.LayoutVersion=0;
+		skin.Weights.clear();
+		skin.WeightVersions.clear();
 
-	if (skinnormals)
-	{
-		n = prim.GetDataVec<dVector>("n");
-		nref = prim.GetDataVec<dVector>("nref");
-		if (!nref)
+		skin.P = prim.GetDataVec<dVector>("p");
+		skin.PRef = prim.GetDataVec<dVector>("pref");
+		skin.N = NULL;
+		skin.NRef = NULL;
+
+		if (!skin.P || !skin.PRef)
 		{
-			Trace::Stream<<"SkinningPrimFunc::Run: aborting: primitive needs an nref (copy of n)"<<endl;
-			return;
+			///\todo sort out a proper error messaging thing
+			Trace::Stream<<"SkinningPrimFunc::Run: aborting: primitive needs a pref (copy of p)"<<endl;
+			return false;
 		}
-	}
 
-	const SceneNode *root = static_cast<const SceneNode *>(world.FindNode(rootid));
-	if (!root)
-	{
-		Trace::Stream<<"GenSkinWeightsPrimFunc::Run: couldn't find skeleton root node "<<rootid<<endl;
-		return;
-	}
+		if (skinnormals)
+		{
+			skin.N = prim.GetDataVec<dVector>("n");
+			skin.NRef = prim.GetDataVec<dVector>("nref");
+			if (!skin.N || !skin.NRef)
+			{
+				Trace::Stream<<"SkinningPrimFunc::Run: aborting: primitive needs an nref (copy of n)"<<endl;
+				return false;
+			}
+		}
 
-	const SceneNode *bindposeroot = static_cast<const SceneNode *>(world.FindNode(bindposerootid));
-	if (!root)
-	{
-		Trace::Stream<<"GenSkinWeightsPrimFunc::Run: couldn't find bindopose skeleton root node "<<bindposerootid<<endl;
-		return;
-	}
+		const SceneNode *root = static_cast<const SceneNode *>(world.FindNode(rootid));
+		if (!root)
+		{
+			Trace::Stream<<"SkinningPrimFunc::Run: couldn't find skeleton root node "<<rootid<<endl;
+			return false;
+		}
+
+		const SceneNode *bindposeroot = static_cast<const SceneNode *>(world.FindNode(bindposerootid));
+		if (!bindposeroot)
+		{
+			Trace::Stream<<"SkinningPrimFunc::Run: couldn't find bindpose skeleton root node "<<bindposerootid<<endl;
+			return false;
+		}
+
+		// get the nodes as flat lists
+		skin.Skeleton.clear();
+		world.GetNodes(root, skin.Skeleton);
+		skin.BindPoseSkeleton.clear();
+		world.GetNodes(bindposeroot, skin.BindPoseSkeleton);
+
+		if (skin.Skeleton.size()!=skin.BindPoseSkeleton.size())
+		{
+			Trace::Stream<<"SkinningPrimFunc::Run: aborting: skeleton sizes do not match! "<<
+				skin.Skeleton.size()<<" vs "<<skin.BindPoseSkeleton.size()<<endl;
+			return false;
+		}
+
+		// the lists are depth first, so parents come before their 
+		// children, and the global transforms can be built up in order
+		skin.Parents.clear();
+		skin.BindPoseParents.clear();
+		map<const Node*,int> skeletonindex, bindposeindex;
+		for (unsigned int i=0; i<skin.Skeleton.size(); i++)
+		{
+			skeletonindex[skin.Skeleton[i]]=i;
+			bindposeindex[skin.BindPoseSkeleton[i]]=i;
+			skin.Parents.push_back(i==0?-1:skeletonindex[skin.Skeleton[i]->Parent]);
+			skin.BindPoseParents.push_back(i==0?-1:bindposeindex[skin.BindPoseSkeleton[i]->Parent]);
+		}
+
+		// get pointers to all the weights
+		for (unsigned int bone=0; bone<skin.Skeleton.size(); bone++)
+		{
+			char wname[256];
+			snprintf(wname,256,"w%d",bone);
+			if (prim.GetDataVec<float>(wname)==NULL)
+			{
+				Trace::Stream<<"SkinningPrimFunc::Run: can't find weights, aborting"<<endl;
+				skin.Weights.clear();
+				return false;
+			}
+			skin.Weights.push_back(prim.GetDataRaw(wname));
+			skin.WeightVersions.push_back(0);
+		}
+
+		skin.BindPose.clear();
+		skin.InverseBindPose.clear();
 
-	// get the nodes as flat lists
-	vector<const SceneNode*> skeleton;
-	world.GetNodes(root, skeleton);
-	vector<const SceneNode*> bindposeskeleton;
-	world.GetNodes(bindposeroot, bindposeskeleton);
+		skin.World=&world;
+		skin.StructureVersion=world.GetStructureVersion();
+		skin.LayoutVersion=prim.GetLayoutVersion();
+		skin.Root=rootid;
+		skin.BindPoseRoot=bindposerootid;
+		skin.SkinNormals=skinnormals;
+	}
 
-	if (skeleton.size()!=bindposeskeleton.size())
+	// the weights only need sorting out again if they've changed
+	for (unsigned int bone=0; bone<skin.Weights.size(); bone++)
 	{
-		Trace::Stream<<"SkinningPrimFunc::Run: aborting: skeleton sizes do not match! "<<
-			skeleton.size()<<" vs "<<bindposeskeleton.size()<<endl;
-		return;
+		if (skin.Weights[bone]->GetVersion()!=skin.WeightVersions[bone])
+		{
+			UpdateInfluences(skin,prim.Size());
+			break;
+		}
 	}
 
-	// make a vector of all the transforms
-	vector<dMatrix> transforms;
-	for (unsigned int i=0; i<skeleton.size(); i++)
+	return true;
+}
+
+void SkinningPrimFunc::UpdateInfluences(Skin &skin, unsigned int size)
+{
+	vector<float*> weights;
+	for (unsigned int bone=0; bone<skin.Weights.size(); bone++)
 	{
-		transforms.push_back(world.GetGlobalTransform(skeleton[i])*
-							 world.GetGlobalTransform(bindposeskeleton[i]).inverse());
+		weights.push_back(size?&static_cast<TypedPData<float>*>(skin.Weights[bone])->m_Data[0]:NULL);
+		skin.WeightVersions[bone]=skin.Weights[bone]->GetVersion();
 	}
 
-	// get pointers to all the weights
-	vector<vector<float, FLX_ALLOC(float) >*> weights;
-	for (unsigned int bone=0; bone<skeleton.size(); bone++)
+	// most verts are only moved by a few bones, so 
+	// only keep the weights which are non zero
+	skin.InfluenceStart.resize(size+1);
+	skin.InfluenceBone.clear();
+	skin.InfluenceWeight.clear();
+	for (unsigned int i=0; i<size; i++)
 	{
-		char wname[256];
-		snprintf(wname,256,"w%d",bone);
-		vector<float, FLX_ALLOC(float) > *w = prim.GetDataVec<float>(wname);
-		if (w==NULL)
+		skin.InfluenceStart[i]=skin.InfluenceBone.size();
+		for (unsigned int bone=0; bone<weights.size(); bone++)
 		{
-			Trace::Stream<<"SkinningPrimFunc::Run: can't find weights, aborting"<<endl;
-			return;
+			if (weights[bone][i]!=0)
+			{
+				skin.InfluenceBone.push_back(bone);
+				skin.InfluenceWeight.push_back(weights[bone][i]);
+			}
 		}
-		weights.push_back(w);
 	}
+	skin.InfluenceStart[size]=skin.InfluenceBone.size();
+}
 
-	for (unsigned int i=0; i<prim.Size(); i++)
+// the same as SceneGraph::GetGlobalTransform, but reusing the parent's
+static dMatrix GlobalTransform(const SceneGraph &world, const vector<const SceneNode*> &nodes,
+	const vector<int> &parents, const vector<dMatrix> &globals, unsigned int i)
+{
+	const SceneNode *node=nodes[i];
+	if (parents[i]==-1) return world.GetGlobalTransform(node);
+	if (!node->Prim) return globals[parents[i]];
+	if (node->Prim->GetState()->Hints & HINT_LAZY_PARENT) return node->Prim->GetState()->Transform;
+	return globals[parents[i]]*node->Prim->GetState()->Transform;
+}
+
+void SkinningPrimFunc::UpdateTransforms(Skin &skin, const SceneGraph &world)
+{
+	unsigned int bones=skin.Skeleton.size();
+
+	// the bind pose doesn't usually move, so only 
+	// invert the transforms which have changed
+	vector<dMatrix> bindpose(bones);
+	skin.InverseBindPose.resize(bones);
+	skin.BindPose.resize(bones);
+	for (unsigned int i=0; i<bones; i++)
 	{
-		dMatrix mat;
-		mat.zero();
-		for	(unsigned int bone=0; bone<skeleton.size(); bone++)
+		bindpose[i]=GlobalTransform(world,skin.BindPoseSkeleton,skin.BindPoseParents,bindpose,i);
+		if (memcmp(bindpose[i].arr(),skin.BindPose[i].arr(),sizeof(float)*16)!=0)
 		{
-			mat+=(transforms[bone]*(*weights[bone])[i]);
+			skin.BindPose[i]=bindpose[i];
+			skin.InverseBindPose[i]=bindpose[i].inverse();
 		}
+	}
 
-		(*p)[i]=mat.transform((*pref)[i]);
+	skin.Transforms.resize(bones);
+	for (unsigned int i=0; i<bones; i++)
+	{
+		skin.Transforms[i]=GlobalTransform(world,skin.Skeleton,skin.Parents,skin.Transforms,i);
+	}
 
-		if (skinnormals)
-		{
-			(*n)[i]=mat.transform_no_trans((*nref)[i]);
-		}
+	for (unsigned int i=0; i<bones; i++)
+	{
+		skin.Transforms[i]*=skin.InverseBindPose[i];
 	}
 }
-
@@ -35,9 +35,55 @@ public:
 	~SkinningPrimFunc();
 
 	virtual void Run(Primitive &prim, const SceneGraph &world);
+	virtual void Queue(Primitive &prim, const SceneGraph &world, JobQueue &queue);
+
+	/// What we keep for each primitive between frames - 
+	/// the pdata and bones are looked up again only when 
+	/// the primitive's pdata or the scenegraph change
+	struct Skin
+	{
+		Skin();
+
+		const SceneGraph *World;
+		unsigned int StructureVersion;
+		unsigned int LayoutVersion;
+		int Root;
+		int BindPoseRoot;
+		bool SkinNormals;
+		unsigned int LastUsed;
+
+		vector<dVector,FLX_ALLOC(dVector) > *P;
+		vector<dVector,FLX_ALLOC(dVector) > *PRef;
+		vector<dVector,FLX_ALLOC(dVector) > *N;
+		vector<dVector,FLX_ALLOC(dVector) > *NRef;
+
+		vector<const SceneNode*> Skeleton;
+		vector<const SceneNode*> BindPoseSkeleton;
+		/// Index of each bone's parent, -1 for the root
+		vector<int> Parents;
+		vector<int> BindPoseParents;
+
+		vector<PData*> Weights;
+		vector<unsigned int> WeightVersions;
+		/// The non zero weights, vertex i is influenced by 
+		/// [InfluenceStart[i],InfluenceStart[i+1])
+		vector<unsigned int> InfluenceStart;
+		vector<unsigned int> InfluenceBone;
+		vector<float> InfluenceWeight;
+
+		/// The bind pose the inverses were made from
+		vector<dMatrix> BindPose;
+		vector<dMatrix> InverseBindPose;
+		vector<dMatrix> Transforms;
+	};
 
 private:
-	
+	bool Update(Skin &skin, Primitive &prim, const SceneGraph &world);
+	void UpdateInfluences(Skin &skin, unsigned int size);
+	void UpdateTransforms(Skin &skin, const SceneGraph &world);
+	Skin &FindSkin(const Primitive *prim, unsigned int batch);
+
+	map<const Primitive*,Skin> m_Skins;
 };
 
 
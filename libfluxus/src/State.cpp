@@ -14,9 +14,11 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <string.h>
 #include "Renderer.h"
 #include "TexturePainter.h"
 #include "State.h"
+#include "StateCache.h"
 #include "PixelPrimitive.h"
 
 using namespace Fluxus;
@@ -47,13 +49,24 @@ Cull(true)
 	}
 }
 
-State::State(const State &other)
+State::State(const State &other) :
+Shader(NULL)
 {
 	*this=other;
 }
 
 const State &State::operator=(const State &other)
 {
+	if (this==&other) return *this;
+
+	// states are reused by immediate mode, so release 
+	// the shader we are replacing
+	if (other.Shader!=NULL)
+	{
+		other.Shader->IncRef();
+	}
+	if (Shader!=NULL && Shader->DecRef()) delete Shader;
+
 	Colour=other.Colour;
 	Specular=other.Specular;
 	Emissive=other.Emissive;
@@ -77,10 +90,6 @@ const State &State::operator=(const State &other)
 	Shader=other.Shader;
 	Cull=other.Cull;
 
-	if (Shader!=NULL)
-	{
-		Shader->IncRef();
-	}
 	for (int n=0; n<MAX_TEXTURES; n++)
 	{
 		Textures[n]=other.Textures[n];
@@ -95,20 +104,20 @@ State::~State()
 	if (Shader!=NULL && Shader->DecRef()) delete Shader;
 }
 
-void State::Apply()
+void State::Apply(bool transform)
 {
-	glMultMatrixf(Transform.arr());
+	if (transform) glMultMatrixf(Transform.arr());
 	if (Opacity != 1.0f) Colour.a=Ambient.a=Emissive.a=Specular.a=Opacity;
 	if (WireOpacity != 1.0f) WireColour.a=WireOpacity;
 	glColor4f(Colour.r,Colour.g,Colour.b,Colour.a);
-	glMaterialfv(GL_FRONT_AND_BACK,GL_AMBIENT,Ambient.arr());
-	glMaterialfv(GL_FRONT_AND_BACK,GL_EMISSION,Emissive.arr());
-	glMaterialfv(GL_FRONT_AND_BACK,GL_DIFFUSE,Colour.arr());
-	glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR,Specular.arr());
-	glMaterialfv(GL_FRONT_AND_BACK,GL_SHININESS,&Shinyness);
-	glLineWidth(LineWidth);
-	glPointSize(PointWidth);
-	glBlendFunc(SourceBlend,DestinationBlend);
+	StateCache::Material(GL_AMBIENT,Ambient);
+	StateCache::Material(GL_EMISSION,Emissive);
+	StateCache::Material(GL_DIFFUSE,Colour);
+	StateCache::Material(GL_SPECULAR,Specular);
+	StateCache::Shininess(Shinyness);
+	StateCache::LineWidth(LineWidth);
+	StateCache::PointSize(PointWidth);
+	StateCache::BlendFunc(SourceBlend,DestinationBlend);
 
 	if (Cull) glEnable(GL_CULL_FACE);
 	else glDisable(GL_CULL_FACE);
@@ -149,6 +158,49 @@ void State::Unapply()
 	}
 }
 
+static inline bool ColourEq(const dColour &a, const dColour &b)
+{
+	return a.r==b.r && a.g==b.g && a.b==b.b && a.a==b.a;
+}
+
+bool State::Batchable(const State &other) const
+{
+	if (Shader!=other.Shader ||
+		Hints!=other.Hints ||
+		Opacity!=other.Opacity ||
+		Shinyness!=other.Shinyness ||
+		LineWidth!=other.LineWidth ||
+		PointWidth!=other.PointWidth ||
+		StippledLines!=other.StippledLines ||
+		StippleFactor!=other.StippleFactor ||
+		StipplePattern!=other.StipplePattern ||
+		SourceBlend!=other.SourceBlend ||
+		DestinationBlend!=other.DestinationBlend ||
+		WireOpacity!=other.WireOpacity ||
+		Cull!=other.Cull ||
+		!ColourEq(Specular,other.Specular) ||
+		!ColourEq(Emissive,other.Emissive) ||
+		!ColourEq(Ambient,other.Ambient) ||
+		!ColourEq(WireColour,other.WireColour) ||
+		!ColourEq(NormalColour,other.NormalColour))
+	{
+		return false;
+	}
+
+	for (int n=0; n<MAX_TEXTURES; n++)
+	{
+		if (Textures[n]!=other.Textures[n]) return false;
+		// texture states only matter for textures we use
+		if (Textures[n]!=0 && 
+			memcmp(&TextureStates[n],&other.TextureStates[n],sizeof(TextureState))!=0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
 void State::Spew()
 {
 	Trace::Stream<<"Colour: "<<Colour<<endl
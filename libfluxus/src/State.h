@@ -49,6 +49,7 @@ namespace Fluxus
 #define HINT_NORMALISE      0x00020000
 #define HINT_NOBLEND        0x00040000
 #define HINT_NOZWRITE       0x00080000
+#define HINT_VBO            0x00100000
 
 #define MAX_TEXTURES  8
 
@@ -66,10 +67,17 @@ public:
 
 	const State &operator=(const State &other);
 
-	void Apply();
+	/// Sets the gl state, multiplying the transform
+	/// onto the modelview matrix unless told not to
+	void Apply(bool transform=true);
 	void Unapply();
 	void Spew();
 
+	/// Returns true if the other state renders the same as
+	/// this one apart from its transform and colour, so 
+	/// primitives drawn with both can be batched as instances
+	bool Batchable(const State &other) const;
+
 	dColour Colour;
 	dColour Specular;
 	dColour Emissive;
@@ -0,0 +1,130 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include "StateCache.h"
+
+using namespace Fluxus;
+
+bool StateCache::m_LineWidthValid=false;
+bool StateCache::m_PointSizeValid=false;
+bool StateCache::m_BlendValid=false;
+bool StateCache::m_MaterialValid[NUM_MATERIALS]={false,false,false,false};
+bool StateCache::m_ShininessValid=false;
+bool StateCache::m_ProgramValid=false;
+float StateCache::m_LineWidth=0;
+float StateCache::m_PointSize=0;
+int StateCache::m_SourceBlend=0;
+int StateCache::m_DestinationBlend=0;
+dColour StateCache::m_Material[NUM_MATERIALS];
+float StateCache::m_Shininess=0;
+unsigned int StateCache::m_Program=0;
+unsigned int StateCache::m_Avoided=0;
+unsigned int StateCache::m_LastAvoided=0;
+
+void StateCache::Invalidate()
+{
+	m_LineWidthValid=false;
+	m_PointSizeValid=false;
+	m_BlendValid=false;
+	m_ProgramValid=false;
+	InvalidateMaterial();
+}
+
+void StateCache::InvalidateMaterial()
+{
+	for (int n=0; n<NUM_MATERIALS; n++) m_MaterialValid[n]=false;
+	m_ShininessValid=false;
+}
+
+void StateCache::NewFrame()
+{
+	m_LastAvoided=m_Avoided;
+	m_Avoided=0;
+	Invalidate();
+}
+
+void StateCache::LineWidth(float w)
+{
+	if (m_LineWidthValid && w==m_LineWidth) { m_Avoided++; return; }
+	glLineWidth(w);
+	m_LineWidth=w;
+	m_LineWidthValid=true;
+}
+
+void StateCache::PointSize(float s)
+{
+	if (m_PointSizeValid && s==m_PointSize) { m_Avoided++; return; }
+	glPointSize(s);
+	m_PointSize=s;
+	m_PointSizeValid=true;
+}
+
+void StateCache::BlendFunc(int src, int dst)
+{
+	if (m_BlendValid && src==m_SourceBlend && dst==m_DestinationBlend) 
+	{ 
+		m_Avoided++; 
+		return; 
+	}
+	glBlendFunc(src,dst);
+	m_SourceBlend=src;
+	m_DestinationBlend=dst;
+	m_BlendValid=true;
+}
+
+int StateCache::MaterialIndex(int pname)
+{
+	switch (pname)
+	{
+		case GL_AMBIENT: return AMBIENT;
+		case GL_EMISSION: return EMISSION;
+		case GL_DIFFUSE: return DIFFUSE;
+		default: return SPECULAR;
+	}
+}
+
+void StateCache::Material(int pname, const dColour &c)
+{
+	int i=MaterialIndex(pname);
+	const dColour &current=m_Material[i];
+	if (m_MaterialValid[i] && c.r==current.r && c.g==current.g && 
+		c.b==current.b && c.a==current.a)
+	{
+		m_Avoided++;
+		return;
+	}
+	glMaterialfv(GL_FRONT_AND_BACK,pname,&c.r);
+	m_Material[i]=c;
+	m_MaterialValid[i]=true;
+}
+
+void StateCache::Shininess(float s)
+{
+	if (m_ShininessValid && s==m_Shininess) { m_Avoided++; return; }
+	glMaterialfv(GL_FRONT_AND_BACK,GL_SHININESS,&s);
+	m_Shininess=s;
+	m_ShininessValid=true;
+}
+
+void StateCache::UseProgram(unsigned int program)
+{
+	#ifdef GLSL
+	if (m_ProgramValid && program==m_Program) { m_Avoided++; return; }
+	glUseProgram(program);
+	m_Program=program;
+	m_ProgramValid=true;
+	#endif
+}
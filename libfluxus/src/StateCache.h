@@ -0,0 +1,82 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_STATECACHE
+#define N_STATECACHE
+
+#include "OpenGL.h"
+#include "dada.h"
+
+namespace Fluxus
+{
+
+///////////////////////////////////////
+/// Remembers the gl state last set by 
+/// State::Apply, so setting it again to 
+/// the same values can be skipped. Anything
+/// which sets these states directly needs
+/// to call Invalidate() afterwards.
+class StateCache
+{
+public:
+	/// Forget everything, so the next calls
+	/// go through to gl
+	static void Invalidate();
+
+	/// Material colours are also changed by
+	/// gl colour calls with GL_COLOR_MATERIAL
+	static void InvalidateMaterial();
+
+	static void LineWidth(float w);
+	static void PointSize(float s);
+	static void BlendFunc(int src, int dst);
+	static void Material(int pname, const dColour &c);
+	static void Shininess(float s);
+	static void UseProgram(unsigned int program);
+
+	/// Count a change that was skipped
+	static void Avoided() { m_Avoided++; }
+
+	/// Called once a frame by the renderer
+	static void NewFrame();
+
+	/// The number of changes skipped last frame
+	static unsigned int GetAvoided() { return m_LastAvoided; }
+
+private:
+	enum {AMBIENT,EMISSION,DIFFUSE,SPECULAR,NUM_MATERIALS};
+	static int MaterialIndex(int pname);
+
+	static bool m_LineWidthValid;
+	static bool m_PointSizeValid;
+	static bool m_BlendValid;
+	static bool m_MaterialValid[NUM_MATERIALS];
+	static bool m_ShininessValid;
+	static bool m_ProgramValid;
+	static float m_LineWidth;
+	static float m_PointSize;
+	static int m_SourceBlend;
+	static int m_DestinationBlend;
+	static dColour m_Material[NUM_MATERIALS];
+	static float m_Shininess;
+	static unsigned int m_Program;
+	static unsigned int m_Avoided;
+	static unsigned int m_LastAvoided;
+};
+
+}
+
+#endif
@@ -0,0 +1,157 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <unistd.h>
+#include <sstream>
+#include "TextureLoader.h"
+#include "PNGLoader.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+
+TextureLoader::TextureLoader() :
+m_DecodedBytes(0),
+m_Decoding(0),
+m_Quit(false)
+{
+	pthread_mutex_init(&m_Mutex,NULL);
+	pthread_cond_init(&m_Work,NULL);
+
+	// leave a cpu for the renderer, decoding is mostly 
+	// waiting for the disk anyway
+	long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int threads=1;
+	if (cpus>2) threads=cpus-1;
+	if (threads>4) threads=4;
+
+	for (unsigned int i=0; i<threads; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,WorkerThread,this)!=0)
+		{
+			Trace::Stream<<"TextureLoader: couldn't start worker thread"<<endl;
+			break;
+		}
+		m_Threads.push_back(thread);
+	}
+}
+
+TextureLoader::~TextureLoader()
+{
+	pthread_mutex_lock(&m_Mutex);
+	m_Quit=true;
+	pthread_cond_broadcast(&m_Work);
+	pthread_mutex_unlock(&m_Mutex);
+
+	for (vector<pthread_t>::iterator i=m_Threads.begin(); i!=m_Threads.end(); ++i)
+	{
+		pthread_join(*i,NULL);
+	}
+
+	for (deque<Request>::iterator i=m_Decoded.begin(); i!=m_Decoded.end(); ++i)
+	{
+		delete[] i->Desc.ImageData;
+	}
+
+	pthread_cond_destroy(&m_Work);
+	pthread_mutex_destroy(&m_Mutex);
+}
+
+void TextureLoader::Add(unsigned int id, const string &fullpath)
+{
+	Request request;
+	request.ID=id;
+	request.Fullpath=fullpath;
+
+	pthread_mutex_lock(&m_Mutex);
+	if (m_Threads.empty())
+	{
+		// no workers, so do it now
+		pthread_mutex_unlock(&m_Mutex);
+		PNGLoader::Load(fullpath,request.Desc);
+		pthread_mutex_lock(&m_Mutex);
+		m_Decoded.push_back(request);
+	}
+	else
+	{
+		m_Requests.push_back(request);
+		pthread_cond_signal(&m_Work);
+	}
+	pthread_mutex_unlock(&m_Mutex);
+}
+
+bool TextureLoader::Get(unsigned int &id, string &fullpath, TexturePainter::TextureDesc &desc, string &log)
+{
+	pthread_mutex_lock(&m_Mutex);
+	if (m_Decoded.empty())
+	{
+		pthread_mutex_unlock(&m_Mutex);
+		return false;
+	}
+
+	Request &request=m_Decoded.front();
+	id=request.ID;
+	fullpath=request.Fullpath;
+	desc=request.Desc;
+	log=request.Log;
+	if (desc.ImageData!=NULL) m_DecodedBytes-=desc.Size;
+	m_Decoded.pop_front();
+	// there may be room for a worker to carry on
+	pthread_cond_broadcast(&m_Work);
+	pthread_mutex_unlock(&m_Mutex);
+	return true;
+}
+
+unsigned int TextureLoader::GetNumPending()
+{
+	pthread_mutex_lock(&m_Mutex);
+	unsigned int ret=m_Requests.size()+m_Decoding+m_Decoded.size();
+	pthread_mutex_unlock(&m_Mutex);
+	return ret;
+}
+
+void *TextureLoader::WorkerThread(void *context)
+{
+	TextureLoader *loader=(TextureLoader*)context;
+
+	pthread_mutex_lock(&loader->m_Mutex);
+	while (!loader->m_Quit)
+	{
+		// always let one through, or a single huge image would never load
+		if (loader->m_Requests.empty() || 
+			(loader->m_DecodedBytes>MAX_DECODED_BYTES && !loader->m_Decoded.empty()))
+		{
+			pthread_cond_wait(&loader->m_Work,&loader->m_Mutex);
+			continue;
+		}
+
+		Request request=loader->m_Requests.front();
+		loader->m_Requests.pop_front();
+		loader->m_Decoding++;
+		pthread_mutex_unlock(&loader->m_Mutex);
+
+		stringstream log;
+		PNGLoader::Load(request.Fullpath,request.Desc,log);
+		request.Log=log.str();
+
+		pthread_mutex_lock(&loader->m_Mutex);
+		loader->m_Decoding--;
+		if (request.Desc.ImageData!=NULL) loader->m_DecodedBytes+=request.Desc.Size;
+		loader->m_Decoded.push_back(request);
+	}
+	pthread_mutex_unlock(&loader->m_Mutex);
+	return NULL;
+}
@@ -0,0 +1,84 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_TEXTURE_LOADER
+#define N_TEXTURE_LOADER
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "TexturePainter.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// Decodes images on a few worker threads, so loading 
+/// them doesn't hold up the renderer. Only decodes - the 
+/// TexturePainter collects the results with Get, and 
+/// uploads them itself. Add and Get should only be 
+/// called from the render thread
+class TextureLoader
+{
+public:
+	TextureLoader();
+	/// Waits for the workers to finish what they are decoding
+	~TextureLoader();
+
+	/// Queues a png to be decoded for the texture id
+	void Add(unsigned int id, const string &fullpath);
+
+	/// Gets the next decoded image, returns false if none are ready.
+	/// desc.ImageData is NULL if it couldn't be loaded, and the caller
+	/// owns it otherwise. Anything the decoder had to say is in log
+	bool Get(unsigned int &id, string &fullpath, TexturePainter::TextureDesc &desc, string &log);
+
+	/// The number of images queued or decoded but not collected yet
+	unsigned int GetNumPending();
+
+	/// How much decoded data can wait to be collected before the
+	/// workers stop, so a folder of images doesn't fill the memory
+	static const unsigned int MAX_DECODED_BYTES = 128*1024*1024;
+
+private:
+	struct Request
+	{
+		unsigned int ID;
+		string Fullpath;
+		TexturePainter::TextureDesc Desc;
+		string Log;
+	};
+
+	static void *WorkerThread(void *context);
+
+	deque<Request> m_Requests;
+	deque<Request> m_Decoded;
+	unsigned int m_DecodedBytes;
+	unsigned int m_Decoding;
+	bool m_Quit;
+
+	vector<pthread_t> m_Threads;
+	pthread_mutex_t m_Mutex;
+	/// Signalled when there's a request, or room for another decode
+	pthread_cond_t m_Work;
+};
+
+}
+
+#endif
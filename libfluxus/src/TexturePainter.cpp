@@ -17,10 +17,14 @@
 #include "OpenGL.h"
 #include "State.h"
 #include "TexturePainter.h"
+#include "StateCache.h"
 #include "PNGLoader.h"
 #include "DDSLoader.h"
+#include "TextureLoader.h"
 #include "SearchPaths.h"
 #include <assert.h>
+#include <algorithm>
+#include <string.h>
 
 using namespace Fluxus;
 
@@ -29,7 +33,19 @@ TexturePainter *TexturePainter::m_Singleton=NULL;
 TexturePainter::TexturePainter() :
 m_MultitexturingEnabled(true),
 m_TextureCompressionEnabled(true),
-m_SGISGenerateMipmap(true)
+m_SGISGenerateMipmap(true),
+m_CurrentValid(false),
+m_CurrentResult(false),
+m_Loader(NULL),
+m_UploadBudget(4*1024*1024),
+m_Placeholder(0),
+m_PBO(0),
+m_MemoryBudget(0),
+m_ResidentBytes(0),
+m_Frame(0),
+m_Evictions(0),
+m_TotalEvictions(0),
+m_Reloads(0)
 {
 	if (glewInit() != GLEW_OK)
 	{
@@ -62,10 +78,17 @@ m_SGISGenerateMipmap(true)
 TexturePainter::~TexturePainter()
 {
 	///\todo Shouldn't we delete all textures here?
+	if (m_Loader!=NULL) delete m_Loader;
+	for (deque<AsyncUpload>::iterator i=m_Uploads.begin(); i!=m_Uploads.end(); ++i)
+	{
+		delete[] i->Desc.ImageData;
+	}
 }
 
 void TexturePainter::Initialise()
 {
+	InvalidateCurrent();
+
 #ifndef DISABLE_MULTITEXTURE
 	if (m_MultitexturingEnabled)
 	{
@@ -87,11 +110,20 @@ void TexturePainter::Initialise()
 
 void TexturePainter::ClearCache()
 {
+	// the textures are still on the card, so their usage is kept
 	m_TextureMap.clear();
 	m_LoadedMap.clear();
 	m_LoadedCubeMap.clear();
 }
 
+// whether a texture can be decoded on another thread and uploaded by Update
+static bool CanLoadAsync(const string &Fullpath, const TexturePainter::CreateParams &params)
+{
+	string extension = Fullpath.substr(Fullpath.find_last_of('.') + 1, Fullpath.size());
+	return params.Async && params.Type==GL_TEXTURE_2D && params.Border==0 && 
+		!params.Compress && extension!="dds";
+}
+
 unsigned int TexturePainter::LoadTexture(const string &Filename, CreateParams &params)
 {
 	string Fullpath = SearchPaths::Get()->GetFullPath(Filename);
@@ -109,9 +141,33 @@ unsigned int TexturePainter::LoadTexture(const string &Filename, CreateParams &p
 		return i->second;
 	}
 
+	// dds files come with their own mipmaps, so they 
+	// are loaded straight away, as are additions to
+	// existing textures
+	if (params.ID==-1 && CanLoadAsync(Fullpath, params))
+	{
+		return LoadTextureAsync(Fullpath, params);
+	}
+
 	TextureDesc desc;
-	string extension = Filename.substr(Filename.find_last_of('.') + 1, Filename.size());
+	if (params.ID==-1)
+	{
+		// LoadFile changes the params as it goes
+		CreateParams original=params;
+		unsigned int id=LoadFile(Fullpath, params, desc);
+		if (id!=0) Track(id, Fullpath, original, desc);
+		return id;
+	}
 
+	// loading it again wouldn't put this back, so it has to stay
+	map<unsigned int,TextureUsage>::iterator u=m_Usage.find(params.ID);
+	if (u!=m_Usage.end()) u->second.Fullpath="";
+	return LoadFile(Fullpath, params, desc);
+}
+
+unsigned int TexturePainter::LoadFile(const string &Fullpath, CreateParams &params, TextureDesc &desc)
+{
+	string extension = Fullpath.substr(Fullpath.find_last_of('.') + 1, Fullpath.size());
 	vector<TextureDesc> mipmaps;
 
 	if (extension == "dds")
@@ -149,6 +205,7 @@ unsigned int TexturePainter::LoadTexture(const string &Filename, CreateParams &p
 		}
 
 		delete [] desc.ImageData;
+		desc.ImageData=NULL;
 		for (unsigned i = 0; i < mipmaps.size(); i++)
 		{
 			delete [] mipmaps[i].ImageData;
@@ -227,6 +284,8 @@ unsigned int TexturePainter::LoadCubeMap(const string &Fullpath, CreateParams &p
 
 		UploadTexture(desc,params);
 		delete[] desc.ImageData;
+		desc.ImageData=NULL;
+		Track(params.ID, "", params, desc);
 		return params.ID;
 	}
 	m_LoadedMap[Fullpath]=0;
@@ -235,6 +294,7 @@ unsigned int TexturePainter::LoadCubeMap(const string &Fullpath, CreateParams &p
 
 void TexturePainter::UploadTexture(TextureDesc desc, CreateParams params)
 {
+	InvalidateCurrent();
 	glBindTexture(params.Type,params.ID);
 
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
@@ -290,6 +350,294 @@ void TexturePainter::UploadTexture(TextureDesc desc, CreateParams params)
 	}
 }
 
+// a white pixel, to stand in for a texture
+static void MakeBlank(unsigned int id)
+{
+	unsigned char white[4]={255,255,255,255};
+	glBindTexture(GL_TEXTURE_2D,id);
+	glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA,1,1,0,GL_RGBA,GL_UNSIGNED_BYTE,white);
+}
+
+unsigned int TexturePainter::LoadTextureAsync(const string &Fullpath, CreateParams &params)
+{
+	if (m_Loader==NULL) m_Loader=new TextureLoader;
+
+	GLuint id;
+	glGenTextures(1,&id);
+	params.ID=id;
+	m_LoadedMap[Fullpath]=id;
+	m_Loading[id]=params;
+	m_Loader->Add(id,Fullpath);
+	return id;
+}
+
+void TexturePainter::Update()
+{
+	m_Frame++;
+	m_Evictions=0;
+	if (m_MemoryBudget>0 && m_ResidentBytes>m_MemoryBudget) EvictToBudget();
+
+	if (m_Loader==NULL) return;
+
+	unsigned int budget=m_UploadBudget;
+	while (budget>0)
+	{
+		if (m_Uploads.empty())
+		{
+			// only take them one at a time, so the loader 
+			// can hold the decoding back if we get behind
+			AsyncUpload upload;
+			string log;
+			if (!m_Loader->Get(upload.ID,upload.Fullpath,upload.Desc,log)) break;
+			if (!log.empty()) Trace::Stream<<log;
+
+			if (upload.Desc.ImageData==NULL)
+			{
+				// the id may be in use already, so keep it but 
+				// leave it blank, and let it be loaded again
+				InvalidateCurrent();
+				MakeBlank(upload.ID);
+				m_Loading.erase(upload.ID);
+				// stop it being reloaded every time it's bound
+				m_Usage.erase(upload.ID);
+				map<string,int>::iterator i=m_LoadedMap.find(upload.Fullpath);
+				if (i!=m_LoadedMap.end() && i->second==(int)upload.ID) m_LoadedMap.erase(i);
+				continue;
+			}
+
+			upload.Params=m_Loading[upload.ID];
+			m_Uploads.push_back(upload);
+		}
+
+		AsyncUpload &upload=m_Uploads.front();
+		unsigned int sent=UploadRows(upload,budget);
+		budget-=sent<budget?sent:budget;
+		if (upload.Row==upload.Desc.Height)
+		{
+			FinishUpload(upload);
+			m_Uploads.pop_front();
+		}
+	}
+}
+
+unsigned int TexturePainter::UploadRows(AsyncUpload &upload, unsigned int budget)
+{
+	TextureDesc &desc=upload.Desc;
+	unsigned int rowbytes=desc.Size/desc.Height;
+	// always get somewhere, even if a row is over the budget
+	unsigned int rows=budget/rowbytes;
+	if (rows==0) rows=1;
+	if (rows>desc.Height-upload.Row) rows=desc.Height-upload.Row;
+	unsigned int size=rows*rowbytes;
+	unsigned char *src=desc.ImageData+upload.Row*rowbytes;
+
+	InvalidateCurrent();
+	glBindTexture(GL_TEXTURE_2D,upload.ID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	if (upload.Row==0)
+	{
+		// make room for it, the rows are filled in as we go
+		glTexImage2D(GL_TEXTURE_2D, 0, desc.InternalFormat, desc.Width, desc.Height, 0,
+				desc.Format, GL_UNSIGNED_BYTE, NULL);
+	}
+
+	bool sent=false;
+	if (GLEW_ARB_pixel_buffer_object)
+	{
+		// copying into a pixel buffer lets the driver send it
+		// to the card while we get on with the frame
+		if (m_PBO==0) glGenBuffers(1,&m_PBO);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER,m_PBO);
+		// orphan the last lot, in case it's still being read
+		glBufferData(GL_PIXEL_UNPACK_BUFFER,size,NULL,GL_STREAM_DRAW);
+		void *dst=glMapBuffer(GL_PIXEL_UNPACK_BUFFER,GL_WRITE_ONLY);
+		if (dst!=NULL)
+		{
+			memcpy(dst,src,size);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.Row, desc.Width, rows,
+					desc.Format, GL_UNSIGNED_BYTE, NULL);
+			sent=true;
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER,0);
+	}
+
+	if (!sent)
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.Row, desc.Width, rows,
+				desc.Format, GL_UNSIGNED_BYTE, src);
+	}
+
+	upload.Row+=rows;
+	return size;
+}
+
+void TexturePainter::FinishUpload(AsyncUpload &upload)
+{
+	TextureDesc &desc=upload.Desc;
+	glBindTexture(GL_TEXTURE_2D,upload.ID);
+
+	if (upload.Params.GenerateMipmaps)
+	{
+		// the card makes them much quicker than gluBuild2DMipmaps
+		if (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object)
+		{
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+		else if (GLEW_EXT_framebuffer_object)
+		{
+			glGenerateMipmapEXT(GL_TEXTURE_2D);
+		}
+		else
+		{
+			gluBuild2DMipmaps(GL_TEXTURE_2D, desc.InternalFormat, desc.Width, desc.Height,
+					desc.Format, GL_UNSIGNED_BYTE, desc.ImageData);
+		}
+	}
+
+	delete[] desc.ImageData;
+	desc.ImageData=NULL;
+	m_TextureMap[upload.ID]=desc;
+	m_Loading.erase(upload.ID);
+	Track(upload.ID,upload.Fullpath,upload.Params,desc);
+	InvalidateCurrent();
+}
+
+void TexturePainter::Track(unsigned int id, const string &Fullpath, const CreateParams &params, const TextureDesc &desc)
+{
+	TextureUsage &usage=m_Usage[id];
+	if (usage.Resident) m_ResidentBytes-=usage.Bytes;
+
+	usage.Fullpath=Fullpath;
+	usage.Params=params;
+	usage.Params.ID=id;
+	usage.Format=desc.InternalFormat;
+	usage.Width=desc.Width;
+	usage.Height=desc.Height;
+	if (params.Compress && m_TextureCompressionEnabled)
+	{
+		// as UploadTexture does
+		if (usage.Format==GL_RGB) usage.Format=GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		else if (usage.Format==GL_RGBA) usage.Format=GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	}
+
+	unsigned long pixels=desc.Width*desc.Height;
+	switch (usage.Format)
+	{
+		case GL_RGB: usage.Bytes=pixels*3; break;
+		case GL_RGBA: usage.Bytes=pixels*4; break;
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: usage.Bytes=pixels/2; break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: usage.Bytes=pixels; break;
+		default: usage.Bytes=desc.Size; break;
+	}
+	// a full set of mipmaps is another third
+	if (params.GenerateMipmaps) usage.Bytes+=usage.Bytes/3;
+
+	usage.LastUsed=m_Frame;
+	usage.Resident=true;
+	m_ResidentBytes+=usage.Bytes;
+}
+
+void TexturePainter::EvictToBudget()
+{
+	// anything bound since the last update is still being drawn, so 
+	// is left alone, even if that means staying over the budget
+	vector<pair<unsigned int,unsigned int> > unused;
+	for (map<unsigned int,TextureUsage>::iterator i=m_Usage.begin(); i!=m_Usage.end(); ++i)
+	{
+		if (i->second.Resident && i->second.Fullpath!="" && i->second.LastUsed+1<m_Frame)
+		{
+			unused.push_back(pair<unsigned int,unsigned int>(i->second.LastUsed,i->first));
+		}
+	}
+
+	// least recently used first
+	sort(unused.begin(),unused.end());
+	for (vector<pair<unsigned int,unsigned int> >::iterator i=unused.begin();
+		i!=unused.end() && m_ResidentBytes>m_MemoryBudget; ++i)
+	{
+		Evict(i->second,m_Usage[i->second]);
+	}
+}
+
+void TexturePainter::Evict(unsigned int id, TextureUsage &usage)
+{
+	// the id may be in use, so it's kept, but all its images are 
+	// made empty, which lets the driver free the memory
+	InvalidateCurrent();
+	glBindTexture(GL_TEXTURE_2D,id);
+	unsigned int w=usage.Width, h=usage.Height;
+	for (int level=0; ; level++)
+	{
+		glTexImage2D(GL_TEXTURE_2D,level,GL_RGBA,0,0,0,GL_RGBA,GL_UNSIGNED_BYTE,NULL);
+		if (!usage.Params.GenerateMipmaps || (w<=1 && h<=1)) break;
+		w=w>1?w/2:1;
+		h=h>1?h/2:1;
+	}
+
+	usage.Resident=false;
+	m_ResidentBytes-=usage.Bytes;
+	m_Evictions++;
+	m_TotalEvictions++;
+}
+
+void TexturePainter::Reload(unsigned int id, TextureUsage &usage)
+{
+	m_Reloads++;
+	CreateParams original=usage.Params;
+	CreateParams params=original;
+	params.ID=id;
+
+	if (CanLoadAsync(usage.Fullpath,params))
+	{
+		// the placeholder is drawn until it's back
+		if (m_Loader==NULL) m_Loader=new TextureLoader;
+		m_Loading[id]=params;
+		m_Loader->Add(id,usage.Fullpath);
+		return;
+	}
+
+	string fullpath=usage.Fullpath;
+	TextureDesc desc;
+	if (LoadFile(fullpath,params,desc)!=0)
+	{
+		Track(id,fullpath,original,desc);
+	}
+	else
+	{
+		InvalidateCurrent();
+		MakeBlank(id);
+		m_Usage.erase(id);
+	}
+}
+
+unsigned int TexturePainter::GetBindID(unsigned int id)
+{
+	map<unsigned int,TextureUsage>::iterator i=m_Usage.find(id);
+	if (i!=m_Usage.end())
+	{
+		i->second.LastUsed=m_Frame;
+		if (!i->second.Resident && m_Loading.find(id)==m_Loading.end())
+		{
+			Reload(id,i->second);
+		}
+	}
+
+	if (m_Loading.empty() || m_Loading.find(id)==m_Loading.end()) return id;
+
+	if (m_Placeholder==0)
+	{
+		GLuint placeholder;
+		glGenTextures(1,&placeholder);
+		m_Placeholder=placeholder;
+		MakeBlank(m_Placeholder);
+	}
+	return m_Placeholder;
+}
+
 ///todo: all pdata texture load/save is to 8 bit RGB or RGBA - need to deal with arbitrary channels and bit depths
 bool TexturePainter::LoadPData(const string &Filename, unsigned int &w, unsigned int &h, TypedPData<dColour> &pixels)
 {
@@ -363,9 +711,16 @@ unsigned int TexturePainter::MakeTexture(unsigned int w, unsigned int h, PData *
 	if (pixels)
 	{
 		// upload to card...
+		InvalidateCurrent();
 		glGenTextures(1,&ID);
 		glBindTexture(GL_TEXTURE_2D,ID);
 		gluBuild2DMipmaps(GL_TEXTURE_2D,4,w,h,GL_RGBA,GL_FLOAT,&pixels->m_Data[0]);
+
+		TextureDesc desc;
+		desc.Width=w;
+		desc.Height=h;
+		desc.InternalFormat=GL_RGBA;
+		Track(ID,"",CreateParams(),desc);
 		return ID;
 	}
 	return 0;
@@ -376,6 +731,24 @@ bool TexturePainter::SetCurrent(unsigned int *ids, TextureState *states)
 	bool ret=false;
 
 	int tcount = (m_MultitexturingEnabled ? MAX_TEXTURES : 1);
+
+	// skip it all if nothing has changed since last time
+	if (m_CurrentValid)
+	{
+		bool same=true;
+		for (int c = 0; c < tcount && same; c++)
+		{
+			same = ids[c]==m_CurrentIDs[c] &&
+				(ids[c]==0 || !memcmp(&states[c],&m_CurrentStates[c],sizeof(TextureState)));
+		}
+
+		if (same)
+		{
+			StateCache::Avoided();
+			return m_CurrentResult;
+		}
+	}
+
 	for (int c = 0; c < tcount; c++)
 	{
 	#ifndef DISABLE_MULTITEXTURE
@@ -404,7 +777,7 @@ bool TexturePainter::SetCurrent(unsigned int *ids, TextureState *states)
 			else // normal 2D texture path
 			{
 				glEnable(GL_TEXTURE_2D);
-				glBindTexture(GL_TEXTURE_2D,ids[c]);
+				glBindTexture(GL_TEXTURE_2D,GetBindID(ids[c]));
 				ApplyState(GL_TEXTURE_2D,states[c],false);
 			}
 
@@ -424,6 +797,11 @@ bool TexturePainter::SetCurrent(unsigned int *ids, TextureState *states)
 	}
 	#endif
 
+	m_CurrentIDs.assign(ids,ids+tcount);
+	m_CurrentStates.assign(states,states+tcount);
+	m_CurrentResult=ret;
+	m_CurrentValid=true;
+
 	return ret;
 }
 
@@ -444,6 +822,8 @@ void TexturePainter::ApplyState(int type, TextureState &state, bool cubemap)
 
 void TexturePainter::DisableAll()
 {
+	InvalidateCurrent();
+
 	#ifndef DISABLE_MULTITEXTURE
 	if (m_MultitexturingEnabled)
 	{
@@ -472,10 +852,54 @@ void TexturePainter::Dump()
 		if (info.Format==GL_RGB) Trace::Stream<<"RGB"<<endl;
 		else if (info.Format==GL_RGBA) Trace::Stream<<"RGBA"<<endl;
 	}
+	if (!m_Loading.empty()) Trace::Stream<<m_Loading.size()<<" still loading"<<endl;
+
+	MemoryStats stats;
+	GetMemoryStats(stats);
+	Trace::Stream<<stats.Resident<<" resident using "<<stats.ResidentBytes/1024<<"k";
+	if (m_MemoryBudget>0) Trace::Stream<<" of "<<m_MemoryBudget/1024<<"k";
+	Trace::Stream<<", "<<stats.Evicted<<" evicted, "<<stats.Reloads<<" reloads"<<endl;
+}
+
+// a short name for the format on the card, for the stats
+static string FormatName(int format)
+{
+	switch (format)
+	{
+		case GL_RGB: return "rgb";
+		case GL_RGBA: return "rgba";
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: 
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: return "dxt1";
+		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: return "dxt3";
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return "dxt5";
+		default: return "other";
+	}
+}
+
+void TexturePainter::GetMemoryStats(MemoryStats &stats)
+{
+	for (map<unsigned int,TextureUsage>::iterator i=m_Usage.begin(); i!=m_Usage.end(); ++i)
+	{
+		if (i->second.Resident)
+		{
+			stats.Resident++;
+			stats.Formats[FormatName(i->second.Format)]++;
+		}
+		else
+		{
+			stats.Evicted++;
+		}
+	}
+	stats.ResidentBytes=m_ResidentBytes;
+	stats.Evictions=m_Evictions;
+	stats.TotalEvictions=m_TotalEvictions;
+	stats.Reloads=m_Reloads;
 }
 
 bool TexturePainter::IsResident(unsigned int id)
 {
+	map<unsigned int,TextureUsage>::iterator i=m_Usage.find(id);
+	if (i!=m_Usage.end() && !i->second.Resident) return false;
 	GLboolean resident;
 	return glAreTexturesResident(1, &id, &resident);
 }
@@ -20,6 +20,7 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include <deque>
 #include "OpenGL.h"
 #include "PData.h"
 
@@ -29,6 +30,7 @@ namespace Fluxus
 {
 
 	class DDSLoader;
+	class TextureLoader;
 
 //////////////////////////////////////////////////////
 /// The texture state
@@ -65,6 +67,7 @@ class TexturePainter
 {
 	friend class PNGLoader;
 	friend class DDSLoader;
+	friend class TextureLoader;
 
 public:
 	///\todo stop this being a singleton...
@@ -90,7 +93,7 @@ public:
 	class CreateParams
 	{
 		public:
-		CreateParams(): ID(-1), Type(GL_TEXTURE_2D), GenerateMipmaps(true), MipLevel(0), Border(0), Compress(false) {}
+		CreateParams(): ID(-1), Type(GL_TEXTURE_2D), GenerateMipmaps(true), MipLevel(0), Border(0), Compress(false), Async(false) {}
 
 		int ID;
 		int Type;
@@ -98,15 +101,60 @@ public:
 		int MipLevel;
 		int Border;
 		bool Compress;
+		/// Decode and upload in the background, see LoadTexture
+		bool Async;
 	};
 
 	////////////////////////////////////
 	///@name Texture Generation/Conversion
 	///@{
 
-	/// Loads a texture returns the OpenGL ID number
+	/// Loads a texture returns the OpenGL ID number. If params.Async 
+	/// is set, new 2D png textures are decoded on other threads and 
+	/// uploaded a bit at a time by Update - the ID is returned straight
+	/// away, and a blank texture is drawn in its place until it's done
 	unsigned int LoadTexture(const string &Filename, CreateParams &params);
 
+	/// Uploads some of the textures being loaded in the background,
+	/// called once a frame by the renderer
+	void Update();
+
+	/// Sets the most texture data Update sends to the card each frame,
+	/// a row at least, so 0 is taken as 1 rather than stopping uploads
+	void SetUploadBudget(unsigned int bytes) { m_UploadBudget=bytes>0?bytes:1; }
+
+	/// The number of textures still loading in the background
+	unsigned int GetNumLoading() const { return m_Loading.size(); }
+
+	/// Sets the most memory textures should take up on the card, zero
+	/// for no limit. Update evicts the textures loaded from files which
+	/// have gone unused longest to keep under it - their ids stay valid,
+	/// and they are loaded again next time they're bound
+	void SetMemoryBudget(unsigned long bytes) { m_MemoryBudget=bytes; }
+	unsigned long GetMemoryBudget() const { return m_MemoryBudget; }
+
+	///////////////////////////////////
+	/// Texture memory use, see GetMemoryStats
+	class MemoryStats
+	{
+		public:
+		MemoryStats() : ResidentBytes(0), Resident(0), Evicted(0),
+			Evictions(0), TotalEvictions(0), Reloads(0) {}
+
+		/// An estimate, including mipmaps
+		unsigned long ResidentBytes;
+		unsigned int Resident;
+		unsigned int Evicted;
+		/// Evictions by the last Update
+		unsigned int Evictions;
+		unsigned int TotalEvictions;
+		unsigned int Reloads;
+		/// Resident textures counted by format name
+		map<string,unsigned int> Formats;
+	};
+
+	void GetMemoryStats(MemoryStats &stats);
+
 	/// Loads texture information into a pdata array of colour type
 	bool LoadPData(const string &Filename, unsigned int &w, unsigned int &h, TypedPData<dColour> &pixels);
 
@@ -139,6 +187,16 @@ public:
 	/// The size of ids is expected to be the same as MAX_TEXTURES
 	bool SetCurrent(unsigned int *ids, TextureState *states);
 
+	/// Forget the last state set by SetCurrent, so the
+	/// next call sets it all again. Needs calling by 
+	/// anything which binds textures itself
+	void InvalidateCurrent() { m_CurrentValid=false; }
+
+	/// What to bind for a texture id, which is the placeholder if it's
+	/// still loading. Marks it as used this frame, and loads it again if
+	/// it's been evicted - anything binding textures itself should use it
+	unsigned int GetBindID(unsigned int id);
+
 	/// Disables all texturing
 	void DisableAll();
 
@@ -182,8 +240,58 @@ private:
 	void ApplyState(int type, TextureState &state, bool cubemap);
 	unsigned int LoadCubeMap(const string &Fullpath, CreateParams &params);
 	void UploadTexture(TextureDesc desc, CreateParams params);
+	/// Decodes and uploads a file, the part of LoadTexture after the cache
+	unsigned int LoadFile(const string &Fullpath, CreateParams &params, TextureDesc &desc);
 	static TexturePainter *m_Singleton;
 
+	//////////////////////////////////////////////////////
+	/// What the memory budget knows about a texture. Ones
+	/// without a path can't be loaded again, so are never
+	/// evicted
+	class TextureUsage
+	{
+	public:
+		TextureUsage() : Format(0), Width(0), Height(0), Bytes(0), LastUsed(0), Resident(false) {}
+		string Fullpath;
+		CreateParams Params;
+		/// The format on the card
+		int Format;
+		/// Kept here as clearing the cache forgets the descriptions,
+		/// and eviction needs them to empty every mip level
+		unsigned int Width;
+		unsigned int Height;
+		unsigned long Bytes;
+		/// The frame it was last bound in
+		unsigned int LastUsed;
+		bool Resident;
+	};
+
+	/// Records a texture which has just been uploaded
+	void Track(unsigned int id, const string &Fullpath, const CreateParams &params, const TextureDesc &desc);
+	/// Evicts unused textures until they fit in the budget
+	void EvictToBudget();
+	void Evict(unsigned int id, TextureUsage &usage);
+	void Reload(unsigned int id, TextureUsage &usage);
+
+	//////////////////////////////////////////////////////
+	/// A texture being uploaded in the background
+	class AsyncUpload
+	{
+	public:
+		AsyncUpload() : ID(0), Row(0) {}
+		unsigned int ID;
+		string Fullpath;
+		TextureDesc Desc;
+		CreateParams Params;
+		/// How far it's got
+		unsigned int Row;
+	};
+
+	unsigned int LoadTextureAsync(const string &Fullpath, CreateParams &params);
+	/// Uploads as many rows as the budget allows, returns the bytes sent
+	unsigned int UploadRows(AsyncUpload &upload, unsigned int budget);
+	void FinishUpload(AsyncUpload &upload);
+
 	map<string,int> m_LoadedMap;
 	map<string,int> m_LoadedCubeMap;
 	map<unsigned int,TextureDesc> m_TextureMap;
@@ -191,6 +299,29 @@ private:
 	bool m_MultitexturingEnabled;
 	bool m_TextureCompressionEnabled;
 	bool m_SGISGenerateMipmap;
+
+	// the last SetCurrent, for skipping redundant changes
+	bool m_CurrentValid;
+	bool m_CurrentResult;
+	vector<unsigned int> m_CurrentIDs;
+	vector<TextureState> m_CurrentStates;
+
+	TextureLoader *m_Loader;
+	/// The textures which haven't finished loading, and their params
+	map<unsigned int,CreateParams> m_Loading;
+	deque<AsyncUpload> m_Uploads;
+	unsigned int m_UploadBudget;
+	unsigned int m_Placeholder;
+	unsigned int m_PBO;
+
+	map<unsigned int,TextureUsage> m_Usage;
+	unsigned long m_MemoryBudget;
+	unsigned long m_ResidentBytes;
+	/// Counts calls to Update
+	unsigned int m_Frame;
+	unsigned int m_Evictions;
+	unsigned int m_TotalEvictions;
+	unsigned int m_Reloads;
 };
 
 }
@@ -0,0 +1,105 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include "VertexBuffer.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+
+bool VertexBuffer::m_Checked=false;
+bool VertexBuffer::m_Supported=false;
+
+VertexBuffer::VertexBuffer(GLenum target) :
+m_Target(target),
+m_Buffer(0),
+m_Bytes(0)
+{
+}
+
+VertexBuffer::~VertexBuffer()
+{
+	if (m_Buffer!=0)
+	{
+		glDeleteBuffers(1,&m_Buffer);
+	}
+}
+
+bool VertexBuffer::Supported()
+{
+	if (!m_Checked)
+	{
+		m_Supported=glewIsSupported("GL_VERSION_1_5");
+		if (!m_Supported)
+		{
+			Trace::Stream<<"Warning: vertex buffer objects not supported, using client side arrays"<<endl;
+		}
+		m_Checked=true;
+	}
+	return m_Supported;
+}
+
+void VertexBuffer::Update(PData *data)
+{
+	if (m_Buffer==0) glGenBuffers(1,&m_Buffer);
+	glBindBuffer(m_Target,m_Buffer);
+
+	unsigned int bytes=data->Size()*data->GetElementSize();
+	if (bytes!=m_Bytes)
+	{
+		// size has changed, so (re)allocate and send the lot
+		glBufferData(m_Target,bytes,data->GetRaw(),GL_DYNAMIC_DRAW);
+		m_Bytes=bytes;
+	}
+	else if (data->IsDirty())
+	{
+		unsigned int start,end;
+		data->GetDirtyRange(start,end);
+		if (start<end)
+		{
+			unsigned int size=data->GetElementSize();
+			glBufferSubData(m_Target,start*size,(end-start)*size,
+				static_cast<char*>(data->GetRaw())+start*size);
+		}
+	}
+
+	data->ClearDirty();
+}
+
+void VertexBuffer::Update(const void *data, unsigned int bytes, bool dirty)
+{
+	if (m_Buffer==0) glGenBuffers(1,&m_Buffer);
+	glBindBuffer(m_Target,m_Buffer);
+
+	if (bytes!=m_Bytes)
+	{
+		glBufferData(m_Target,bytes,data,GL_DYNAMIC_DRAW);
+		m_Bytes=bytes;
+	}
+	else if (dirty)
+	{
+		glBufferSubData(m_Target,0,bytes,data);
+	}
+}
+
+void VertexBuffer::Bind()
+{
+	glBindBuffer(m_Target,m_Buffer);
+}
+
+void VertexBuffer::Unbind()
+{
+	glBindBuffer(m_Target,0);
+}
@@ -0,0 +1,67 @@
+// Copyright (C) 2005 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#ifndef N_VERTEX_BUFFER
+#define N_VERTEX_BUFFER
+
+#include "OpenGL.h"
+#include "PData.h"
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////
+/// A copy of a pdata array held in video memory. 
+/// The whole array is uploaded the first time, after 
+/// that only the dirty range of the pdata is sent,
+/// so static geometry costs nothing per frame.
+class VertexBuffer
+{
+public:
+	VertexBuffer(GLenum target=GL_ARRAY_BUFFER);
+	~VertexBuffer();
+	
+	/// Whether the driver supports buffer objects
+	static bool Supported();
+	
+	/// Brings the buffer up to date with the pdata,
+	/// clears the pdata's dirty range, and leaves 
+	/// the buffer bound
+	void Update(PData *data);
+	
+	/// As above, for data not stored as pdata (indices),
+	/// the whole buffer is reuploaded if dirty is set
+	void Update(const void *data, unsigned int bytes, bool dirty);
+	
+	void Bind();
+	void Unbind();
+	
+private:
+	// not copyable, we own the buffer object
+	VertexBuffer(const VertexBuffer &other);
+	const VertexBuffer &operator=(const VertexBuffer &other);
+	
+	GLenum m_Target;
+	GLuint m_Buffer;
+	unsigned int m_Bytes;
+	
+	static bool m_Checked;
+	static bool m_Supported;
+};
+
+}
+
+#endif
@@ -26,6 +26,10 @@
 #include <iostream>
 #include "Trace.h"
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 using namespace std;
 
 namespace Fluxus
@@ -485,6 +489,20 @@ public:
     	t.m[i][j]=m[0][j]*rhs.m[i][0]+m[1][j]*rhs.m[i][1]+m[2][j]*rhs.m[i][2]+m[3][j]*rhs.m[i][3];
     	*/
 
+#ifdef __SSE__
+		// each row of the result is the rows of this matrix weighted
+		// by the same row of rhs
+		__m128 r0=_mm_loadu_ps(m[0]), r1=_mm_loadu_ps(m[1]);
+		__m128 r2=_mm_loadu_ps(m[2]), r3=_mm_loadu_ps(m[3]);
+		for (int i=0; i<4; i++)
+		{
+			__m128 row=_mm_mul_ps(_mm_set1_ps(rhs.m[i][0]),r0);
+			row=_mm_add_ps(row,_mm_mul_ps(_mm_set1_ps(rhs.m[i][1]),r1));
+			row=_mm_add_ps(row,_mm_mul_ps(_mm_set1_ps(rhs.m[i][2]),r2));
+			row=_mm_add_ps(row,_mm_mul_ps(_mm_set1_ps(rhs.m[i][3]),r3));
+			_mm_storeu_ps(t.m[i],row);
+		}
+#else
     	t.m[0][0]=m[0][0]*rhs.m[0][0]+m[1][0]*rhs.m[0][1]+m[2][0]*rhs.m[0][2]+m[3][0]*rhs.m[0][3];
     	t.m[0][1]=m[0][1]*rhs.m[0][0]+m[1][1]*rhs.m[0][1]+m[2][1]*rhs.m[0][2]+m[3][1]*rhs.m[0][3];
     	t.m[0][2]=m[0][2]*rhs.m[0][0]+m[1][2]*rhs.m[0][1]+m[2][2]*rhs.m[0][2]+m[3][2]*rhs.m[0][3];
@@ -504,6 +522,7 @@ public:
     	t.m[3][1]=m[0][1]*rhs.m[3][0]+m[1][1]*rhs.m[3][1]+m[2][1]*rhs.m[3][2]+m[3][1]*rhs.m[3][3];
     	t.m[3][2]=m[0][2]*rhs.m[3][0]+m[1][2]*rhs.m[3][1]+m[2][2]*rhs.m[3][2]+m[3][2]*rhs.m[3][3];
     	t.m[3][3]=m[0][3]*rhs.m[3][0]+m[1][3]*rhs.m[3][1]+m[2][3]*rhs.m[3][2]+m[3][3]*rhs.m[3][3];
+#endif
 
     	return t;
 	}
@@ -775,20 +794,24 @@ public:
 	inline dVector transform(dVector const &p) const
 	{
     	dVector t;
+#ifdef __SSE__
+		__m128 r=_mm_mul_ps(_mm_set1_ps(p.x),_mm_loadu_ps(m[0]));
+		r=_mm_add_ps(r,_mm_mul_ps(_mm_set1_ps(p.y),_mm_loadu_ps(m[1])));
+		r=_mm_add_ps(r,_mm_mul_ps(_mm_set1_ps(p.z),_mm_loadu_ps(m[2])));
+		r=_mm_add_ps(r,_mm_mul_ps(_mm_set1_ps(p.w),_mm_loadu_ps(m[3])));
+		_mm_storeu_ps(t.arr(),r);
+#else
     	t.x=p.x*m[0][0] + p.y*m[1][0] + p.z*m[2][0] + p.w*m[3][0];
     	t.y=p.x*m[0][1] + p.y*m[1][1] + p.z*m[2][1] + p.w*m[3][1];
     	t.z=p.x*m[0][2] + p.y*m[1][2] + p.z*m[2][2] + p.w*m[3][2];
     	t.w=p.x*m[0][3] + p.y*m[1][3] + p.z*m[2][3] + p.w*m[3][3];
+#endif
     	return t;
 	}
 
 	inline dVector transform_persp(dVector const &p) const
 	{
-    	dVector t;
-    	t.x=p.x*m[0][0] + p.y*m[1][0] + p.z*m[2][0] + p.w*m[3][0];
-    	t.y=p.x*m[0][1] + p.y*m[1][1] + p.z*m[2][1] + p.w*m[3][1];
-    	t.z=p.x*m[0][2] + p.y*m[1][2] + p.z*m[2][2] + p.w*m[3][2];
-    	t.w=p.x*m[0][3] + p.y*m[1][3] + p.z*m[2][3] + p.w*m[3][3];
+    	dVector t=transform(p);
 		t.homog();
     	return t;
 	}
@@ -855,26 +878,46 @@ public:
 
 	inline dMatrix inverse() const
 	{
+		// cofactors built from the 2x2 determinants of the top
+		// and bottom pairs of rows, divided by the determinant
+		float s0=m[0][0]*m[1][1]-m[1][0]*m[0][1];
+		float s1=m[0][0]*m[1][2]-m[1][0]*m[0][2];
+		float s2=m[0][0]*m[1][3]-m[1][0]*m[0][3];
+		float s3=m[0][1]*m[1][2]-m[1][1]*m[0][2];
+		float s4=m[0][1]*m[1][3]-m[1][1]*m[0][3];
+		float s5=m[0][2]*m[1][3]-m[1][2]*m[0][3];
+
+		float c5=m[2][2]*m[3][3]-m[3][2]*m[2][3];
+		float c4=m[2][1]*m[3][3]-m[3][1]*m[2][3];
+		float c3=m[2][1]*m[3][2]-m[3][1]*m[2][2];
+		float c2=m[2][0]*m[3][3]-m[3][0]*m[2][3];
+		float c1=m[2][0]*m[3][2]-m[3][0]*m[2][2];
+		float c0=m[2][0]*m[3][1]-m[3][0]*m[2][1];
+
+		float det=s0*c5-s1*c4+s2*c3+s3*c2-s4*c1+s5*c0;
+		float r=det?1/det:0;
+
 		dMatrix temp;
-		temp.m[0][0] = m[1][2]*m[2][3]*m[3][1] - m[1][3]*m[2][2]*m[3][1] + m[1][3]*m[2][1]*m[3][2] - m[1][1]*m[2][3]*m[3][2] - m[1][2]*m[2][1]*m[3][3] + m[1][1]*m[2][2]*m[3][3];
-		temp.m[0][1] = m[0][3]*m[2][2]*m[3][1] - m[0][2]*m[2][3]*m[3][1] - m[0][3]*m[2][1]*m[3][2] + m[0][1]*m[2][3]*m[3][2] + m[0][2]*m[2][1]*m[3][3] - m[0][1]*m[2][2]*m[3][3];
-		temp.m[0][2] = m[0][2]*m[1][3]*m[3][1] - m[0][3]*m[1][2]*m[3][1] + m[0][3]*m[1][1]*m[3][2] - m[0][1]*m[1][3]*m[3][2] - m[0][2]*m[1][1]*m[3][3] + m[0][1]*m[1][2]*m[3][3];
-		temp.m[0][3] = m[0][3]*m[1][2]*m[2][1] - m[0][2]*m[1][3]*m[2][1] - m[0][3]*m[1][1]*m[2][2] + m[0][1]*m[1][3]*m[2][2] + m[0][2]*m[1][1]*m[2][3] - m[0][1]*m[1][2]*m[2][3];
-		temp.m[1][0] = m[1][3]*m[2][2]*m[3][0] - m[1][2]*m[2][3]*m[3][0] - m[1][3]*m[2][0]*m[3][2] + m[1][0]*m[2][3]*m[3][2] + m[1][2]*m[2][0]*m[3][3] - m[1][0]*m[2][2]*m[3][3];
-		temp.m[1][1] = m[0][2]*m[2][3]*m[3][0] - m[0][3]*m[2][2]*m[3][0] + m[0][3]*m[2][0]*m[3][2] - m[0][0]*m[2][3]*m[3][2] - m[0][2]*m[2][0]*m[3][3] + m[0][0]*m[2][2]*m[3][3];
-		temp.m[1][2] = m[0][3]*m[1][2]*m[3][0] - m[0][2]*m[1][3]*m[3][0] - m[0][3]*m[1][0]*m[3][2] + m[0][0]*m[1][3]*m[3][2] + m[0][2]*m[1][0]*m[3][3] - m[0][0]*m[1][2]*m[3][3];
-		temp.m[1][3] = m[0][2]*m[1][3]*m[2][0] - m[0][3]*m[1][2]*m[2][0] + m[0][3]*m[1][0]*m[2][2] - m[0][0]*m[1][3]*m[2][2] - m[0][2]*m[1][0]*m[2][3] + m[0][0]*m[1][2]*m[2][3];
-		temp.m[2][0] = m[1][1]*m[2][3]*m[3][0] - m[1][3]*m[2][1]*m[3][0] + m[1][3]*m[2][0]*m[3][1] - m[1][0]*m[2][3]*m[3][1] - m[1][1]*m[2][0]*m[3][3] + m[1][0]*m[2][1]*m[3][3];
-		temp.m[2][1] = m[0][3]*m[2][1]*m[3][0] - m[0][1]*m[2][3]*m[3][0] - m[0][3]*m[2][0]*m[3][1] + m[0][0]*m[2][3]*m[3][1] + m[0][1]*m[2][0]*m[3][3] - m[0][0]*m[2][1]*m[3][3];
-		temp.m[2][2] = m[0][1]*m[1][3]*m[3][0] - m[0][3]*m[1][1]*m[3][0] + m[0][3]*m[1][0]*m[3][1] - m[0][0]*m[1][3]*m[3][1] - m[0][1]*m[1][0]*m[3][3] + m[0][0]*m[1][1]*m[3][3];
-		temp.m[2][3] = m[0][3]*m[1][1]*m[2][0] - m[0][1]*m[1][3]*m[2][0] - m[0][3]*m[1][0]*m[2][1] + m[0][0]*m[1][3]*m[2][1] + m[0][1]*m[1][0]*m[2][3] - m[0][0]*m[1][1]*m[2][3];
-		temp.m[3][0] = m[1][2]*m[2][1]*m[3][0] - m[1][1]*m[2][2]*m[3][0] - m[1][2]*m[2][0]*m[3][1] + m[1][0]*m[2][2]*m[3][1] + m[1][1]*m[2][0]*m[3][2] - m[1][0]*m[2][1]*m[3][2];
-		temp.m[3][1] = m[0][1]*m[2][2]*m[3][0] - m[0][2]*m[2][1]*m[3][0] + m[0][2]*m[2][0]*m[3][1] - m[0][0]*m[2][2]*m[3][1] - m[0][1]*m[2][0]*m[3][2] + m[0][0]*m[2][1]*m[3][2];
-		temp.m[3][2] = m[0][2]*m[1][1]*m[3][0] - m[0][1]*m[1][2]*m[3][0] - m[0][2]*m[1][0]*m[3][1] + m[0][0]*m[1][2]*m[3][1] + m[0][1]*m[1][0]*m[3][2] - m[0][0]*m[1][1]*m[3][2];
-		temp.m[3][3] = m[0][1]*m[1][2]*m[2][0] - m[0][2]*m[1][1]*m[2][0] + m[0][2]*m[1][0]*m[2][1] - m[0][0]*m[1][2]*m[2][1] - m[0][1]*m[1][0]*m[2][2] + m[0][0]*m[1][1]*m[2][2];
-	   float scale=1/temp.determinant();
-	   temp.scale(scale,scale,scale);
-	   return temp;
+		temp.m[0][0]=( m[1][1]*c5-m[1][2]*c4+m[1][3]*c3)*r;
+		temp.m[0][1]=(-m[0][1]*c5+m[0][2]*c4-m[0][3]*c3)*r;
+		temp.m[0][2]=( m[3][1]*s5-m[3][2]*s4+m[3][3]*s3)*r;
+		temp.m[0][3]=(-m[2][1]*s5+m[2][2]*s4-m[2][3]*s3)*r;
+
+		temp.m[1][0]=(-m[1][0]*c5+m[1][2]*c2-m[1][3]*c1)*r;
+		temp.m[1][1]=( m[0][0]*c5-m[0][2]*c2+m[0][3]*c1)*r;
+		temp.m[1][2]=(-m[3][0]*s5+m[3][2]*s2-m[3][3]*s1)*r;
+		temp.m[1][3]=( m[2][0]*s5-m[2][2]*s2+m[2][3]*s1)*r;
+
+		temp.m[2][0]=( m[1][0]*c4-m[1][1]*c2+m[1][3]*c0)*r;
+		temp.m[2][1]=(-m[0][0]*c4+m[0][1]*c2-m[0][3]*c0)*r;
+		temp.m[2][2]=( m[3][0]*s4-m[3][1]*s2+m[3][3]*s0)*r;
+		temp.m[2][3]=(-m[2][0]*s4+m[2][1]*s2-m[2][3]*s0)*r;
+
+		temp.m[3][0]=(-m[1][0]*c3+m[1][1]*c1-m[1][2]*c0)*r;
+		temp.m[3][1]=( m[0][0]*c3-m[0][1]*c1+m[0][2]*c0)*r;
+		temp.m[3][2]=(-m[3][0]*s3+m[3][1]*s1-m[3][2]*s0)*r;
+		temp.m[3][3]=( m[2][0]*s3-m[2][1]*s1+m[2][2]*s0)*r;
+		return temp;
 	}
 
 	inline float determinant()  const
@@ -987,10 +1030,10 @@ class dBoundingBox
 {
 public:
 	dBoundingBox() : m_Empty(true) {}
-	dBoundingBox(const dVector &cmin, const dVector &cmax) : min(cmin), max(cmax) {}
+	dBoundingBox(const dVector &cmin, const dVector &cmax) : min(cmin), max(cmax), m_Empty(false) {}
 	virtual ~dBoundingBox() {}
 	
-	bool empty() { return m_Empty; }
+	bool empty() const { return m_Empty; }
 	void getvertices(dVector *out) const;
 	void expand(dVector v);
 	void expand(dBoundingBox v);
@@ -15,73 +15,107 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 #include <limits.h>
+#include <unistd.h>
 #include <iostream>
 #include <sndfile.h>
 #include "AudioCollector.h"
 #include "JackClient.h"
 
 static const int MAX_FFT_LENGTH = 4096;
+// the biggest jack period we expect to be given
+static const unsigned int MAX_JACK_PERIOD = 8192;
+// how many ffts are run over each buffer length of audio
+static const unsigned int HOPS_PER_BUFFER = 4;
+// set in m_Middle when it's been written since the render thread last looked
+static const int FRESH = 4;
 
-FFT::FFT(int length) :
-m_FFTLength(length),
-#ifndef __FFTWFLOAT__
-m_In(new double[length]),
-#else
-m_In(new float[length]),
-#endif
-
-#ifndef __FFTWFLOAT__
-m_Spectrum(new fftw_complex[length])
+// swaps the value, with a full barrier either side
+static int Exchange(volatile int *p, int v)
 {
-	m_Plan = fftw_plan_dft_r2c_1d(m_FFTLength, m_In, m_Spectrum, FFTW_ESTIMATE);
+	int old;
+	do old=*p; while (!__sync_bool_compare_and_swap(p,old,v));
+	return old;
 }
-#else
-m_Spectrum(new fftwf_complex[length])
+
+FFT::FFT(int length) :
+m_FFTLength(length),
+m_In((float*)fftwf_malloc(sizeof(float)*length)),
+m_Window(new float[length]),
+m_Spectrum((fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex)*(length/2+1)))
 {
-	m_Plan = fftwf_plan_dft_r2c_1d(m_FFTLength, m_In, m_Spectrum, FFTW_ESTIMATE);
+	// measuring scribbles over the arrays, so do it before filling them
+	m_Plan = fftwf_plan_dft_r2c_1d(m_FFTLength, m_In, m_Spectrum, FFTW_MEASURE);
+	memset(m_In,0,sizeof(float)*length);
+
+	// the window loses half the level, so make up for it here
+	for (unsigned int i=0; i<m_FFTLength; i++)
+	{
+		m_Window[i] = 1.0f-cosf(2.0f*M_PI*i/(float)m_FFTLength);
+	}
 }
-#endif
 
 FFT::~FFT()
 {
-	delete[] m_In;
-#ifndef __FFTWFLOAT__
-	fftw_destroy_plan(m_Plan);
-#else
 	fftwf_destroy_plan(m_Plan);
-#endif
+	fftwf_free(m_In);
+	fftwf_free(m_Spectrum);
+	delete[] m_Window;
 }
 
-void FFT::Impulse2Freq(float *imp, float *out)
+void FFT::Impulse2Freq(const float *imp, float *out)
 {
-  unsigned int i;
-
-  for (i=0; i<m_FFTLength; i++)
-  {
-    m_In[i] = imp[i];
-  }
-
-#ifndef __FFTWFLOAT__
-  fftw_execute(m_Plan);
-#else
-  fftwf_execute(m_Plan);
-#endif
-
-  for (i=0; i<m_FFTLength; i++)
-  {
-    out[i] = m_Spectrum[i][0];
-  }
+	for (unsigned int i=0; i<m_FFTLength; i++)
+	{
+		m_In[i] = imp[i]*m_Window[i];
+	}
+
+	fftwf_execute(m_Plan);
+
+	for (unsigned int i=0; i<GetNumBins(); i++)
+	{
+		out[i] = sqrtf(m_Spectrum[i][0]*m_Spectrum[i][0]+m_Spectrum[i][1]*m_Spectrum[i][1]);
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+AudioCollector::BarTable::BarTable(unsigned int numbars, unsigned int numbins) :
+NumBars(numbars),
+From(numbars),
+To(numbars)
+{
+	// spaced evenly in octaves from the first bin above dc up to 
+	// nyquist, but at least a bin wide where they would be narrower
+	unsigned int top=numbins-1;
+	unsigned int from=1;
+	for (unsigned int n=0; n<numbars; n++)
+	{
+		unsigned int to=(unsigned int)(powf((float)top,(n+1)/(float)numbars)+0.5f);
+		if (to<from) to=from;
+		if (to>top) to=top;
+		From[n]=from<top?from:top;
+		To[n]=to;
+		from=to+1;
+	}
+}
+
 AudioCollector::AudioCollector(const string &port, int BufferLength, unsigned int Samplerate, const string &portname, int FFTBuffers) :
 m_Gain(1),
 m_SmoothingBias(0.8),
 m_FFT(BufferLength),
+m_ProcessFFT(BufferLength),
 m_FFTBuffers(FFTBuffers),
 m_JackBuffer(NULL),
+m_RingWrite(0),
+m_RingRead(0),
+m_Back(0),
+m_Front(1),
+m_Middle(2),
+m_ThreadRunning(false),
+m_Quit(false),
 m_OSSBuffer(NULL),
 m_OneOverSHRT_MAX(1/(float)SHRT_MAX),
 m_Processing(false),
@@ -91,15 +125,23 @@ m_NumBars(16)
 	m_BufferLength = BufferLength;
 	m_Samplerate = Samplerate;
 	m_BufferTime = m_BufferLength/(float)m_Samplerate;
+	m_Hop = m_BufferLength/HOPS_PER_BUFFER;
+	if (m_Hop<1) m_Hop=1;
 	
-	m_Buffer = new float[BufferLength];
-	memset(m_Buffer,0,BufferLength*sizeof(float));
+	m_Spectrum.resize(m_FFT.GetNumBins());
+	m_ProcessSpectrum.resize(m_FFT.GetNumBins());
+	m_History.resize(m_BufferLength,0);
 	
-	m_FFTBuffer = new float[BufferLength*m_FFTBuffers];
-	memset(m_FFTBuffer,0,BufferLength*sizeof(float));
+	// jack gives us a period at a time, which may be more than the buffer
+	m_JackBufferLength = max(m_BufferLength,MAX_JACK_PERIOD);
+	m_JackBuffer = new float[m_JackBufferLength];
+	memset(m_JackBuffer,0,m_JackBufferLength*sizeof(float));
 	
-	m_JackBuffer = new float[BufferLength];
-	memset(m_JackBuffer,0,BufferLength*sizeof(float));
+	// room for a few periods, in case the analysis thread is held up
+	unsigned int ringsize=1;
+	while (ringsize<m_JackBufferLength*4) ringsize<<=1;
+	m_Ring.resize(ringsize,0);
+	m_RingMask=ringsize-1;
 	
 	m_AudioBuffer = new float[BufferLength];
 	memset(m_AudioBuffer,0,BufferLength*sizeof(float));
@@ -107,8 +149,17 @@ m_NumBars(16)
 	m_FFTOutput = new float[m_NumBars];
 	for (unsigned int n=0; n<m_NumBars; n++) m_FFTOutput[n]=0;
 	
-	m_Mutex = new pthread_mutex_t;
-	pthread_mutex_init(m_Mutex,NULL);
+	m_Table = new BarTable(m_NumBars,m_FFT.GetNumBins());
+	m_TableInUse = NULL;
+	
+	if (pthread_create(&m_Thread,NULL,AnalysisThread,this)==0)
+	{
+		m_ThreadRunning=true;
+	}
+	else
+	{
+		cerr<<"Could not start the audio analysis thread"<<endl;
+	}
 	
 	JackClient *Jack = JackClient::Get();
 	Jack->SetCallback(AudioCallback,(void*)this);
@@ -128,6 +179,21 @@ m_NumBars(16)
 AudioCollector::~AudioCollector()
 {
 	JackClient::Get()->Detach();
+	
+	if (m_ThreadRunning)
+	{
+		m_Quit=true;
+		pthread_join(m_Thread,NULL);
+	}
+	
+	for (vector<BarTable*>::iterator i=m_OldTables.begin(); i!=m_OldTables.end(); ++i)
+	{
+		delete *i;
+	}
+	delete m_Table;
+	delete[] m_JackBuffer;
+	delete[] m_AudioBuffer;
+	delete[] m_FFTOutput;
 }
 
 bool AudioCollector::IsConnected()
@@ -140,13 +206,66 @@ float AudioCollector::GetHarmonic(int h)
 	return  m_FFTOutput[h%m_NumBars];
 }
 
+void AudioCollector::SetNumBars(unsigned int s)
+{
+	if (s < 1) s = 1;
+	m_NumBars = s;
+	delete[] m_FFTOutput;
+	m_FFTOutput = new float[s];
+	memset(m_FFTOutput, 0, sizeof(float) * s);
+	
+	// the analysis thread picks it up at the next hop
+	BarTable *old = m_Table;
+	m_OldTables.push_back(old);
+	BarTable *table = new BarTable(s,m_FFT.GetNumBins());
+	__sync_synchronize();
+	m_Table = table;
+	DeleteOldTables();
+}
+
+void AudioCollector::DeleteOldTables()
+{
+	// any the analysis thread isn't holding on to can go, as
+	// it'll only see the current one from now on
+	__sync_synchronize();
+	unsigned int n=0;
+	while (n<m_OldTables.size())
+	{
+		if (m_OldTables[n]!=m_TableInUse)
+		{
+			delete m_OldTables[n];
+			m_OldTables[n]=m_OldTables.back();
+			m_OldTables.pop_back();
+		}
+		else n++;
+	}
+}
+
+void AudioCollector::MakeBars(FFT &fft, const float *audio, const BarTable &table, float *spectrum, float *bars)
+{
+	fft.Impulse2Freq(audio,spectrum);
+	for (unsigned int n=0; n<table.NumBars; n++)
+	{
+		float Value = 0;
+		for (unsigned int i=table.From[n]; i<=table.To[n]; i++)
+		{
+			Value += spectrum[i];
+		}
+		bars[n] = Value;
+	}
+}
+
 float *AudioCollector::GetFFT()
 {
+	const float *bars = NULL;
+	
 	if (m_Processing)
 	{
 		if (m_ProcessPos+m_BufferLength<m_ProcessLength)
 		{
-			m_FFT.Impulse2Freq(m_ProcessBuffer+m_ProcessPos,m_FFTBuffer);
+			m_ProcessBars.resize(m_Table->NumBars);
+			MakeBars(m_ProcessFFT,m_ProcessBuffer+m_ProcessPos,*m_Table,&m_ProcessSpectrum[0],&m_ProcessBars[0]);
+			bars = &m_ProcessBars[0];
 			memcpy((void*)m_AudioBuffer,(void*)(m_ProcessBuffer+m_ProcessPos),m_BufferLength*sizeof(float));
 			m_ProcessPos+=m_BufferLength;
 		}
@@ -161,43 +280,110 @@ float *AudioCollector::GetFFT()
 	}
 	else
 	{
-		pthread_mutex_lock(m_Mutex);
-		memcpy((void*)m_AudioBuffer,(void*)m_Buffer,m_BufferLength*sizeof(float));
-		pthread_mutex_unlock(m_Mutex);
+		// swap in the latest results, if there are new ones
+		if (m_Middle&FRESH)
+		{
+			m_Front = Exchange(&m_Middle,m_Front)&~FRESH;
+		}
+		
+		const Result &result = m_Results[m_Front];
+		// they may be from before the number of bars changed
+		if (result.Bars.size()==m_NumBars)
+		{
+			bars = &result.Bars[0];
+			memcpy((void*)m_AudioBuffer,(void*)&result.Audio[0],m_BufferLength*sizeof(float));
+		}
+	}
+
+	if (bars!=NULL)
+	{
+		for (unsigned int n=0; n<m_NumBars; n++)
+		{
+			float Value = bars[n]*m_Gain;
+			m_FFTOutput[n]=((m_FFTOutput[n]*m_SmoothingBias)+Value*(1-m_SmoothingBias));
+		}
+	}
+	
+	if (!m_OldTables.empty()) DeleteOldTables();
+	return m_FFTOutput;
+}
 
-		m_FFT.Impulse2Freq(m_AudioBuffer,m_FFTBuffer);
+void *AudioCollector::AnalysisThread(void *context)
+{
+	AudioCollector *collector=(AudioCollector*)context;
+	
+	// wake up a couple of times a hop
+	useconds_t sleep=(useconds_t)(collector->m_Hop*500000.0/collector->m_Samplerate);
+	if (sleep<1000) sleep=1000;
+	
+	while (!collector->m_Quit)
+	{
+		collector->Analyse();
+		usleep(sleep);
 	}
+	return NULL;
+}
 
-	// seem to only have stuff in the lower half - something to do with nyquist?
-	float UsefulArea = m_BufferLength/2;
+void AudioCollector::Analyse()
+{
+	unsigned int read=m_RingRead;
+	unsigned int available=m_RingWrite-read;
+	__sync_synchronize();
 
-	for (unsigned int n=0; n<m_NumBars; n++)
+	// if we've fallen a long way behind, skip to the latest
+	// audio, as nobody wants to see old results
+	if (available>m_BufferLength*2)
 	{
-		float Value = 0;
+		unsigned int skip=(available-m_BufferLength)/m_Hop*m_Hop;
+		read+=skip;
+		available-=skip;
+	}
 
-		float f = n/(float)m_NumBars;
-		float t = (n+1)/(float)m_NumBars;
-		f*=f;
-		t*=t;
-		unsigned from = f*UsefulArea;
-		unsigned to = t*UsefulArea;
+	if (available<m_Hop) return;
 
-		for (unsigned int i=from; i<=to; i++)
+	// hold on to the table, making sure it wasn't replaced
+	// before the render thread could see we're using it
+	BarTable *table;
+	do
+	{
+		table=m_Table;
+		m_TableInUse=table;
+		__sync_synchronize();
+	}
+	while (table!=m_Table);
+
+	while (available>=m_Hop)
+	{
+		// slide the last buffer length of audio along by a hop
+		memmove(&m_History[0],&m_History[m_Hop],(m_BufferLength-m_Hop)*sizeof(float));
+		float *dest=&m_History[m_BufferLength-m_Hop];
+		for (unsigned int n=0; n<m_Hop; n++)
 		{
-			if (i<m_BufferLength)
-			{
-				Value += m_FFTBuffer[i];
-			}
+			dest[n]=m_Ring[(read+n)&m_RingMask];
 		}
+		read+=m_Hop;
+		available-=m_Hop;
+		__sync_synchronize();
+		m_RingRead=read;
+
+		// only the last one is going to be seen
+		if (available>=m_Hop) continue;
 
-		if (Value<0) Value=-Value;
-		Value*=m_Gain;
-		m_FFTOutput[n]=((m_FFTOutput[n]*m_SmoothingBias)+Value*(1-m_SmoothingBias));
+		Result &result=m_Results[m_Back];
+		result.Bars.resize(table->NumBars);
+		result.Audio=m_History;
+		MakeBars(m_FFT,&m_History[0],*table,&m_Spectrum[0],&result.Bars[0]);
+		Publish();
 	}
 
-	return m_FFTOutput;
+	__sync_synchronize();
+	m_TableInUse=NULL;
 }
 
+void AudioCollector::Publish()
+{
+	m_Back = Exchange(&m_Middle,m_Back|FRESH)&~FRESH;
+}
 
 void AudioCollector::Process(const string &filename)
 {
@@ -243,11 +429,19 @@ void AudioCollector::Process(const string &filename)
 
 void AudioCollector::AudioCallback_i(unsigned int Size)
 {
-	if (Size<=m_BufferLength && !pthread_mutex_trylock(m_Mutex))
+	if (Size>m_JackBufferLength) Size=m_JackBufferLength;
+	
+	// never waits - if the analysis thread has fallen this
+	// far behind, it can do without this period
+	unsigned int write=m_RingWrite;
+	if (m_Ring.size()-(write-m_RingRead)<Size) return;
+	
+	for (unsigned int n=0; n<Size; n++)
 	{
-		memcpy((void*)m_Buffer,(void*)m_JackBuffer,m_BufferLength*sizeof(float));
-		pthread_mutex_unlock(m_Mutex);
+		m_Ring[(write+n)&m_RingMask]=m_JackBuffer[n];
 	}
+	__sync_synchronize();
+	m_RingWrite=write+Size;
 }
 
 void AudioCollector::AudioCallback(void *Context, unsigned int Size)
@@ -14,42 +14,46 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
-//#define __FFTWFLOAT__
 #include <fftw3.h>
 #include <pthread.h>
 #include <string>
+#include <vector>
 
 #ifndef AUDIO_COLLECTOR
 #define AUDIO_COLLECTOR
 
 using namespace std;
 
+// a hann windowed real fft, giving the magnitudes of
+// the bins up to nyquist
 class FFT
 {
 public:
     FFT(int length);
     ~FFT();
-	void Impulse2Freq(float *imp, float *out);
+	// out needs room for GetNumBins() values
+	void Impulse2Freq(const float *imp, float *out);
+	unsigned int GetNumBins() const { return m_FFTLength/2+1; }
 private:
-#ifndef __FFTWFLOAT__
-	fftw_plan m_Plan;
-	unsigned int m_FFTLength;
-	double *m_In;
-	fftw_complex *m_Spectrum;
-#else
 	fftwf_plan m_Plan;
 	unsigned int m_FFTLength;
 	float *m_In;
+	float *m_Window;
 	fftwf_complex *m_Spectrum;
-#endif
 };
 
+// the audio is passed from the jack thread to an analysis thread through
+// a ring buffer, which runs an fft every hop samples over the last buffer
+// length of them, and adds them up into bars. the results are handed to
+// the render thread through a triple buffer, so nobody ever waits for
+// anyone else, and the render thread doesn't do any of the work
 class AudioCollector
 {
 public:
 	AudioCollector(const string &port, int BufferLength, unsigned int Samplerate, const string &portname = "Fluxus", int FFTBuffers = 1);
 	~AudioCollector();
 
+	// picks up the latest bars, and smooths them
 	float *GetFFT();
 	float *GetAudioBuffer() { return m_AudioBuffer; }
 	int GetAudioBufferLength() { return m_BufferLength; }
@@ -62,47 +66,90 @@ public:
 	bool  IsProcessing() { return m_Processing; }
 	float BufferTime() { return m_BufferTime; }
 
-	void SetNumBars(unsigned int s)
-	{
-		if (s < 1) s = 1;
-		m_NumBars = s;
-		delete[] m_FFTOutput;
-		m_FFTOutput = new float[s];
-		memset(m_FFTOutput, 0, sizeof(float) * s);
-	}
-
+	void SetNumBars(unsigned int s);
 	unsigned GetNumBars(void) { return m_NumBars; }
 
 private:
 
-    void AudioCallback_i(unsigned int);
+	// which fft bins go into each bar, log spaced
+	struct BarTable
+	{
+		BarTable(unsigned int numbars, unsigned int numbins);
+		unsigned int NumBars;
+		vector<unsigned int> From;
+		vector<unsigned int> To;
+	};
+
+	// what the analysis thread hands over
+	struct Result
+	{
+		vector<float> Bars;
+		vector<float> Audio;
+	};
+
+	void AudioCallback_i(unsigned int);
 	static void AudioCallback(void *, unsigned int);
 
+	static void *AnalysisThread(void *context);
+	void Analyse();
+	static void MakeBars(FFT &fft, const float *audio, const BarTable &table, float *spectrum, float *bars);
+	void Publish();
+	void DeleteOldTables();
+
 	float m_Gain;
 	float m_SmoothingBias;
 	unsigned int m_Samplerate;
 	float m_BufferTime;
 	unsigned int m_BufferLength;
+	unsigned int m_Hop;
+	// used by the analysis thread
 	FFT m_FFT;
-	pthread_mutex_t* m_Mutex;
-	float *m_Buffer;
+	// and this one by process, on the render thread
+	FFT m_ProcessFFT;
+	vector<float> m_Spectrum;
+	vector<float> m_History;
 	float *m_AudioBuffer;
-	float *m_FFTBuffer;
 	float *m_FFTOutput;
 	int    m_FFTBuffers;
 	int    m_InputPort;
 
 	float *m_JackBuffer;
+	unsigned int m_JackBufferLength;
+
+	// written by the jack thread, read by the analysis thread
+	vector<float> m_Ring;
+	unsigned int m_RingMask;
+	volatile unsigned int m_RingWrite;
+	volatile unsigned int m_RingRead;
+
+	// the analysis thread fills m_Results[m_Back], the render thread
+	// reads m_Results[m_Front], and they swap with the spare one in
+	// m_Middle, which is marked when it's newer than the front one
+	Result m_Results[3];
+	int m_Back;
+	int m_Front;
+	volatile int m_Middle;
+
+	// the current table, and the one the analysis thread is using, 
+	// so the render thread knows when old ones can be deleted
+	BarTable *volatile m_Table;
+	BarTable *volatile m_TableInUse;
+	vector<BarTable*> m_OldTables;
+
+	pthread_t m_Thread;
+	bool m_ThreadRunning;
+	volatile bool m_Quit;
 
 	int    m_Dspfd;
 	short *m_OSSBuffer;
 	float  m_OneOverSHRT_MAX;
 	bool   m_Processing;
 	float *m_ProcessBuffer;
+	vector<float> m_ProcessSpectrum;
+	vector<float> m_ProcessBars;
 	unsigned int m_ProcessPos;
 	unsigned int m_ProcessLength;
     unsigned int m_NumBars;
 };
 
 #endif
-
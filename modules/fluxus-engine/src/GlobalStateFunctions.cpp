@@ -19,6 +19,7 @@
 #include "Engine.h"
 #include "GlobalStateFunctions.h"
 #include "Renderer.h"
+#include "StateCache.h"
 
 using namespace GlobalStateFunctions;
 using namespace SchemeHelper;
@@ -605,7 +606,8 @@ Scheme_Object *camera_lag(int argc, Scheme_Object **argv)
 // (build-cube) ; le cube sera texturé en accord avec l'image.
 // EndFunctionDoc
 
-Scheme_Object *load_texture(int argc, Scheme_Object **argv)
+// load-texture and load-texture-async
+static Scheme_Object *LoadTexture(const char *name, bool async, int argc, Scheme_Object **argv)
 {
 	Scheme_Object *paramvec = NULL;
 	MZ_GC_DECL_REG(2);
@@ -613,10 +615,11 @@ Scheme_Object *load_texture(int argc, Scheme_Object **argv)
 	MZ_GC_VAR_IN_REG(1, paramvec);
 	MZ_GC_REG();
 
-	if (argc==2) ArgCheck("load-texture", "pl", argc, argv);
-	else ArgCheck("load-texture", "p", argc, argv);
+	if (argc==2) ArgCheck(name, "pl", argc, argv);
+	else ArgCheck(name, "p", argc, argv);
 
 	TexturePainter::CreateParams createparams;
+	createparams.Async = async;
 
 	if (argc==2)
 	{
@@ -693,6 +696,40 @@ Scheme_Object *load_texture(int argc, Scheme_Object **argv)
 	return scheme_make_integer_value(ret);
 }
 
+Scheme_Object *load_texture(int argc, Scheme_Object **argv)
+{
+	return LoadTexture("load-texture", false, argc, argv);
+}
+
+// StartFunctionDoc-en
+// load-texture-async pngfilename-string optional-create-params-list
+// Returns: textureid-number
+// Description:
+// Like load-texture, but the texture is loaded in the background, so loading lots 
+// of big textures doesn't hold up the frames. The id is returned straight away, and 
+// a blank texture is drawn instead until it's ready. Images are decoded on other 
+// threads, and a few rows at a time are sent to the graphics card each frame (see 
+// texture-upload-budget), with the mipmaps made by the card. Cube maps, dds files, 
+// compressed textures or images added to an existing texture with 'id are loaded 
+// straight away, as with load-texture.
+// Example:
+// (define textures
+//     (map
+//         (lambda (n)
+//             (load-texture-async (string-append "frame" (number->string n) ".png")))
+//         (build-list 100 (lambda (n) n))))
+//
+// (every-frame
+//     (with-state
+//         (texture (list-ref textures (modulo (inexact->exact (floor (* (time) 25))) 100)))
+//         (draw-cube)))
+// EndFunctionDoc
+
+Scheme_Object *load_texture_async(int argc, Scheme_Object **argv)
+{
+	return LoadTexture("load-texture-async", true, argc, argv);
+}
+
 // StartFunctionDoc-en
 // clear-texture-cache
 // Returns: void
@@ -726,6 +763,132 @@ Scheme_Object *clear_texture_cache(int argc, Scheme_Object **argv)
     return scheme_void;
 }
 
+// StartFunctionDoc-en
+// texture-upload-budget bytes-number
+// Returns: void
+// Description:
+// Sets how much texture data load-texture-async sends to the graphics card each
+// frame. Larger values load textures quicker, but may make frames take longer.
+// At least one row of a texture is sent each frame, whatever the budget. It must
+// be more than 0, and the default is 4 megabytes.
+// Example:
+// (texture-upload-budget (* 16 1024 1024))
+// EndFunctionDoc
+
+Scheme_Object *texture_upload_budget(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("texture-upload-budget", "i", argc, argv);
+	int bytes=IntFromScheme(argv[0]);
+	if (bytes<1)
+	{
+		Trace::Stream<<"texture-upload-budget: budget less than 1!"<<endl;
+		MZ_GC_UNREG();
+		return scheme_void;
+	}
+	Engine::Get()->Renderer()->GetTexturePainter()->SetUploadBudget(bytes);
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// textures-loading
+// Returns: number
+// Description:
+// Returns the number of textures load-texture-async is still loading.
+// Example:
+// (display (textures-loading))(newline)
+// EndFunctionDoc
+
+Scheme_Object *textures_loading(int argc, Scheme_Object **argv)
+{
+	return scheme_make_integer(Engine::Get()->Renderer()->GetTexturePainter()->GetNumLoading());
+}
+
+// StartFunctionDoc-en
+// texture-memory-budget bytes-number
+// Returns: void
+// Description:
+// Sets the most memory textures should take up on the graphics card, 0 for no 
+// limit (the default). When textures loaded from files take up more than this, 
+// the ones which have gone unused longest are evicted from the card. Their ids 
+// still work, and they are loaded again the next time they are drawn - textures 
+// loaded with load-texture-async are drawn blank until they're back. Textures 
+// drawn in the last frame are never evicted, so if they take up more than the 
+// budget on their own it will be exceeded.
+// Example:
+// (texture-memory-budget (* 256 1024 1024))
+// EndFunctionDoc
+
+Scheme_Object *texture_memory_budget(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("texture-memory-budget", "f", argc, argv);
+	float bytes=FloatFromScheme(argv[0]);
+	Engine::Get()->Renderer()->GetTexturePainter()->SetMemoryBudget(bytes>0?(unsigned long)bytes:0);
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// texture-stats
+// Returns: association list
+// Description:
+// Returns how much memory textures are estimated to be using on the graphics 
+// card (including mipmaps), the budget set by texture-memory-budget, the number 
+// of textures on the card and evicted from it, the evictions made at the start 
+// of the last frame and in total, the number of evicted textures loaded again, 
+// and the number of textures on the card in each format. Pixel primitives make 
+// their own textures, which aren't included.
+// Example:
+// (display (texture-stats))(newline)
+// (display (cdr (assq 'resident-bytes (texture-stats))))(newline)
+// EndFunctionDoc
+
+Scheme_Object *texture_stats(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *ret = NULL;
+	Scheme_Object *formats = NULL;
+	Scheme_Object *tmp = NULL;
+	MZ_GC_DECL_REG(3);
+	MZ_GC_VAR_IN_REG(0, ret);
+	MZ_GC_VAR_IN_REG(1, formats);
+	MZ_GC_VAR_IN_REG(2, tmp);
+	MZ_GC_REG();
+
+	TexturePainter *painter=Engine::Get()->Renderer()->GetTexturePainter();
+	TexturePainter::MemoryStats stats;
+	painter->GetMemoryStats(stats);
+
+	formats = scheme_null;
+	for (map<string,unsigned int>::iterator i=stats.Formats.begin(); i!=stats.Formats.end(); ++i)
+	{
+		tmp = scheme_make_pair(scheme_intern_symbol(i->first.c_str()), scheme_make_integer_value_from_unsigned(i->second));
+		formats = scheme_make_pair(tmp, formats);
+	}
+
+	ret = scheme_null;
+	tmp = scheme_make_pair(scheme_intern_symbol("formats"), formats);
+	ret = scheme_make_pair(tmp, ret);
+	tmp = scheme_make_pair(scheme_intern_symbol("reloads"), scheme_make_integer_value_from_unsigned(stats.Reloads));
+	ret = scheme_make_pair(tmp, ret);
+	tmp = scheme_make_pair(scheme_intern_symbol("total-evictions"), scheme_make_integer_value_from_unsigned(stats.TotalEvictions));
+	ret = scheme_make_pair(tmp, ret);
+	tmp = scheme_make_pair(scheme_intern_symbol("evictions"), scheme_make_integer_value_from_unsigned(stats.Evictions));
+	ret = scheme_make_pair(tmp, ret);
+	tmp = scheme_make_pair(scheme_intern_symbol("evicted"), scheme_make_integer_value_from_unsigned(stats.Evicted));
+	ret = scheme_make_pair(tmp, ret);
+	tmp = scheme_make_pair(scheme_intern_symbol("resident"), scheme_make_integer_value_from_unsigned(stats.Resident));
+	ret = scheme_make_pair(tmp, ret);
+	tmp = scheme_make_pair(scheme_intern_symbol("budget"), scheme_make_integer_value_from_unsigned(painter->GetMemoryBudget()));
+	ret = scheme_make_pair(tmp, ret);
+	tmp = scheme_make_pair(scheme_intern_symbol("resident-bytes"), scheme_make_integer_value_from_unsigned(stats.ResidentBytes));
+	ret = scheme_make_pair(tmp, ret);
+
+	MZ_GC_UNREG();
+	return ret;
+}
+
 // StartFunctionDoc-en
 // is-resident? textureid-number
 // Returns: boolean
@@ -1964,7 +2127,10 @@ Scheme_Object *set_screen_size(int argc, Scheme_Object **argv)
 // Returns: primitiveid-number
 // Description:
 // Looks in the region specified and returns the id of the closest primitive to the camera rendered
-// there, or 0 if none exist.
+// there, or 0 if none exist. A ray is cast through the middle of the region and tested against
+// the primitives' geometry, the bounding boxes are used for primitives which can't be tested
+// like this. The bounding boxes follow the primitives as they move, but call (recalc-bb) if 
+// you change the pdata.
 // Example:
 // (display (select 10 10 2))(newline)
 // EndFunctionDoc
@@ -2562,6 +2728,44 @@ Scheme_Object *print_info(int argc, Scheme_Object **argv)
   return scheme_void;
 }
 
+// StartFunctionDoc-en
+// set-state-sort boolean
+// Returns: void
+// Description:
+// Draws the scene grouped by state (shader, textures, hints and blending)
+// rather than in scene graph order, so less time is spent changing state.
+// Only use this if the draw order doesn't matter to you, as it will change
+// the results of blending, and children will no longer inherit hints like
+// nozwrite from their parents. Depth sorted primitives are not affected.
+// Example:
+// (set-state-sort #t)
+// EndFunctionDoc
+
+Scheme_Object *set_state_sort(int argc, Scheme_Object **argv)
+{
+  DECL_ARGV();
+  ArgCheck("set-state-sort", "b", argc, argv);
+  Engine::Get()->Renderer()->SetStateSort(BoolFromScheme(argv[0]));
+  MZ_GC_UNREG();
+  return scheme_void;
+}
+
+// StartFunctionDoc-en
+// get-state-changes-avoided
+// Returns: number
+// Description:
+// Returns the number of graphics state changes which were skipped
+// in the last frame, as they were already set. Useful for seeing
+// how much set-state-sort helps your scene.
+// Example:
+// (display (get-state-changes-avoided))(newline)
+// EndFunctionDoc
+
+Scheme_Object *get_state_changes_avoided(int argc, Scheme_Object **argv)
+{
+  return scheme_make_integer_value(StateCache::GetAvoided());
+}
+
 // StartFunctionDoc-en
 // set-cursor image-name-symbol
 // Returns: void
@@ -2703,7 +2907,12 @@ void GlobalStateFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("lock-camera", scheme_make_prim_w_arity(lock_camera, "lock-camera", 1, 1), env);
 	scheme_add_global("camera-lag", scheme_make_prim_w_arity(camera_lag, "camera-lag", 1, 1), env);
 	scheme_add_global("load-texture", scheme_make_prim_w_arity(load_texture, "load-texture", 1, 2), env);
+	scheme_add_global("load-texture-async", scheme_make_prim_w_arity(load_texture_async, "load-texture-async", 1, 2), env);
 	scheme_add_global("clear-texture-cache", scheme_make_prim_w_arity(clear_texture_cache, "clear-texture-cache", 0, 0), env);
+	scheme_add_global("texture-upload-budget", scheme_make_prim_w_arity(texture_upload_budget, "texture-upload-budget", 1, 1), env);
+	scheme_add_global("textures-loading", scheme_make_prim_w_arity(textures_loading, "textures-loading", 0, 0), env);
+	scheme_add_global("texture-memory-budget", scheme_make_prim_w_arity(texture_memory_budget, "texture-memory-budget", 1, 1), env);
+	scheme_add_global("texture-stats", scheme_make_prim_w_arity(texture_stats, "texture-stats", 0, 0), env);
 	scheme_add_global("is-resident?",scheme_make_prim_w_arity(is_resident,"is-resident?",1,1), env);
 	scheme_add_global("set-texture-priority",scheme_make_prim_w_arity(is_resident,"set-texture-priority",2,2), env);
 	scheme_add_global("texture-width",scheme_make_prim_w_arity(texture_width,"texture-width",1,1), env);
@@ -2740,6 +2949,8 @@ void GlobalStateFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("shadow-debug", scheme_make_prim_w_arity(shadow_debug, "shadow-ldebug", 1, 1), env);
 	scheme_add_global("accum", scheme_make_prim_w_arity(accum, "accum", 2, 2), env);
 	scheme_add_global("print-info", scheme_make_prim_w_arity(print_info, "print-info", 0, 0), env);
+	scheme_add_global("set-state-sort", scheme_make_prim_w_arity(set_state_sort, "set-state-sort", 1, 1), env);
+	scheme_add_global("get-state-changes-avoided", scheme_make_prim_w_arity(get_state_changes_avoided, "get-state-changes-avoided", 0, 0), env);
 	scheme_add_global("set-cursor",scheme_make_prim_w_arity(set_cursor,"set-cursor",1,1), env);
 	scheme_add_global("set-full-screen", scheme_make_prim_w_arity(set_full_screen, "set-full-screen", 0, 0), env);
 
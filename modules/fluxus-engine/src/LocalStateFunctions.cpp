@@ -1804,6 +1804,8 @@ Scheme_Object *blend_mode(int argc, Scheme_Object **argv)
 //    into a pixelprimitive.
 // 'zwrite - Enables/disables z writes. Useful to disable for sometimes hacking
 //    transparency.
+// 'vbo - keep polygon primitive pdata in video memory, only changed pdata
+//    elements are sent to the graphics card each frame.
 // 'lit - turn on lighting
 // 'all - all of the hints above
 //
@@ -1959,6 +1961,10 @@ Scheme_Object *hints(int argc, Scheme_Object **argv, int on)
 		{
 			neg_flags |= HINT_NOZWRITE;
 		}
+		else if (s == "vbo")
+		{
+			flags |= HINT_VBO;
+		}
 		else if (s == "lit")
 		{
 			neg_flags |= HINT_UNLIT;
@@ -2419,6 +2425,30 @@ Scheme_Object *hint_nozwrite(int argc, Scheme_Object **argv)
     return scheme_void;
 }
 
+// StartFunctionDoc-en
+// hint-vbo
+// Returns: void
+// Description:
+// Keeps the pdata of polygon primitives in vertex buffer objects in video memory,
+// rather than sending it to the graphics card every frame. The first frame uploads
+// everything, after that only the range of elements changed by pdata-set!, pdata-op
+// and friends is sent - so static geometry costs nothing to send. Has no effect on
+// other primitive types.
+// Example:
+// (clear)
+// (hint-vbo)
+// (define s (build-sphere 50 50))
+// (every-frame
+//     (with-primitive s
+//         (pdata-set! "p" 0 (vmul (pdata-ref "n" 0) (+ 1 (sin (time)))))))
+// EndFunctionDoc
+
+Scheme_Object *hint_vbo(int argc, Scheme_Object **argv)
+{
+    Engine::Get()->State()->Hints|=HINT_VBO;
+    return scheme_void;
+}
+
 // StartFunctionDoc-en
 // line-pattern factor pattern
 // Returns: void
@@ -3759,6 +3789,183 @@ Scheme_Object *clear_shader_cache(int argc, Scheme_Object **argv)
   return scheme_void;
 }
 
+// StartFunctionDoc-en
+// shader-binary-dir directory-string
+// Returns: void
+// Description:
+// Sets the directory linked shaders are saved in, so they don't need compiling
+// again the next time fluxus starts, or the same shaders are loaded again. They
+// are only saved if the graphics driver supports it, and are compiled again if
+// the driver changes. The default is ~/.cache/fluxus/shaders, an empty string
+// stops them being saved. Put this in your .fluxus.scm to use it from startup.
+// Example:
+// (shader-binary-dir "/tmp/fluxus-shaders")
+// EndFunctionDoc
+
+Scheme_Object *shader_binary_dir(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("shader-binary-dir", "s", argc, argv);
+	ShaderCache::SetBinaryDir(StringFromScheme(argv[0]));
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// shader-cache-stats
+// Returns: list of hits and misses
+// Description:
+// Returns the number of shaders loaded from the binaries saved by earlier runs,
+// and the number which had to be compiled.
+// Example:
+// (display (shader-cache-stats))(newline)
+// EndFunctionDoc
+
+Scheme_Object *shader_cache_stats(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *ret = NULL;
+	MZ_GC_DECL_REG(1);
+	MZ_GC_VAR_IN_REG(0, ret);
+	MZ_GC_REG();
+	ret = scheme_make_pair(scheme_make_integer(ShaderCache::GetBinaryMisses()), scheme_null);
+	ret = scheme_make_pair(scheme_make_integer(ShaderCache::GetBinaryHits()), ret);
+	MZ_GC_UNREG();
+	return ret;
+}
+
+// converts a scheme value to the right type of uniform, and stores it in the shader
+static void SetUniformFromScheme(GLSLShader *shader, int handle, const string &param, Scheme_Object *value)
+{
+	Scheme_Object *listvec = NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, value);
+	MZ_GC_VAR_IN_REG(1, listvec);
+	MZ_GC_REG();
+
+	if (SCHEME_NUMBERP(value))
+	{
+		if (SCHEME_EXACT_INTEGERP(value))
+		{
+			shader->SetInt(handle,IntFromScheme(value));
+		}
+		else
+		{
+			shader->SetFloat(handle,(float)FloatFromScheme(value));
+		}
+	}
+	else if (SCHEME_VECTORP(value))
+	{
+		// set vec2f, vec3f, vec4f uniform variables
+		listvec = value;
+		int vecsize = SCHEME_VEC_SIZE(listvec);
+
+		if ((2 <= vecsize) && (vecsize <= 4))
+		{
+			dVector vec;
+			FloatsFromScheme(listvec, vec.arr(), vecsize);
+			shader->SetVector(handle, vec, vecsize);
+		}
+		else
+		if (vecsize == 16)
+		{
+			dMatrix m;
+			FloatsFromScheme(listvec, m.arr(), vecsize);
+			shader->SetMatrix(handle, m);
+		}
+		else
+		{
+			Trace::Stream << "shader is expecting vector size 2, 3, 4 or 16 but found " << vecsize <<
+				" for variable " << param << endl;
+		}
+	}
+	else if (SCHEME_LISTP(value))
+	{
+		listvec = scheme_list_to_vector(value);
+		unsigned int sz = SCHEME_VEC_SIZE(listvec);
+		if (sz>0)
+		{
+			if (SCHEME_NUMBERP(SCHEME_VEC_ELS(listvec)[0]))
+			{
+				if (SCHEME_EXACT_INTEGERP(SCHEME_VEC_ELS(listvec)[0]))
+				{
+					vector<int, FLX_ALLOC(int) > array;
+					for (unsigned int i=0; i<sz; i++)
+					{
+						if (!SCHEME_EXACT_INTEGERP(SCHEME_VEC_ELS(listvec)[i]))
+						{
+							Trace::Stream<<"found a dodgy element in a uniform array"<<endl;
+							break;
+						}
+						array.push_back(IntFromScheme(SCHEME_VEC_ELS(listvec)[i]));
+					}
+					shader->SetIntArray(handle,array);
+				}
+				else
+				{
+					vector<float, FLX_ALLOC(float) > array;
+					for (unsigned int i=0; i<sz; i++)
+					{
+						if (!SCHEME_NUMBERP(SCHEME_VEC_ELS(listvec)[i]))
+						{
+							Trace::Stream<<"found a dodgy element in a uniform array"<<endl;
+							break;
+						}
+						array.push_back(FloatFromScheme(SCHEME_VEC_ELS(listvec)[i]));
+					}
+					shader->SetFloatArray(handle,array);
+				}
+			}
+			else if (SCHEME_VECTORP(SCHEME_VEC_ELS(listvec)[0]))
+			{
+				if (SCHEME_VEC_SIZE(SCHEME_VEC_ELS(listvec)[0]) == 3)
+				{
+					vector<dVector, FLX_ALLOC(dVector) > array;
+					for (unsigned int i=0; i<sz; i++)
+					{
+						if (!SCHEME_VECTORP(SCHEME_VEC_ELS(listvec)[i]) ||
+							SCHEME_VEC_SIZE(SCHEME_VEC_ELS(listvec)[i]) != 3)
+						{
+							Trace::Stream<<"found a dodgy element in a uniform array"<<endl;
+							break;
+						}
+						dVector vec;
+						FloatsFromScheme(SCHEME_VEC_ELS(listvec)[i],vec.arr(),3);
+						array.push_back(vec);
+					}
+					shader->SetVectorArray(handle,array);
+				}
+				else if (SCHEME_VEC_SIZE(SCHEME_VEC_ELS(listvec)[0]) == 4)
+				{
+					vector<dColour, FLX_ALLOC(dColour) > array;
+					for (unsigned int i=0; i<sz; i++)
+					{
+						if (!SCHEME_VECTORP(SCHEME_VEC_ELS(listvec)[i]) ||
+							SCHEME_VEC_SIZE(SCHEME_VEC_ELS(listvec)[i]) != 4)
+						{
+							Trace::Stream<<"found a dodgy element in a uniform array"<<endl;
+							break;
+						}
+						dColour vec;
+						FloatsFromScheme(SCHEME_VEC_ELS(listvec)[i],vec.arr(),4);
+						array.push_back(vec);
+					}
+					shader->SetColourArray(handle,array);
+				}
+				else
+				{
+					Trace::Stream<<"shader has found a vector argument list of a strange size"<<endl;
+				}
+			}
+		}
+	}
+	else
+	{
+		Trace::Stream<<"shader has found an argument type it can't send, numbers and vectors, or lists of them only"<<endl;
+	}
+
+	MZ_GC_UNREG();
+}
+
 // StartFunctionDoc-en
 // shader-set! [parameter-name-keyword parameter-value ...] argument-list
 // Returns: void
@@ -3863,11 +4070,9 @@ Scheme_Object *clear_shader_cache(int argc, Scheme_Object **argv)
 Scheme_Object *shader_set(int argc, Scheme_Object **argv)
 {
 	Scheme_Object *paramvec = NULL;
-	Scheme_Object *listvec = NULL;
-	MZ_GC_DECL_REG(3);
+	MZ_GC_DECL_REG(2);
 	MZ_GC_VAR_IN_REG(0, argv);
 	MZ_GC_VAR_IN_REG(1, paramvec);
-	MZ_GC_VAR_IN_REG(2, listvec);
 	MZ_GC_REG();
 
 	ArgCheck("shader-set!", "l", argc, argv);
@@ -3879,8 +4084,7 @@ Scheme_Object *shader_set(int argc, Scheme_Object **argv)
 		// vectors seem easier to handle than lists with this api
 		paramvec = scheme_list_to_vector(argv[0]);
 
-		// apply to set parameters
-		shader->Apply();
+		// these are kept with the shader, and sent when it's next drawn
 
 		for (int n=0; n<SCHEME_VEC_SIZE(paramvec); n+=2)
 		{
@@ -3888,140 +4092,88 @@ Scheme_Object *shader_set(int argc, Scheme_Object **argv)
 			{
 				// get the parameter name
 				string param = StringFromScheme(SCHEME_VEC_ELS(paramvec)[n]);
-
-				if (SCHEME_NUMBERP(SCHEME_VEC_ELS(paramvec)[n+1]))
-				{
-					if (SCHEME_EXACT_INTEGERP(SCHEME_VEC_ELS(paramvec)[n+1]))
-					{
-						shader->SetInt(param,IntFromScheme(SCHEME_VEC_ELS(paramvec)[n+1]));
-					}
-					else
-					{
-						shader->SetFloat(param,(float)FloatFromScheme(SCHEME_VEC_ELS(paramvec)[n+1]));
-					}
-				}
-				else if (SCHEME_VECTORP(SCHEME_VEC_ELS(paramvec)[n+1]))
-				{
-					// set vec2f, vec3f, vec4f uniform variables
-					listvec = SCHEME_VEC_ELS(paramvec)[n + 1];
-					int vecsize = SCHEME_VEC_SIZE(listvec);
-
-					if ((2 <= vecsize) && (vecsize <= 4))
-					{
-						dVector vec;
-						FloatsFromScheme(listvec, vec.arr(), vecsize);
-						shader->SetVector(param, vec, vecsize);
-					}
-					else
-					if (vecsize == 16)
-					{
-						dMatrix m;
-						FloatsFromScheme(listvec, m.arr(), vecsize);
-						shader->SetMatrix(param, m);
-					}
-					else
-					{
-						Trace::Stream << "shader is expecting vector size 2, 3, 4 or 16 but found " << vecsize <<
-							" for variable " << param << endl;
-					}
-				}
-				else if (SCHEME_LISTP(SCHEME_VEC_ELS(paramvec)[n+1]))
-				{
-					listvec = scheme_list_to_vector(SCHEME_VEC_ELS(paramvec)[n+1]);
-					unsigned int sz = SCHEME_VEC_SIZE(listvec);
-					if (sz>0)
-					{
-						if (SCHEME_NUMBERP(SCHEME_VEC_ELS(listvec)[0]))
-						{
-							if (SCHEME_EXACT_INTEGERP(SCHEME_VEC_ELS(listvec)[0]))
-							{
-								vector<int, FLX_ALLOC(int) > array;
-								for (unsigned int i=0; i<sz; i++)
-								{
-									if (!SCHEME_EXACT_INTEGERP(SCHEME_VEC_ELS(listvec)[i]))
-									{
-										Trace::Stream<<"found a dodgy element in a uniform array"<<endl;
-										break;
-									}
-									array.push_back(IntFromScheme(SCHEME_VEC_ELS(listvec)[i]));
-								}
-								shader->SetIntArray(param,array);
-							}
-							else
-							{
-								vector<float, FLX_ALLOC(float) > array;
-								for (unsigned int i=0; i<sz; i++)
-								{
-									if (!SCHEME_NUMBERP(SCHEME_VEC_ELS(listvec)[i]))
-									{
-										Trace::Stream<<"found a dodgy element in a uniform array"<<endl;
-										break;
-									}
-									array.push_back(FloatFromScheme(SCHEME_VEC_ELS(listvec)[i]));
-								}
-								shader->SetFloatArray(param,array);
-							}
-						}
-						else if (SCHEME_VECTORP(SCHEME_VEC_ELS(listvec)[0]))
-						{
-							if (SCHEME_VEC_SIZE(SCHEME_VEC_ELS(listvec)[0]) == 3)
-							{
-								vector<dVector, FLX_ALLOC(dVector) > array;
-								for (unsigned int i=0; i<sz; i++)
-								{
-									if (!SCHEME_VECTORP(SCHEME_VEC_ELS(listvec)[i]) ||
-										SCHEME_VEC_SIZE(SCHEME_VEC_ELS(listvec)[i]) != 3)
-									{
-										Trace::Stream<<"found a dodgy element in a uniform array"<<endl;
-										break;
-									}
-									dVector vec;
-									FloatsFromScheme(SCHEME_VEC_ELS(listvec)[i],vec.arr(),3);
-									array.push_back(vec);
-								}
-								shader->SetVectorArray(param,array);
-							}
-							else if (SCHEME_VEC_SIZE(SCHEME_VEC_ELS(listvec)[0]) == 4)
-							{
-								vector<dColour, FLX_ALLOC(dColour) > array;
-								for (unsigned int i=0; i<sz; i++)
-								{
-									if (!SCHEME_VECTORP(SCHEME_VEC_ELS(listvec)[i]) ||
-										SCHEME_VEC_SIZE(SCHEME_VEC_ELS(listvec)[i]) != 4)
-									{
-										Trace::Stream<<"found a dodgy element in a uniform array"<<endl;
-										break;
-									}
-									dColour vec;
-									FloatsFromScheme(SCHEME_VEC_ELS(listvec)[i],vec.arr(),4);
-									array.push_back(vec);
-								}
-								shader->SetColourArray(param,array);
-							}
-							else
-							{
-								Trace::Stream<<"shader has found a vector argument list of a strange size"<<endl;
-							}
-						}
-					}
-				}
-				else
-				{
-					Trace::Stream<<"shader has found an argument type it can't send, numbers and vectors, or lists of them only"<<endl;
-				}
+				SetUniformFromScheme(shader,shader->GetUniformHandle(param),param,SCHEME_VEC_ELS(paramvec)[n+1]);
 			}
 			else
 			{
 				Trace::Stream<<"shader has found a mal-formed parameter list"<<endl;
 			}
 		}
-		GLSLShader::Unapply();
 	}
 
 	MZ_GC_UNREG();
 	return scheme_void;
 }
 
+// StartFunctionDoc-en
+// shader-uniform-handle parameter-name-string
+// Returns: handle-number
+// Description:
+// Looks up a uniform parameter of the current shader by name, and returns a
+// handle to use with (shader-set-handle!), or -1 if the shader doesn't use it.
+// Looking the name up once saves doing it every time the parameter is set, which
+// helps when setting lots of them every frame. The handle is the same for all the
+// shaders made from the same source files.
+// Example:
+// (clear)
+// (define s (with-state
+//     (shader "simple.vert.glsl" "simple.frag.glsl")
+//     (build-sphere 20 20)))
+//
+// (define deform (with-primitive s (shader-uniform-handle "deformamount")))
+//
+// (every-frame
+//     (with-primitive s
+//         (shader-set-handle! deform (cos (time)))))
+// EndFunctionDoc
+
+Scheme_Object *shader_uniform_handle(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("shader-uniform-handle", "s", argc, argv);
+	int handle=-1;
+	if (Engine::Get()->State()->Shader!=NULL)
+	{
+		handle=Engine::Get()->State()->Shader->GetUniformHandle(StringFromScheme(argv[0]));
+	}
+	MZ_GC_UNREG();
+	return scheme_make_integer(handle);
+}
+
+// StartFunctionDoc-en
+// shader-set-handle! handle-number parameter-value
+// Returns: void
+// Description:
+// Sets a uniform parameter of the current shader from a handle returned by
+// (shader-uniform-handle). The value can be anything (shader-set!) takes. As
+// with (shader-set!), values are only sent to the graphics card when they change.
+// Example:
+// (clear)
+// (define s (with-state
+//     (shader "simple.vert.glsl" "simple.frag.glsl")
+//     (build-sphere 20 20)))
+//
+// (define deform (with-primitive s (shader-uniform-handle "deformamount")))
+//
+// (every-frame
+//     (with-primitive s
+//         (shader-set-handle! deform (cos (time)))))
+// EndFunctionDoc
+
+Scheme_Object *shader_set_handle(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("shader-set-handle!", "i?", argc, argv);
+	GLSLShader *shader=Engine::Get()->State()->Shader;
+	int handle=IntFromScheme(argv[0]);
+	if (shader!=NULL && handle>=0)
+	{
+		SetUniformFromScheme(shader,handle,shader->GetUniformName(handle),argv[1]);
+	}
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
 // StartFunctionDoc-en
 // texture-params texture-unit-number parameter-list
 // Returns: void
@@ -4308,6 +4460,7 @@ void LocalStateFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("hint-normalise",scheme_make_prim_w_arity(hint_normalise,"hint-normalise",0,0), env);
 	scheme_add_global("hint-noblend",scheme_make_prim_w_arity(hint_noblend,"hint-noblend",0,0), env);
 	scheme_add_global("hint-nozwrite",scheme_make_prim_w_arity(hint_nozwrite,"hint-nozwrite",0,0), env);
+	scheme_add_global("hint-vbo",scheme_make_prim_w_arity(hint_vbo,"hint-vbo",0,0), env);
 	scheme_add_global("line-width",scheme_make_prim_w_arity(line_width,"line-width",1,1), env);
 	scheme_add_global("line-pattern",scheme_make_prim_w_arity(line_pattern,"line-pattern",2,2), env);
 	scheme_add_global("point-width",scheme_make_prim_w_arity(point_width,"point-width",1,1), env);
@@ -4319,7 +4472,11 @@ void LocalStateFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("shader",scheme_make_prim_w_arity(shader,"shader",2,2), env);
 	scheme_add_global("shader-source",scheme_make_prim_w_arity(shader_source,"shader-source",2,2), env);
 	scheme_add_global("clear-shader-cache",scheme_make_prim_w_arity(clear_shader_cache,"clear-shader-cache",0,0), env);
+	scheme_add_global("shader-binary-dir",scheme_make_prim_w_arity(shader_binary_dir,"shader-binary-dir",1,1), env);
+	scheme_add_global("shader-cache-stats",scheme_make_prim_w_arity(shader_cache_stats,"shader-cache-stats",0,0), env);
 	scheme_add_global("shader-set!",scheme_make_prim_w_arity(shader_set,"shader-set!",1,1), env);
+	scheme_add_global("shader-uniform-handle",scheme_make_prim_w_arity(shader_uniform_handle,"shader-uniform-handle",1,1), env);
+	scheme_add_global("shader-set-handle!",scheme_make_prim_w_arity(shader_set_handle,"shader-set-handle!",2,2), env);
 	scheme_add_global("texture-params",scheme_make_prim_w_arity(texture_params,"texture-params",2,2), env);
 	scheme_add_global("backfacecull",scheme_make_prim_w_arity(backfacecull,"backfacecull",1,1), env);
 	MZ_GC_UNREG();
@@ -504,14 +504,18 @@ Scheme_Object *pdata_names(int argc, Scheme_Object **argv)
 
 
 // StartFunctionDoc-en
-// pdata-op funcname-string pdataname-string operator
+// pdata-op funcname-string pdataname-string operator [operator2-number]
 // Returns: void
 // Description:
 // This is an experimental feature allowing you to do operations on pdata very quickly,
 // for instance adding element for element one array of pdata to another. You can 
 // implement this in Scheme as a loop over each element, but this is slow as the 
 // interpreter is doing all the work. It's much faster if you can use a pdata-op as
-// the same operation will only be one Scheme call.
+// the same operation will only be one Scheme call. The operators are "+", "-", "*",
+// "min", "max", "closest", "sin", "cos", "transform" (by a matrix or a matrix pdata),
+// "normalise" (to the given length), "noise" (displace by simplex noise with a number
+// amplitude, or along a vector pdata such as the normals), and "lerp" and "clamp"
+// which take a number as the extra operator.
 // Example:
 // (clear)
 // (define t (build-torus 1 4 10 10))
@@ -529,6 +533,10 @@ Scheme_Object *pdata_names(int argc, Scheme_Object **argv)
 //     ; can't think of a good example for these...
 //     ;(pdata-op "sin" "mydata" "myotherdata")  ; sine of one float pdata to another
 //     ;(pdata-op "cos" "mydata" "myotherdata")  ; cosine of one float pdata to another
+//     (pdata-op "transform" "p" (mrotate (vector 0 45 0))) ; transform all the vertices
+//     (pdata-op "noise" "p" "n") ; displace the vertices along their normals
+//     (pdata-op "lerp" "p" "pref" 0.1) ; move the vertices 10% of the way back to "pref"
+//     (pdata-op "clamp" "c" 0 1) ; clamp the colours between 0 and 1
 //     )
 // 
 // ; most common example of pdata op is for particles
@@ -651,10 +659,19 @@ Scheme_Object *pdata_names(int argc, Scheme_Object **argv)
 //     (pdata-op "+" "p" "vel"))) 
 // EndFunctionDoc
 
+// runs a pdata operation with or without the extra number operand
+template<class T>
+static PData *DataOp(Primitive *prim, const string &op, const string &pd, T operand, bool extra, float operand2)
+{
+	if (extra) return prim->DataOp(op, pd, operand, operand2);
+	return prim->DataOp(op, pd, operand);
+}
+
 Scheme_Object *pdata_op(int argc, Scheme_Object **argv)
 {
 	DECL_ARGV(); 
 	ArgCheck("pdata-op", "ss?", argc, argv);			
+	if (argc>3) ArgCheck("pdata-op", "???f", argc, argv);
     PData *ret=NULL;
 	
     Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();    
@@ -662,6 +679,8 @@ Scheme_Object *pdata_op(int argc, Scheme_Object **argv)
 	{
 		string op=StringFromScheme(argv[0]);
 		string pd=StringFromScheme(argv[1]);
+		bool extra=argc>3;
+		float operand2=extra?FloatFromScheme(argv[3]):0;
 		
 		// find out what the inputs are, and call the corresponding function
 		if (SCHEME_CHAR_STRINGP(argv[2]))
@@ -671,26 +690,26 @@ Scheme_Object *pdata_op(int argc, Scheme_Object **argv)
 			PData* pd2 = Grabbed->GetDataRaw(operand);
 			
 			TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(pd2);	
-			if (data) ret = Grabbed->DataOp(op, pd, data);
+			if (data) ret = DataOp(Grabbed, op, pd, data, extra, operand2);
 			else
 			{
 				TypedPData<dColour> *data = dynamic_cast<TypedPData<dColour>*>(pd2);
-				if (data) ret = Grabbed->DataOp(op, pd, data);
+				if (data) ret = DataOp(Grabbed, op, pd, data, extra, operand2);
 				else 
 				{
 					TypedPData<float> *data = dynamic_cast<TypedPData<float>*>(pd2);
-					if (data) ret = Grabbed->DataOp(op, pd, data);
+					if (data) ret = DataOp(Grabbed, op, pd, data, extra, operand2);
 					else 
 					{
 						TypedPData<dMatrix> *data = dynamic_cast<TypedPData<dMatrix>*>(pd2);
-						if (data) ret = Grabbed->DataOp(op, pd, data);
+						if (data) ret = DataOp(Grabbed, op, pd, data, extra, operand2);
 					}
 				}
 			}
 		}
 		else if (SCHEME_NUMBERP(argv[2]))
 		{
-			ret = Grabbed->DataOp(op, pd, (float)FloatFromScheme(argv[2]));
+			ret = DataOp(Grabbed, op, pd, (float)FloatFromScheme(argv[2]), extra, operand2);
 		}
 		else if (SCHEME_VECTORP(argv[2]))
 		{
@@ -700,21 +719,21 @@ Scheme_Object *pdata_op(int argc, Scheme_Object **argv)
 				{
 					dVector v;
 					FloatsFromScheme(argv[2],v.arr(),3);
-					ret = Grabbed->DataOp(op, pd, v);
+					ret = DataOp(Grabbed, op, pd, v, extra, operand2);
 				}
 				break;
 				case 4:
 				{
 					dColour v;
 					FloatsFromScheme(argv[2],v.arr(),4);
-					ret = Grabbed->DataOp(op, pd, v);
+					ret = DataOp(Grabbed, op, pd, v, extra, operand2);
 				}
 				break;
 				case 16:
 				{
 					dMatrix v;
 					FloatsFromScheme(argv[2],v.arr(),16);
-					ret = Grabbed->DataOp(op, pd, v);
+					ret = DataOp(Grabbed, op, pd, v, extra, operand2);
 				}
 				break;	
 			}
@@ -771,6 +790,281 @@ Scheme_Object *pdata_op(int argc, Scheme_Object **argv)
 	return scheme_void;
 }
 
+// number of floats in each element of a pdata type
+static unsigned int PDataElementSize(char type)
+{
+	switch (type)
+	{
+		case 'f': return 1;
+		case 'v': return 3;
+		case 'c': return 4;
+		case 'm': return 16;
+	}
+	return 0;
+}
+
+// StartFunctionDoc-en
+// pdata->flvector pdataname-string
+// Returns: flvector
+// Description:
+// Copies a whole pdata array into a flvector with a single call, rather than building a
+// Scheme vector for each element with pdata-ref. Vectors take 3 slots each, colours 4 and
+// matrices 16. Use with the racket/flonum functions, and write it back with flvector->pdata!
+// Example:
+// (with-primitive (build-sphere 10 10)
+//     (let ((p (pdata->flvector "p")))
+//         (for ((i (in-range 1 (flvector-length p) 3))) ; squash in y
+//             (flvector-set! p i (* (flvector-ref p i) 0.5)))
+//         (flvector->pdata! "p" p)))
+// EndFunctionDoc
+
+Scheme_Object *pdata_to_flvector(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *ret=NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, ret);
+	MZ_GC_REG();
+	ArgCheck("pdata->flvector", "s", argc, argv);
+    Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed)
+	{
+		string name=StringFromScheme(argv[0]);
+		unsigned int size;
+		char type;
+		if (Grabbed->GetDataInfo(name,type,size))
+		{
+			unsigned int width=PDataElementSize(type);
+			ret=(Scheme_Object*)scheme_alloc_flvector(size*width);
+			double *dst=SCHEME_FLVEC_ELS(ret);
+			PData *pd=Grabbed->GetDataRaw(name);
+
+			switch (type)
+			{
+				case 'f':
+				{
+					TypedPData<float> *data=static_cast<TypedPData<float>*>(pd);
+					for (unsigned int i=0; i<size; i++) dst[i]=data->m_Data[i];
+				}
+				break;
+				case 'v':
+				{
+					TypedPData<dVector> *data=static_cast<TypedPData<dVector>*>(pd);
+					for (unsigned int i=0; i<size; i++)
+					{
+						*dst++=data->m_Data[i].x;
+						*dst++=data->m_Data[i].y;
+						*dst++=data->m_Data[i].z;
+					}
+				}
+				break;
+				case 'c':
+				{
+					TypedPData<dColour> *data=static_cast<TypedPData<dColour>*>(pd);
+					for (unsigned int i=0; i<size; i++)
+					{
+						const float *src=data->m_Data[i].arr();
+						for (unsigned int n=0; n<4; n++) *dst++=src[n];
+					}
+				}
+				break;
+				case 'm':
+				{
+					TypedPData<dMatrix> *data=static_cast<TypedPData<dMatrix>*>(pd);
+					for (unsigned int i=0; i<size; i++)
+					{
+						const float *src=data->m_Data[i].arr();
+						for (unsigned int n=0; n<16; n++) *dst++=src[n];
+					}
+				}
+				break;
+			}
+			MZ_GC_UNREG();
+			return ret;
+		}
+		Trace::Stream<<"pdata->flvector: pdata: "<<name<<" doesn't exist"<<endl;
+	}
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// flvector->pdata! pdataname-string flvector
+// Returns: void
+// Description:
+// Copies a flvector back into a whole pdata array with a single call, the layout is the
+// same as pdata->flvector returns. Colours are copied as they are, whatever the colour mode.
+// Example:
+// (with-primitive (build-sphere 10 10)
+//     (let ((p (pdata->flvector "p")))
+//         (for ((i (in-range 1 (flvector-length p) 3))) ; squash in y
+//             (flvector-set! p i (* (flvector-ref p i) 0.5)))
+//         (flvector->pdata! "p" p)))
+// EndFunctionDoc
+
+Scheme_Object *flvector_to_pdata(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("flvector->pdata!", "s?", argc, argv);
+	if (!SCHEME_FLVECTORP(argv[1]))
+	{
+		MZ_GC_UNREG();
+		scheme_wrong_type("flvector->pdata!", "flvector", 1, argc, argv);
+	}
+    Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed)
+	{
+		string name=StringFromScheme(argv[0]);
+		unsigned int size;
+		char type;
+		if (Grabbed->GetDataInfo(name,type,size))
+		{
+			unsigned int width=PDataElementSize(type);
+			if ((unsigned int)SCHEME_FLVEC_SIZE(argv[1])!=size*width)
+			{
+				Trace::Stream<<"flvector->pdata!: flvector is size "<<SCHEME_FLVEC_SIZE(argv[1])
+					<<", expected "<<size*width<<" for pdata: "<<name<<endl;
+				MZ_GC_UNREG();
+				return scheme_void;
+			}
+
+			const double *src=SCHEME_FLVEC_ELS(argv[1]);
+			PData *pd=Grabbed->GetDataRaw(name);
+
+			switch (type)
+			{
+				case 'f':
+				{
+					TypedPData<float> *data=static_cast<TypedPData<float>*>(pd);
+					for (unsigned int i=0; i<size; i++) data->m_Data[i]=src[i];
+				}
+				break;
+				case 'v':
+				{
+					TypedPData<dVector> *data=static_cast<TypedPData<dVector>*>(pd);
+					for (unsigned int i=0; i<size; i++, src+=3)
+					{
+						data->m_Data[i]=dVector(src[0],src[1],src[2]);
+					}
+				}
+				break;
+				case 'c':
+				{
+					TypedPData<dColour> *data=static_cast<TypedPData<dColour>*>(pd);
+					for (unsigned int i=0; i<size; i++)
+					{
+						float *dst=data->m_Data[i].arr();
+						for (unsigned int n=0; n<4; n++) dst[n]=*src++;
+					}
+				}
+				break;
+				case 'm':
+				{
+					TypedPData<dMatrix> *data=static_cast<TypedPData<dMatrix>*>(pd);
+					for (unsigned int i=0; i<size; i++)
+					{
+						float *dst=data->m_Data[i].arr();
+						for (unsigned int n=0; n<16; n++) dst[n]=*src++;
+					}
+				}
+				break;
+			}
+			pd->SetDirty();
+		}
+		else Trace::Stream<<"flvector->pdata!: pdata: "<<name<<" doesn't exist"<<endl;
+	}
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// the pdata-ops that pdata-map! can use in place of a scheme procedure,
+// with the pdata types that give the same result as the procedure would
+struct MapKernel
+{
+	const char *Op;
+	char WriteType;
+	char ReadType; // 0 for no read array
+};
+
+static const MapKernel MAP_KERNELS[]={
+	{"+", 'v', 'v'}, {"+", 'c', 'c'},                   // vadd
+	{"-", 'v', 'v'}, {"-", 'c', 'c'},                   // vsub
+	{"*", 'v', 'f'}, {"*", 'c', 'f'},                   // vmul
+	{"transform", 'v', 'm'},                            // vtransform
+	{"normalise", 'v', 0},                              // vnormalise
+	{NULL, 0, 0}
+};
+
+// StartFunctionDoc-en
+// pdata-map-kernel! funcname-string write-pdataname-string [read-pdataname-string]
+// Returns: boolean
+// Description:
+// Runs one of the pdata-op operators in place of a pdata-map! loop, if the pdata types are
+// ones it gives the same result for as the equivalent scheme procedure. Returns #f without
+// changing anything otherwise. pdata-map! uses this automatically when it is given vadd,
+// vsub, vmul, vtransform or vnormalise, so you shouldn't normally need to call it.
+// Example:
+// (with-primitive (build-sphere 10 10)
+//     (pdata-map! vadd "p" "n")) ; runs natively, as (pdata-op "+" "p" "n")
+// EndFunctionDoc
+
+Scheme_Object *pdata_map_kernel(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("pdata-map-kernel!", "ss", argc, argv);
+	if (argc>2) ArgCheck("pdata-map-kernel!", "??s", argc, argv);
+    Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed)
+	{
+		string op=StringFromScheme(argv[0]);
+		string write=StringFromScheme(argv[1]);
+		string read;
+		unsigned int size;
+		char wtype, rtype=0;
+		if (!Grabbed->GetDataInfo(write,wtype,size))
+		{
+			MZ_GC_UNREG();
+			return scheme_false;
+		}
+		if (argc>2)
+		{
+			read=StringFromScheme(argv[2]);
+			if (!Grabbed->GetDataInfo(read,rtype,size))
+			{
+				MZ_GC_UNREG();
+				return scheme_false;
+			}
+		}
+
+		// colours set from scheme go through the colour mode
+		if (wtype=='c' && Grabbed->GetState()->ColourMode!=MODE_RGB)
+		{
+			MZ_GC_UNREG();
+			return scheme_false;
+		}
+
+		for (const MapKernel *k=MAP_KERNELS; k->Op!=NULL; k++)
+		{
+			if (op==k->Op && wtype==k->WriteType && rtype==k->ReadType)
+			{
+				PData *pd=read.empty()?NULL:Grabbed->GetDataRaw(read);
+				switch (rtype)
+				{
+					case 0: Grabbed->DataOp(op, write, 1.0f); break;
+					case 'f': Grabbed->DataOp(op, write, static_cast<TypedPData<float>*>(pd)); break;
+					case 'v': Grabbed->DataOp(op, write, static_cast<TypedPData<dVector>*>(pd)); break;
+					case 'c': Grabbed->DataOp(op, write, static_cast<TypedPData<dColour>*>(pd)); break;
+					case 'm': Grabbed->DataOp(op, write, static_cast<TypedPData<dMatrix>*>(pd)); break;
+				}
+				MZ_GC_UNREG();
+				return scheme_true;
+			}
+		}
+	}
+	MZ_GC_UNREG();
+	return scheme_false;
+}
+
 // StartFunctionDoc-en
 // pdata-copy pdatafrom-string pdatato-string
 // Returns: void
@@ -943,7 +1237,10 @@ void PDataFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("pdata-add", scheme_make_prim_w_arity(pdata_add, "pdata-add", 2, 2), env);
 	scheme_add_global("pdata-exists?", scheme_make_prim_w_arity(pdata_exists, "pdata-exists?", 1, 1), env);
 	scheme_add_global("pdata-names", scheme_make_prim_w_arity(pdata_names, "pdata-names", 0, 0), env);
-	scheme_add_global("pdata-op", scheme_make_prim_w_arity(pdata_op, "pdata-op", 3, 3), env);
+	scheme_add_global("pdata-op", scheme_make_prim_w_arity(pdata_op, "pdata-op", 3, 4), env);
+	scheme_add_global("pdata->flvector", scheme_make_prim_w_arity(pdata_to_flvector, "pdata->flvector", 1, 1), env);
+	scheme_add_global("flvector->pdata!", scheme_make_prim_w_arity(flvector_to_pdata, "flvector->pdata!", 2, 2), env);
+	scheme_add_global("pdata-map-kernel!", scheme_make_prim_w_arity(pdata_map_kernel, "pdata-map-kernel!", 2, 3), env);
 	scheme_add_global("pdata-copy", scheme_make_prim_w_arity(pdata_copy, "pdata-copy", 2, 2), env);
 	scheme_add_global("pdata-size", scheme_make_prim_w_arity(pdata_size, "pdata-size", 0, 0), env);
 	scheme_add_global("recalc-normals", scheme_make_prim_w_arity(recalc_normals, "recalc-normals", 1, 1), env);
@@ -56,15 +56,35 @@ unsigned int PFuncContainer::Make(const string &name)
 }
 
 void PFuncContainer::Run(unsigned int id, Primitive *p, const SceneGraph *sg)
+{
+	Queue(id,p,sg);
+	Flush();
+}
+
+void PFuncContainer::Queue(unsigned int id, Primitive *p, const SceneGraph *sg)
 {
 	if (id<m_PFuncVec.size())
 	{
-		m_PFuncVec[id]->Run(*p,*sg);
-	}	
+		// pfuncs on the same primitive have to run one after
+		// the other, so finish the earlier ones first
+		if (m_Queued.find(p)!=m_Queued.end()) Flush();
+
+		m_PFuncVec[id]->Queue(*p,*sg,*JobQueue::Get());
+		m_Queued.insert(p);
+	}
+}
+
+void PFuncContainer::Flush()
+{
+	JobQueue::Get()->Run();
+	m_Queued.clear();
 }
 
 void PFuncContainer::Clear()
 {
+	// queued jobs may still refer to the pfuncs
+	Flush();
+
 	for (vector<PrimitiveFunction*>::iterator i=m_PFuncVec.begin();
 		i!=m_PFuncVec.end(); i++)
 	{
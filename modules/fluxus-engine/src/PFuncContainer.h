@@ -19,6 +19,7 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include "Renderer.h"
 #include "PrimitiveFunction.h"
 #include "ArithmeticPrimFunc.h"
@@ -38,11 +39,17 @@ public:
 	template <class T>
 	void SetArg(unsigned int id, const string &name, const T &arg);
 	void Run(unsigned int id, Primitive *p, const SceneGraph *sg);
+	/// Queues the pfunc to run on the primitive alongside
+	/// the others queued, they are all run by Flush
+	void Queue(unsigned int id, Primitive *p, const SceneGraph *sg);
+	void Flush();
 	void Clear();
 
 private:
 
 	vector<PrimitiveFunction*> m_PFuncVec;
+	/// Primitives with pfuncs waiting to run on them
+	set<Primitive*> m_Queued;
 
 };
 
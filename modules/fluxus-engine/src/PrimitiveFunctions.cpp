@@ -24,6 +24,7 @@
 #include "TextPrimitive.h"
 #include "ParticlePrimitive.h"
 #include "LocatorPrimitive.h"
+#include "InstancePrimitive.h"
 #include "PixelPrimitive.h"
 #include "BlobbyPrimitive.h"
 #include "TypePrimitive.h"
@@ -1123,6 +1124,53 @@ Scheme_Object *build_voxels(int argc, Scheme_Object **argv)
 	return scheme_make_integer_value(Engine::Get()->Renderer()->AddPrimitive(VoxPrim));
 }
 
+// StartFunctionDoc-en
+// build-instances primitiveid-number count-number
+// Returns: primitiveid-number
+// Description:
+// Builds a primitive which draws count copies of the source primitive, each with
+// it's own transform and colour, stored in the "m" and "c" pdata. The source
+// primitive is copied, so you can destroy it afterwards. If the source is a polygon
+// primitive with a shader declaring "attribute mat4 InstanceTransform;" (and
+// optionally "attribute vec4 InstanceColour;") all the copies are drawn with a
+// single hardware instanced call, otherwise they are drawn one after the other.
+// Example:
+// (define inst (build-instances (build-cube) 100))
+// (with-primitive inst
+//     (pdata-index-map!
+//         (lambda (i m)
+//             (mtranslate (vector (* 2 (modulo i 10)) (* 2 (quotient i 10)) 0)))
+//         "m")
+//     (pdata-map!
+//         (lambda (c)
+//             (rndvec))
+//         "c"))
+// EndFunctionDoc
+
+Scheme_Object *build_instances(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("build-instances", "ii", argc, argv);
+	Primitive *src = Engine::Get()->Renderer()->GetPrimitive(IntFromScheme(argv[0]));
+	int count = IntFromScheme(argv[1]);
+	if (!src)
+	{
+		Trace::Stream<<"build-instances can only be called with an existing object id"<<endl;
+		MZ_GC_UNREG();
+		return scheme_void;
+	}
+	if (count<0)
+	{
+		Trace::Stream<<"build-instances: count must be positive"<<endl;
+		MZ_GC_UNREG();
+		return scheme_void;
+	}
+
+	InstancePrimitive *Prim = new InstancePrimitive(src,count);
+	MZ_GC_UNREG();
+	return scheme_make_integer_value(Engine::Get()->Renderer()->AddPrimitive(Prim));
+}
+
 // StartFunctionDoc-en
 // voxels->blobby voxelsprimitiveid-number
 // Returns: blobbyprimid-number
@@ -2969,7 +3017,8 @@ Scheme_Object *blobby2poly(int argc, Scheme_Object **argv)
 // Returns: void
 // Description:
 // Copies a retained mode primitive and draws it in the current state as an immediate mode
-// primitive.
+// primitive. Consecutive instances of the same primitive which only differ in transform
+// and colour are batched together and drawn with the rest of the state set once.
 // Example:
 // (define mynewshape (build-cube))
 // (colour (vector 1 0 0))
@@ -4081,12 +4130,25 @@ Scheme_Object *pfunc_set(int argc, Scheme_Object **argv)
 }
 
 // StartFunctionDoc-en
-// pfunc-run id-number
+// pfunc-run id-number-or-list primitiveid-list
 // Returns: void
 // Description:
-// Runs a primitive function on the currently grabbed primitive.
+// Runs a primitive function on the currently grabbed primitive. If a list 
+// of primitives is given, the pfunc is run on each of them instead. With a 
+// list of pfuncs as well, each pfunc is run on the primitive at the same 
+// place in the primitive list. Pfuncs which can (like skinning) are split 
+// across all the cpus, and run on all the primitives at the same time, so 
+// running them in one go is much faster than one at a time.
 // Example:
-// (define mypfunc (make-pfunc 'arithmetic))
+// (define mover (make-pfunc 'arithmetic))
+// (pfunc-set! mover (list 'operator "add" 'src "p" 'constant 0.1 'dst "p"))
+// (define shrinker (make-pfunc 'arithmetic))
+// (pfunc-set! shrinker (list 'operator "mul" 'src "p" 'constant 0.9 'dst "p"))
+// (define a (build-cube))
+// (define b (build-sphere 10 10))
+// (with-primitive a (pfunc-run mover)) ; on the grabbed primitive
+// (pfunc-run mover (list a b)) ; on each primitive in the list
+// (pfunc-run (list mover shrinker) (list a b)) ; mover on a, shrinker on b
 // EndFunctionDoc
 
 
@@ -4110,14 +4172,58 @@ Scheme_Object *pfunc_set(int argc, Scheme_Object **argv)
 
 Scheme_Object *pfunc_run(int argc, Scheme_Object **argv)
 {
-	DECL_ARGV();
-	ArgCheck("pfunc-run", "i", argc, argv);
-	if (Engine::Get()->Grabbed()) 
+	Scheme_Object *pfuncvec = NULL;
+	Scheme_Object *primvec = NULL;
+	MZ_GC_DECL_REG(3);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, pfuncvec);
+	MZ_GC_VAR_IN_REG(2, primvec);
+	MZ_GC_REG();
+
+	if (argc==1)
 	{
-		Engine::Get()->GetPFuncContainer()->Run(IntFromScheme(argv[0]),
-						Engine::Get()->Grabbed(),
-						&Engine::Get()->Renderer()->GetSceneGraph());
+		ArgCheck("pfunc-run", "i", argc, argv);
+		if (Engine::Get()->Grabbed()) 
+		{
+			Engine::Get()->GetPFuncContainer()->Run(IntFromScheme(argv[0]),
+							Engine::Get()->Grabbed(),
+							&Engine::Get()->Renderer()->GetSceneGraph());
+		}
+		MZ_GC_UNREG(); 
+		return scheme_void;
 	}
+
+	ArgCheck("pfunc-run", "?l", argc, argv);
+	if (SCHEME_LISTP(argv[0])) pfuncvec = scheme_list_to_vector(argv[0]);
+	else if (!SCHEME_INTP(argv[0]))
+	{
+		MZ_GC_UNREG();
+		scheme_wrong_type("pfunc-run", "int or list", 0, argc, argv);
+	}
+	primvec = scheme_list_to_vector(argv[1]);
+
+	if (pfuncvec && SCHEME_VEC_SIZE(pfuncvec)!=SCHEME_VEC_SIZE(primvec))
+	{
+		Trace::Stream<<"pfunc-run: pfunc and primitive lists are different lengths"<<endl;
+		MZ_GC_UNREG(); 
+		return scheme_void;
+	}
+
+	PFuncContainer *pfuncs=Engine::Get()->GetPFuncContainer();
+	SceneGraph &world=Engine::Get()->Renderer()->GetSceneGraph();
+	for (int n=0; n<SCHEME_VEC_SIZE(primvec); n++)
+	{
+		Scheme_Object *pfuncid=pfuncvec?SCHEME_VEC_ELS(pfuncvec)[n]:argv[0];
+		if (!SCHEME_INTP(pfuncid) || !SCHEME_INTP(SCHEME_VEC_ELS(primvec)[n])) continue;
+
+		SceneNode *node=(SceneNode*)world.FindNode(IntFromScheme(SCHEME_VEC_ELS(primvec)[n]));
+		if (node && node->Prim)
+		{
+			pfuncs->Queue(IntFromScheme(pfuncid),node->Prim,&world);
+		}
+	}
+	pfuncs->Flush();
+
 	MZ_GC_UNREG(); 
     return scheme_void;
 }
@@ -4492,6 +4598,131 @@ Scheme_Object *bb_point_intersect(int argc, Scheme_Object **argv)
 	return scheme_false;
 }
 
+// builds a scheme list from primitive ids, keeping the order
+static Scheme_Object *IDListToScheme(const vector<int> &ids)
+{
+	Scheme_Object *l = NULL;
+	MZ_GC_DECL_REG(1);
+	MZ_GC_VAR_IN_REG(0, l);
+	MZ_GC_REG();
+	l = scheme_null;
+	for (vector<int>::const_reverse_iterator i=ids.rbegin(); i!=ids.rend(); ++i)
+	{
+		l=scheme_make_pair(scheme_make_integer(*i),l);
+	}
+	MZ_GC_UNREG();
+	return l;
+}
+
+// StartFunctionDoc-en
+// bb/bb-intersecting thresh
+// Returns: list of primitiveid-numbers
+// Description:
+// Returns all the primitives whose bounding boxes intersect with the current
+// primitive's bounding box, with an additional expanding threshold. This is much
+// faster than calling bb/bb-intersect? on every pair of primitives, as it uses a
+// bounding volume hierarchy of the scene. Bounding boxes follow the primitives
+// as they move, but you need to call (recalc-bb) if the pdata has changed.
+// Example:
+// (clear)
+// (define a (build-sphere 10 10))
+// (for ((i (in-range 0 100)))
+//     (with-state
+//         (translate (vmul (crndvec) 10))
+//         (build-cube)))
+//
+// (every-frame
+//     (with-primitive a
+//         (translate (vector (* 0.1 (sin (time))) 0 0))
+//         (for-each
+//             (lambda (p)
+//                 (with-primitive p
+//                     (colour (rndvec))))
+//             (bb/bb-intersecting 0))))
+// EndFunctionDoc
+
+Scheme_Object *bb_bb_intersecting(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("bb/bb-intersecting", "f", argc, argv);
+	vector<int> ids;
+	if (Engine::Get()->Grabbed())
+	{
+		SceneNode *node=(SceneNode*)(Engine::Get()->Renderer()->GetSceneGraph().FindNode(Engine::Get()->GrabbedID()));
+		if (node)
+		{
+			Engine::Get()->Renderer()->GetSceneGraph().Intersect(node,FloatFromScheme(argv[0]),ids);
+		}
+	}
+	MZ_GC_UNREG();
+	return IDListToScheme(ids);
+}
+
+// StartFunctionDoc-en
+// bb/point-intersecting point thresh
+// Returns: list of primitiveid-numbers
+// Description:
+// Returns all the primitives whose bounding boxes contain the world space point,
+// with an additional expanding threshold.
+// Example:
+// (clear)
+// (for ((i (in-range 0 100)))
+//     (with-state
+//         (translate (vmul (crndvec) 10))
+//         (build-cube)))
+//
+// (for-each
+//     (lambda (p)
+//         (with-primitive p
+//             (colour (vector 1 0 0))))
+//     (bb/point-intersecting (vector 0 0 0) 2))
+// EndFunctionDoc
+
+Scheme_Object *bb_point_intersecting(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("bb/point-intersecting", "vf", argc, argv);
+	vector<int> ids;
+	Engine::Get()->Renderer()->GetSceneGraph().Intersect(VectorFromScheme(argv[0]),FloatFromScheme(argv[1]),ids);
+	MZ_GC_UNREG();
+	return IDListToScheme(ids);
+}
+
+// StartFunctionDoc-en
+// bb/line-intersecting start-vec end-vec
+// Returns: list of primitiveid-numbers
+// Description:
+// Returns all the primitives whose bounding boxes the world space line crosses, 
+// closest to the start first. Use this to find which primitives are worth calling
+// geo/line-intersect on.
+// Example:
+// (clear)
+// (for ((i (in-range 0 100)))
+//     (with-state
+//         (translate (vmul (crndvec) 10))
+//         (build-sphere 10 10)))
+//
+// (define (first-hit start end ids)
+//     (cond
+//         ((null? ids) #f)
+//         ((not (null? (with-primitive (car ids) 
+//              (geo/line-intersect start end)))) (car ids))
+//         (else (first-hit start end (cdr ids)))))
+//
+// (let ((start (vector 0 0 -20)) (end (vector 0 0 20)))
+//     (first-hit start end (bb/line-intersecting start end)))
+// EndFunctionDoc
+
+Scheme_Object *bb_line_intersecting(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("bb/line-intersecting", "vv", argc, argv);
+	vector<int> ids;
+	Engine::Get()->Renderer()->GetSceneGraph().Intersect(VectorFromScheme(argv[0]),VectorFromScheme(argv[1]),ids);
+	MZ_GC_UNREG();
+	return IDListToScheme(ids);
+}
+
 // StartFunctionDoc-en
 // get-children 
 // Returns: list-numbers
@@ -4753,6 +4984,7 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("build-image", scheme_make_prim_w_arity(build_image, "build-image", 3, 3), env);
 	scheme_add_global("build-locator", scheme_make_prim_w_arity(build_locator, "build-locator", 0, 0), env);
 	scheme_add_global("build-voxels", scheme_make_prim_w_arity(build_voxels, "build-voxels", 3, 3), env);
+	scheme_add_global("build-instances", scheme_make_prim_w_arity(build_instances, "build-instances", 2, 2), env);
 	scheme_add_global("locator-bounding-radius", scheme_make_prim_w_arity(locator_bounding_radius, "locator-bounding-radius", 1, 1), env);
 	scheme_add_global("build-pixels", scheme_make_prim_w_arity(build_pixels, "build-pixels", 2, 4), env);
 	scheme_add_global("build-type", scheme_make_prim_w_arity(build_type, "build-type", 2, 2), env);
@@ -4804,11 +5036,14 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("build-copy", scheme_make_prim_w_arity(build_copy, "build-copy", 1, 1), env);
 	scheme_add_global("make-pfunc", scheme_make_prim_w_arity(make_pfunc, "make-pfunc", 1, 1), env);
 	scheme_add_global("pfunc-set!", scheme_make_prim_w_arity(pfunc_set, "pfunc-set!", 2, 2), env);
-	scheme_add_global("pfunc-run", scheme_make_prim_w_arity(pfunc_run, "pfunc-run", 1, 1), env);
+	scheme_add_global("pfunc-run", scheme_make_prim_w_arity(pfunc_run, "pfunc-run", 1, 2), env);
 	scheme_add_global("geo/line-intersect", scheme_make_prim_w_arity(geo_line_intersect, "geo/line-intersect", 2, 2), env);
 	scheme_add_global("recalc-bb", scheme_make_prim_w_arity(recalc_bb, "recalc-bb", 0, 0), env);
 	scheme_add_global("bb/bb-intersect?", scheme_make_prim_w_arity(bb_bb_intersect, "bb/bb-intersect?", 2, 2), env);
 	scheme_add_global("bb/point-intersect?", scheme_make_prim_w_arity(bb_point_intersect, "bb/point-intersect?", 2, 2), env);
+	scheme_add_global("bb/bb-intersecting", scheme_make_prim_w_arity(bb_bb_intersecting, "bb/bb-intersecting", 1, 1), env);
+	scheme_add_global("bb/point-intersecting", scheme_make_prim_w_arity(bb_point_intersecting, "bb/point-intersecting", 2, 2), env);
+	scheme_add_global("bb/line-intersecting", scheme_make_prim_w_arity(bb_line_intersecting, "bb/line-intersecting", 2, 2), env);
 	scheme_add_global("get-children", scheme_make_prim_w_arity(get_children, "get-children", 0, 0), env);
 	scheme_add_global("get-parent", scheme_make_prim_w_arity(get_parent, "get-parent", 0, 0), env);
 	scheme_add_global("get-bb", scheme_make_prim_w_arity(get_bb, "get-bb", 0, 0), env);
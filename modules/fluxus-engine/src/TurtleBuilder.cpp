@@ -53,8 +53,7 @@ void TurtleBuilder::Prim(PolyPrimitive::Type Type)
 void TurtleBuilder::Attach(PolyPrimitive *p)
 {
 	Initialise();
-	TypedPData<dVector> *points = dynamic_cast<TypedPData<dVector>* >(p->GetDataRaw("p"));
-	m_AttachedPoints = &points->m_Data;
+	m_AttachedPoints = dynamic_cast<TypedPData<dVector>* >(p->GetDataRaw("p"));
 }
 
 
@@ -64,9 +63,11 @@ void TurtleBuilder::Vert()
 	{
 		m_BuildingPrim->AddVertex(dVertex(m_State.begin()->m_Pos,dVector(0,1,0)));
 	}
-	else if (m_AttachedPoints && !m_AttachedPoints->empty() )
+	else if (m_AttachedPoints && !m_AttachedPoints->m_Data.empty() )
 	{
-		(*m_AttachedPoints)[m_Position%m_AttachedPoints->size()]=m_State.begin()->m_Pos;
+		unsigned int index=m_Position%m_AttachedPoints->Size();
+		m_AttachedPoints->m_Data[index]=m_State.begin()->m_Pos;
+		m_AttachedPoints->SetDirty(index);
 	}
 
 	m_Position++;
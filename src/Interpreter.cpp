@@ -58,6 +58,18 @@ Scheme_Object *Interpreter::m_ErrReadPort=NULL;
 Scheme_Object *Interpreter::m_OutWritePort=NULL;
 Scheme_Object *Interpreter::m_ErrWritePort=NULL;
 std::wstring Interpreter::m_Language;
+Scheme_Object *Interpreter::m_Callbacks[Interpreter::NUM_CALLBACKS];
+bool Interpreter::m_CallbacksResolved=false;
+
+// wrappers around the callbacks, compiled once so the main loop only needs
+// to apply them - these refer to the global bindings rather than capturing
+// their values, so redefining a callback takes effect straight away
+static const char *CALLBACK_WRAPPERS[Interpreter::NUM_CALLBACKS]={
+	"(lambda () (fluxus-frame-callback))",
+	"(lambda (w h) (fluxus-reshape-callback w h))",
+	"(lambda (k b s st x y m) (fluxus-input-callback k b s st x y m))",
+	"(lambda (k b s st x y m) (fluxus-input-release-callback k b s st x y m))"
+};
 
 void Interpreter::Register()
 {
@@ -69,6 +81,7 @@ void Interpreter::Register()
 	MZ_REGISTER_STATIC(Interpreter::m_ErrReadPort);
 	MZ_REGISTER_STATIC(Interpreter::m_OutWritePort);
 	MZ_REGISTER_STATIC(Interpreter::m_ErrWritePort);
+	MZ_REGISTER_STATIC(Interpreter::m_Callbacks);
 
     MZ_GC_UNREG();
 }
@@ -86,6 +99,10 @@ void Interpreter::Initialise()
 	m_Scheme=scheme_basic_env();
 	Interpreter::Register();
 
+	// the callbacks need compiling again against the new environment
+	for (int n=0; n<NUM_CALLBACKS; n++) m_Callbacks[n]=NULL;
+	m_CallbacksResolved=false;
+
 	scheme_pipe(&m_OutReadPort,&m_OutWritePort);
 	scheme_pipe(&m_ErrReadPort,&m_ErrWritePort);
 	config = scheme_current_config();
@@ -212,17 +229,44 @@ wstring Interpreter::SetupLanguage(const wstring &str)
 	return L"(module foo "+m_Language+L" "+str+L") (require foo)";
 }
 
-bool Interpreter::Interpret(const wstring &str, Scheme_Object **ret, bool abort)
+void Interpreter::FlushPort(Scheme_Object *port)
 {
 	char msg[LOG_SIZE];
-	mz_jmp_buf * volatile save = NULL, fresh;
 
 	MZ_GC_DECL_REG(2);
-	MZ_GC_VAR_IN_REG(0, msg);
-    MZ_GC_VAR_IN_REG(1, save);
+	MZ_GC_VAR_IN_REG(0, port);
+	MZ_GC_VAR_IN_REG(1, msg);
 	MZ_GC_REG();
 
-	wstring code = SetupLanguage(str);
+	if (port!=NULL)
+	{
+		int char_available;
+		do
+		{
+			char_available = fill_from_port(port, msg, LOG_SIZE);
+			if (strlen(msg)>0)
+			{
+				if (m_Repl==NULL) cerr<<msg<<endl;
+				else m_Repl->Print(string_to_wstring(string(msg)));
+			}
+		} while (char_available);
+	}
+
+	MZ_GC_UNREG();
+}
+
+bool Interpreter::Interpret(const wstring &str, Scheme_Object **ret, bool abort)
+{
+	return Eval(wstring_to_string(SetupLanguage(str)), ret, abort);
+}
+
+bool Interpreter::Eval(const string &code, Scheme_Object **ret, bool abort)
+{
+	mz_jmp_buf * volatile save = NULL, fresh;
+
+	MZ_GC_DECL_REG(1);
+    MZ_GC_VAR_IN_REG(0, save);
+	MZ_GC_REG();
 
     save = scheme_current_thread->error_buf;
 	scheme_current_thread->error_buf = &fresh;
@@ -230,19 +274,7 @@ bool Interpreter::Interpret(const wstring &str, Scheme_Object **ret, bool abort)
 	if (scheme_setjmp(scheme_error_buf))
 	{
 		scheme_current_thread->error_buf = save;
-		if (m_ErrReadPort!=NULL)
-		{
-			int char_available;
-			do
-			{
-				char_available = fill_from_port(m_ErrReadPort, msg, LOG_SIZE);
-				if (strlen(msg)>0)
-				{
-					if (m_Repl==NULL) cerr<<msg<<endl;
-					else m_Repl->Print(string_to_wstring(string(msg)));
-				}
-			} while (char_available);
-		}
+		FlushPort(m_ErrReadPort);
 		if (abort) exit(-1);
 		MZ_GC_UNREG();
 		return false;
@@ -251,28 +283,73 @@ bool Interpreter::Interpret(const wstring &str, Scheme_Object **ret, bool abort)
 	{
 		if (ret==NULL)
 		{
-			scheme_eval_string_all(wstring_to_string(code).c_str(), m_Scheme, 1);
+			scheme_eval_string_all(code.c_str(), m_Scheme, 1);
         }
 		else
 		{
-			*ret = scheme_eval_string_all(wstring_to_string(code).c_str(), m_Scheme, 1);
+			*ret = scheme_eval_string_all(code.c_str(), m_Scheme, 1);
 		}
 		scheme_current_thread->error_buf = save;
 	}
 
-	if (m_OutReadPort!=NULL)
+	FlushPort(m_OutReadPort);
+
+	MZ_GC_UNREG();
+	return true;
+}
+
+void Interpreter::ResolveCallbacks()
+{
+	// any which fail are tried again next call, as
+	// they may not have been defined yet
+	m_CallbacksResolved=true;
+	for (int n=0; n<NUM_CALLBACKS; n++)
 	{
-		int char_available;
-		do
+		if (m_Callbacks[n]!=NULL) continue;
+
+		// evaluated directly in the toplevel, as the boot script defines
+		// the callbacks there whatever language is set
+		if (!Eval(CALLBACK_WRAPPERS[n], &m_Callbacks[n], false))
 		{
-			char_available = fill_from_port(m_OutReadPort, msg, LOG_SIZE);
-			if (strlen(msg)>0)
-			{
-				if (m_Repl==NULL) cerr<<msg<<endl;
-				else m_Repl->Print(string_to_wstring(string(msg)));
-			}
-		} while (char_available);
+			m_Callbacks[n]=NULL;
+			m_CallbacksResolved=false;
+		}
+	}
+}
+
+bool Interpreter::Call(Callback cb, int argc, Scheme_Object **argv)
+{
+	mz_jmp_buf * volatile save = NULL, fresh;
+
+	MZ_GC_DECL_REG(1);
+    MZ_GC_VAR_IN_REG(0, save);
+	MZ_GC_REG();
+
+	if (!m_CallbacksResolved) ResolveCallbacks();
+
+	if (m_Callbacks[cb]==NULL)
+	{
+		MZ_GC_UNREG();
+		return false;
+	}
+
+    save = scheme_current_thread->error_buf;
+	scheme_current_thread->error_buf = &fresh;
+
+	if (scheme_setjmp(scheme_error_buf))
+	{
+		scheme_current_thread->error_buf = save;
+		FlushPort(m_ErrReadPort);
+		MZ_GC_UNREG();
+		return false;
 	}
+	else
+	{
+		scheme_apply(m_Callbacks[cb], argc, argv);
+		scheme_current_thread->error_buf = save;
+	}
+
+	FlushPort(m_OutReadPort);
 
 	MZ_GC_UNREG();
 	return true;
@@ -36,9 +36,21 @@ public:
 	static void SetRepl(Repl *s);
 	static bool Interpret(const std::wstring &code, Scheme_Object **ret=NULL, bool abort=false);
 	static void SetLanguage(const std::wstring &lang) { m_Language=lang; }
-	
+
+	/// The callbacks the boot script defines for the main loop
+	enum Callback {FRAME_CALLBACK, RESHAPE_CALLBACK, INPUT_CALLBACK, INPUT_RELEASE_CALLBACK, NUM_CALLBACKS};
+
+	/// Applies one of the callbacks directly, without parsing or compiling
+	/// any code. The callbacks are compiled once after each Initialise, and
+	/// call through the global binding so a set! on it (eg. by
+	/// override-frame-callback) is still seen
+	static bool Call(Callback cb, int argc=0, Scheme_Object **argv=NULL);
+
 private:
 	static std::wstring SetupLanguage(const std::wstring &str);
+	static bool Eval(const std::string &code, Scheme_Object **ret, bool abort);
+	static void ResolveCallbacks();
+	static void FlushPort(Scheme_Object *port);
 
 	static Scheme_Env *m_Scheme;
 	static Repl *m_Repl;
@@ -47,6 +59,8 @@ private:
 	static Scheme_Object *m_OutWritePort;
 	static Scheme_Object *m_ErrWritePort;
 	static std::wstring m_Language;
+	static Scheme_Object *m_Callbacks[NUM_CALLBACKS];
+	static bool m_CallbacksResolved;
 };
 
 }
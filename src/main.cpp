@@ -36,25 +36,45 @@
 
 using namespace std;
 
-static const wstring ENGINE_CALLBACK=L"(fluxus-frame-callback)";
-static const wstring RESHAPE_CALLBACK=L"fluxus-reshape-callback";
-static const wstring INPUT_CALLBACK=L"fluxus-input-callback";
-static const wstring INPUT_RELEASE_CALLBACK=L"fluxus-input-release-callback";
-
 FluxusMain *app = NULL;
 EventRecorder *recorder = NULL;
 int modifiers = 0;
 
+// passes an event to fluxus-input-callback or fluxus-input-release-callback,
+// keyboard keys are sent as characters, everything else uses 0
+void CallInput(Interpreter::Callback cb, unsigned char key, int button, int special,
+			int state, int x, int y, int mod)
+{
+	Scheme_Object *args[7];
+	MZ_GC_DECL_REG(3);
+	MZ_GC_ARRAY_VAR_IN_REG(0, args, 7);
+	MZ_GC_REG();
+
+	for (int n=0; n<7; n++) args[n]=NULL;
+	if (key!=0) args[0]=scheme_make_char(key);
+	else args[0]=scheme_make_integer(0);
+	args[1]=scheme_make_integer(button);
+	args[2]=scheme_make_integer(special);
+	args[3]=scheme_make_integer(state);
+	args[4]=scheme_make_integer(x);
+	args[5]=scheme_make_integer(y);
+	args[6]=scheme_make_integer(mod);
+	Interpreter::Call(cb,7,args);
+
+	MZ_GC_UNREG();
+}
+
 void ReshapeCallback(int width, int height)
 {
 	app->Reshape(width,height);
-	wchar_t code[256];
-	#ifndef WIN32
-	swprintf(code,256,L"(%S %d %d)",RESHAPE_CALLBACK.c_str(),width,height);
-	#else
-	swprintf(code,L"(%s %d %d)",RESHAPE_CALLBACK.c_str(),width,height);
-	#endif
-	Interpreter::Interpret(code);
+	Scheme_Object *args[2];
+	MZ_GC_DECL_REG(3);
+	MZ_GC_ARRAY_VAR_IN_REG(0, args, 2);
+	MZ_GC_REG();
+	args[0]=scheme_make_integer(width);
+	args[1]=scheme_make_integer(height);
+	Interpreter::Call(Interpreter::RESHAPE_CALLBACK,2,args);
+	MZ_GC_UNREG();
 }
 
 void print_bin(unsigned char v)
@@ -81,7 +101,6 @@ void KeyboardCallback(unsigned char key,int x, int y)
 	if (recorder->GetMode()!=EventRecorder::PLAYBACK) mod=glutGetModifiers();
 	if ((recorder->GetMode() != EventRecorder::PLAYBACK) || ((x == -1) && (y == -1)))
 		app->Handle(key, -1, -1, -1, x, y, mod);
-	wchar_t code[256];
 	if (key > 0 && key<0x80)
 	{ // key is 0 on ctrl+2 and ignore extended ascii for the time being
 		int imod = 0;
@@ -91,27 +110,16 @@ void KeyboardCallback(unsigned char key,int x, int y)
 			imod |= 2;
 		if (mod & GLUT_ACTIVE_ALT)
 			imod |= 4;
-#ifndef WIN32
-		swprintf(code,256,L"(%S #\\%c %d %d %d %d %d %d)",INPUT_CALLBACK.c_str(),key,-1,-1,-1,x,y,imod);
-#else
-		swprintf(code,L"(%s #\\%c %d %d %d %d %d %d)",INPUT_CALLBACK.c_str(),key,-1,-1,-1,x,y,imod);
-#endif
-		Interpreter::Interpret(code);
+		CallInput(Interpreter::INPUT_CALLBACK,key,-1,-1,-1,x,y,imod);
 	}
 	recorder->Record(RecorderMessage("keydown",key,mod));
 }
 
 void KeyboardUpCallback(unsigned char key,int x, int y)
 {
-	wchar_t code[256];
 	if (key > 0 && key<0x80) 
     { // key is 0 on ctrl+2
-             #ifndef WIN32
-		swprintf(code,256,L"(%S #\\%c %d %d %d %d %d %d)",INPUT_RELEASE_CALLBACK.c_str(),key,-1,-1,-1,x,y,0);
-	     #else
-		swprintf(code,L"(%s #\\%c %d %d %d %d %d %d)",INPUT_RELEASE_CALLBACK.c_str(),key,-1,-1,-1,x,y,0);
-	     #endif
-		Interpreter::Interpret(code);
+		CallInput(Interpreter::INPUT_RELEASE_CALLBACK,key,-1,-1,-1,x,y,0);
 	}
 	recorder->Record(RecorderMessage("keyup",key,0));
 }
@@ -124,65 +132,35 @@ void SpecialKeyboardCallback(int key,int x, int y)
 		recorder->PauseToggle();
 	if ((recorder->GetMode() != EventRecorder::PLAYBACK) || ((x == -1) && (y == -1)))
 		app->Handle(0, -1, key, -1, x, y, mod);
-	wchar_t code[256];
-	#ifndef WIN32
-	swprintf(code,256,L"(%S %d %d %d %d %d %d %d)",INPUT_CALLBACK.c_str(),0,-1,key,-1,x,y,mod);
-	#else
-	swprintf(code,L"(%s %d %d %d %d %d %d %d)",INPUT_CALLBACK.c_str(),0,-1,key,-1,x,y,mod);
-	#endif
-	Interpreter::Interpret(code);
+	CallInput(Interpreter::INPUT_CALLBACK,0,-1,key,-1,x,y,mod);
 	recorder->Record(RecorderMessage("specialkeydown",key,mod));
 }
 
 void SpecialKeyboardUpCallback(int key,int x, int y)
 {
 	//app->Handle( 0, 0, key, 1, x, y);
-	wchar_t code[256];
-	#ifndef WIN32
-	swprintf(code,256,L"(%S %d %d %d %d %d %d %d)",INPUT_RELEASE_CALLBACK.c_str(),0,-1,key,-1,x,y,0);
-	#else
-	swprintf(code,L"(%s %d %d %d %d %d %d %d)",INPUT_RELEASE_CALLBACK.c_str(),0,-1,key,-1,x,y,0);
-	#endif
-	Interpreter::Interpret(code);
+	CallInput(Interpreter::INPUT_RELEASE_CALLBACK,0,-1,key,-1,x,y,0);
 	recorder->Record(RecorderMessage("specialkeyup",key,0));
 }
 
 void MouseCallback(int button, int state, int x, int y)
 {
 	app->Handle(0, button, -1, state, x, y, 0);
-	wchar_t code[256];
-	#ifndef WIN32
-	swprintf(code,256,L"(%S %d %d %d %d %d %d %d)",INPUT_CALLBACK.c_str(),0,button,-1,state,x,y,0);
-	#else
-	swprintf(code,L"(%s %d %d %d %d %d %d %d)",INPUT_CALLBACK.c_str(),0,button,-1,state,x,y,0);
-	#endif
-	Interpreter::Interpret(code);
+	CallInput(Interpreter::INPUT_CALLBACK,0,button,-1,state,x,y,0);
 	recorder->Record(RecorderMessage("mouse",x,y,button,state));
 }
 
 void MotionCallback(int x, int y)
 {
 	app->Handle(0, -1, -1, -1, x, y, 0);
-	wchar_t code[256];
-	#ifndef WIN32
-	swprintf(code,256,L"(%S %d %d %d %d %d %d %d)",INPUT_CALLBACK.c_str(),0,-1,-1,-1,x,y,0);
-	#else
-	swprintf(code,L"(%s %d %d %d %d %d %d %d)",INPUT_CALLBACK.c_str(),0,-1,-1,-1,x,y,0);
-	#endif
-	Interpreter::Interpret(code);
+	CallInput(Interpreter::INPUT_CALLBACK,0,-1,-1,-1,x,y,0);
 	recorder->Record(RecorderMessage("motion",x,y));
 }
 
 void PassiveMotionCallback(int x, int y)
 {
 	app->Handle(0, -1, -1, -1, x, y, 0);
-	wchar_t code[256];
-	#ifndef WIN32
-	swprintf(code,256,L"(%S %d %d %d %d %d %d %d)",INPUT_CALLBACK.c_str(),0,-1,-1,-1,x,y,0);
-	#else
-	swprintf(code,L"(%s %d %d %d %d %d %d %d)",INPUT_CALLBACK.c_str(),0,-1,-1,-1,x,y,0);
-	#endif
-	Interpreter::Interpret(code);
+	CallInput(Interpreter::INPUT_CALLBACK,0,-1,-1,-1,x,y,0);
 	recorder->Record(RecorderMessage("passivemotion",x,y));
 }
 
@@ -236,7 +214,7 @@ void DisplayCallback()
 		Interpreter::Interpret(fragment);
 	}
 
-	if (!Interpreter::Interpret(ENGINE_CALLBACK))
+	if (!Interpreter::Call(Interpreter::FRAME_CALLBACK))
 	{
 		// the callback has failed, so clear the screen so we can fix the error...
 		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);